@@ -2,7 +2,7 @@ import sqlite3 as sql
 from io import StringIO, TextIOWrapper
 from subprocess import PIPE, Popen, run
 from contextlib import closing
-import csv, json
+import csv, json, mmap, os, struct
 import pandas as pd
 
 
@@ -131,6 +131,167 @@ def OR(*terms):
 	return sql_boolean_binary_operator("OR",*terms)
 
 
+#
+# Binary records
+#
+
+# The number of rows inserted by one executemany()
+DEFAULT_CHUNK_ROWS = 1<<16
+
+# mmap_header and shm_header of tables.hh
+MMAP_HEADER = struct.Struct('=8s7Q')
+SHM_HEADER = struct.Struct('=8s8Q')
+
+
+def schema_type(col):
+	"""
+	Return the python type (int, float or str) of a column of a 
+	schema generated by output_table::generate_schema().
+	"""
+	if col['arithmetic']:
+		if col['type'] in ('float', 'double', 'long double'):
+			return float
+		else:
+			return int
+	else:
+		return str
+
+
+class RecordLayout(object):
+	"""
+	The layout of the packed binary records of a table, as written
+	into output_mmap files and output_shm segments.
+
+	The layout is the JSON object of output_mmap::layout(), holding the
+	table's schema and the offset and size of each column. Fields are
+	decoded in the order of the schema's columns.
+	"""
+	def __init__(self, layout):
+		self.schema = layout['schema']
+		self.record_size = layout['record_size']
+		self.columns = self.schema['columns']
+		place = {f['name']: f for f in layout['layout']}
+		self.fields = [place[col['name']] for col in self.columns]
+
+		# a struct format, in the order of the offsets
+		order = sorted(range(len(self.fields)), key=lambda i: self.fields[i]['offset'])
+		fmt, pos = '=', 0
+		for i in order:
+			f = self.fields[i]
+			if f['offset'] > pos:
+				fmt += '%dx' % (f['offset'] - pos)
+			fmt += self.__code(self.columns[i], f['size'])
+			pos = f['offset'] + f['size']
+		if self.record_size > pos:
+			fmt += '%dx' % (self.record_size - pos)
+		self.record = struct.Struct(fmt)
+		# from the order of the offsets to the order of the schema
+		self.permutation = [order.index(i) for i in range(len(order))]
+		self.strings = [i for i,col in enumerate(self.columns) if schema_type(col) is str]
+
+	@staticmethod
+	def __code(col, size):
+		if schema_type(col) is str:
+			return '%ds' % size
+		if col['type'] == 'bool':
+			return '?'
+		if schema_type(col) is float:
+			if size not in (4, 8):
+				raise ValueError("unsupported floating point column "+col['name'])
+			return 'f' if size == 4 else 'd'
+		if size not in (1, 2, 4, 8):
+			raise ValueError("unsupported integer column "+col['name'])
+		code = {1:'b', 2:'h', 4:'i', 8:'q'}[size]
+		return code.upper() if col['type'].startswith('unsigned') else code
+
+	def dtype(self):
+		"""Return the numpy dtype of the records."""
+		import numpy as np
+		formats = []
+		for col,f in zip(self.columns, self.fields):
+			code = self.__code(col, f['size'])
+			formats.append('S%d' % f['size'] if code.endswith('s') else '='+code)
+		return np.dtype({
+			'names': [col['name'] for col in self.columns],
+			'formats': formats,
+			'offsets': [f['offset'] for f in self.fields],
+			'itemsize': self.record_size })
+
+	def rows(self, buf):
+		"""
+		Iterate over the rows of a buffer of records, as tuples in the 
+		order of the schema. Strings are decoded, up to their first NUL.
+		"""
+		perm, strings = self.permutation, self.strings
+		for rec in self.record.iter_unpack(buf):
+			row = [rec[j] for j in perm]
+			for i in strings:
+				row[i] = row[i].split(b'\0', 1)[0].decode('utf-8', 'replace')
+			yield tuple(row)
+
+
+def read_layout(buf, offset, size):
+	"""Return the JSON layout stored in a buffer."""
+	return json.loads(bytes(buf[offset:offset+size]).rstrip(b'\0').decode('utf-8'))
+
+
+def decode_frame(frame):
+	"""Decode the byte string columns of a pandas data frame, in place."""
+	for name in frame.columns:
+		if frame[name].dtype == object and len(frame) and isinstance(frame[name].iloc[0], bytes):
+			# numpy strips the NUL padding of fixed-size strings
+			frame[name] = frame[name].str.decode('utf-8', 'replace')
+	return frame
+
+
+def mmap_frame(filename):
+	"""
+	Return a pandas data frame with the rows of an output_mmap file.
+
+	The records are read by numpy with no parsing, using the layout
+	stored in the file.
+	"""
+	import numpy as np
+	with open(filename, 'rb') as f:
+		magic, data, record, rows, layout, *_ = MMAP_HEADER.unpack(f.read(MMAP_HEADER.size))
+		if magic != b'TABLEMM1':
+			raise RuntimeError("`"+filename+"' is not a table file")
+		rl = RecordLayout(json.loads(f.read(layout).rstrip(b'\0').decode('utf-8')))
+		f.seek(data)
+		records = np.fromfile(f, dtype=rl.dtype(), count=rows)
+	return decode_frame(pd.DataFrame(records))
+
+
+def hdf5_frame(filename, name):
+	"""
+	Return a pandas data frame with the rows of the dataset of a 
+	table in an HDF5 file written by output_hdf5. This requires h5py.
+	"""
+	import h5py
+	with h5py.File(filename, 'r') as f:
+		return decode_frame(pd.DataFrame(f[name][()]))
+
+
+def arrow_frame(filename):
+	"""
+	Return a pandas data frame with the rows of an output_arrow file.
+
+	Column groups (Arrow struct fields) are flattened into columns
+	named by their path. This requires pyarrow.
+	"""
+	from pyarrow import feather
+	table = flatten_arrow(feather.read_table(filename))
+	return table.to_pandas()
+
+
+def flatten_arrow(table):
+	"""Flatten the struct columns of a pyarrow table, naming them by path."""
+	import pyarrow as pa
+	while any(pa.types.is_struct(f.type) for f in table.schema):
+		table = table.flatten()
+	return table.rename_columns([n.replace('.', '/') for n in table.column_names])
+
+
 #
 # Database schema objects
 #
@@ -324,15 +485,7 @@ class Dataset(object):
 			# (a) any arithmetic type is turned to either int or float
 			# (b) anything else is turned into a string
 			# For this to work, we rely on the "arithmetic"
-			if col['arithmetic']:
-				if col['type'] in ('float', 'double', 'long double'):
-					ctype = float
-				else:
-					ctype = int
-			else:
-				ctype = str
-
-			alist.append(Attribute(cname,ctype))
+			alist.append(Attribute(cname,schema_type(col)))
 		return self.create_table(name, alist)
 
 
@@ -430,6 +583,147 @@ class Dataset(object):
                 # load the table
 		self.insert_table_data(table, data)
 
+
+	def __schema_table(self, jsschema):
+		"""Return the table of a json schema, creating it if needed."""
+		name = jsschema['name']
+		if name in self.relations:
+			return self.relations[name]
+		return self.create_table_from_json(jsschema)
+
+	def insert_chunks(self, table, rows, chunk_rows=DEFAULT_CHUNK_ROWS):
+		"""
+		Insert rows into a table, with one executemany() per chunk of
+		rows, in a single transaction.
+
+		table - a table name or a table object
+		rows - an iterable of tuples matching the table schema
+		"""
+		table = self.__get_relation(table) if isinstance(table, str) else table
+		assert isinstance(table,Table)
+		qry = table.sql_insertmany()
+		rows = iter(rows)
+		with self.conn:
+			while True:
+				chunk = [row for _,row in zip(range(chunk_rows), rows)]
+				if not chunk:
+					break
+				self.conn.executemany(qry, chunk)
+
+	def load_records(self, layout, buf, chunk_rows=DEFAULT_CHUNK_ROWS):
+		"""
+		Load a buffer of packed binary records into a table.
+
+		layout - the JSON layout of the records (see RecordLayout)
+		buf - a buffer holding a whole number of records
+
+		The table is created from the schema in the layout, if needed.
+		"""
+		rl = layout if isinstance(layout, RecordLayout) else RecordLayout(layout)
+		table = self.__schema_table(rl.schema)
+		self.insert_chunks(table, rl.rows(buf), chunk_rows)
+		return table
+
+	def load_mmap(self, filename, chunk_rows=DEFAULT_CHUNK_ROWS):
+		"""
+		Load the rows of an output_mmap file into a table.
+
+		The file is mapped, and its records are decoded in bulk using
+		the layout stored in the file.
+		"""
+		with open(filename, 'rb') as f, closing(mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)) as mm:
+			magic, data, record, rows, layout, *_ = MMAP_HEADER.unpack_from(mm)
+			if magic != b'TABLEMM1':
+				raise RuntimeError("`"+filename+"' is not a table file")
+			rl = RecordLayout(read_layout(mm, MMAP_HEADER.size, layout))
+			with memoryview(mm)[data:data+rows*record] as records:
+				return self.load_records(rl, records, chunk_rows)
+
+	def load_shm(self, segment, chunk_rows=DEFAULT_CHUNK_ROWS):
+		"""
+		Load the rows currently held by the ring of an output_shm 
+		segment into a table.
+
+		segment - the segment name, e.g., '/prefix.table'
+
+		The ring is copied and the rows that are overwritten meanwhile
+		are dropped, as by shm_reader. Only the latest rows of a table
+		are in its ring.
+		"""
+		path = '/dev/shm/' + segment.lstrip('/')
+		with open(path, 'rb') as f, closing(mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)) as mm:
+			magic, seq, data, record, capacity, layout, *_ = SHM_HEADER.unpack_from(mm)
+			if magic != b'TABLESH1':
+				raise RuntimeError("`"+segment+"' is not a table segment")
+			rl = RecordLayout(read_layout(mm, SHM_HEADER.size, layout))
+			ring = mm[data:data+capacity*record]
+			after = SHM_HEADER.unpack_from(mm)[1]
+
+		# the rows written before the copy, less those overwritten since
+		written = seq // 2
+		first = max(written - capacity, (after+1) // 2 - capacity, 0)
+		slots = [r % capacity for r in range(first, written)]
+		buf = b''.join(ring[s*record:(s+1)*record] for s in slots)
+		return self.load_records(rl, buf, chunk_rows)
+
+	def load_hdf5(self, filename, names=None, schema=None, chunk_rows=DEFAULT_CHUNK_ROWS):
+		"""
+		Load the datasets of an HDF5 file written by output_hdf5 into 
+		tables. This requires h5py.
+
+		names - a table name or a list of names; by default, all the
+		        datasets at the root of the file
+		schema - a json schema (see output_table::generate_schema()) 
+		         for a single table; by default, tables are loaded from
+		         their <name>.schema file
+
+		The datasets are read by chunks of rows.
+		"""
+		import h5py
+		if isinstance(names, str):
+			names = [names]
+		with h5py.File(filename, 'r') as f:
+			if names is None:
+				names = [n for n in f if isinstance(f[n], h5py.Dataset)]
+			for name in names:
+				table = self.__schema_table(schema) if schema else self.__get_relation(name)
+				self.insert_chunks(table, self.__hdf5_rows(f[name], table, chunk_rows), chunk_rows)
+
+	@staticmethod
+	def __hdf5_rows(dset, table, chunk_rows):
+		for start in range(0, dset.shape[0], chunk_rows):
+			block = dset[start:start+chunk_rows]
+			cols = []
+			for a in table.attributes:
+				values = block[a.name].tolist()
+				if block.dtype[a.name].kind == 'S':
+					values = [v.split(b'\0', 1)[0].decode('utf-8', 'replace') for v in values]
+				cols.append(values)
+			yield from zip(*cols)
+
+	def load_arrow(self, filename, schema=None, chunk_rows=DEFAULT_CHUNK_ROWS):
+		"""
+		Load an output_arrow file into a table. This requires pyarrow.
+
+		schema - the json schema of the table; by default, it is loaded
+		         from the <name>.schema file, where name is the file name
+		         without its extension
+
+		The file is read by record batches.
+		"""
+		import pyarrow as pa
+		from pyarrow import ipc
+		if schema:
+			table = self.__schema_table(schema)
+		else:
+			table = self.__get_relation(os.path.splitext(os.path.basename(filename))[0])
+		with ipc.open_file(filename) as reader:
+			for i in range(reader.num_record_batches):
+				batch = flatten_arrow(pa.Table.from_batches([reader.get_batch(i)]))
+				cols = [batch.column(a.name).to_pylist() for a in table.attributes]
+				self.insert_chunks(table, zip(*cols), chunk_rows)
+		return table
+
 		
 
 	def print_relation(self, name):
@@ -188,6 +188,61 @@ public:
 		TS_ASSERT_EQUALS(string("foo::bar2::grp::foo"), grp2.foo.path_name("::"));
 	}
 
+	void test_incremental_columns()
+	{
+		result_table tab("tab");
+		column<int> a(&tab, "a", "%d");
+		columns c1(&tab, "foo");
+		column<int> b(&tab, "b", "%d");
+
+		std::vector<basic_column*> order;
+		auto check_order = [&]() {
+			order.clear();
+			tab.visit([&](column_item* item) {
+				if(item->is_column()) order.push_back((basic_column*) item);
+			});
+			TS_ASSERT_EQUALS(tab.size(), order.size());
+			for(size_t i=0; i<order.size() && i<tab.size(); i++)
+				TS_ASSERT_EQUALS(tab[i], order[i]);
+		};
+
+		TS_ASSERT_EQUALS(tab.size(), 2);
+		check_order();
+
+		// columns added below a group which is already in the table
+		column<int> x(&c1, "x", "%d");
+		auto grp = std::make_unique<table_mixin3>("grp", &c1);
+		column<int> y(&c1, "y", "%d");
+		TS_ASSERT_EQUALS(tab.size(), 6);
+		TS_ASSERT_EQUALS(tab[1], &x);
+		TS_ASSERT_EQUALS(tab[2], &grp->foo);
+		TS_ASSERT_EQUALS(tab[4], &y);
+		check_order();
+
+		TS_ASSERT_EQUALS(tab.get_item("foo/grp/bar"), &grp->bar);
+		TS_ASSERT_EQUALS(tab.get_item("foo/y"), &y);
+
+		// removing a group drops its columns and their paths
+		grp.reset();
+		TS_ASSERT_EQUALS(tab.size(), 4);
+		check_order();
+		TS_ASSERT_THROWS(tab.get_item("foo/grp/bar"), std::out_of_range);
+		TS_ASSERT_THROWS(tab.get_item("foo/grp"), std::out_of_range);
+
+		// a detached group keeps its columns and brings them back
+		columns loose("loose");
+		column<int> z(&loose, "z", "%d");
+		tab.add(loose);
+		TS_ASSERT_EQUALS(tab.size(), 5);
+		TS_ASSERT_EQUALS(tab[4], &z);
+		TS_ASSERT_EQUALS(tab.get_item("loose/z"), &z);
+
+		tab.remove_item(&loose);
+		TS_ASSERT_EQUALS(tab.size(), 4);
+		TS_ASSERT_THROWS(tab.get_item("loose/z"), std::out_of_range);
+		check_order();
+	}
+
 
 	struct hier_table : result_table 
 	{
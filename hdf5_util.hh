@@ -46,11 +46,22 @@ struct output_hdf5::table_handler
 	H5::CompType type;
 	H5::DataSet dataset;
 
+	std::vector<char> rowbuf;	// staging buffer of packed records
+	size_t nrows;				// number of rows in the staging buffer
+	size_t capacity;			// capacity of the staging buffer, in rows
+	output_counters* counters;	// the statistics of the file, or null
 
-	table_handler(output_table& _table);
+	table_handler(output_table& _table, size_t _rows=1, size_t _bytes=0);
 	void make_row(char* buffer);
-	void create_dataset(const H5::Group& loc);
+	void create_dataset(const H5::Group& loc, 
+		const hdf5_dataset_options& opts = hdf5_dataset_options());
+	void open_dataset(const H5::Group& loc,
+		const hdf5_dataset_options& opts = hdf5_dataset_options());
 	void append_row();
+	void append_record(const char* record);
+	void append_records(const char* records, size_t n);
+	void flush_rows();
+	void write_records(const char* records, size_t n);
 	~table_handler();
 };
 
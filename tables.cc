@@ -10,7 +10,32 @@
 #include <iostream>
 #include <sstream>
 #include <stack>
-#include <regex>
+#include <cctype>
+#include <charconv>
+#include <cstdarg>
+#include <cmath>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <zlib.h>
+#include <deque>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define TABLES_HAVE_ZSTD 1
+#include <zstd.h>
+#endif
 
 #include <boost/core/demangle.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -20,6 +45,86 @@
 
 namespace tables {
 
+// -------------------------------------
+//
+// Pools
+//
+// -------------------------------------
+
+/*
+	A pool of fixed-size blocks, for the small objects that are made
+	and destroyed with every table: bindings and formatters. Blocks are
+	carved from chunks of growing size, and recycled through a free 
+	list. Chunks are kept for the life of the process.
+ */
+template <size_t Size>
+class __block_pool
+{
+	union block {
+		block* next;
+		alignas(std::max_align_t) char data[Size];
+	};
+
+	std::mutex mtx;
+	block* free_list;
+	std::vector<std::unique_ptr<block[]>> chunks;
+	size_t chunk_blocks;
+
+	__block_pool() : free_list(nullptr), chunk_blocks(16) { }
+
+public:
+	void* allocate()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(! free_list) {
+			chunks.emplace_back(new block[chunk_blocks]);
+			block* c = chunks.back().get();
+			for(size_t i=chunk_blocks; i>0; i--) {
+				c[i-1].next = free_list;
+				free_list = &c[i-1];
+			}
+			chunk_blocks = std::min(2*chunk_blocks, (size_t)1024);
+		}
+		block* b = free_list;
+		free_list = b->next;
+		return b;
+	}
+
+	void release(void* p)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		block* b = (block*) p;
+		b->next = free_list;
+		free_list = b;
+	}
+
+	// never destroyed, objects may be released during static destruction
+	static __block_pool& instance()
+	{
+		static __block_pool* pool = new __block_pool();
+		return *pool;
+	}
+};
+
+// allocate from the pool of the smallest fitting size class
+static void* __pool_allocate(size_t size)
+{
+	if(size <= 64) return __block_pool<64>::instance().allocate();
+	if(size <= 128) return __block_pool<128>::instance().allocate();
+	if(size <= 256) return __block_pool<256>::instance().allocate();
+	return ::operator new(size);
+}
+
+static void __pool_release(void* p, size_t size)
+{
+	if(! p) return;
+	if(size <= 64) __block_pool<64>::instance().release(p);
+	else if(size <= 128) __block_pool<128>::instance().release(p);
+	else if(size <= 256) __block_pool<256>::instance().release(p);
+	else ::operator delete(p);
+}
+
+
 // -------------------------------------
 //
 // bindings
@@ -27,24 +132,50 @@ namespace tables {
 // -------------------------------------
 
 output_binding::output_binding(output_file* f, output_table* t)
-: file(f), table(t), 
-	in_file_list(f->tables.insert(f->tables.end(),this)),
-	in_table_list(t->files.insert(t->files.end(), this)),
-	enabled(true)
-{ }
+: file(f), table(t), enabled(true), snapshot(false),
+	file_pos(f->tables.size()), table_pos(t->files.size())
+{
+	f->tables.push_back(this);
+	try {
+		t->files.push_back(this);
+	} catch(...) {
+		f->tables.pop_back();
+		throw;
+	}
+}
+
+void* output_binding::operator new(size_t size)
+{
+	return __pool_allocate(size);
+}
+
+void output_binding::operator delete(void* p, size_t size)
+{
+	__pool_release(p, size);
+}
 
 void output_binding::unbind_all(output_binding::list& L)
 {
 	while(! L.empty()) {
-		output_binding* b = L.front();
+		output_binding* b = L.back();
 		delete b;
 	}
 }
 
+// remove the binding at a position, moving the last one in its place
+static void __erase_binding(output_binding::list& L, size_t pos, size_t output_binding::* index)
+{
+	output_binding* last = L.back();
+	L[pos] = last;
+	last->*index = pos;
+	L.pop_back();
+}
+
 output_binding::~output_binding()
 {
-	file->tables.erase(in_file_list);
-	table->files.erase(in_table_list);
+	file->output_unbind(*table);
+	__erase_binding(file->tables, file_pos, &output_binding::file_pos);
+	__erase_binding(table->files, table_pos, &output_binding::table_pos);
 }
 
 
@@ -68,6 +199,21 @@ output_binding* output_binding::find(list& L, output_table* t)
 		return *found;
 }
 
+void output_binding::set_reducer(output_reducer* r)
+{
+	if(table->is_locked())
+		throw std::logic_error("cannot change the reducer of a locked table");
+	reducer.reset(r);
+}
+
+void output_binding::output(const row_view& r)
+{
+	if(reducer)
+		reducer->row(*this, r);
+	else
+		file->output_row(r);
+}
+
 
 //--------------------------------------------
 //
@@ -136,7 +282,7 @@ string column_item::path_name(const string& sep)
 
 
 column_group::column_group(column_group* p, const string& n)
-	: column_item(p,n), _dirty(false)
+	: column_item(p,n), _ncols(0), _dirty(false)
 { }	
 
 column_group::~column_group()
@@ -158,11 +304,67 @@ void column_group::_mark_dirty()
 }
 
 
-void column_group::_mark_dirty_columns()
+
+size_t column_group::_column_count(column_item* item)
+{
+	if(item->is_column())
+		return 1;
+	if(item->is_columns() || item->is_table())
+		return static_cast<column_group*>(item)->_ncols;
+	return 0;
+}
+
+size_t column_group::_position(column_item* child)
+{
+	size_t pos = 0;
+	for(column_item* c=child; c->_parent; c=c->_parent) {
+		const auto& siblings = c->_parent->_children;
+		for(size_t i=0; i<c->_index; i++)
+			if(siblings[i]) 
+				pos += _column_count(siblings[i]);
+	}
+	return pos;
+}
+
+void column_group::_attach(column_item* child, bool column_only)
+{
+	size_t n = _column_count(child);
+	for(column_group* g=this; g; g=g->_parent)
+		g->_ncols += n;
+
+	output_table* tab = table();
+	if(! tab) return;
+	// the columns of the subtree go right after those preceding it
+	std::vector<basic_column*> cols;
+	auto collect = [&](column_item* item) {
+		if(item->is_column())
+			cols.push_back(static_cast<basic_column*>(item));
+		if(! column_only)
+			tab->_paths[item->path_name()] = item;
+	};
+	if(column_only)
+		collect(child);
+	else
+		child->visit(collect);
+	if(! cols.empty())
+		tab->_columns.insert(tab->_columns.begin() + _position(child), cols.begin(), cols.end());
+	tab->_dirty_columns = true;
+}
+
+void column_group::_detach(column_item* child)
 {
+	size_t n = _column_count(child);
 	output_table* tab = table();
-	if(tab)
+	if(tab) {
+		if(n > 0) {
+			auto first = tab->_columns.begin() + _position(child);
+			tab->_columns.erase(first, first + n);
+		}
+		child->visit([&](column_item* item) { tab->_paths.erase(item->path_name()); });
 		tab->_dirty_columns = true;
+	}
+	for(column_group* g=this; g; g=g->_parent)
+		g->_ncols -= n;
 }
 
 void column_group::_cleanup()
@@ -180,14 +382,14 @@ void column_group::_cleanup()
 			if(pos < i) {
 				assert(_children[pos]==nullptr); 
 				_children[pos] = _children[i];
+				_children[i] = nullptr;
 
 				assert(_children[pos]->_index == i); 
 				_children[pos]->_index = pos; 
 			}
 			// clean up a child that is a group
-			column_group* _child = dynamic_cast<column_group*>(_children[pos]);
-			if(_child)
-				_child->_cleanup();
+			if(_children[pos]->is_columns())
+				static_cast<column_group*>(_children[pos])->_cleanup();
 			// advance pos
 			pos++;
 		}
@@ -217,7 +419,7 @@ void column_group::add_item(column_item* col)
 	col->_index = _children.size();
 	_children.push_back(col);
 	_item_names[col->name()] = col;
-	_mark_dirty_columns();
+	_attach(col);
 }
 
 
@@ -228,6 +430,7 @@ void column_group::remove_item(column_item* col)
 		throw std::invalid_argument(
 			"column_group::remove(col) column not bound to this table");
 	assert(_children[col->_index]==col);
+	_detach(col);
 	_children[col->_index] = nullptr;
 	_item_names.erase(col->name());
 	assert(_item_names.find(col->name())==_item_names.end());
@@ -260,9 +463,26 @@ column_item* column_group::get_item(const std::vector<string>& inames)
 
 column_item* column_group::get_item(const string& path)
 {
-	std::vector<string> inames;
-	boost::split(inames, path, boost::is_any_of("/"));
-	return get_item(inames);
+	if(is_table()) {
+		const auto& paths = static_cast<output_table*>(this)->_paths;
+		auto found = paths.find(path);
+		if(found == paths.end())
+			throw std::out_of_range("item not found: "+path);
+		return found->second;
+	}
+
+	// walk down the path, a name at a time
+	column_item* ret = this;
+	size_t from = 0;
+	for(;;) {
+		size_t to = std::min(path.find('/', from), path.size());
+		if(! (ret->is_columns() || ret->is_table()))
+			throw std::runtime_error("item not found");
+		ret = static_cast<column_group*>(ret)->_item_names.at(path.substr(from, to-from));
+		if(to == path.size())
+			return ret;
+		from = to+1;
+	}
 }
 
 
@@ -320,11 +540,23 @@ basic_column::basic_column(column_group* _grp, const string& _name,
 : 	column_item(_grp, _name), 
 	_format(f), 
 	_type(_t), _size(_s), _align(_a)
- { }
+{
+	// now, this item is a column
+	if(parent())
+		parent()->_attach(this, true);
+}
 
 
 basic_column::~basic_column()
 {
+	// leave while still a column
+	if(parent())
+		parent()->remove_item(this);
+}
+
+basic_column::copy_function basic_column::copier() const
+{
+	return [](basic_column* c, void* ptr) { c->copy(ptr); };
 }
 
 void basic_column::set(double val)
@@ -343,6 +575,355 @@ void basic_column::set(const string&)
 
 
 
+//-------------------------------------
+//
+// Aggregate columns
+//
+//-------------------------------------
+
+running_quantile::running_quantile(column_group* _grp, const string& _n, double _p, const string& fmt)
+: column<double>(_grp, _n, fmt, 0.0), p(_p), n(0)
+{
+	if(!(p >= 0.0 && p <= 1.0))
+		throw std::invalid_argument("quantile must be in [0,1]");
+}
+
+void running_quantile::add(double x)
+{
+	if(n < 5) {
+		// keep the first samples sorted, the quantile is exact
+		size_t i = n++;
+		for(; i>0 && q[i-1] > x; i--) q[i] = q[i-1];
+		q[i] = x;
+		val = q[(size_t) std::floor(p*(n-1) + 0.5)];
+		if(n == 5) {
+			for(size_t j=0; j<5; j++) pos[j] = j+1;
+			want[0] = 1; want[1] = 1+2*p; want[2] = 1+4*p; want[3] = 3+2*p; want[4] = 5;
+		}
+		return;
+	}
+	n++;
+
+	// find the cell of x, and update the extreme markers
+	size_t k;
+	if(x < q[0]) { q[0] = x; k = 0; }
+	else if(x < q[1]) k = 0;
+	else if(x < q[2]) k = 1;
+	else if(x < q[3]) k = 2;
+	else if(x <= q[4]) k = 3;
+	else { q[4] = x; k = 3; }
+
+	for(size_t i=k+1; i<5; i++) pos[i] += 1;
+	const double dn[5] = { 0, p/2, p, (1+p)/2, 1 };
+	for(size_t i=0; i<5; i++) want[i] += dn[i];
+
+	// adjust the middle markers
+	for(size_t i=1; i<4; i++) {
+		double d = want[i] - pos[i];
+		if((d >= 1 && pos[i+1]-pos[i] > 1) || (d <= -1 && pos[i-1]-pos[i] < -1)) {
+			double s = (d > 0) ? 1 : -1;
+			// piecewise-parabolic prediction
+			double qp = q[i] + s/(pos[i+1]-pos[i-1]) * (
+				(pos[i]-pos[i-1]+s)*(q[i+1]-q[i])/(pos[i+1]-pos[i]) +
+				(pos[i+1]-pos[i]-s)*(q[i]-q[i-1])/(pos[i]-pos[i-1]) );
+			if(q[i-1] < qp && qp < q[i+1])
+				q[i] = qp;
+			else {
+				// linear prediction
+				size_t j = (s > 0) ? i+1 : i-1;
+				q[i] += s*(q[j]-q[i])/(pos[j]-pos[i]);
+			}
+			pos[i] += s;
+		}
+	}
+	val = q[2];
+}
+
+
+histogram::histogram(column_group* par, const string& nam, double _lo, double _hi, size_t nbins)
+: columns(par, nam), lo(_lo), hi(_hi)
+{
+	if(nbins == 0 || !(lo < hi))
+		throw std::invalid_argument("bad histogram bins");
+	scale = nbins/(hi-lo);
+	counts.emplace_back(new column<size_t>(this, "under", "%zu", 0));
+	for(size_t i=0; i<nbins; i++)
+		counts.emplace_back(new column<size_t>(this, "b"+std::to_string(i), "%zu", 0));
+	counts.emplace_back(new column<size_t>(this, "over", "%zu", 0));
+}
+
+histogram::~histogram()
+{ 
+	// the columns are removed before the group is destroyed
+	counts.clear();
+}
+
+void histogram::reset()
+{
+	for(auto& c : counts)
+		c->value() = 0;
+}
+
+
+//-------------------------------------
+//
+// Row plans
+//
+//-------------------------------------
+
+inline static size_t __aligned(size_t pos, size_t al) {
+	assert( (al&(al-1)) == 0); // al is a power of 2
+	return al*((pos+al-1)/al);
+}
+
+template <typename T>
+static std::pair<type_index, type_tag> __tag_entry()
+{
+	type_tag tag;
+	if(std::is_same<T, bool>::value)
+		tag = type_tag::boolean;
+	else if(std::is_floating_point<T>::value)
+		tag = (sizeof(T)==4) ? type_tag::float32 
+			: (sizeof(T)==8) ? type_tag::float64 : type_tag::ldouble;
+	else {
+		// int8, uint8, int16, ... in order
+		unsigned lg = (sizeof(T)==1) ? 0 : (sizeof(T)==2) ? 1 : (sizeof(T)==4) ? 2 : 3;
+		tag = (type_tag) ((unsigned) type_tag::int8 + 2*lg + (std::is_unsigned<T>::value ? 1 : 0));
+	}
+	return { typeid(T), tag };
+}
+
+static const std::pair<type_index, type_tag> __type_tags[] = {
+	__tag_entry<bool>(),
+	__tag_entry<char>(), __tag_entry<signed char>(), __tag_entry<unsigned char>(),
+	__tag_entry<short>(), __tag_entry<unsigned short>(),
+	__tag_entry<int>(), __tag_entry<unsigned int>(),
+	__tag_entry<long>(), __tag_entry<unsigned long>(),
+	__tag_entry<long long>(), __tag_entry<unsigned long long>(),
+	__tag_entry<float>(), __tag_entry<double>(), __tag_entry<long double>()
+};
+
+static const char* __type_tag_names[] = {
+	"other", "bool", 
+	"int8", "uint8", "int16", "uint16", "int32", "uint32", "int64", "uint64",
+	"float32", "float64", "ldouble", "string"
+};
+
+type_tag make_type_tag(type_index type)
+{
+	if(type == typeid(string))
+		return type_tag::string;
+	for(auto& t : __type_tags)
+		if(t.first == type) return t.second;
+	return type_tag::other;
+}
+
+const char* type_tag_name(type_tag tag)
+{
+	size_t i = (size_t) tag;
+	return i < sizeof(__type_tag_names)/sizeof(__type_tag_names[0]) ? __type_tag_names[i] : "other";
+}
+
+static const char __layout_magic[9] = "TABLELY1";
+
+// a column entry of a binary descriptor, before the path name
+struct __layout_entry {
+	uint64_t offset;
+	uint64_t size;
+	uint16_t tag;
+	uint16_t length;
+};
+static const size_t __layout_entry_size = 20;
+
+static string __descriptor(const std::vector<row_plan::entry>& entries, 
+	const std::vector<string>& paths, size_t size, size_t align)
+{
+	string out(sizeof(layout_header), '\0');
+	for(size_t i=0; i<entries.size(); i++) {
+		const string& path = paths[i];
+		if(path.size() > UINT16_MAX)
+			throw std::invalid_argument("Column path `"+path.substr(0,64)+"...' is too long");
+		__layout_entry le { entries[i].offset, entries[i].size, 
+			(uint16_t) entries[i].tag, (uint16_t) path.size() };
+		out.append((const char*) &le, __layout_entry_size);
+		out.append(path);
+		out.append(__aligned(out.size(), 8) - out.size(), '\0');
+	}
+	layout_header h;
+	memcpy(h.magic, __layout_magic, 8);
+	h.columns = entries.size();
+	h.bytes = out.size();
+	h.record = size;
+	h.align = align;
+	memcpy(&out[0], &h, sizeof(h));
+	return out;
+}
+
+record_layout record_layout::decode(const void* data, size_t len)
+{
+	const char* buf = (const char*) data;
+	layout_header h;
+	if(len < sizeof(h))
+		throw std::runtime_error("Truncated layout descriptor");
+	memcpy(&h, buf, sizeof(h));
+	if(memcmp(h.magic, __layout_magic, 8)!=0 || h.bytes > len)
+		throw std::runtime_error("Bad layout descriptor");
+
+	record_layout ret;
+	ret.size = h.record;
+	ret.align = h.align;
+	size_t pos = sizeof(h);
+	for(uint32_t i=0; i<h.columns; i++) {
+		__layout_entry le;
+		if(pos + __layout_entry_size > h.bytes)
+			throw std::runtime_error("Truncated layout descriptor");
+		memcpy(&le, buf+pos, __layout_entry_size);
+		pos += __layout_entry_size;
+		if(pos + le.length > h.bytes || le.offset + le.size > h.record)
+			throw std::runtime_error("Bad layout descriptor");
+		ret.fields.push_back(record_field { string(buf+pos, le.length), 
+			(type_tag) le.tag, le.offset, le.size });
+		pos = __aligned(pos + le.length, 8);
+	}
+	return ret;
+}
+
+const record_field* record_layout::find(const string& path) const
+{
+	for(auto& f : fields)
+		if(f.path == path) return &f;
+	return nullptr;
+}
+
+row_plan::row_plan()
+: _size(0), _align(1)
+{ }
+
+void row_plan::compile(const std::vector<basic_column*>& cols)
+{
+	_entries.clear();
+	_paths.clear();
+	_size = 0;
+	_align = 1;
+
+	size_t pos = 0;
+	for(size_t i=0; i<cols.size(); i++) {
+		basic_column* c = cols[i];
+		_align = std::max(_align, c->align());
+		if(i>0) pos = __aligned(pos+cols[i-1]->size(), c->align());
+		_entries.push_back(entry { c, c->value_address(), c->copier(),
+			c->type(), pos, c->size(), make_type_tag(c->type()) });
+		_paths.push_back(c->path_name());
+	}
+
+	// the record size (note: this is padded to the alignment 
+	// of the first column, as HDF5 tables always were)
+	if(! cols.empty())
+		_size = __aligned(pos + cols.back()->size(), cols[0]->align());
+	_descriptor = __descriptor(_entries, _paths, _size, _align);
+}
+
+void row_plan::write_json(std::ostream& out) const
+{
+	using std::endl;
+	out << "\"record_size\": " << _size << "," << endl;
+	out << "\"align\": " << _align << "," << endl;
+	out << "\"layout\": [" << endl;
+	for(size_t i=0; i<_entries.size(); i++) {
+		const entry& e = _entries[i];
+		out << "\t{ \"name\": \"" << _paths[i] << "\", "
+			<< "\"type\": \"" << type_tag_name(e.tag) << "\", "
+			<< "\"offset\": " << e.offset << ", "
+			<< "\"size\": " << e.size << " }";
+		if(i+1 < _entries.size()) out << ",";
+		out << endl;
+	}
+	out << "]" << endl;
+}
+
+
+//-------------------------------------
+//
+// Statistics
+//
+//-------------------------------------
+
+std::atomic<bool> output_stats::_enabled(false);
+
+void output_stats::enable(bool on)
+{
+	_enabled = on;
+}
+
+output_stats output_counters::snapshot() const
+{
+	output_stats s;
+	s.rows = rows.get();
+	s.bytes = bytes.get();
+	s.row_seconds = row_ns.get()*1e-9;
+	s.flushes = flushes.get();
+	s.flush_seconds = flush_ns.get()*1e-9;
+	s.extends = extends.get();
+	s.writes = writes.get();
+	return s;
+}
+
+void output_counters::reset()
+{
+	for(stat_counter* c : { &rows, &bytes, &row_ns, &flushes, &flush_ns, &extends, &writes })
+		c->reset();
+}
+
+
+stats_series::stats_series(const string& name)
+: time_series<double>(name, "%.6f", [this]() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}),
+	start(std::chrono::steady_clock::now())
+{ }
+
+void stats_series::watch(output_table& t)
+{
+	sources.push_back(source { t.name(), &t, nullptr });
+}
+
+void stats_series::watch(output_file& f, const string& name)
+{
+	sources.push_back(source { name, nullptr, &f });
+}
+
+void stats_series::unwatch(output_table& t)
+{
+	sources.erase(std::remove_if(sources.begin(), sources.end(), 
+		[&](const source& s) { return s.table == &t; }), sources.end());
+}
+
+void stats_series::unwatch(output_file& f)
+{
+	sources.erase(std::remove_if(sources.begin(), sources.end(), 
+		[&](const source& s) { return s.file == &f; }), sources.end());
+}
+
+void stats_series::publish()
+{
+	for(const source& src : sources) {
+		output_stats st = src.table ? src.table->stats() : src.file->stats();
+		kind = src.table ? "table" : "file";
+		source_name = src.name;
+		rows = st.rows;
+		bytes = st.bytes;
+		row_seconds = st.row_seconds;
+		flushes = st.flushes;
+		flush_seconds = st.flush_seconds;
+		extends = st.extends;
+		writes = st.writes;
+		queued = st.queued;
+		dropped = st.dropped;
+		emit_row();
+	}
+}
+
+
 //-------------------------------------
 //
 // Tables (result_table + timeseries)
@@ -361,8 +942,16 @@ static std::unordered_set<output_table*>& __all_tables()
 	return foo;
 }
 
+// guards the registry, tables may be created by many threads
+static std::mutex& __registry_mutex()
+{
+	static std::mutex foo;
+	return foo;
+}
+
 output_table* output_table::get(const string& name)
 {
+	std::lock_guard<std::mutex> lock(__registry_mutex());
 	auto iter = __table_registry().find(name);
 	return (iter!=__table_registry().end()) ? iter->second : nullptr;
 }
@@ -375,8 +964,9 @@ const output_table::registry& output_table::all()
 
 
 output_table::output_table(const string& _name, table_flavor _f)
-: column_group(nullptr, _name), _dirty_columns(false), en(true), _locked(false), _flavor(_f)
+: column_group(nullptr, _name), _dirty_columns(false), _snapshot(false), en(true), _locked(false), _flavor(_f)
 {
+	std::lock_guard<std::mutex> lock(__registry_mutex());
 	if(__table_registry().count(_name)>0)
 		throw std::runtime_error("A table of name `"+_name+"' is already registered");
 	__table_registry()[_name] = this;
@@ -387,6 +977,7 @@ output_table::output_table(const string& _name, table_flavor _f)
 output_table::~output_table()
 {
 	output_binding::unbind_all(files);
+	std::lock_guard<std::mutex> lock(__registry_mutex());
 	__table_registry().erase(this->name());
 	__all_tables().erase(this);
 }
@@ -400,20 +991,12 @@ output_table* output_table::table()
 
 void output_table::_cleanup()
 {
-	if(_dirty) {
-		_dirty_columns = true; // trigger the recomputation of columns
+	// the columns are kept up to date, only the children need packing
+	if(_dirty)
 		column_group::_cleanup();
-	}
 	assert(! _dirty);
 	if(_dirty_columns) {
-		_columns.clear();
-
-		visit([&](column_item* item) {
-			basic_column* col = dynamic_cast<basic_column*>(item);
-			if(col)
-				_columns.push_back(col);
-		});
-
+		_plan.compile(_columns);
 		_dirty_columns = false;
 	}
 }
@@ -431,6 +1014,41 @@ basic_column* output_table::operator[](const string& n)
 
 
 
+// output a row to every enabled binding, and time every file 
+// if the statistics are enabled
+template <typename F>
+static void __dispatch_row(const output_binding::list& files, output_counters& counters, F output,
+	size_t rows = 1)
+{
+	if(! output_stats::enabled()) {
+		for(auto b : files)
+			if(b->enabled){
+				// for every enabled binding
+				output(b);
+			}
+		return;
+	}
+
+	// the same, timing every file
+	using std::chrono::steady_clock;
+	auto ns = [](steady_clock::duration d) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+	};
+	auto start = steady_clock::now();
+	auto last = start;
+	for(auto b : files)
+		if(b->enabled){
+			output(b);
+			auto now = steady_clock::now();
+			output_counters& c = b->file->counters();
+			c.rows.add(rows);
+			c.row_ns.add(ns(now-last));
+			last = now;
+		}
+	counters.rows.add(rows);
+	counters.row_ns.add(ns(last-start));
+}
+
 void output_table::emit_row()
 {
 	if(files.empty())
@@ -439,22 +1057,103 @@ void output_table::emit_row()
 		throw std::logic_error("prolog() has not been called before emit_row()");
 	// is the table enabled?
 	if(!en) return;
+	// is the row sampled?
+	if(_filter && !_filter->accept(*this)) return;
 	// ok, we are enabled
-	for(auto b : bindings())
-		if(b->enabled){
-			// for every enabled binding
+	// evaluate the columns once, for all the bindings taking the snapshot
+	if(_snapshot)
+		_plan.pack(_record.data());
+	__dispatch_row(files, _counters, [&](output_binding* b) {
+		if(b->reducer)
+			b->reducer->row(*b, row_view { *this, _plan, _record.data() });
+		else if(b->snapshot)
+			b->file->output_row(row_view { *this, _plan, _record.data() });
+		else
 			b->file->output_row(*this);
+	});
+}
+
+void output_table::_emit_record(const char* record)
+{
+	row_view r { *this, _plan, record };
+	__dispatch_row(files, _counters, [&](output_binding* b) { b->output(r); });
+}
+
+void output_table::emit_rows(size_t n, const void* records)
+{
+	if(files.empty() || n==0)
+		return;
+	if(!_locked)
+		throw std::logic_error("prolog() has not been called before emit_rows()");
+	if(!en) return;
+
+	const char* recs = (const char*) records;
+	row_view first { *this, _plan, recs };
+	__dispatch_row(files, _counters, [&](output_binding* b) {
+		if(b->reducer)
+			for(size_t i=0; i<n; i++)
+				b->reducer->row(*b, row_view { *this, _plan, recs + i*_plan.size() });
+		else
+			b->file->output_rows(first, n);
+	}, n);
+}
+
+void output_table::emit_columns(size_t n, const std::vector<const void*>& spans)
+{
+	if(!_locked)
+		throw std::logic_error("prolog() has not been called before emit_columns()");
+	if(spans.size() != _plan.columns())
+		throw std::invalid_argument("emit_columns() needs a span for every column");
+	if(files.empty() || !en || n==0)
+		return;
+
+	// pack the rows in blocks
+	const size_t block = std::min(n, std::max(default_emit_block_bytes / std::max(_plan.size(), (size_t)1), (size_t)1));
+	std::vector<char> buffer(block * _plan.size(), 0);
+	for(size_t from=0; from<n; from+=block) {
+		size_t rows = std::min(block, n-from);
+		for(size_t c=0; c<spans.size(); c++) {
+			const row_plan::entry& e = _plan[c];
+			const char* src = (const char*) spans[c] + from*e.size;
+			char* dst = buffer.data() + e.offset;
+			for(size_t i=0; i<rows; i++)
+				memcpy(dst + i*_plan.size(), src + i*e.size, e.size);
 		}
+		emit_rows(rows, buffer.data());
+	}
 }
 
 void output_table::prolog()
 {
-	// repack the table after possible column removals
+	// repack the table after possible column removals,
+	// this also compiles the row plan
 	_cleanup();
 
+	// the filter may reject the table, before any file is touched
+	if(_filter)
+		_filter->prolog(*this);
 	// do this for every bound file, enabled or not
 	for(auto b : bindings())
 		b->file->output_prolog(*this);
+	// a snapshot is worth it for reducers, or if more than one
+	// file would evaluate the columns; files get it only if all the
+	// values can be read back from the record (i.e., have a type tag),
+	// otherwise they evaluate the columns themselves
+	bool reduced = false;
+	size_t takers = 0;
+	for(auto b : bindings()) {
+		if(b->reducer) {
+			b->reducer->prolog(*b);
+			reduced = true;
+		} else if(b->file->takes_snapshots())
+			takers++;
+	}
+	bool described = std::all_of(_plan.begin(), _plan.end(), 
+		[](const row_plan::entry& e) { return e.tag != type_tag::other; });
+	_snapshot = reduced || (described && takers > 1);
+	for(auto b : bindings())
+		b->snapshot = described && _snapshot && !b->reducer && b->file->takes_snapshots();
+	_record.assign(_snapshot ? _plan.size() : 0, 0);
 
 	// we are ready for business
 	_locked = true;
@@ -462,6 +1161,15 @@ void output_table::prolog()
 
 void output_table::epilog()
 {
+	// the filter may emit rows
+	if(_filter && _locked)
+		_filter->epilog(*this);
+	// the reducers emit their pending rows
+	if(_locked)
+		for(auto b : bindings())
+			if(b->reducer)
+				b->reducer->epilog(*b);
+
 	// changes are allowed
 	_locked = false;
 
@@ -471,26 +1179,363 @@ void output_table::epilog()
 }
 
 
-void output_table::generate_schema(std::ostream& out)
+void output_table::set_filter(std::unique_ptr<emit_filter> f)
 {
-	using std::endl;
-	// output top-level
-	out << "{" << endl;
-	out << "\t\"name\": \"" << name() << "\"," << endl;
-	out << "\t\"columns\": [";
+	if(_locked)
+		throw std::logic_error("cannot change the filter of a locked table");
+	_filter = std::move(f);
+}
 
-	// output columns
-	for(size_t i=0; i<size(); i++) {
-		out << "\t\t{" << endl;
 
-		basic_column* col = (*this)[i];
-		out << "\t\t\t\"name\": \"" << col->path_name() << "\"," << endl;
+//-------------------------------------
+//
+// Sampling filters
+//
+//-------------------------------------
 
-		out << "\t\t\t\"path\": [";
-		std::stack<column_item*> stk;
-		column_item* item = col;
-		while(item!=this) { stk.push(item); item=item->parent(); }
-		while(! stk.empty()) {
+emit_filter::~emit_filter()
+{ }
+
+sample_random::sample_random(double p, unsigned _seed)
+: gen(_seed), threshold(0), all(p >= 1.0), seed(_seed)
+{
+	if(p > 0.0 && !all)
+		threshold = (uint64_t) std::ldexp(p, 64);
+}
+
+sample_reservoir::sample_reservoir(size_t _k, unsigned _seed)
+: k(_k), seed(_seed), gen(_seed), seen(0)
+{ }
+
+bool sample_reservoir::accept(output_table& t)
+{
+	// algorithm R: the i-th row replaces a random slot with probability k/i
+	size_t slot = seen < k ? seen : gen() % (seen+1);
+	if(slot < k) {
+		const row_plan& plan = t.plan();
+		plan.pack(records.data() + slot*plan.size());
+		order[slot] = seen;
+	}
+	seen++;
+	return false;
+}
+
+// filters emitting rows from their records need every value to be
+// readable back from a record
+static void __require_tags(output_table& t, const char* filter)
+{
+	for(auto& e : t.plan())
+		if(e.tag == type_tag::other)
+			throw std::logic_error(string(filter)+" needs columns with a type tag, but column '"
+				+ e.column->name() + "' of table '" + t.name() + "' has none");
+}
+
+void sample_reservoir::prolog(output_table& t)
+{
+	__require_tags(t, "emit_reservoir()");
+	gen.seed(seed);
+	seen = 0;
+	records.assign(k*t.plan().size(), 0);
+	order.assign(k, 0);
+}
+
+void sample_reservoir::epilog(output_table& t)
+{
+	const row_plan& plan = t.plan();
+	size_t n = std::min(seen, k);
+	std::vector<size_t> slots;
+	for(size_t i=0; i<n; i++) slots.push_back(i);
+	std::sort(slots.begin(), slots.end(), [&](size_t a, size_t b) { return order[a] < order[b]; });
+
+	if(t.enabled())
+		for(size_t i : slots)
+			t._emit_record(records.data() + i*plan.size());
+	records.clear();
+}
+
+sample_on_change::sample_on_change()
+: from(0), first(true)
+{ }
+
+bool sample_on_change::accept(output_table& t)
+{
+	const row_plan& plan = t.plan();
+	plan.pack(current.data());
+	if(!first && memcmp(current.data()+from, last.data()+from, plan.size()-from)==0)
+		return false;
+	first = false;
+	std::swap(current, last);
+	// emit the record, so that the columns are not evaluated again
+	t._emit_record(last.data());
+	return false;
+}
+
+void sample_on_change::prolog(output_table& t)
+{
+	__require_tags(t, "emit_on_change()");
+	const row_plan& plan = t.plan();
+	last.assign(plan.size(), 0);
+	current.assign(plan.size(), 0);
+	first = true;
+	// skip the time of time series
+	from = 0;
+	if(t.flavor() == table_flavor::TIMESERIES && plan.columns() > 1)
+		from = plan[1].offset;
+}
+
+
+//-------------------------------------
+//
+// Reducers
+//
+//-------------------------------------
+
+output_reducer::~output_reducer()
+{ }
+
+void output_reducer::emit(output_binding& b, const row_view& r)
+{
+	if(b.enabled && b.table->enabled())
+		b.file->output_row(r);
+}
+
+template <typename T>
+static double __load_at(const char* p)
+{
+	T x;
+	memcpy(&x, p, sizeof(T));
+	return x;
+}
+
+template <typename T>
+static void __store_at(char* p, double x)
+{
+	T v = std::is_integral<T>::value ? (T) std::llround(x) : (T) x;
+	memcpy(p, &v, sizeof(T));
+}
+
+static void __value_access(type_index t, window_reducer::load_function& load, window_reducer::store_function& store)
+{
+#define __ACCESS(T) if(t==typeid(T)) { load = __load_at<T>; store = __store_at<T>; return; }
+	__ACCESS(double) __ACCESS(float)
+	__ACCESS(int) __ACCESS(unsigned int)
+	__ACCESS(long) __ACCESS(unsigned long)
+	__ACCESS(long long) __ACCESS(unsigned long long)
+	__ACCESS(short) __ACCESS(unsigned short)
+	__ACCESS(char) __ACCESS(signed char) __ACCESS(unsigned char)
+	__ACCESS(bool) __ACCESS(long double)
+#undef __ACCESS
+	load = nullptr;
+	store = nullptr;
+}
+
+static const row_plan& __series_plan(output_binding& b)
+{
+	if(b.table->flavor() != table_flavor::TIMESERIES)
+		throw std::logic_error("this reducer applies to time series only");
+	const row_plan& plan = b.table->plan();
+	if(plan.columns()==0)
+		throw std::logic_error("the time series has no time column");
+	return plan;
+}
+
+
+window_reducer::window_reducer(double _width, window_op _op)
+: width(_width), op(_op), plan(nullptr), window(0), n(0)
+{
+	if(!(width > 0))
+		throw std::invalid_argument("the window width must be positive");
+}
+
+void window_reducer::prolog(output_binding& b)
+{
+	plan = &__series_plan(b);
+	slots.clear();
+	for(auto& e : *plan) {
+		slot s { e.offset, e.size, nullptr, nullptr };
+		__value_access(e.type, s.load, s.store);
+		slots.push_back(s);
+	}
+	if(! slots[0].load)
+		throw std::invalid_argument("the time column is not arithmetic");
+	acc.assign(slots.size(), 0.0);
+	out.assign(plan->size(), 0);
+	n = 0;
+}
+
+void window_reducer::row(output_binding& b, const row_view& r)
+{
+	double w = std::floor(slots[0].load(r.record + slots[0].offset) / width);
+	if(n && w != window)
+		flush(b);
+	if(n==0) {
+		window = w;
+		memcpy(out.data(), r.record, out.size());
+	}
+
+	switch(op) {
+	case window_op::first:
+		break;
+	case window_op::last:
+		memcpy(out.data(), r.record, out.size());
+		break;
+	default:
+		for(size_t i=1; i<slots.size(); i++) {
+			const slot& s = slots[i];
+			if(! s.load) {
+				// the last value of non-arithmetic columns
+				memcpy(out.data() + s.offset, r.record + s.offset, s.size);
+				continue;
+			}
+			double x = s.load(r.record + s.offset);
+			if(n==0) acc[i] = x;
+			else if(op==window_op::min) acc[i] = std::min(acc[i], x);
+			else if(op==window_op::max) acc[i] = std::max(acc[i], x);
+			else acc[i] += (x-acc[i])/(n+1);
+		}
+	}
+	n++;
+}
+
+void window_reducer::flush(output_binding& b)
+{
+	if(op != window_op::first && op != window_op::last)
+		for(size_t i=1; i<slots.size(); i++)
+			if(slots[i].store)
+				slots[i].store(out.data() + slots[i].offset, acc[i]);
+	slots[0].store(out.data() + slots[0].offset, window*width);
+	emit(b, row_view { *b.table, *plan, out.data() });
+	n = 0;
+}
+
+void window_reducer::epilog(output_binding& b)
+{
+	if(n) flush(b);
+}
+
+
+lttb_reducer::lttb_reducer(size_t _bucket_rows, const string& _ycol)
+: bucket_rows(_bucket_rows), ycol(_ycol), rsize(0), ncur(0), nnext(0), first(true)
+{
+	if(bucket_rows == 0)
+		throw std::invalid_argument("the bucket must have rows");
+}
+
+void lttb_reducer::prolog(output_binding& b)
+{
+	const row_plan& plan = __series_plan(b);
+	basic_column* y = (*b.table)[ycol];
+	window_reducer::store_function store;
+	xoff = plan[0].offset;
+	__value_access(plan[0].type, xload, store);
+	yload = nullptr;
+	for(auto& e : plan)
+		if(e.column == y) {
+			yoff = e.offset;
+			__value_access(e.type, yload, store);
+		}
+	if(!xload || !yload)
+		throw std::invalid_argument("the lttb columns must be arithmetic");
+
+	rsize = plan.size();
+	a.assign(rsize, 0);
+	cur.assign(bucket_rows*rsize, 0);
+	next.assign(bucket_rows*rsize, 0);
+	ncur = nnext = 0;
+	first = true;
+}
+
+void lttb_reducer::select(output_binding& b, size_t rows, double cx, double cy)
+{
+	double ax = xload(a.data() + xoff), ay = yload(a.data() + yoff);
+	size_t best = 0;
+	double area = -1;
+	for(size_t i=0; i<rows; i++) {
+		const char* p = cur.data() + i*rsize;
+		double px = xload(p + xoff), py = yload(p + yoff);
+		double s = std::fabs((ax-cx)*(py-ay) - (ax-px)*(cy-ay));
+		if(s > area) { area = s; best = i; }
+	}
+	memcpy(a.data(), cur.data() + best*rsize, rsize);
+	emit(b, row_view { *b.table, b.table->plan(), a.data() });
+}
+
+void lttb_reducer::row(output_binding& b, const row_view& r)
+{
+	if(first) {
+		memcpy(a.data(), r.record, rsize);
+		emit(b, r);
+		first = false;
+		return;
+	}
+	if(ncur < bucket_rows) {
+		memcpy(cur.data() + (ncur++)*rsize, r.record, rsize);
+		return;
+	}
+	memcpy(next.data() + (nnext++)*rsize, r.record, rsize);
+	if(nnext == bucket_rows) {
+		double cx, cy;
+		average(next, nnext, cx, cy);
+		select(b, ncur, cx, cy);
+		std::swap(cur, next);
+		ncur = nnext;
+		nnext = 0;
+	}
+}
+
+void lttb_reducer::average(const std::vector<char>& rows, size_t nrows, double& cx, double& cy) const
+{
+	cx = cy = 0;
+	for(size_t i=0; i<nrows; i++) {
+		cx += xload(rows.data() + i*rsize + xoff);
+		cy += yload(rows.data() + i*rsize + yoff);
+	}
+	cx /= nrows;
+	cy /= nrows;
+}
+
+void lttb_reducer::epilog(output_binding& b)
+{
+	if(first) return;
+	if(nnext) {
+		double cx, cy;
+		average(next, nnext, cx, cy);
+		select(b, ncur, cx, cy);
+		std::swap(cur, next);
+		ncur = nnext;
+		nnext = 0;
+	}
+	// the last row closes the series
+	if(ncur) {
+		const char* last = cur.data() + (ncur-1)*rsize;
+		if(ncur > 1)
+			select(b, ncur-1, xload(last + xoff), yload(last + yoff));
+		emit(b, row_view { *b.table, b.table->plan(), last });
+	}
+	ncur = 0;
+}
+
+
+void output_table::generate_schema(std::ostream& out)
+{
+	using std::endl;
+	// output top-level
+	out << "{" << endl;
+	out << "\t\"name\": \"" << name() << "\"," << endl;
+	out << "\t\"columns\": [";
+
+	// output columns
+	for(size_t i=0; i<size(); i++) {
+		out << "\t\t{" << endl;
+
+		basic_column* col = (*this)[i];
+		out << "\t\t\t\"name\": \"" << col->path_name() << "\"," << endl;
+
+		out << "\t\t\t\"path\": [";
+		std::stack<column_item*> stk;
+		column_item* item = col;
+		while(item!=this) { stk.push(item); item=item->parent(); }
+		while(! stk.empty()) {
 			out << "\"" << stk.top()->name() << "\"";
 			stk.pop();
 			if(!stk.empty())
@@ -539,51 +1584,99 @@ output_file::~output_file()
 	output_binding::unbind_all(tables);
 }
 
+void output_file::output_row(const row_view&)
+{
+	throw std::logic_error("this output file does not support row snapshots");
+}
+
+void output_file::output_rows(const row_view& first, size_t n)
+{
+	for(size_t i=0; i<n; i++)
+		output_row(row_view { first.table, first.plan, first.record + i*first.plan.size() });
+}
 
 
 
-#define RE_FNAME "[a-zA-X0-9 _:\'\\.\\-\\$]+"
-#define RE_PATH "(/?(?:" RE_FNAME "/)*(?:" RE_FNAME "))"
-#define RE_ID   "[a-zA-Z_][a-zA-Z0-9_]*"
-#define RE_TYPE "(" RE_ID  "):"
-#define RE_VAR  RE_ID "=" RE_PATH
-#define RE_VARS RE_VAR "(?:," RE_VAR ")*" 
-#define RE_URL  RE_TYPE RE_PATH "?(?:\\?(" RE_VARS "))?" 
 
-bool parse_url(const string& url, string& type, string& path, varmap& vars)
+// the identifiers of URLs: [a-zA-Z_][a-zA-Z0-9_]*
+static bool __url_id(const char* b, const char* e)
 {
-	using std::regex;
-	using std::smatch;
-	using std::regex_match;
-	using std::sregex_token_iterator;
-	
-	regex re_url(RE_URL);
-	smatch match;
-	
-	if(! regex_match(url, match, re_url))
+	if(b == e || !(isalpha((unsigned char) *b) || *b == '_'))
 		return false;
+	for(b++; b != e; b++)
+		if(!(isalnum((unsigned char) *b) || *b == '_'))
+			return false;
+	return true;
+}
+
+// the paths of URLs: names, separated by `/', with an optional `/' in front
+static bool __url_path(const char* b, const char* e)
+{
+	if(b != e && *b == '/') b++;
+	bool empty = true;
+	for(; b != e; b++) {
+		char c = *b;
+		if(c == '/') {
+			if(empty) return false;
+			empty = true;
+		} else if(isalnum((unsigned char) c) || (c && strchr(" _:'.-$", c)))
+			empty = false;
+		else
+			return false;
+	}
+	return !empty;
+}
+
+bool parse_url(const string& url, string& type, string& path, varmap& vars)
+{
+	const char* begin = url.data();
+	const char* end = begin + url.size();
 
-	type = match[1];
-	path = match[2];
-	string allvars = match[3];
+	// type:path?vars
+	const char* colon = std::find(begin, end, ':');
+	if(colon == end || !__url_id(begin, colon))
+		return false;
+	const char* query = std::find(colon+1, end, '?');
+	if(query != colon+1 && !__url_path(colon+1, query))
+		return false;
 
-	// split variables
-	regex re_var( "(" RE_ID ")=(" RE_PATH ")" );
-	regex re_comma(",");
-	auto s = sregex_token_iterator(allvars.begin(), allvars.end(), re_comma, -1);
-	auto s2 = sregex_token_iterator();
-	for(; s!=s2; ++s) {
-		string var =*s;
-		smatch vmatch;
-		regex_match(var, vmatch, re_var);
-		string vname = vmatch[1];
-		string vvalue = vmatch[2];
-		if(! vname.empty()) vars[vname] = vvalue; 
+	// name=value, separated by commas
+	varmap parsed;
+	if(query != end) {
+		const char* p = query+1;
+		for(;;) {
+			const char* comma = std::find(p, end, ',');
+			const char* eq = std::find(p, comma, '=');
+			if(eq == comma || !__url_id(p, eq) || !__url_path(eq+1, comma))
+				return false;
+			parsed[string(p, eq)] = string(eq+1, comma);
+			if(comma == end) break;
+			p = comma+1;
+		}
 	}
 
+	type.assign(begin, colon);
+	path.assign(colon+1, query);
+	for(auto& v : parsed)
+		vars[v.first] = v.second;
 	return true;
 }
 
+string normalize_url(const string& url)
+{
+	string type, path;
+	varmap vars;
+	if(! parse_url(url, type, path, vars))
+		throw std::runtime_error("Malformed url `"+url+"'");
+	string ret = type + ":" + path;
+	char sep = '?';
+	for(auto& v : vars) {
+		ret += sep + v.first + "=" + v.second;
+		sep = ',';
+	}
+	return ret;
+}
+
 
 
 
@@ -602,6 +1695,29 @@ std::unordered_map<string, text_format> text_format_map {
         { "csvrel", text_format::csvrel}
 };
 
+std::unordered_map<string, hdf5_compression> hdf5_compression_map {
+	{"none", hdf5_compression::none},
+	{"deflate", hdf5_compression::deflate},
+	{"lzf", hdf5_compression::lzf},
+	{"blosc", hdf5_compression::blosc}
+};
+
+std::unordered_map<string, text_compression> text_compression_map {
+	{"none", text_compression::none},
+	{"gzip", text_compression::gzip},
+	{"zstd", text_compression::zstd}
+};
+
+std::unordered_map<string, async_policy> async_policy_map {
+	{"block", async_policy::block},
+	{"drop", async_policy::drop}
+};
+
+std::unordered_map<string, bool> bool_map {
+	{"true", true},
+	{"false", false}
+};
+
 template <typename T>
 T proc_enum_var(const string& var, 
 		const std::map<string, string>& vars, 
@@ -618,6 +1734,170 @@ T proc_enum_var(const string& var,
 	}
 }
 
+size_t proc_size_var(const string& var, 
+		const std::map<string, string>& vars,
+		size_t defval)
+{
+	if(vars.count(var)>0) {
+		const string& val = vars.at(var);
+		size_t pos = 0;
+		size_t ret = 0;
+		try {
+			ret = std::stoul(val, &pos);
+		} catch(std::logic_error&) {
+			pos = 0;
+		}
+		if(pos==0 || pos!=val.size())
+			throw std::runtime_error("Illegal value in URL: "+var+"="+val);
+		return ret;
+	} else {
+		return defval;
+	}
+}
+
+}
+
+
+//
+// The factories of the URL types
+//
+
+static output_file* __open_text_file(const string& path, const varmap& vars)
+{
+	open_mode   mode = proc_enum_var("open_mode", vars, open_mode_map, default_open_mode);
+	text_format format = proc_enum_var("format", vars, text_format_map, default_text_format);
+	text_compression_options z;
+	z.method = proc_enum_var("compress", vars, text_compression_map, z.method);
+	if(vars.count("level")>0)
+		z.level = proc_size_var("level", vars, 0);
+	z.threaded = proc_enum_var("thread", vars, bool_map, z.threaded);
+	return new output_c_file(path, mode, format, z);
+}
+
+static output_file* __open_hdf5_file(const string& path, const varmap& vars)
+{
+	open_mode mode = proc_enum_var("open_mode", vars, open_mode_map, default_open_mode);
+	hdf5_dataset_options opts;
+	opts.chunk_rows = proc_size_var("chunk", vars, opts.chunk_rows);
+	opts.compression = proc_enum_var("compress", vars, hdf5_compression_map, opts.compression);
+	size_t level = proc_size_var("level", vars, opts.level);
+	if(level > 9)
+		throw std::invalid_argument("Illegal value in URL: level="+vars.at("level")+" (must be 0 to 9)");
+	opts.level = level;
+	opts.shuffle = proc_enum_var("shuffle", vars, bool_map, opts.shuffle);
+	opts.chunk_cache = proc_size_var("cache", vars, opts.chunk_cache);
+	size_t buffer = proc_size_var("buffer", vars, 1);
+
+	output_hdf5* f = new output_hdf5(path, mode);
+	f->set_dataset_options(opts);
+	f->set_buffer_rows(buffer);
+	return f;
+}
+
+static output_file* __open_arrow_file(const string& path, const varmap& vars)
+{
+	open_mode mode = proc_enum_var("open_mode", vars, open_mode_map, default_open_mode);
+	size_t batch = proc_size_var("batch", vars, default_arrow_batch_rows);
+	bool dict = proc_enum_var("dict", vars, bool_map, true);
+	if(mode != open_mode::truncate)
+		throw std::invalid_argument("Arrow files can only be opened in truncate mode");
+	return new output_arrow(path, batch, dict);
+}
+
+static output_file* __open_mmap_file(const string& path, const varmap& vars)
+{
+	open_mode mode = proc_enum_var("open_mode", vars, open_mode_map, default_open_mode);
+	return new output_mmap(path, mode, proc_size_var("grow", vars, default_mmap_grow));
+}
+
+static output_file* __open_shm_file(const string& path, const varmap& vars)
+{
+	return new output_shm(path, proc_size_var("rows", vars, default_shm_rows));
+}
+
+static output_file* __open_socket(const string& path, const varmap& vars, bool udp)
+{
+	size_t colon = path.rfind(':');
+	if(colon == string::npos)
+		throw std::invalid_argument("Socket URLs need a port: `"+path+"'");
+	// these mean something else for other types
+	if(vars.count("compress")>0)
+		throw std::invalid_argument("Socket URLs take `zlib', not `compress'");
+	if(vars.count("buffer")>0)
+		throw std::invalid_argument("Socket URLs take `sendbuf', not `buffer'");
+	size_t batch = proc_size_var("batch", vars, default_socket_batch_rows);
+	size_t sendbuf = proc_size_var("sendbuf", vars, default_socket_buffer);
+	async_policy policy = proc_enum_var("backpressure", vars, async_policy_map, async_policy::block);
+	bool zlib = proc_enum_var("zlib", vars, bool_map, false);
+	bool encode = proc_enum_var("encode", vars, bool_map, false);
+	bool reconnect = proc_enum_var("reconnect", vars, bool_map, false);
+
+	output_socket* f = new output_socket(path.substr(0, colon), path.substr(colon+1), udp, batch);
+	f->set_buffer_bytes(sendbuf);
+	f->set_policy(policy);
+	f->set_compression(zlib);
+	f->set_encoding(encode);
+	f->set_reconnect(reconnect);
+	return f;
+}
+
+// the standard streams are never deleted
+static inline bool __owned_file(output_file* f)
+{
+	return f != &output_stdout && f != &output_stderr;
+}
+
+namespace {
+
+/*
+	The factories of URL types, and the files opened by open_shared_file(),
+	by their normalized URLs.
+ */
+struct file_registry
+{
+	struct shared_file {
+		output_file* file;
+		size_t refs;
+	};
+
+	std::recursive_mutex mutex;
+	std::unordered_map<string, output_factory> factories;
+	std::unordered_map<string, shared_file> files;
+	std::unordered_map<output_file*, string> urls;
+
+	file_registry()
+	{
+		factories["file"] = __open_text_file;
+		factories["hdf5"] = __open_hdf5_file;
+		factories["arrow"] = __open_arrow_file;
+		factories["feather"] = __open_arrow_file;
+		factories["mmap"] = __open_mmap_file;
+		factories["shm"] = __open_shm_file;
+		factories["tcp"] = [](const string& p, const varmap& v) { return __open_socket(p, v, false); };
+		factories["udp"] = [](const string& p, const varmap& v) { return __open_socket(p, v, true); };
+		factories["stdout"] = [](const string&, const varmap&) -> output_file* { return &output_stdout; };
+		factories["stderr"] = [](const string&, const varmap&) -> output_file* { return &output_stderr; };
+	}
+
+	// never destroyed, since files may be released at exit
+	static file_registry& get() {
+		static file_registry* registry = new file_registry();
+		return *registry;
+	}
+};
+
+}
+
+void register_output_type(const string& type, const output_factory& factory)
+{
+	if(! __url_id(type.data(), type.data()+type.size()))
+		throw std::invalid_argument("Bad URL type `"+type+"'");
+	file_registry& r = file_registry::get();
+	std::lock_guard<std::recursive_mutex> lock(r.mutex);
+	if(factory)
+		r.factories[type] = factory;
+	else
+		r.factories.erase(type);
 }
 
 
@@ -630,18 +1910,68 @@ output_file* open_file(const string& url)
     if(! parse_url(url, type, path, vars))
 		throw std::runtime_error("Malformed url `"+url+"'");
 
-	open_mode   mode = proc_enum_var("open_mode", vars, open_mode_map, default_open_mode);
-	text_format format = proc_enum_var("format", vars, text_format_map, default_text_format);
+	bool async = proc_enum_var("async", vars, bool_map, false);
+	size_t queue = proc_size_var("queue", vars, default_async_queue);
+	async_policy policy = proc_enum_var("policy", vars, async_policy_map, async_policy::block);
+
+	output_factory factory;
+	{
+		file_registry& r = file_registry::get();
+		std::lock_guard<std::recursive_mutex> lock(r.mutex);
+		auto found = r.factories.find(type);
+		if(found == r.factories.end())
+			throw std::runtime_error("Unknown output_file type in URL: `"+type+"'");
+		factory = found->second;
+	}
+
+	output_file* f = factory(path, vars);
+	if(async) {
+		// delete the file if it cannot be wrapped
+		std::unique_ptr<output_file> owned(__owned_file(f) ? f : nullptr);
+		f = new output_async(f, owned != nullptr, queue, policy);
+		owned.release();
+	}
+	return f;
+}
+
+output_file* open_shared_file(const string& url)
+{
+	string key = normalize_url(url);
+	file_registry& r = file_registry::get();
+	std::lock_guard<std::recursive_mutex> lock(r.mutex);
+	auto found = r.files.find(key);
+	if(found != r.files.end()) {
+		found->second.refs++;
+		return found->second.file;
+	}
+
+	output_file* f = open_file(key);
+	if(__owned_file(f)) {
+		r.files[key] = { f, 1 };
+		r.urls[f] = key;
+	}
+	return f;
+}
 
-    if(type == "file")
-        return new output_c_file(path, mode, format);
-    else if (type == "hdf5")
-        return new output_hdf5(path, mode);
-	else if (type == "stdout")
-        return &output_stdout;
-    else if (type == "stderr")
-        return &output_stderr;
-    throw std::runtime_error("Unknown output_file type in URL: `"+type+"'");
+bool close_shared_file(output_file* f)
+{
+	if(! __owned_file(f)) return false;
+	output_file* closed = nullptr;
+	{
+		file_registry& r = file_registry::get();
+		std::lock_guard<std::recursive_mutex> lock(r.mutex);
+		auto url = r.urls.find(f);
+		if(url == r.urls.end())
+			throw std::invalid_argument("The file was not opened by open_shared_file()");
+		auto found = r.files.find(url->second);
+		if(--found->second.refs > 0)
+			return false;
+		r.files.erase(found);
+		r.urls.erase(url);
+		closed = f;
+	}
+	delete closed;
+	return true;
 }
 
 
@@ -666,19 +1996,349 @@ formatter::formatter(output_c_file* of, output_table& tab)
 formatter::~formatter()
 { }
 
+inline void formatter::count(size_t bytes)
+{
+	if(output_stats::enabled())
+		ofile->counters().bytes.add(bytes);
+}
 
-struct csvtab_formatter : formatter
+
+
+//
+// Helper namespace for encoding rows to text without fprintf
+//
+namespace {
+
+/*
+	A text cell of a row. Encoders take a pointer to the binary image 
+	of the value (for strings, a zero-terminated array).
+ */
+struct text_cell;
+typedef void (*encode_function)(string& out, const void* val, const text_cell& c);
+
+struct text_cell
 {
-	using formatter::formatter;
-	void prolog() override;
-	void row() override;
-	void epilog() override;
+	row_plan::entry entry;		// copy of the column's plan
+	encode_function encode;		// the fast encoder, or null
+	encode_function print;		// the printf-based encoder, or null
+	const string* str;			// the value of string columns, or null
+	std::chars_format fmt;		// for floating-point formats
+	int precision;				// for floating-point formats
 };
 
-void csvtab_formatter::prolog() 
+template <typename T>
+inline T __value(const void* val)
 {
-	/*
-		Logic for prolog:
+	T ret;
+	memcpy(&ret, val, sizeof(T));
+	return ret;
+}
+
+// Formats %d, %u and their length modifiers: the value is converted
+// to the type implied by the format, like printf does
+template <typename Src, typename Dst>
+void __encode_int(string& out, const void* val, const text_cell& c)
+{
+	char buf[32];
+	Dst v = (Dst) __value<Src>(val);
+	auto res = std::to_chars(buf, buf+sizeof(buf), v);
+	out.append(buf, res.ptr);
+}
+
+inline void __sprintf(string& out, const char* fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+
+// Append printf output to a string
+inline void __sprintf(string& out, const char* fmt, ...)
+{
+	char buf[128];
+	va_list args, args2;
+	va_start(args, fmt);
+	va_copy(args2, args);
+	int len = vsnprintf(buf, sizeof(buf), fmt, args);
+	if(len < (int)sizeof(buf))
+		out.append(buf, std::max(len, 0));
+	else {
+		size_t pos = out.size();
+		out.resize(pos+len+1);
+		vsnprintf(&out[pos], len+1, fmt, args2);
+		out.resize(pos+len);
+	}
+	va_end(args2);
+	va_end(args);
+}
+
+// Formats %f, %e, %g with an optional precision
+template <typename Src, typename Dst>
+void __encode_float(string& out, const void* val, const text_cell& c)
+{
+	char buf[384];
+	Dst v = __value<Src>(val);
+	auto res = std::to_chars(buf, buf+sizeof(buf), v, c.fmt, c.precision);
+	if(res.ec == std::errc())
+		out.append(buf, res.ptr);
+	else
+		// a very long number, let printf handle it
+		c.print(out, val, c);
+}
+
+// Format %s
+void __encode_text(string& out, const void* val, const text_cell& c)
+{
+	const char* v = (const char*) val;
+	out.append(v, strnlen(v, c.entry.size));
+}
+
+// Any format, via printf
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+template <typename T>
+void __print_value(string& out, const void* val, const text_cell& c)
+{
+	__sprintf(out, c.entry.column->format(), __value<T>(val));
+}
+
+void __print_text(string& out, const void* val, const text_cell& c)
+{
+	__sprintf(out, c.entry.column->format(), (const char*) val);
+}
+#pragma GCC diagnostic pop
+
+template <typename Dst>
+encode_function __int_encoder(type_index t)
+{
+	if(t==typeid(bool)) return __encode_int<bool, Dst>;
+	if(t==typeid(char)) return __encode_int<char, Dst>;
+	if(t==typeid(signed char)) return __encode_int<signed char, Dst>;
+	if(t==typeid(unsigned char)) return __encode_int<unsigned char, Dst>;
+	if(t==typeid(short)) return __encode_int<short, Dst>;
+	if(t==typeid(unsigned short)) return __encode_int<unsigned short, Dst>;
+	if(t==typeid(int)) return __encode_int<int, Dst>;
+	if(t==typeid(unsigned int)) return __encode_int<unsigned int, Dst>;
+	if(t==typeid(long)) return __encode_int<long, Dst>;
+	if(t==typeid(unsigned long)) return __encode_int<unsigned long, Dst>;
+	if(t==typeid(long long)) return __encode_int<long long, Dst>;
+	if(t==typeid(unsigned long long)) return __encode_int<unsigned long long, Dst>;
+	return nullptr;
+}
+
+template <typename Signed, typename Unsigned>
+encode_function __int_encoder(type_index t, char conv)
+{
+	return (conv=='u') ? __int_encoder<Unsigned>(t) : __int_encoder<Signed>(t);
+}
+
+encode_function __printer(type_index t)
+{
+	if(t==typeid(bool)) return __print_value<bool>;
+	if(t==typeid(char)) return __print_value<char>;
+	if(t==typeid(signed char)) return __print_value<signed char>;
+	if(t==typeid(unsigned char)) return __print_value<unsigned char>;
+	if(t==typeid(short)) return __print_value<short>;
+	if(t==typeid(unsigned short)) return __print_value<unsigned short>;
+	if(t==typeid(int)) return __print_value<int>;
+	if(t==typeid(unsigned int)) return __print_value<unsigned int>;
+	if(t==typeid(long)) return __print_value<long>;
+	if(t==typeid(unsigned long)) return __print_value<unsigned long>;
+	if(t==typeid(long long)) return __print_value<long long>;
+	if(t==typeid(unsigned long long)) return __print_value<unsigned long long>;
+	if(t==typeid(float)) return __print_value<float>;
+	if(t==typeid(double)) return __print_value<double>;
+	if(t==typeid(long double)) return __print_value<long double>;
+	if(t==typeid(string)) return __print_text;
+	return nullptr;
+}
+
+/*
+	Select an encoder for the given format. Only formats consisting of
+	a single conversion with no flags or width are recognized.
+ */
+void __select_encoder(text_cell& c)
+{
+	c.encode = nullptr;
+	c.print = __printer(c.entry.type);
+	c.str = nullptr;
+	c.fmt = std::chars_format::general;
+	c.precision = 6;
+
+	const char* f = c.entry.column->format();
+	type_index t = c.entry.type;
+
+	if(t == typeid(string)) {
+		if(auto col = dynamic_cast<column<string>*>(c.entry.column))
+			c.str = & static_cast<const column<string>*>(col)->value();
+		else if(auto col = dynamic_cast<column_ref<string>*>(c.entry.column))
+			c.str = & col->value();
+	}
+
+	if(*f++ != '%') return;
+
+	// optional precision
+	bool has_prec = false;
+	if(*f == '.') {
+		has_prec = true;
+		f++;
+		int prec = 0;
+		while(*f>='0' && *f<='9' && prec < 1000)
+			prec = 10*prec + (*f++ - '0');
+		c.precision = prec;
+	}
+
+	// optional length modifier
+	string len;
+	while(*f && strchr("hlLzjt", *f)) len += *f++;
+
+	// the conversion must end the format
+	char conv = *f++;
+	if(conv=='\0' || *f != '\0') return;
+
+	if(conv=='s') {
+		if(!has_prec && len.empty() && t == typeid(string)) 
+			c.encode = __encode_text;
+	} 
+	else if(conv=='d' || conv=='i' || conv=='u') {
+		if(has_prec) return;
+		if(len=="") c.encode = __int_encoder<int, unsigned int>(t, conv);
+		else if(len=="hh") c.encode = __int_encoder<signed char, unsigned char>(t, conv);
+		else if(len=="h") c.encode = __int_encoder<short, unsigned short>(t, conv);
+		else if(len=="l") c.encode = __int_encoder<long, unsigned long>(t, conv);
+		else if(len=="ll") c.encode = __int_encoder<long long, unsigned long long>(t, conv);
+		else if(len=="z") c.encode = __int_encoder<std::make_signed_t<size_t>, size_t>(t, conv);
+		else if(len=="j") c.encode = __int_encoder<intmax_t, uintmax_t>(t, conv);
+		else if(len=="t") c.encode = __int_encoder<ptrdiff_t, std::make_unsigned_t<ptrdiff_t>>(t, conv);
+	}
+	else if(conv=='f' || conv=='e' || conv=='g') {
+		c.fmt = (conv=='f') ? std::chars_format::fixed :
+				(conv=='e') ? std::chars_format::scientific : std::chars_format::general;
+		if(len=="" || len=="l") {
+			if(t==typeid(double)) c.encode = __encode_float<double, double>;
+			else if(t==typeid(float)) c.encode = __encode_float<float, double>;
+		} else if(len=="L" && t==typeid(long double)) 
+			c.encode = __encode_float<long double, long double>;
+	}
+}
+
+/*
+	Writes rows of a table as comma-separated text, optionally 
+	prefixed, with one fwrite per row. Rows are taken either from the
+	current column values, or from a row snapshot.
+ */
+class row_encoder
+{
+	std::vector<text_cell> cells;
+	string buffer;
+public:
+	void compile(output_table& table)
+	{
+		cells.clear();
+		for(auto& e : table.plan()) {
+			text_cell c { e, nullptr, nullptr, nullptr, std::chars_format::general, 6 };
+			__select_encoder(c);
+			cells.push_back(c);
+		}
+	}
+
+	size_t row(FILE* f, const string& prefix)
+	{
+		size_t written = 0;
+		buffer.assign(prefix);
+		for(size_t i=0; i<cells.size(); i++) {
+			const text_cell& c = cells[i];
+			if(i>0 || !prefix.empty()) buffer += ',';
+
+			if(c.str) {
+				// string columns are taken whole
+				if(c.encode) buffer.append(*c.str);
+				else c.print(buffer, c.str->c_str(), c);
+				continue;
+			}
+
+			// get the binary value of arithmetic columns
+			alignas(16) char tmp[16];
+			const void* val = c.entry.src;
+			if(!val && c.print && c.entry.size <= sizeof(tmp)) {
+				c.entry.copy_to(tmp);
+				val = tmp;
+			}
+
+			if(val && c.encode)
+				c.encode(buffer, val, c);
+			else if(val && c.print)
+				c.print(buffer, val, c);
+			else {
+				// unknown column type, let it print itself
+				written += fwrite(buffer.data(), 1, buffer.size(), f);
+				buffer.clear();
+				c.entry.column->emit(f);
+			}
+		}
+		buffer += '\n';
+		return written + fwrite(buffer.data(), 1, buffer.size(), f);
+	}
+
+	// append the line of a record to the buffer
+	void encode(const string& prefix, const char* record)
+	{
+		buffer.append(prefix);
+		for(size_t i=0; i<cells.size(); i++) {
+			const text_cell& c = cells[i];
+			if(i>0 || !prefix.empty()) buffer += ',';
+			const char* val = record + c.entry.offset;
+			if(c.encode)
+				c.encode(buffer, val, c);
+			else if(c.print)
+				c.print(buffer, val, c);
+			else
+				throw std::logic_error("cannot format column `"
+					+c.entry.column->name()+"' from a row snapshot");
+		}
+		buffer += '\n';
+	}
+
+	size_t row(FILE* f, const string& prefix, const char* record)
+	{
+		buffer.clear();
+		encode(prefix, record);
+		return fwrite(buffer.data(), 1, buffer.size(), f);
+	}
+
+	// format consecutive records, writing in large blocks
+	size_t rows(FILE* f, const string& prefix, const char* records, size_t stride, size_t n)
+	{
+		size_t written = 0;
+		buffer.clear();
+		for(size_t i=0; i<n; i++) {
+			encode(prefix, records + i*stride);
+			if(buffer.size() >= text_block_bytes) {
+				written += fwrite(buffer.data(), 1, buffer.size(), f);
+				buffer.clear();
+			}
+		}
+		return written + fwrite(buffer.data(), 1, buffer.size(), f);
+	}
+
+	static constexpr size_t text_block_bytes = 1<<16;
+};
+
+}
+
+struct csvtab_formatter : formatter
+{
+	using formatter::formatter;
+	void prolog() override;
+	void row() override;
+	void row(const row_view& r) override;
+	void rows(const row_view& first, size_t n) override;
+	void epilog() override;
+
+	row_encoder encoder;
+};
+
+void csvtab_formatter::prolog() 
+{
+	/*
+		Logic for prolog:
 		When the file is seekable, check if we are at the beginning
 		before we output a header.
 	 */
@@ -690,15 +2350,22 @@ void csvtab_formatter::prolog()
 		}
 		fputs("\n", ofile->file());
 	} 
+	encoder.compile(table);
 }
 
 void csvtab_formatter::row() 
 {
-	for(size_t col=0;col < table.size(); col++) {
-		if(col) fputs(",", ofile->file());
-		table[col]->emit(ofile->file());
-	}
-	fputs("\n", ofile->file());	
+	count(encoder.row(ofile->file(), string()));
+}
+
+void csvtab_formatter::row(const row_view& r) 
+{
+	count(encoder.row(ofile->file(), string(), r.record));
+}
+
+void csvtab_formatter::rows(const row_view& first, size_t n) 
+{
+	count(encoder.rows(ofile->file(), string(), first.record, first.plan.size(), n));
 }
 
 void csvtab_formatter::epilog() 
@@ -709,18 +2376,25 @@ struct csvrel_formatter : formatter
 {
 	using formatter::formatter;
 
-	void prolog() override { }
+	void prolog() override { 
+		encoder.compile(table);
+	}
 
 	void row() override {
-		fputs(table.name().c_str(), ofile->file());
-		for(size_t col=0;col < table.size(); col++) {
-			fputs(",", ofile->file());
-			table[col]->emit(ofile->file());
-		}
-		fputs("\n", ofile->file());	
+		count(encoder.row(ofile->file(), table.name()));
+	}
+
+	void row(const row_view& r) override {
+		count(encoder.row(ofile->file(), table.name(), r.record));
+	}
+
+	void rows(const row_view& first, size_t n) override {
+		count(encoder.rows(ofile->file(), table.name(), first.record, first.plan.size(), n));
 	}
 
 	void epilog() override { }
+
+	row_encoder encoder;
 };
 
 
@@ -738,148 +2412,3076 @@ formatter* formatter::create(output_c_file* f, output_table& t, text_format fmt)
 	}
 }
 
-void formatter::destroy(formatter* fmt)
+void formatter::destroy(formatter* fmt)
+{
+	delete fmt;
+}
+
+void* formatter::operator new(size_t size)
+{
+	return __pool_allocate(size);
+}
+
+void formatter::operator delete(void* p, size_t size)
+{
+	__pool_release(p, size);
+}
+
+void formatter::rows(const row_view& first, size_t n)
+{
+	for(size_t i=0; i<n; i++)
+		row(row_view { first.table, first.plan, first.record + i*first.plan.size() });
+}
+
+//-------------------------------
+//
+// Compressed text streams
+//
+//-------------------------------
+
+namespace {
+
+// the compression of a stream of blocks
+struct text_codec
+{
+	enum mode_type { more, sync, end };
+	virtual ~text_codec() { }
+	virtual void process(const char* in, size_t n, mode_type mode, std::vector<char>& out)=0;
+};
+
+struct gzip_codec : text_codec
+{
+	z_stream z;
+
+	gzip_codec(int level)
+	{
+		memset(&z, 0, sizeof(z));
+		// a gzip header, with 15 bits of window
+		if(deflateInit2(&z, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED,
+				15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			throw std::invalid_argument("Bad gzip compression level");
+	}
+
+	~gzip_codec() { deflateEnd(&z); }
+
+	void process(const char* in, size_t n, mode_type mode, std::vector<char>& out) override
+	{
+		int flush = (mode==more) ? Z_NO_FLUSH : (mode==sync) ? Z_SYNC_FLUSH : Z_FINISH;
+		z.next_in = (Bytef*) in;
+		z.avail_in = n;
+		for(;;) {
+			size_t old = out.size();
+			out.resize(old + std::max(deflateBound(&z, z.avail_in), (uLong)(1<<12)));
+			z.next_out = (Bytef*) out.data() + old;
+			z.avail_out = out.size() - old;
+			int ret = deflate(&z, flush);
+			out.resize(out.size() - z.avail_out);
+			if(ret == Z_STREAM_ERROR)
+				throw std::runtime_error("gzip compression error");
+			if(mode == end ? ret == Z_STREAM_END : (z.avail_in == 0 && z.avail_out != 0))
+				break;
+		}
+	}
+};
+
+#ifdef TABLES_HAVE_ZSTD
+struct zstd_codec : text_codec
+{
+	ZSTD_CCtx* ctx;
+
+	zstd_codec(int level)
+	: ctx(ZSTD_createCCtx())
+	{
+		if(ZSTD_isError(ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level < 0 ? 3 : level))) {
+			ZSTD_freeCCtx(ctx);
+			throw std::invalid_argument("Bad zstd compression level");
+		}
+	}
+
+	~zstd_codec() { ZSTD_freeCCtx(ctx); }
+
+	void process(const char* in, size_t n, mode_type mode, std::vector<char>& out) override
+	{
+		ZSTD_EndDirective op = (mode==more) ? ZSTD_e_continue : (mode==sync) ? ZSTD_e_flush : ZSTD_e_end;
+		ZSTD_inBuffer src { in, n, 0 };
+		for(;;) {
+			size_t old = out.size();
+			out.resize(old + ZSTD_CStreamOutSize());
+			ZSTD_outBuffer dst { out.data() + old, out.size() - old, 0 };
+			size_t left = ZSTD_compressStream2(ctx, &dst, &src, op);
+			out.resize(old + dst.pos);
+			if(ZSTD_isError(left))
+				throw std::runtime_error(string("zstd compression error: ")+ZSTD_getErrorName(left));
+			if(mode == more ? src.pos == src.size : left == 0)
+				break;
+		}
+	}
+};
+#endif
+
+// check that a compression is available, before creating any file
+void check_text_compression(const text_compression_options& z)
+{
+	switch(z.method) {
+	case text_compression::gzip:
+		break;
+	case text_compression::zstd:
+#ifndef TABLES_HAVE_ZSTD
+		throw std::invalid_argument("zstd compression is not available");
+#endif
+		break;
+	default:
+		throw std::invalid_argument("Bad text compression");
+	}
+}
+
+}
+
+/*
+	The state of a compressed stream. The stream is a FILE via 
+	fopencookie(), whose writes are collected in blocks; the blocks
+	are compressed, on a worker thread or not, and written to the 
+	target stream.
+ */
+struct text_compressor
+{
+	struct job {
+		std::vector<char> data;
+		text_codec::mode_type mode;
+	};
+
+	FILE* target;
+	std::unique_ptr<text_codec> codec;
+	bool threaded;
+	uint64_t position;			// the position in the text, for ftell()
+	std::vector<char> block;	// the text not yet compressed
+	std::vector<char> out;		// the compressed data
+
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<job> jobs;
+	size_t submitted, done;
+	bool failed;
+
+	static constexpr size_t block_bytes = 1<<18;
+	static constexpr size_t max_jobs = 4;
+
+	text_compressor(FILE* _target, const text_compression_options& z)
+	: target(_target), threaded(z.threaded), position(0), submitted(0), done(0), failed(false)
+	{
+		check_text_compression(z);
+#ifdef TABLES_HAVE_ZSTD
+		if(z.method == text_compression::zstd)
+			codec.reset(new zstd_codec(z.level));
+		else
+#endif
+			codec.reset(new gzip_codec(z.level));
+		// appending: the text is not at the start of the file
+		long pos = ftell(target);
+		position = (pos > 0) ? pos : 0;
+		block.reserve(block_bytes);
+		if(threaded)
+			worker = std::thread([this]() { run(); });
+	}
+
+	// compress and write a block
+	bool compress(const std::vector<char>& data, text_codec::mode_type mode)
+	{
+		out.clear();
+		try {
+			codec->process(data.data(), data.size(), mode, out);
+		} catch(std::exception&) {
+			return false;
+		}
+		if(fwrite(out.data(), 1, out.size(), target) != out.size())
+			return false;
+		return mode == text_codec::more || fflush(target) == 0;
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		for(;;) {
+			cv.wait(lock, [&]() { return !jobs.empty(); });
+			job j = std::move(jobs.front());
+			jobs.pop_front();
+			cv.notify_all();
+			lock.unlock();
+			bool ok = compress(j.data, j.mode);
+			lock.lock();
+			failed |= !ok;
+			done++;
+			cv.notify_all();
+			if(j.mode == text_codec::end)
+				return;
+		}
+	}
+
+	// hand the current block over, and return false on errors
+	bool submit(text_codec::mode_type mode)
+	{
+		if(! threaded) {
+			failed |= !compress(block, mode);
+			block.clear();
+			return !failed;
+		}
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&]() { return jobs.size() < max_jobs; });
+		jobs.push_back(job { std::move(block), mode });
+		size_t ticket = ++submitted;
+		cv.notify_all();
+		block = std::vector<char>();
+		block.reserve(block_bytes);
+		// flushes wait for the worker
+		if(mode != text_codec::more)
+			cv.wait(lock, [&]() { return done >= ticket; });
+		return !failed;
+	}
+
+	ssize_t write(const char* buf, size_t size)
+	{
+		block.insert(block.end(), buf, buf+size);
+		position += size;
+		if(block.size() >= block_bytes && !submit(text_codec::more))
+			return -1;
+		return size;
+	}
+
+	bool finish()
+	{
+		bool ok = submit(text_codec::end);
+		if(worker.joinable()) worker.join();
+		return fclose(target) == 0 && ok;
+	}
+
+	static ssize_t cookie_write(void* c, const char* buf, size_t size)
+	{
+		return ((text_compressor*) c)->write(buf, size);
+	}
+
+	static int cookie_seek(void* c, off64_t* pos, int whence)
+	{
+		// only ftell() is supported
+		if(whence != SEEK_CUR || *pos != 0)
+			return -1;
+		*pos = ((text_compressor*) c)->position;
+		return 0;
+	}
+
+	static int cookie_close(void* c)
+	{
+		text_compressor* z = (text_compressor*) c;
+		bool ok = z->finish();
+		delete z;
+		return ok ? 0 : EOF;
+	}
+};
+
+void output_c_file::open_compressed(FILE* target, const text_compression_options& z)
+{
+	text_compressor* zs;
+	try {
+		zs = new text_compressor(target, z);
+	} catch(...) {
+		fclose(target);
+		throw;
+	}
+	cookie_io_functions_t io { nullptr, text_compressor::cookie_write, 
+		text_compressor::cookie_seek, text_compressor::cookie_close };
+	FILE* f = fopencookie(zs, "w", io);
+	if(! f) {
+		delete zs;
+		fclose(target);
+		throw std::runtime_error("I/O error opening compressed stream");
+	}
+	setvbuf(f, nullptr, _IOFBF, 1<<16);
+	stream = f;
+	owner = true;
+	zsink = zs;
+}
+
+
+//-------------------------------
+//
+// A C-style file
+//
+//-------------------------------
+
+void output_c_file::open(const string& fpath, open_mode mode)
+{
+	if(stream) 
+		throw std::runtime_error("output file already open");
+	stream = fopen(fpath.c_str(), (mode==open_mode::append?"a":"w"));
+	if(!stream) 
+		throw std::runtime_error("I/O error opening file");
+	filepath = fpath;
+	owner = true;
+}
+
+void output_c_file::open(const string& fpath, open_mode mode, const text_compression_options& z)
+{
+	if(z.method == text_compression::none) {
+		open(fpath, mode);
+		return;
+	}
+	if(stream) 
+		throw std::runtime_error("output file already open");
+	check_text_compression(z);
+	FILE* target = fopen(fpath.c_str(), (mode==open_mode::append?"a":"w"));
+	if(!target) 
+		throw std::runtime_error("I/O error opening file");
+	open_compressed(target, z);
+	filepath = fpath;
+}
+
+void output_c_file::open(FILE* _file, bool _owner)
+{
+	if(stream) 
+		throw std::runtime_error("output file already open");
+	stream = _file;
+	owner = _owner;
+}
+
+void output_c_file::close()
+{
+	// handle the stream
+	if((!stream)) return;
+	if(owner) {
+		// the stream is released even if fclose() fails
+		FILE* f = stream;
+		stream = nullptr;
+		zsink = nullptr;	// deleted by fclose()
+		owner = false;
+		filepath = string();
+		if(fclose(f)!=0)
+			throw std::runtime_error("I/O error closing file");		
+		return;
+	}
+	flush();
+	stream = nullptr;
+	zsink = nullptr;
+	filepath = string();
+}
+
+void output_c_file::flush()
+{
+	stat_timer timer(_counters.flushes, _counters.flush_ns);
+	if(!stream)
+		throw std::runtime_error("I/O error flushing closed file");
+	if(fflush(stream)!=0)
+		throw std::runtime_error("I/O error flushing file");
+	if(zsink && !zsink->submit(text_codec::sync))
+		throw std::runtime_error("I/O error flushing compressed file");
+}
+
+
+output_c_file::output_c_file(FILE* _stream, bool _owner, text_format f)
+: stream(_stream), owner(_owner), fmt(f), zsink(nullptr) { }
+
+
+output_c_file::output_c_file(const string& _fpath, open_mode mode, text_format f)
+: output_c_file(f)
+{
+	open(_fpath, mode);
+}
+
+output_c_file::output_c_file(const string& _fpath, open_mode mode, text_format f,
+	const text_compression_options& z)
+: output_c_file(f)
+{
+	open(_fpath, mode, z);
+}
+
+
+output_c_file::~output_c_file()
+{
+	close();
+	// remove any open formatters
+	for(auto&& f : fmtr)
+		formatter::destroy(f.second);
+}
+
+
+void output_c_file::output_prolog(output_table& table)
+{
+	// Create formatter for table
+	if(fmtr.count(&table)>0) return;
+	auto form = fmtr[&table] = formatter::create(this, table, fmt);
+	form->prolog();
+}
+
+void output_c_file::output_row(output_table& table)
+{
+	fmtr.at(&table)->row();
+}
+
+void output_c_file::output_row(const row_view& r)
+{
+	fmtr.at(&r.table)->row(r);
+}
+
+void output_c_file::output_rows(const row_view& first, size_t n)
+{
+	fmtr.at(&first.table)->rows(first, n);
+}
+
+void output_c_file::output_epilog(output_table& table)
+{ 
+	auto form = fmtr.at(&table);
+	form->epilog();
+
+	fmtr.erase(&table);
+	formatter::destroy(form);
+}
+
+
+
+
+output_c_file output_stdout(stdout, false);
+output_c_file output_stderr(stderr, false);
+
+
+//-------------------------------------
+//
+// A memory file 
+//
+//-------------------------------------
+
+
+output_mem_file::output_mem_file(text_format fmt)
+	: output_c_file(fmt), state(0)
+{
+	state = new memstate();
+	state->buffer = nullptr;
+	state->len = 0;
+	FILE* f = open_memstream(&state->buffer, &state->len);
+	if(!f) {
+		delete state;
+		throw std::runtime_error("I/O error opening memory stream");
+	}
+	open(f, true);
+}
+
+output_mem_file::output_mem_file(text_format fmt, const text_compression_options& z)
+	: output_c_file(fmt), state(0)
+{
+	if(z.method != text_compression::none)
+		check_text_compression(z);
+	state = new memstate();
+	state->buffer = nullptr;
+	state->len = 0;
+	FILE* f = open_memstream(&state->buffer, &state->len);
+	if(!f) {
+		delete state;
+		throw std::runtime_error("I/O error opening memory stream");
+	}
+	if(z.method == text_compression::none) {
+		open(f, true);
+		return;
+	}
+	try {
+		open_compressed(f, z);
+	} catch(...) {
+		// the memory stream was closed by open_compressed()
+		free(state->buffer);
+		delete state;
+		throw;
+	}
+}
+
+output_mem_file::~output_mem_file()
+{
+	if(stream != nullptr) 
+		close();
+	if(state) {
+		free(state->buffer);
+		delete state;
+	}
+
+}
+
+const char* output_mem_file::contents()
+{
+	if(stream) {
+		fflush(stream);
+		if(zsink) 
+			zsink->submit(text_codec::sync);
+	}
+	return state->buffer;
+}
+
+size_t output_mem_file::size()
+{
+	contents();
+	return state->len;
+}
+
+string output_mem_file::str()
+{
+	const char* data = contents();
+	return string(data, state->len);
+}
+
+
+
+//-------------------------------------
+//
+// Asynchronous output
+//
+//-------------------------------------
+
+output_async::output_async(output_file* f, bool _owner, size_t queue, async_policy p)
+: target(f), owner(_owner), policy(p), 
+	ring(std::max(__aligned(queue, slot_align), 2*slot_align)),
+	head(0), tail(0), waiting(false), blocked(0), stop(false), failed(false), ndropped(0)
+{
+	static_assert(sizeof(slot) <= slot_align, "slot_align is too small");
+	// the caller's thread may make other HDF5 calls meanwhile
+	hbool_t safe = false;
+	if(dynamic_cast<output_hdf5*>(f) && (H5is_library_threadsafe(&safe) < 0 || !safe))
+		throw std::invalid_argument("HDF5 files cannot be written asynchronously,"
+			" the HDF5 library is not thread-safe");
+	worker = std::thread(&output_async::run, this);
+}
+
+output_async::~output_async()
+{
+	drain();
+	stop = true;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		cv.notify_one();
+	}
+	worker.join();
+	if(owner)
+		delete target;
+}
+
+size_t output_async::slot_size(const row_plan& plan) const
+{
+	return __aligned(sizeof(slot) + plan.size(), slot_align);
+}
+
+void output_async::run()
+{
+	size_t cap = ring.size();
+	for(;;) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if(t == head.load(std::memory_order_acquire)) {
+			// the queue is empty, wait for more
+			if(stop) return;
+			std::unique_lock<std::mutex> lock(mtx);
+			waiting = true;
+			cv.wait(lock, [&]() { return head.load()!=t || stop; });
+			waiting = false;
+			continue;
+		}
+
+		slot* sl = (slot*) (ring.data() + t % cap);
+		if(sl->table && !failed.load(std::memory_order_relaxed)) {
+			try {
+				target->output_row(row_view { *sl->table, *sl->plan, (const char*)(sl+1) });
+			} catch(...) {
+				std::lock_guard<std::mutex> lock(mtx);
+				error = std::current_exception();
+				failed = true;
+			}
+		}
+		tail.store(t + sl->size);
+		// wake the producer if needed
+		size_t b = blocked;
+		if(b && t + sl->size >= b) {
+			std::lock_guard<std::mutex> lock(mtx);
+			room.notify_one();
+		}
+	}
+}
+
+// block the producer until the consumer reaches position t
+void output_async::wait_for_tail(size_t t)
+{
+	if(tail.load(std::memory_order_acquire) >= t) return;
+	std::unique_lock<std::mutex> lock(mtx);
+	blocked = t;
+	room.wait(lock, [&]() { return tail.load() >= t; });
+	blocked = 0;
+}
+
+void output_async::drain()
+{
+	wait_for_tail(head.load(std::memory_order_relaxed));
+}
+
+void output_async::check_error()
+{
+	if(! failed.load(std::memory_order_relaxed)) return;
+	std::exception_ptr e;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		std::swap(e, error);
+		failed = false;
+	}
+	std::rethrow_exception(e);
+}
+
+void output_async::flush()
+{
+	stat_timer timer(_counters.flushes, _counters.flush_ns);
+	drain();
+	check_error();
+	target->flush();
+}
+
+void output_async::close()
+{
+	drain();
+	target->close();
+	check_error();
+}
+
+output_stats output_async::stats() const
+{
+	output_stats s = _counters.snapshot();
+	s.queued = queued();
+	s.dropped = dropped();
+	return s;
+}
+
+void output_async::output_prolog(output_table& table)
+{
+	if(2*slot_size(table.plan()) > ring.size())
+		throw std::length_error("the rows of table `"+table.name()
+			+"' do not fit in the async queue");
+	drain();
+	check_error();
+	target->output_prolog(table);
+}
+
+void output_async::output_row(output_table& table)
+{
+	enqueue(table, nullptr);
+}
+
+void output_async::output_row(const row_view& r)
+{
+	enqueue(r.table, r.record);
+}
+
+// queue a row, packing it unless a record is given
+void output_async::enqueue(output_table& table, const char* record)
+{
+	check_error();
+
+	const row_plan& plan = table.plan();
+	size_t cap = ring.size();
+	size_t need = slot_size(plan);
+
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t idx = h % cap;
+	// a slot is contiguous, if needed skip to the start of the ring
+	size_t skip = (cap - idx < need) ? cap - idx : 0;
+
+	if(cap - (h - tail.load(std::memory_order_acquire)) < skip + need) {
+		if(policy == async_policy::drop) {
+			ndropped++;
+			return;
+		}
+		wait_for_tail(h + skip + need - cap);
+	}
+
+	if(skip) {
+		slot* sl = (slot*) (ring.data() + idx);
+		sl->table = nullptr;
+		sl->size = skip;
+		idx = 0;
+	}
+	slot* sl = (slot*) (ring.data() + idx);
+	sl->table = &table;
+	sl->plan = &plan;
+	sl->size = need;
+	if(record)
+		memcpy(sl+1, record, plan.size());
+	else
+		plan.pack(sl+1);
+
+	// publish and wake the consumer if needed
+	head.store(h + skip + need);
+	if(waiting) {
+		std::lock_guard<std::mutex> lock(mtx);
+		cv.notify_one();
+	}
+}
+
+void output_async::output_epilog(output_table& table)
+{
+	drain();
+	target->output_epilog(table);
+	check_error();
+}
+
+
+//-------------------------------------
+//
+// Concurrent emission
+//
+//-------------------------------------
+
+// emitter ids, to tell apart emitters reusing the same address
+static std::atomic<size_t> __emitter_ids(0);
+
+typedef bool (*__record_less)(const char*, const char*);
+
+template <typename T>
+static bool __less_at(const char* a, const char* b)
+{
+	T x, y;
+	memcpy(&x, a, sizeof(T));
+	memcpy(&y, b, sizeof(T));
+	return x < y;
+}
+
+static __record_less __time_less(type_index t)
+{
+	if(t==typeid(double)) return __less_at<double>;
+	if(t==typeid(float)) return __less_at<float>;
+	if(t==typeid(int)) return __less_at<int>;
+	if(t==typeid(unsigned int)) return __less_at<unsigned int>;
+	if(t==typeid(long)) return __less_at<long>;
+	if(t==typeid(unsigned long)) return __less_at<unsigned long>;
+	if(t==typeid(long long)) return __less_at<long long>;
+	if(t==typeid(unsigned long long)) return __less_at<unsigned long long>;
+	throw std::invalid_argument("the time column type cannot be ordered");
+}
+
+
+concurrent_emitter::row::row(concurrent_emitter& e)
+: owner(e), batch(e.batch_rows*e.plan.size()), n(0)
+{
+	// start from the current values of the table
+	owner.plan.pack(batch.data());
+}
+
+void concurrent_emitter::row::set(size_t col, const string& val)
+{
+	const row_plan::entry& e = owner.plan[col];
+	if(e.type != typeid(string))
+		throw std::invalid_argument("wrong column type for column "+e.column->name());
+	char* dst = current() + e.offset;
+	size_t len = std::min(val.size(), e.size-1);
+	memcpy(dst, val.data(), len);
+	memset(dst+len, 0, e.size-len);
+}
+
+void concurrent_emitter::row::emit()
+{
+	if(! owner.table.enabled()) return;
+
+	const row_plan& plan = owner.plan;
+	char* rec = current();
+	// evaluate computed columns
+	for(const row_plan::entry& e : plan)
+		if(e.src==nullptr && e.type!=typeid(string))
+			e.copy_to(rec + e.offset);
+
+	if(++n == owner.batch_rows)
+		submit();
+	else
+		// the next row starts with the values of this one
+		memcpy(rec + plan.size(), rec, plan.size());
+}
+
+void concurrent_emitter::row::submit()
+{
+	owner.submit(*this);
+}
+
+void concurrent_emitter::row::flush()
+{
+	if(n>0) submit();
+}
+
+void concurrent_emitter::submit(row& r)
+{
+	size_t len = plan.size();
+	std::vector<char> next;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(! spare.empty()) {
+			next = std::move(spare.back());
+			spare.pop_back();
+		}
+	}
+	if(next.size() != r.batch.size())
+		next.resize(r.batch.size());
+	// keep the values of the last row
+	memcpy(next.data(), r.batch.data() + (r.n-1)*len, len);
+
+	size_t nrows = r.n;
+	std::swap(next, r.batch);
+	r.n = 0;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	ready.emplace_back(std::move(next), nrows);
+	cv.notify_all();
+}
+
+
+concurrent_emitter::concurrent_emitter(output_table& t, size_t _batch_rows, bool _ordered)
+: table(t), plan(t.plan()), batch_rows(std::max(_batch_rows, (size_t)1)), ordered(_ordered),
+	pending(0), stop(false), id(++__emitter_ids)
+{
+	if(! table.is_locked())
+		throw std::logic_error("a concurrent emitter needs a locked table");
+	if(ordered) {
+		if(table.flavor() != table_flavor::TIMESERIES)
+			throw std::invalid_argument("ordered emission needs a time series table");
+		__time_less(plan[0].type);
+	}
+	for(size_t i=0; i<plan.columns(); i++) {
+		basic_column* c = plan[i].column;
+		names[c->path_name()] = i;
+	}
+	writer = std::thread(&concurrent_emitter::run, this);
+}
+
+concurrent_emitter::~concurrent_emitter()
+{
+	try {
+		flush();
+	} catch(...) {
+		// nothing to do in a destructor
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+		cv.notify_all();
+	}
+	writer.join();
+}
+
+size_t concurrent_emitter::index(const string& path) const
+{
+	auto it = names.find(path);
+	if(it == names.end())
+		throw std::out_of_range("column `"+path+"' not in table");
+	return it->second;
+}
+
+concurrent_emitter::row& concurrent_emitter::local()
+{
+	// the rows of this thread, by emitter id; the weak pointers
+	// expire with their emitter
+	struct entry { row* r; std::weak_ptr<row> alive; };
+	thread_local std::unordered_map<size_t, entry> mine;
+	auto it = mine.find(id);
+	if(it != mine.end())
+		return *it->second.r;
+
+	// forget the rows of destroyed emitters
+	for(auto i=mine.begin(); i!=mine.end(); )
+		if(i->second.alive.expired())
+			i = mine.erase(i);
+		else
+			++i;
+
+	std::shared_ptr<row> r = std::make_shared<row>(*this);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		rows.push_back(r);
+	}
+	mine[id] = entry { r.get(), r };
+	return *r;
+}
+
+void concurrent_emitter::flush()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for(auto& r : rows)
+			if(r->n > 0) {
+				size_t len = plan.size();
+				std::vector<char> next(r->batch.size());
+				memcpy(next.data(), r->batch.data() + (r->n-1)*len, len);
+				ready.emplace_back(std::move(r->batch), r->n);
+				r->batch = std::move(next);
+				r->n = 0;
+			}
+		cv.notify_all();
+	}
+
+	std::exception_ptr e;
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [&]() { return ready.empty() && pending==0; });
+		std::swap(e, error);
+	}
+	if(e)
+		std::rethrow_exception(e);
+}
+
+void concurrent_emitter::write_batch(std::vector<std::pair<std::vector<char>, size_t>>& batches)
+{
+	std::vector<const char*> recs;
+	for(auto& b : batches)
+		for(size_t i=0; i<b.second; i++)
+			recs.push_back(b.first.data() + i*plan.size());
+
+	if(ordered) {
+		__record_less less = __time_less(plan[0].type);
+		size_t off = plan[0].offset;
+		std::stable_sort(recs.begin(), recs.end(), [&](const char* a, const char* b) {
+			return less(a+off, b+off);
+		});
+	}
+
+	// as in emit_row(), without the filter; the enabled flag
+	// was checked at emission, by row::emit()
+	for(const char* rec : recs)
+		table._emit_record(rec);
+}
+
+void concurrent_emitter::run()
+{
+	std::vector<std::pair<std::vector<char>, size_t>> batches;
+	std::unique_lock<std::mutex> lock(mtx);
+	for(;;) {
+		cv.wait(lock, [&]() { return !ready.empty() || stop; });
+		if(ready.empty()) return;
+
+		std::swap(batches, ready);
+		pending = batches.size();
+		lock.unlock();
+
+		try {
+			write_batch(batches);
+		} catch(...) {
+			lock.lock();
+			if(! error) error = std::current_exception();
+			lock.unlock();
+		}
+
+		lock.lock();
+		for(auto& b : batches)
+			spare.push_back(std::move(b.first));
+		batches.clear();
+		pending = 0;
+		cv.notify_all();
+	}
+}
+
+
+//-------------------------------------
+//
+// A columnar memory file 
+//
+//-------------------------------------
+
+
+output_columnar::output_columnar()
+{ }
+
+output_columnar::~output_columnar()
+{ }
+
+const output_columnar::table_data& output_columnar::tdata(output_table& t) const
+{
+	auto it = _data.find(&t);
+	if(it == _data.end())
+		throw std::out_of_range("table `"+t.name()+"' has no columnar data");
+	return it->second;
+}
+
+size_t output_columnar::rows(output_table& t) const
+{
+	auto it = _data.find(&t);
+	return (it == _data.end()) ? 0 : it->second.rows;
+}
+
+const output_columnar::column_data& output_columnar::column(output_table& t, size_t col) const
+{
+	return tdata(t).columns.at(col);
+}
+
+const output_columnar::column_data& output_columnar::column(output_table& t, const string& path) const
+{
+	for(auto& cd : tdata(t).columns)
+		if(cd.name == path) return cd;
+	throw std::out_of_range("column not in table");
+}
+
+void output_columnar::pack_rows(output_table& t, size_t from, size_t n, 
+	char* buffer, const std::vector<size_t>& offset, size_t stride) const
+{
+	const table_data& td = tdata(t);
+	if(from+n > td.rows)
+		throw std::out_of_range("rows out of range in pack_rows");
+	if(offset.size() != td.columns.size())
+		throw std::invalid_argument("wrong number of offsets in pack_rows");
+
+	for(size_t i=0; i<td.columns.size(); i++) {
+		const column_data& cd = td.columns[i];
+		const char* src = cd.data.data() + from*cd.width;
+		char* dst = buffer + offset[i];
+		for(size_t r=0; r<n; r++, src += cd.width, dst += stride)
+			memcpy(dst, src, cd.width);
+	}
+}
+
+void output_columnar::clear(output_table& t)
+{
+	auto it = _data.find(&t);
+	if(it == _data.end()) return;
+	if(it->second.active) {
+		// keep the columns, drop the values
+		for(auto& cd : it->second.columns)
+			cd.data.clear();
+		it->second.rows = 0;
+	} else
+		_data.erase(it);
+}
+
+void output_columnar::clear()
+{
+	auto it = _data.begin();
+	while(it != _data.end()) {
+		output_table* t = (it++)->first;
+		clear(*t);
+	}
+}
+
+void output_columnar::output_prolog(output_table& table)
+{
+	auto it = _data.find(&table);
+	if(it == _data.end()) {
+		table_data& td = _data[&table];
+		td.rows = 0;
+		td.active = true;
+		for(size_t i=0; i<table.size(); i++) {
+			basic_column* col = table[i];
+			td.columns.push_back(column_data {
+				col->path_name(), col->type(), col->size(), {}, col });
+		}
+	} else {
+		// appending to existing data, check compatibility
+		table_data& td = it->second;
+		td.active = true;
+		bool compatible = td.columns.size() == table.size();
+		for(size_t i=0; compatible && i<table.size(); i++) {
+			column_data& cd = td.columns[i];
+			basic_column* col = table[i];
+			compatible = (cd.type == col->type()) && (cd.width == col->size());
+			cd.source = col;
+		}
+		if(! compatible)
+			throw std::runtime_error("On appending to columnar table,"\
+				" columns are not compatible");
+	}
+}
+
+void output_columnar::output_row(output_table& table)
+{
+	table_data& td = _data.at(&table);
+	const row_plan& plan = table.plan();
+	for(size_t i=0; i<td.columns.size(); i++) {
+		column_data& cd = td.columns[i];
+		size_t pos = cd.data.size();
+		cd.data.resize(pos + cd.width);
+		plan[i].copy_to(cd.data.data() + pos);
+	}
+	td.rows++;
+	if(output_stats::enabled()) _counters.bytes.add(plan.size());
+}
+
+void output_columnar::output_row(const row_view& r)
+{
+	table_data& td = _data.at(&r.table);
+	for(size_t i=0; i<td.columns.size(); i++) {
+		column_data& cd = td.columns[i];
+		cd.data.insert(cd.data.end(), r.record + r.plan[i].offset, 
+			r.record + r.plan[i].offset + cd.width);
+	}
+	td.rows++;
+	if(output_stats::enabled()) _counters.bytes.add(r.plan.size());
+}
+
+void output_columnar::output_epilog(output_table& table)
+{
+	auto it = _data.find(&table);
+	if(it == _data.end()) return;
+	it->second.active = false;
+	for(auto& cd : it->second.columns)
+		cd.source = nullptr;
+}
+
+void output_columnar::output_unbind(output_table& table)
+{
+	// the data is keyed by the table's address, which may be reused
+	_data.erase(&table);
+}
+
+
+
+//-------------------------------------
+//
+// Arrow IPC files
+//
+//-------------------------------------
+
+//
+// Helper namespace for writing Arrow IPC files
+//
+namespace {
+
+// A flatbuffer under construction. Objects are written front to back:
+// referenced objects (and vtables) are placed after their referrers.
+struct fb_buffer
+{
+	std::vector<char> data;
+
+	inline size_t size() const { return data.size(); }
+	inline void align(size_t al) { data.resize(__aligned(data.size(), al), 0); }
+	inline size_t put(const void* p, size_t n) {
+		size_t pos = data.size();
+		data.insert(data.end(), (const char*)p, (const char*)p + n);
+		return pos;
+	}
+	template <typename T>
+	inline void poke(size_t pos, T val) { memcpy(data.data()+pos, &val, sizeof(T)); }
+};
+
+// A flatbuffer table: scalar fields and references to other objects.
+// The field ids are the positions of the fields in the schema (a union
+// takes two ids, the type and the value).
+class fb_table
+{
+	struct field
+	{
+		size_t id;
+		size_t size;
+		uint64_t value;		// scalars
+		std::function<size_t(fb_buffer&)> child;	// referenced objects
+	};
+	std::vector<field> fields;
+
+	fb_table& object(size_t id, std::function<size_t(fb_buffer&)> f) {
+		fields.push_back(field { id, 4, 0, f });
+		return *this;
+	}
+
+public:
+	template <typename T>
+	fb_table& scalar(size_t id, T val) {
+		static_assert(sizeof(T)<=8, "not a scalar");
+		field f { id, sizeof(T), 0, nullptr };
+		memcpy(&f.value, &val, sizeof(T));
+		fields.push_back(f);
+		return *this;
+	}
+
+	fb_table& table(size_t id, const fb_table& t) {
+		return object(id, [t](fb_buffer& b) { return t.write(b); });
+	}
+
+	fb_table& which(size_t id, uint8_t type, const fb_table& t) {
+		return scalar(id, type).table(id+1, t);
+	}
+
+	fb_table& text(size_t id, const string& s) {
+		return object(id, [s](fb_buffer& b) {
+			b.align(4);
+			uint32_t n = s.size();
+			size_t pos = b.put(&n, 4);
+			b.put(s.c_str(), n+1);
+			return pos;
+		});
+	}
+
+	fb_table& tables(size_t id, const std::vector<fb_table>& v) {
+		return object(id, [v](fb_buffer& b) {
+			b.align(4);
+			uint32_t n = v.size();
+			size_t pos = b.put(&n, 4);
+			b.data.resize(pos + 4 + 4*n, 0);
+			for(size_t i=0; i<n; i++) {
+				size_t slot = pos + 4 + 4*i;
+				b.poke<uint32_t>(slot, v[i].write(b) - slot);
+			}
+			return pos;
+		});
+	}
+
+	template <typename S>
+	fb_table& structs(size_t id, const std::vector<S>& v) {
+		return object(id, [v](fb_buffer& b) {
+			// the elements are aligned, the length precedes them
+			static_assert(alignof(S)<=8, "struct alignment is too large");
+			b.align(4);
+			if((b.size()+4) % alignof(S)) b.data.resize(b.size()+4, 0);
+			uint32_t n = v.size();
+			size_t pos = b.put(&n, 4);
+			b.put(v.data(), n*sizeof(S));
+			return pos;
+		});
+	}
+
+	// write the table, return its position
+	size_t write(fb_buffer& b) const;
+
+	// return a finished flatbuffer with this table at the root
+	std::vector<char> finish() const {
+		fb_buffer b;
+		b.data.resize(4, 0);
+		b.poke<uint32_t>(0, write(b));
+		b.align(8);
+		return std::move(b.data);
+	}
+};
+
+size_t fb_table::write(fb_buffer& b) const
+{
+	// lay out the fields by decreasing size, after the vtable offset
+	std::vector<size_t> order;
+	for(size_t i=0; i<fields.size(); i++) order.push_back(i);
+	std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+		return fields[x].size > fields[y].size;
+	});
+	std::vector<size_t> pos(fields.size());
+	size_t tsize = 4, nslots = 0;
+	for(size_t i : order) {
+		tsize = __aligned(tsize, fields[i].size);
+		pos[i] = tsize;
+		tsize += fields[i].size;
+		nslots = std::max(nslots, fields[i].id+1);
+	}
+
+	// the vtable
+	std::vector<uint16_t> vt(2+nslots, 0);
+	vt[0] = 2*vt.size();
+	vt[1] = tsize;
+	for(size_t i=0; i<fields.size(); i++)
+		vt[2+fields[i].id] = pos[i];
+	b.align(2);
+	size_t vtpos = b.put(vt.data(), 2*vt.size());
+
+	// the table, aligned for any field
+	b.align(8);
+	size_t tpos = b.size();
+	b.data.resize(tpos+tsize, 0);
+	b.poke<int32_t>(tpos, tpos-vtpos);
+	for(size_t i=0; i<fields.size(); i++)
+		if(! fields[i].child)
+			memcpy(b.data.data()+tpos+pos[i], &fields[i].value, fields[i].size);
+
+	// the referenced objects
+	for(size_t i=0; i<fields.size(); i++)
+		if(fields[i].child) {
+			size_t slot = tpos+pos[i];
+			b.poke<uint32_t>(slot, fields[i].child(b) - slot);
+		}
+	return tpos;
+}
+
+
+// Arrow format constants
+enum : uint8_t { ARROW_INT=2, ARROW_FLOAT=3, ARROW_UTF8=5, ARROW_BOOL=6, ARROW_STRUCT=13 };
+enum : uint8_t { ARROW_SCHEMA=1, ARROW_DICTIONARY=2, ARROW_RECORDS=3 };
+const int16_t __arrow_version = 4;	// V5
+const char __arrow_magic[8] = "ARROW1";
+
+struct arrow_scalar { uint8_t type; int32_t bits; bool is_signed; };
+
+// the Arrow type of a column, from its type tag
+static bool __arrow_scalar(type_tag tag, arrow_scalar& a)
+{
+	switch(tag) {
+	case type_tag::boolean: a = {ARROW_BOOL, 1, false}; return true;
+	case type_tag::int8: a = {ARROW_INT, 8, true}; return true;
+	case type_tag::uint8: a = {ARROW_INT, 8, false}; return true;
+	case type_tag::int16: a = {ARROW_INT, 16, true}; return true;
+	case type_tag::uint16: a = {ARROW_INT, 16, false}; return true;
+	case type_tag::int32: a = {ARROW_INT, 32, true}; return true;
+	case type_tag::uint32: a = {ARROW_INT, 32, false}; return true;
+	case type_tag::int64: a = {ARROW_INT, 64, true}; return true;
+	case type_tag::uint64: a = {ARROW_INT, 64, false}; return true;
+	case type_tag::float32: a = {ARROW_FLOAT, 32, true}; return true;
+	case type_tag::float64: a = {ARROW_FLOAT, 64, true}; return true;
+	default: return false;
+	}
+}
+
+// flatbuffer structs of the Arrow format
+struct arrow_node { int64_t length, null_count; };
+struct arrow_buffer { int64_t offset, length; };
+struct arrow_block { int64_t offset; int32_t meta; int32_t pad; int64_t body; };
+
+static fb_table __arrow_int(int32_t bits, bool is_signed)
+{
+	return fb_table().scalar(0, bits).scalar(1, is_signed);
+}
+
+// A field of the schema: a column or a struct (column group)
+struct arrow_field
+{
+	string name;
+	const column_item* item;
+	long col;				// the column index, or -1 for a struct
+	std::vector<arrow_field> children;
+};
+
+// The data of a column, for the current record batch
+struct arrow_column
+{
+	size_t offset;				// the offset in the record
+	size_t width;
+	arrow_scalar kind;			// for arithmetic columns
+	bool is_string;
+	bool dict;					// dictionary-encoded string
+	std::vector<char> values;	// values, or dictionary indices
+	std::vector<int32_t> offsets;	// string offsets, of new dictionary entries if dict
+	std::vector<char> chars;
+	std::unordered_map<string, int32_t> index;	// the dictionary
+	string key;					// the lookup key, reused across cells
+	bool dict_written;
+
+	void append(const char* rec) {
+		const char* p = rec + offset;
+		if(! is_string) {
+			if(kind.type == ARROW_BOOL)
+				values.push_back(*p != 0);
+			else
+				values.insert(values.end(), p, p+width);
+			return;
+		}
+
+		size_t len = strnlen(p, width);
+		if(dict) {
+			key.assign(p, len);
+			auto it = index.find(key);
+			if(it == index.end()) {
+				it = index.emplace(key, (int32_t)index.size()).first;
+				chars.insert(chars.end(), p, p+len);
+				offsets.push_back(chars.size());
+			}
+			const char* v = (const char*) &it->second;
+			values.insert(values.end(), v, v+sizeof(int32_t));
+		} else {
+			chars.insert(chars.end(), p, p+len);
+			offsets.push_back(chars.size());
+		}
+	}
+};
+
+// The body of a record batch
+struct arrow_body
+{
+	std::vector<char> data;
+	std::vector<arrow_node> nodes;
+	std::vector<arrow_buffer> buffers;
+
+	void node(size_t len) { nodes.push_back(arrow_node { (int64_t)len, 0 }); }
+	void buffer(const void* p, size_t n) {
+		buffers.push_back(arrow_buffer { (int64_t)data.size(), (int64_t)n });
+		data.insert(data.end(), (const char*)p, (const char*)p + n);
+		data.resize(__aligned(data.size(), 8), 0);
+	}
+	void no_buffer() { buffer(nullptr, 0); }
+
+	fb_table records(size_t len) const {
+		return fb_table().scalar<int64_t>(0, len).structs(1, nodes).structs(2, buffers);
+	}
+};
+
+}
+
+
+struct output_arrow::table_writer
+{
+	output_table& table;
+	FILE* stream;
+	size_t pos;				// the file position
+	size_t nbatch;
+	size_t rows;			// rows in the current batch
+	std::vector<arrow_column> columns;
+	std::vector<arrow_field> fields;
+	fb_table schema;
+	std::vector<arrow_block> dictionaries, batches;
+	std::vector<char> record;
+	output_counters& counters;
+
+	table_writer(output_table& t, const string& path, size_t _nbatch, bool dict,
+		output_counters& _counters);
+	~table_writer();
+
+	fb_table field_schema(const arrow_field& f) const;
+	void field_body(const arrow_field& f, arrow_body& body) const;
+
+	void write(const void* p, size_t n);
+	arrow_block message(uint8_t type, const fb_table& header, const arrow_body* body);
+
+	void append(const char* rec);
+	void write_batch();
+	void finish();
+};
+
+
+output_arrow::table_writer::table_writer(output_table& t, const string& path, size_t _nbatch, bool dict,
+	output_counters& _counters)
+: table(t), stream(nullptr), pos(0), nbatch(_nbatch), rows(0), record(t.plan().size()),
+	counters(_counters)
+{
+	const row_plan& plan = table.plan();
+	for(size_t i=0; i<plan.columns(); i++) {
+		const row_plan::entry& e = plan[i];
+		arrow_column c { e.offset, e.size, {}, e.tag==type_tag::string, false, {}, {0}, {}, {}, {}, false };
+		if(c.is_string)
+			c.dict = dict;
+		else if(! __arrow_scalar(e.tag, c.kind))
+			throw std::invalid_argument("the type of column "+e.column->name()
+				+" is not supported by Arrow files");
+		columns.push_back(std::move(c));
+
+		// find the field of the column, within the fields of its groups
+		std::vector<const column_item*> groups;
+		for(column_item* p=e.column->parent(); p && !p->is_table(); p=p->parent())
+			groups.push_back(p);
+		std::vector<arrow_field>* level = &fields;
+		for(auto g=groups.rbegin(); g!=groups.rend(); ++g) {
+			if(level->empty() || level->back().item != *g)
+				level->push_back(arrow_field { (*g)->name(), *g, -1, {} });
+			level = &level->back().children;
+		}
+		level->push_back(arrow_field { e.column->name(), e.column, (long)i, {} });
+	}
+
+	std::vector<fb_table> fs;
+	for(auto& f : fields)
+		fs.push_back(field_schema(f));
+	schema.scalar(0, (int16_t)0).tables(1, fs);	// little endian
+
+	stream = fopen(path.c_str(), "wb");
+	if(stream == nullptr)
+		throw std::runtime_error("Could not open file `"+path+"' for writing");
+	write(__arrow_magic, 8);
+	message(ARROW_SCHEMA, schema, nullptr);
+}
+
+output_arrow::table_writer::~table_writer()
+{
+	if(stream) fclose(stream);
+}
+
+fb_table output_arrow::table_writer::field_schema(const arrow_field& f) const
+{
+	fb_table ret;
+	std::vector<fb_table> children;
+	ret.text(0, f.name).scalar(1, false);
+
+	if(f.col < 0) {
+		ret.which(2, ARROW_STRUCT, fb_table());
+		for(auto& c : f.children)
+			children.push_back(field_schema(c));
+	} else {
+		const arrow_column& c = columns[f.col];
+		if(c.is_string) {
+			ret.which(2, ARROW_UTF8, fb_table());
+			if(c.dict)
+				ret.table(4, fb_table().scalar<int64_t>(0, f.col)
+					.table(1, __arrow_int(32, true)).scalar(2, false));
+		} else if(c.kind.type == ARROW_INT)
+			ret.which(2, ARROW_INT, __arrow_int(c.kind.bits, c.kind.is_signed));
+		else if(c.kind.type == ARROW_FLOAT)
+			ret.which(2, ARROW_FLOAT, fb_table().scalar<int16_t>(0, c.kind.bits==32 ? 1 : 2));
+		else
+			ret.which(2, ARROW_BOOL, fb_table());
+	}
+	return ret.tables(5, children);
+}
+
+void output_arrow::table_writer::field_body(const arrow_field& f, arrow_body& body) const
+{
+	body.node(rows);
+	body.no_buffer();	// no nulls, no validity bitmap
+	if(f.col < 0) {
+		for(auto& c : f.children)
+			field_body(c, body);
+		return;
+	}
+
+	const arrow_column& c = columns[f.col];
+	if(c.is_string && !c.dict) {
+		body.buffer(c.offsets.data(), 4*c.offsets.size());
+		body.buffer(c.chars.data(), c.chars.size());
+	} else if(c.kind.type == ARROW_BOOL && !c.is_string) {
+		std::vector<uint8_t> bits((rows+7)/8, 0);
+		for(size_t i=0; i<rows; i++)
+			bits[i/8] |= c.values[i] << (i%8);
+		body.buffer(bits.data(), bits.size());
+	} else
+		body.buffer(c.values.data(), c.values.size());
+}
+
+void output_arrow::table_writer::write(const void* p, size_t n)
+{
+	if(fwrite(p, 1, n, stream) != n)
+		throw std::runtime_error("Error writing Arrow file for table `"+table.name()+"'");
+	pos += n;
+	if(output_stats::enabled()) counters.bytes.add(n);
+}
+
+arrow_block output_arrow::table_writer::message(uint8_t type, const fb_table& header, 
+	const arrow_body* body)
+{
+	size_t blen = body ? body->data.size() : 0;
+	std::vector<char> meta = fb_table()
+		.scalar(0, __arrow_version)
+		.which(1, type, header)
+		.scalar<int64_t>(3, blen).finish();
+
+	arrow_block block { (int64_t)pos, (int32_t)(8+meta.size()), 0, (int64_t)blen };
+	int32_t prefix[2] = { -1, (int32_t)meta.size() };
+	write(prefix, 8);
+	write(meta.data(), meta.size());
+	if(blen) write(body->data.data(), blen);
+	return block;
+}
+
+void output_arrow::table_writer::append(const char* rec)
+{
+	for(auto& c : columns)
+		c.append(rec);
+	if(++rows == nbatch)
+		write_batch();
+}
+
+void output_arrow::table_writer::write_batch()
+{
+	// the new dictionary entries
+	for(size_t i=0; i<columns.size(); i++) {
+		arrow_column& c = columns[i];
+		if(!c.dict || (c.dict_written && c.offsets.size()==1)) continue;
+		size_t n = c.offsets.size()-1;
+		arrow_body body;
+		body.node(n);
+		body.no_buffer();
+		body.buffer(c.offsets.data(), 4*c.offsets.size());
+		body.buffer(c.chars.data(), c.chars.size());
+		fb_table header = fb_table().scalar<int64_t>(0, i)
+			.table(1, body.records(n)).scalar(2, c.dict_written);
+		dictionaries.push_back(message(ARROW_DICTIONARY, header, &body));
+		c.dict_written = true;
+		c.offsets.assign(1, 0);
+		c.chars.clear();
+	}
+
+	arrow_body body;
+	for(auto& f : fields)
+		field_body(f, body);
+	batches.push_back(message(ARROW_RECORDS, body.records(rows), &body));
+
+	for(auto& c : columns) {
+		c.values.clear();
+		if(! c.dict) {
+			c.offsets.assign(1, 0);
+			c.chars.clear();
+		}
+	}
+	rows = 0;
+}
+
+void output_arrow::table_writer::finish()
+{
+	if(rows>0 || batches.empty())
+		write_batch();
+
+	int32_t eos[2] = { -1, 0 };
+	write(eos, 8);
+	std::vector<char> footer = fb_table()
+		.scalar(0, __arrow_version)
+		.table(1, schema)
+		.structs(2, dictionaries)
+		.structs(3, batches).finish();
+	int32_t len = footer.size();
+	write(footer.data(), footer.size());
+	write(&len, 4);
+	write(__arrow_magic, 6);
+
+	FILE* s = stream;
+	stream = nullptr;
+	if(fclose(s) != 0)
+		throw std::runtime_error("Error closing Arrow file for table `"+table.name()+"'");
+}
+
+
+output_arrow::output_arrow(const string& path, size_t batch_rows, bool dictionary)
+: filepath(path), nbatch(std::max(batch_rows, (size_t)1)), dict(dictionary), writer(nullptr)
+{ }
+
+output_arrow::~output_arrow()
+{
+	if(writer) {
+		try {
+			writer->finish();
+		} catch(...) {
+			// nothing to do in a destructor
+		}
+		delete writer;
+	}
+}
+
+void output_arrow::set_batch_rows(size_t rows)
+{
+	nbatch = std::max(rows, (size_t)1);
+}
+
+void output_arrow::flush()
+{
+	stat_timer timer(_counters.flushes, _counters.flush_ns);
+	if(writer && writer->rows>0) {
+		writer->write_batch();
+		fflush(writer->stream);
+	}
+}
+
+void output_arrow::output_prolog(output_table& table)
+{
+	if(writer) {
+		if(&writer->table != &table)
+			throw std::logic_error("an Arrow file holds a single table");
+		delete writer;
+		writer = nullptr;
+	}
+	writer = new table_writer(table, filepath, nbatch, dict, _counters);
+}
+
+void output_arrow::output_row(output_table& table)
+{
+	table.plan().pack(writer->record.data());
+	writer->append(writer->record.data());
+}
+
+void output_arrow::output_row(const row_view& r)
+{
+	writer->append(r.record);
+}
+
+void output_arrow::output_epilog(output_table& table)
+{
+	if(writer == nullptr) return;
+	std::unique_ptr<table_writer> w(writer);
+	writer = nullptr;
+	w->finish();
+}
+
+
+//-------------------------------------
+//
+// Memory-mapped files
+//
+//-------------------------------------
+
+static const char __mmap_magic[9] = "TABLEMM1";
+
+output_mmap::output_mmap(const string& path, open_mode _mode, size_t _grow)
+: filepath(path), mode(_mode), created(false), grow(std::max(_grow, (size_t)sysconf(_SC_PAGESIZE))),
+	active(nullptr), fd(-1), base(nullptr), mapped(0), stride(0)
+{ }
+
+output_mmap::~output_mmap()
+{
+	try {
+		close_file();
+	} catch(...) {
+		// nothing to do in a destructor
+	}
+}
+
+string output_mmap::layout(output_table& table)
+{
+	using std::endl;
+	const row_plan& plan = table.plan();
+	std::ostringstream out;
+	out << "{" << endl;
+	out << "\"schema\": ";
+	table.generate_schema(out);
+	out << "," << endl;
+	plan.write_json(out);
+	out << "}" << endl;
+	return out.str();
+}
+
+size_t output_mmap::rows() const
+{
+	return base ? ((const mmap_header*) base)->rows : 0;
+}
+
+void output_mmap::reserve(size_t bytes)
+{
+	if(bytes <= mapped) return;
+	size_t size = __aligned(std::max(bytes, mapped + grow), sysconf(_SC_PAGESIZE));
+
+	if(ftruncate(fd, size) != 0)
+		throw std::runtime_error("Could not extend file `"+filepath+"': "+strerror(errno));
+	void* addr = (base == nullptr)
+		? mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)
+		: mremap(base, mapped, size, MREMAP_MAYMOVE);
+	if(addr == MAP_FAILED)
+		throw std::runtime_error("Could not map file `"+filepath+"': "+strerror(errno));
+	base = (char*) addr;
+	mapped = size;
+}
+
+void output_mmap::close_file()
+{
+	if(fd < 0) return;
+	size_t size = base ? header()->data + header()->rows*stride : 0;
+	if(base) munmap(base, mapped);
+	base = nullptr;
+	mapped = 0;
+	active = nullptr;
+
+	// drop the unused space at the end
+	int ret = ftruncate(fd, size);
+	::close(fd);
+	fd = -1;
+	if(ret != 0)
+		throw std::runtime_error("Could not truncate file `"+filepath+"': "+strerror(errno));
+}
+
+inline char* output_mmap::next_record()
+{
+	mmap_header* h = header();
+	reserve(h->data + (h->rows+1)*stride);
+	h = header();
+	return base + h->data + h->rows*stride;
+}
+
+void output_mmap::flush()
+{
+	stat_timer timer(_counters.flushes, _counters.flush_ns);
+	if(base)
+		msync(base, mapped, MS_ASYNC);
+}
+
+void output_mmap::output_prolog(output_table& table)
+{
+	if(active && active != &table)
+		throw std::logic_error("a memory-mapped file holds a single table");
+	close_file();
+
+	string desc = layout(table);
+	const row_plan& plan = table.plan();
+	stride = plan.size();
+
+	// truncate only the first time, as the open mode applies to the file object
+	bool trunc = mode==open_mode::truncate && !created;
+	fd = ::open(filepath.c_str(), O_RDWR|O_CREAT|(trunc ? O_TRUNC : 0), 0666);
+	if(fd < 0)
+		throw std::runtime_error("Could not open file `"+filepath+"': "+strerror(errno));
+	created = true;
+	size_t size = lseek(fd, 0, SEEK_END);
+
+	if(size == 0) {
+		// a new file
+		const string& bin = plan.descriptor();
+		size_t dpos = __aligned(sizeof(mmap_header) + desc.size() + 1, 8);
+		size_t data = __aligned(dpos + bin.size(), std::max(plan.align(), (size_t)64));
+		reserve(data);
+		mmap_header* h = header();
+		memcpy(h->magic, __mmap_magic, 8);
+		h->data = data;
+		h->record = stride;
+		h->rows = 0;
+		h->layout = desc.size();
+		h->descriptor = dpos;
+		h->descriptor_size = bin.size();
+		memcpy(h+1, desc.c_str(), desc.size()+1);
+		memcpy(base + dpos, bin.data(), bin.size());
+	} else {
+		// appending, check that the layout is the same
+		void* addr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if(addr != MAP_FAILED) {
+			base = (char*) addr;
+			mapped = size;
+		}
+		mmap_header* h = header();
+		bool compatible = base && size >= sizeof(mmap_header) && memcmp(h->magic, __mmap_magic, 8)==0
+			&& h->record == stride && h->layout == desc.size()
+			&& size >= sizeof(mmap_header) + h->layout
+			&& desc.compare(0, desc.size(), (const char*)(h+1), h->layout)==0;
+		if(! compatible) {
+			if(base) munmap(base, mapped);
+			base = nullptr;
+			::close(fd);
+			fd = -1;
+			throw std::runtime_error("On appending to file `"+filepath+"',"\
+				" the layout is not compatible");
+		}
+	}
+	active = &table;
+}
+
+void output_mmap::output_row(output_table& table)
+{
+	table.plan().pack(next_record());
+	header()->rows++;
+	if(output_stats::enabled()) _counters.bytes.add(stride);
+}
+
+void output_mmap::output_row(const row_view& r)
+{
+	memcpy(next_record(), r.record, stride);
+	header()->rows++;
+	if(output_stats::enabled()) _counters.bytes.add(stride);
+}
+
+void output_mmap::output_epilog(output_table& table)
+{
+	if(active == &table)
+		close_file();
+}
+
+
+//-------------------------------------
+//
+// Shared-memory segments
+//
+//-------------------------------------
+
+static const char __shm_magic[9] = "TABLESH1";
+
+output_shm::output_shm(const string& name, size_t rows)
+: prefix(name), capacity(std::max(rows, (size_t)1))
+{
+	if(prefix.empty() || prefix[0] != '/')
+		prefix = "/" + prefix;
+}
+
+output_shm::~output_shm()
+{
+	for(auto& s : segments)
+		close_segment(s.second, true);
+}
+
+string output_shm::segment(output_table& table) const
+{
+	return prefix + "." + table.name();
+}
+
+void output_shm::close_segment(segment_data& s, bool unlink)
+{
+	if(s.base) munmap(s.base, s.mapped);
+	if(s.fd >= 0) ::close(s.fd);
+	if(unlink) shm_unlink(s.name.c_str());
+	s.base = nullptr;
+	s.fd = -1;
+}
+
+template <typename F>
+inline void output_shm::segment_data::publish(F fill)
+{
+	// readers find the slot being overwritten from the odd sequence
+	shm_header* h = header();
+	uint64_t seq = h->seq.load(std::memory_order_relaxed);
+	h->seq.store(seq+1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	fill(base + h->data + ((seq/2) % capacity)*stride);
+	h->seq.store(seq+2, std::memory_order_release);
+}
+
+void output_shm::output_prolog(output_table& table)
+{
+	auto found = segments.find(&table);
+	if(found != segments.end()) {
+		close_segment(found->second, true);
+		segments.erase(found);
+	}
+
+	string desc = output_mmap::layout(table);
+	const row_plan& plan = table.plan();
+	segment_data s { segment(table), -1, nullptr, 0, plan.size(), capacity };
+
+	// a new segment for every run, so that readers see a consistent header
+	shm_unlink(s.name.c_str());
+	s.fd = shm_open(s.name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0666);
+	if(s.fd < 0)
+		throw std::runtime_error("Could not create shared memory `"+s.name+"': "+strerror(errno));
+	const string& bin = plan.descriptor();
+	size_t dpos = __aligned(sizeof(shm_header) + desc.size() + 1, 8);
+	size_t data = __aligned(dpos + bin.size(), std::max(plan.align(), (size_t)64));
+	s.mapped = __aligned(data + capacity*s.stride, sysconf(_SC_PAGESIZE));
+	void* addr = MAP_FAILED;
+	if(ftruncate(s.fd, s.mapped) == 0)
+		addr = mmap(nullptr, s.mapped, PROT_READ|PROT_WRITE, MAP_SHARED, s.fd, 0);
+	if(addr == MAP_FAILED) {
+		int err = errno;
+		close_segment(s, true);
+		throw std::runtime_error("Could not map shared memory `"+s.name+"': "+strerror(err));
+	}
+	s.base = (char*) addr;
+
+	shm_header* h = s.header();
+	h->data = data;
+	h->record = s.stride;
+	h->capacity = capacity;
+	h->layout = desc.size();
+	h->descriptor = dpos;
+	h->descriptor_size = bin.size();
+	memcpy((char*)(h+1), desc.c_str(), desc.size()+1);
+	memcpy(s.base + dpos, bin.data(), bin.size());
+	h->seq.store(0, std::memory_order_relaxed);
+	h->active.store(1, std::memory_order_relaxed);
+	// the magic is last, readers check it
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(h->magic, __shm_magic, 8);
+
+	segments.emplace(&table, s);
+}
+
+void output_shm::output_row(output_table& table)
+{
+	segment_data& s = segments.at(&table);
+	s.publish([&](char* slot) { table.plan().pack(slot); });
+	if(output_stats::enabled()) _counters.bytes.add(s.stride);
+}
+
+void output_shm::output_row(const row_view& r)
+{
+	segment_data& s = segments.at(&r.table);
+	s.publish([&](char* slot) { memcpy(slot, r.record, s.stride); });
+	if(output_stats::enabled()) _counters.bytes.add(s.stride);
+}
+
+void output_shm::output_epilog(output_table& table)
+{
+	// the segment stays, for the readers to see the last rows
+	auto found = segments.find(&table);
+	if(found != segments.end())
+		found->second.header()->active.store(0, std::memory_order_release);
+}
+
+
+shm_reader::shm_reader(const string& name)
+: fd(-1), base(nullptr), mapped(0), next(0), _lost(0)
+{
+	fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0)
+		throw std::runtime_error("Could not open shared memory `"+name+"': "+strerror(errno));
+	struct stat st;
+	void* addr = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(shm_header))
+		addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(addr == MAP_FAILED || memcmp(((const shm_header*)addr)->magic, __shm_magic, 8) != 0) {
+		if(addr != MAP_FAILED) munmap(addr, st.st_size);
+		::close(fd);
+		throw std::runtime_error("Not a table segment: `"+name+"'");
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	base = (const char*) addr;
+	mapped = st.st_size;
+}
+
+shm_reader::~shm_reader()
+{
+	munmap((void*) base, mapped);
+	::close(fd);
+}
+
+string shm_reader::layout() const
+{
+	return string((const char*)(header()+1), header()->layout);
+}
+
+record_layout shm_reader::descriptor() const
+{
+	const shm_header* h = header();
+	if(h->descriptor + h->descriptor_size > mapped)
+		throw std::runtime_error("Bad layout descriptor");
+	return record_layout::decode(base + h->descriptor, h->descriptor_size);
+}
+
+size_t shm_reader::read(void* buffer, size_t max)
+{
+	const shm_header* h = header();
+	const size_t stride = h->record;
+	const uint64_t cap = h->capacity;
+	for(;;) {
+		uint64_t written = h->seq.load(std::memory_order_acquire) / 2;
+		if(next >= written || max == 0)
+			return 0;
+		// the oldest rows may be gone
+		uint64_t from = std::max(next, written > cap ? written-cap : 0);
+		size_t n = std::min((uint64_t) max, written-from);
+		for(size_t i=0; i<n; i++)
+			memcpy((char*) buffer + i*stride, base + h->data + ((from+i) % cap)*stride, stride);
+
+		// the rows that the writer may have overwritten while copying
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t started = (h->seq.load(std::memory_order_relaxed) + 1) / 2;
+		if(started <= cap || from >= started-cap) {
+			_lost += from - next;
+			next = from + n;
+			return n;
+		}
+	}
+}
+
+
+//-------------------------------------
+//
+// Block encoding
+//
+//-------------------------------------
+
+static inline void __put_varint(std::vector<char>& out, uint64_t v)
+{
+	while(v >= 0x80) {
+		out.push_back((char) (v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char) v);
+}
+
+static inline uint64_t __get_varint(const char*& p, const char* end)
+{
+	uint64_t v = 0;
+	for(unsigned shift = 0; shift < 64; shift += 7) {
+		if(p == end) break;
+		uint8_t b = *p++;
+		v |= (uint64_t) (b & 0x7f) << shift;
+		if(!(b & 0x80)) return v;
+	}
+	throw std::runtime_error("Bad encoded block");
+}
+
+static inline uint64_t __zigzag(uint64_t v)
+{
+	return (v << 1) ^ (uint64_t) ((int64_t) v >> 63);
+}
+
+static inline uint64_t __unzigzag(uint64_t v)
+{
+	return (v >> 1) ^ (0 - (v & 1));
+}
+
+// a value of up to 8 bytes, as an integer
+static inline uint64_t __load_value(const char* p, size_t size, bool is_signed)
+{
+	uint64_t v = 0;
+	memcpy(&v, p, size);
+	if(is_signed && size < 8) {
+		unsigned shift = 64 - 8*size;
+		v = (uint64_t) ((int64_t) (v << shift) >> shift);
+	}
+	return v;
+}
+
+// a stream of bits, most significant first
+struct __bit_writer
+{
+	std::vector<char>& out;
+	uint64_t acc = 0;
+	unsigned n = 0;		// the bits in acc, less than 8
+
+	__bit_writer(std::vector<char>& _out) : out(_out) { }
+
+	inline void put(uint64_t v, unsigned bits) {
+		if(bits > 32) {
+			put(v >> 32, bits-32);
+			bits = 32;
+		}
+		acc = (acc << bits) | (v & ((1ull << bits) - 1));
+		n += bits;
+		while(n >= 8) {
+			n -= 8;
+			out.push_back((char) (acc >> n));
+		}
+	}
+
+	inline void finish() {
+		if(n) out.push_back((char) (acc << (8-n)));
+		n = 0;
+	}
+};
+
+struct __bit_reader
+{
+	const char* p;
+	const char* end;
+	uint64_t acc = 0;
+	unsigned n = 0;
+
+	__bit_reader(const char* _p, const char* _end) : p(_p), end(_end) { }
+
+	inline uint64_t get(unsigned bits) {
+		if(bits > 32) {
+			uint64_t hi = get(bits-32);
+			return (hi << 32) | get(32);
+		}
+		while(n < bits) {
+			if(p == end)
+				throw std::runtime_error("Bad encoded block");
+			acc = (acc << 8) | (uint8_t) *p++;
+			n += 8;
+		}
+		n -= bits;
+		return (acc >> n) & ((1ull << bits) - 1);
+	}
+};
+
+/*
+	Gorilla-style XOR of values of `width' bits: the first value is 
+	stored as is, then each value is XORed with the previous one. 
+	A zero is stored as a 0 bit; otherwise a 1 bit, followed by either
+	a 0 bit and the bits in the window of the previous XOR, or a 1 bit,
+	the leading zeros (5 bits), the number of meaningful bits (6 bits,
+	0 for 64) and the meaningful bits.
+ */
+static void __encode_xor(const char* p, size_t stride, size_t rows, unsigned width, std::vector<char>& out)
+{
+	__bit_writer bits(out);
+	uint64_t prev = 0;
+	unsigned lead = ~0u, trail = 0;
+	for(size_t r=0; r<rows; r++, p += stride) {
+		uint64_t v = __load_value(p, width/8, false);
+		if(r == 0) {
+			bits.put(v, width);
+			prev = v;
+			continue;
+		}
+		uint64_t x = v ^ prev;
+		prev = v;
+		if(x == 0) {
+			bits.put(0, 1);
+			continue;
+		}
+		unsigned lz = std::min(__builtin_clzll(x) - (64 - width), 31u);
+		unsigned tz = __builtin_ctzll(x);
+		if(lead != ~0u && lz >= lead && tz >= trail) {
+			bits.put(2, 2);
+			bits.put(x >> trail, width - lead - trail);
+		} else {
+			unsigned m = width - lz - tz;
+			bits.put(3, 2);
+			bits.put(lz, 5);
+			bits.put(m & 63, 6);
+			bits.put(x >> tz, m);
+			lead = lz;
+			trail = tz;
+		}
+	}
+	bits.finish();
+}
+
+static void __decode_xor(const char* data, const char* end, char* p, size_t stride, size_t rows, unsigned width)
+{
+	__bit_reader bits(data, end);
+	uint64_t prev = 0;
+	unsigned lead = ~0u, trail = 0;
+	for(size_t r=0; r<rows; r++, p += stride) {
+		if(r == 0)
+			prev = bits.get(width);
+		else if(bits.get(1)) {
+			if(bits.get(1)) {
+				lead = bits.get(5);
+				unsigned m = bits.get(6);
+				if(m == 0) m = 64;
+				if(lead + m > width)
+					throw std::runtime_error("Bad encoded block");
+				trail = width - lead - m;
+			} else if(lead == ~0u)
+				throw std::runtime_error("Bad encoded block");
+			prev ^= bits.get(width - lead - trail) << trail;
+		}
+		memcpy(p, &prev, width/8);
+	}
+}
+
+/*
+	Delta-of-delta, as zigzag varints, where a zero is followed by the
+	number of zeros that follow it.
+ */
+static void __encode_delta(const char* p, size_t stride, size_t rows, size_t size, bool is_signed, std::vector<char>& out)
+{
+	uint64_t prev = 0, delta = 0;
+	size_t zeros = 0;
+	for(size_t r=0; r<rows; r++, p += stride) {
+		uint64_t v = __load_value(p, size, is_signed);
+		uint64_t d = v - prev;
+		uint64_t dd = d - delta;
+		prev = v;
+		delta = d;
+		if(dd == 0 && zeros > 0) {
+			zeros++;
+			continue;
+		}
+		if(zeros > 0) {
+			__put_varint(out, zeros-1);
+			zeros = 0;
+		}
+		__put_varint(out, __zigzag(dd));
+		if(dd == 0) zeros = 1;
+	}
+	if(zeros > 0)
+		__put_varint(out, zeros-1);
+}
+
+static void __decode_delta(const char* data, const char* end, char* p, size_t stride, size_t rows, size_t size)
+{
+	uint64_t prev = 0, delta = 0;
+	size_t zeros = 0;
+	for(size_t r=0; r<rows; r++, p += stride) {
+		if(zeros > 0)
+			zeros--;
+		else {
+			uint64_t dd = __unzigzag(__get_varint(data, end));
+			if(dd == 0) {
+				zeros = __get_varint(data, end);
+				if(zeros >= rows - r)
+					throw std::runtime_error("Bad encoded block");
+			}
+			delta += dd;
+		}
+		prev += delta;
+		memcpy(p, &prev, size);
+	}
+}
+
+// runs, as the run length (a varint) followed by the value
+static void __encode_rle(const char* p, size_t stride, size_t rows, size_t size, std::vector<char>& out)
+{
+	size_t r = 0;
+	while(r < rows) {
+		const char* v = p + r*stride;
+		size_t run = 1;
+		while(r + run < rows && memcmp(v, v + run*stride, size) == 0)
+			run++;
+		__put_varint(out, run);
+		out.insert(out.end(), v, v+size);
+		r += run;
+	}
+}
+
+static void __decode_rle(const char* data, const char* end, char* p, size_t stride, size_t rows, size_t size)
+{
+	size_t r = 0;
+	while(r < rows) {
+		uint64_t run = __get_varint(data, end);
+		if(run == 0 || run > rows - r || (size_t)(end - data) < size)
+			throw std::runtime_error("Bad encoded block");
+		for(size_t i=0; i<run; i++, r++)
+			memcpy(p + r*stride, data, size);
+		data += size;
+	}
+}
+
+block_codec::block_codec(const row_plan& plan, bool series)
+: _record(plan.size())
+{
+	for(size_t i=0; i<plan.columns(); i++) {
+		const row_plan::entry& e = plan[i];
+		column_info c { e.offset, e.size, false, column_encoding::raw };
+		switch(e.tag) {
+		case type_tag::int8: case type_tag::int16: case type_tag::int32: case type_tag::int64:
+			c.is_signed = true;
+			// fall through
+		case type_tag::boolean:
+		case type_tag::uint8: case type_tag::uint16: case type_tag::uint32: case type_tag::uint64:
+		case type_tag::string:
+			c.encoding = column_encoding::rle;
+			break;
+		case type_tag::float32: case type_tag::float64:
+			c.encoding = column_encoding::xor_float;
+			break;
+		default:
+			break;
+		}
+		if(series && i == 0 && c.size <= 8 && c.encoding != column_encoding::raw
+				&& e.tag != type_tag::string)
+			c.encoding = column_encoding::delta;
+		_columns.push_back(c);
+	}
+}
+
+void block_codec::set_encoding(size_t i, column_encoding e)
+{
+	column_info& c = _columns.at(i);
+	if((e == column_encoding::xor_float && c.size != 4 && c.size != 8)
+			|| (e == column_encoding::delta && c.size > 8)
+			|| e > column_encoding::rle)
+		throw std::invalid_argument("Bad encoding for a column of "+std::to_string(c.size)+" bytes");
+	c.encoding = e;
+}
+
+void block_codec::encode(const char* records, size_t rows, std::vector<char>& out) const
+{
+	__put_varint(out, _columns.size());
+	std::vector<char> data;
+	for(const column_info& c : _columns) {
+		const char* p = records + c.offset;
+		data.clear();
+		switch(c.encoding) {
+		case column_encoding::delta: 
+			__encode_delta(p, _record, rows, c.size, c.is_signed, data); 
+			break;
+		case column_encoding::xor_float: 
+			__encode_xor(p, _record, rows, 8*c.size, data); 
+			break;
+		case column_encoding::rle: 
+			__encode_rle(p, _record, rows, c.size, data); 
+			break;
+		default:
+			for(size_t r=0; r<rows; r++)
+				data.insert(data.end(), p + r*_record, p + r*_record + c.size);
+		}
+		out.push_back((char) c.encoding);
+		__put_varint(out, data.size());
+		out.insert(out.end(), data.begin(), data.end());
+	}
+}
+
+void block_codec::decode(const char* data, size_t bytes, size_t rows, char* records) const
+{
+	const char* end = data + bytes;
+	if(__get_varint(data, end) != _columns.size())
+		throw std::runtime_error("Bad encoded block: wrong number of columns");
+	memset(records, 0, rows*_record);
+	for(const column_info& c : _columns) {
+		if(data == end)
+			throw std::runtime_error("Bad encoded block");
+		column_encoding enc = (column_encoding) *data++;
+		uint64_t size = __get_varint(data, end);
+		if(size > (uint64_t)(end - data))
+			throw std::runtime_error("Bad encoded block");
+		const char* cend = data + size;
+		char* p = records + c.offset;
+		switch(enc) {
+		case column_encoding::delta:
+			if(c.size > 8) throw std::runtime_error("Bad encoded block");
+			__decode_delta(data, cend, p, _record, rows, c.size);
+			break;
+		case column_encoding::xor_float:
+			if(c.size != 4 && c.size != 8) throw std::runtime_error("Bad encoded block");
+			__decode_xor(data, cend, p, _record, rows, 8*c.size);
+			break;
+		case column_encoding::rle:
+			__decode_rle(data, cend, p, _record, rows, c.size);
+			break;
+		case column_encoding::raw:
+			if(size != rows*c.size) throw std::runtime_error("Bad encoded block");
+			for(size_t r=0; r<rows; r++)
+				memcpy(p + r*_record, data + r*c.size, c.size);
+			break;
+		default:
+			throw std::runtime_error("Bad encoded block: unknown encoding");
+		}
+		data = cend;
+	}
+}
+
+
+//-------------------------------------
+//
+// Sockets
+//
+//-------------------------------------
+
+// the largest UDP payload
+static const size_t __udp_max = 65507;
+
+// the types of columns that can be sent
+struct __wire_type {
+	const char* name;
+	type_index type;
+	basic_column* (*make)(column_group*, const string&, const string& fmt, size_t size);
+	char arg;	// the printf argument: i(nt), l(ong), L(ong long), d(ouble), D (long double), s(tring)
+};
+
+template <typename T>
+static basic_column* __make_wire_column(column_group* g, const string& n, const string& fmt, size_t)
+{
+	return new column<T>(g, n, fmt);
+}
+
+static basic_column* __make_wire_string(column_group* g, const string& n, const string& fmt, size_t size)
+{
+	return new column<string>(g, n, size-1, fmt);
+}
+
+static const __wire_type __wire_types[] = {
+	{ "bool", typeid(bool), __make_wire_column<bool>, 'i' },
+	{ "char", typeid(char), __make_wire_column<char>, 'i' },
+	{ "schar", typeid(signed char), __make_wire_column<signed char>, 'i' },
+	{ "uchar", typeid(unsigned char), __make_wire_column<unsigned char>, 'i' },
+	{ "short", typeid(short), __make_wire_column<short>, 'i' },
+	{ "ushort", typeid(unsigned short), __make_wire_column<unsigned short>, 'i' },
+	{ "int", typeid(int), __make_wire_column<int>, 'i' },
+	{ "uint", typeid(unsigned int), __make_wire_column<unsigned int>, 'i' },
+	{ "long", typeid(long), __make_wire_column<long>, 'l' },
+	{ "ulong", typeid(unsigned long), __make_wire_column<unsigned long>, 'l' },
+	{ "llong", typeid(long long), __make_wire_column<long long>, 'L' },
+	{ "ullong", typeid(unsigned long long), __make_wire_column<unsigned long long>, 'L' },
+	{ "float", typeid(float), __make_wire_column<float>, 'd' },
+	{ "double", typeid(double), __make_wire_column<double>, 'd' },
+	{ "ldouble", typeid(long double), __make_wire_column<long double>, 'D' },
+	{ "string", typeid(string), __make_wire_string, 's' }
+};
+
+// the size of the integer argument of a printf length modifier, or 0
+static size_t __printf_int_size(const string& len)
+{
+	if(len=="" || len=="h" || len=="hh") return sizeof(int);
+	if(len=="l") return sizeof(long);
+	if(len=="ll") return sizeof(long long);
+	if(len=="j") return sizeof(intmax_t);
+	if(len=="z") return sizeof(size_t);
+	if(len=="t") return sizeof(ptrdiff_t);
+	return 0;
+}
+
+// Check that a printf format is safe for the argument of a wire type:
+// it has exactly one conversion, which matches the argument, no
+// '*' width or precision, and no %n.
+static bool __safe_wire_format(const string& fmt, const __wire_type& w)
+{
+	const char* f = fmt.c_str();
+	size_t convs = 0;
+	for(size_t i=0; i<fmt.size(); i++) {
+		if(f[i] != '%') continue;
+		if(f[++i] == '%') continue;
+		i += strspn(f+i, "-+ #0'");
+		i += strspn(f+i, "0123456789");
+		if(f[i] == '.') {
+			i++;
+			i += strspn(f+i, "0123456789");
+		}
+		size_t l = strspn(f+i, "hlLjzt");
+		string len(f+i, l);
+		i += l;
+		char conv = f[i];
+		if(conv == 0) return false;
+		convs++;
+
+		bool ok;
+		switch(w.arg) {
+		case 'i': ok = strchr("diouxXc", conv) && __printf_int_size(len)==sizeof(int); break;
+		case 'l': ok = strchr("diouxX", conv) && __printf_int_size(len)==sizeof(long); break;
+		case 'L': ok = strchr("diouxX", conv) && __printf_int_size(len)==sizeof(long long); break;
+		case 'd': ok = strchr("fFeEgGaA", conv) && (len=="" || len=="l"); break;
+		case 'D': ok = strchr("fFeEgGaA", conv) && len=="L"; break;
+		case 's': ok = conv=='s' && len==""; break;
+		default: ok = false;
+		}
+		if(! ok) return false;
+	}
+	return convs == 1;
+}
+
+static const __wire_type* __find_wire_type(type_index t)
+{
+	for(auto& w : __wire_types)
+		if(w.type == t) return &w;
+	return nullptr;
+}
+
+static const __wire_type* __find_wire_type(const string& name)
+{
+	for(auto& w : __wire_types)
+		if(name == w.name) return &w;
+	return nullptr;
+}
+
+static inline socket_frame __frame(uint16_t kind, uint16_t table, size_t length, size_t rows=0, size_t raw=0)
+{
+	return socket_frame { (uint32_t) length, kind, table, (uint32_t) rows, (uint32_t) raw };
+}
+
+
+output_socket::output_socket(const string& _host, const string& _port, bool _udp, size_t batch)
+: host(_host), port(_port), udp(_udp), batch_rows(std::max(batch, (size_t)1)),
+	max_buffer(default_socket_buffer), policy(async_policy::block), compress(false), 
+	encode(false), reconnect(false), fd(-1), connecting(false), outpos(0), next_id(0), _dropped(0)
+{ }
+
+output_socket::~output_socket()
+{
+	// an error here cannot be reported, since we are in a destructor
+	try {
+		for(auto& s : streams)
+			send_batch(s.second);
+		if(connected() && !udp)
+			drain(policy == async_policy::block);
+	} catch(...) { }
+	if(fd >= 0) ::close(fd);
+}
+
+void output_socket::set_buffer_bytes(size_t bytes) { max_buffer = bytes; }
+void output_socket::set_policy(async_policy p) { policy = p; }
+void output_socket::set_compression(bool on) { compress = on; }
+void output_socket::set_encoding(bool on) { encode = on; }
+void output_socket::set_reconnect(bool on) { reconnect = on; }
+
+bool output_socket::try_connect(int wait_ms)
+{
+	if(connected()) return true;
+
+	if(fd < 0) {
+		// retry at most once per second
+		auto now = std::chrono::steady_clock::now();
+		if(last_attempt.time_since_epoch().count() != 0 && now - last_attempt < std::chrono::seconds(1))
+			return false;
+		last_attempt = now;
+
+		addrinfo hints {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+		addrinfo* res = nullptr;
+		if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+			return false;
+		for(addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+			if(fd < 0) continue;
+			if(::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				connecting = false;
+			else if(errno == EINPROGRESS)
+				connecting = true;
+			else {
+				::close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(res);
+		if(fd < 0) return false;
+		if(! connecting) {
+			connected_now();
+			return true;
+		}
+	}
+
+	// wait for the connection in progress
+	pollfd pfd { fd, POLLOUT, 0 };
+	if(::poll(&pfd, 1, wait_ms) <= 0)
+		return false;
+	int err = 0;
+	socklen_t len = sizeof(err);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	if(err != 0) {
+		::close(fd);
+		fd = -1;
+		connecting = false;
+		return false;
+	}
+	connecting = false;
+	connected_now();
+	return true;
+}
+
+void output_socket::connected_now()
+{
+	if(! udp) {
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	outbuf.clear();
+	outpos = 0;
+	// the receiver needs the schemas first
+	for(auto& s : streams)
+		send_frame(s.second.schema.data(), s.second.schema.size(), 0);
+}
+
+void output_socket::disconnect()
+{
+	if(fd >= 0) ::close(fd);
+	fd = -1;
+	connecting = false;
+	outbuf.clear();
+	outpos = 0;
+	if(! reconnect)
+		throw std::runtime_error("The connection to "+host+":"+port+" is lost");
+}
+
+bool output_socket::drain(bool wait)
+{
+	while(outpos < outbuf.size()) {
+		ssize_t n = ::send(fd, outbuf.data()+outpos, outbuf.size()-outpos, MSG_NOSIGNAL);
+		if(n > 0) {
+			outpos += n;
+			if(output_stats::enabled()) _counters.bytes.add(n);
+			continue;
+		}
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if(! wait) break;
+			pollfd pfd { fd, POLLOUT, 0 };
+			::poll(&pfd, 1, -1);
+			continue;
+		}
+		disconnect();
+		return false;
+	}
+
+	// compact the buffer
+	if(outpos == outbuf.size()) {
+		outbuf.clear();
+		outpos = 0;
+	} else if(outpos > outbuf.size()/2) {
+		outbuf.erase(outbuf.begin(), outbuf.begin()+outpos);
+		outpos = 0;
+	}
+	return true;
+}
+
+void output_socket::send_frame(const char* frame, size_t bytes, size_t rows)
+{
+	if(! try_connect(0)) {
+		if(! reconnect)
+			throw std::runtime_error("Not connected to "+host+":"+port);
+		_dropped += rows;
+		return;
+	}
+
+	if(udp) {
+		// one datagram per frame, dropped if the socket is busy
+		ssize_t n = ::send(fd, frame, bytes, MSG_NOSIGNAL);
+		if(n == (ssize_t) bytes) {
+			if(output_stats::enabled()) _counters.bytes.add(n);
+		} else
+			_dropped += rows;
+		return;
+	}
+
+	// schemas and epilogs are never dropped
+	if(rows && buffered() + bytes > max_buffer) {
+		if(! drain(false)) { _dropped += rows; return; }
+		if(buffered() + bytes > max_buffer) {
+			if(policy == async_policy::drop) {
+				_dropped += rows;
+				return;
+			}
+			if(! drain(true)) { _dropped += rows; return; }
+		}
+	}
+	outbuf.insert(outbuf.end(), frame, frame+bytes);
+	drain(false);
+}
+
+void output_socket::send_batch(stream_data& s)
 {
-	delete fmt;
-}
+	if(s.rows == 0) return;
+	if(udp && s.frames++ % 64 == 63)
+		send_frame(s.schema.data(), s.schema.size(), 0);
+
+	// the frame, encoded if that makes it smaller
+	char* frame = s.batch.data();
+	size_t raw = s.rows*s.stride;
+	uint16_t kind = socket_frame::rows;
+	if(encode) {
+		s.encoded.resize(sizeof(socket_frame));
+		s.codec.encode(frame+sizeof(socket_frame), s.rows, s.encoded);
+		if(s.encoded.size() - sizeof(socket_frame) < raw) {
+			frame = s.encoded.data();
+			raw = s.encoded.size() - sizeof(socket_frame);
+			kind = socket_frame::encoded;
+		}
+	}
 
-//-------------------------------
-//
-// A C-style file
-//
-//-------------------------------
+	socket_frame f = __frame(kind, s.id, raw, s.rows);
+	if(compress) {
+		uLongf zlen = compressBound(raw);
+		zbuf.resize(sizeof(f) + zlen);
+		if(compress2((Bytef*) zbuf.data()+sizeof(f), &zlen, 
+				(const Bytef*) frame+sizeof(f), raw, 1) == Z_OK && zlen < raw) {
+			f.length = zlen;
+			f.raw = raw;
+			memcpy(zbuf.data(), &f, sizeof(f));
+			send_frame(zbuf.data(), sizeof(f)+zlen, s.rows);
+			s.rows = 0;
+			return;
+		}
+	}
+	memcpy(frame, &f, sizeof(f));
+	send_frame(frame, sizeof(f)+raw, s.rows);
+	s.rows = 0;
+}
 
-void output_c_file::open(const string& fpath, open_mode mode)
+void output_socket::flush()
 {
-	if(stream) 
-		throw std::runtime_error("output file already open");
-	stream = fopen(fpath.c_str(), (mode==open_mode::append?"a":"w"));
-	if(!stream) 
-		throw std::runtime_error("I/O error opening file");
-	filepath = fpath;
-	owner = true;
+	stat_timer timer(_counters.flushes, _counters.flush_ns);
+	for(auto& s : streams)
+		send_batch(s.second);
+	if(connected() && !udp)
+		drain(policy == async_policy::block);
 }
 
-void output_c_file::open(FILE* _file, bool _owner)
+output_stats output_socket::stats() const
 {
-	if(stream) 
-		throw std::runtime_error("output file already open");
-	stream = _file;
-	owner = _owner;
+	output_stats s = _counters.snapshot();
+	s.queued = buffered();
+	s.dropped = _dropped;
+	return s;
 }
 
-void output_c_file::close()
+void output_socket::output_prolog(output_table& table)
 {
-	// handle the stream
-	if((!stream)) return;
-	if(owner) {
-		if(fclose(stream)!=0)
-			throw std::runtime_error("I/O error closing file");		
-	} else {
-		flush();
+	const row_plan& plan = table.plan();
+
+	// the schema, as text lines
+	std::ostringstream text;
+	text << table.name() << "\n" 
+		<< (table.flavor() == table_flavor::TIMESERIES ? 1 : 0) << "\n"
+		<< plan.size() << "\n";
+	for(auto& e : plan) {
+		const __wire_type* w = __find_wire_type(e.type);
+		string fmt = e.column->format();
+		string path = e.column->path_name();
+		if(!w || !__safe_wire_format(fmt, *w) 
+			|| fmt.find_first_of("\t\n") != string::npos || path.find_first_of("\t\n") != string::npos)
+			throw std::invalid_argument("Column `"+path+"' cannot be sent over a socket");
+		text << w->name << "\t" << e.size << "\t" << fmt << "\t" << path << "\n";
 	}
-	stream = nullptr;
-	owner = false;
-	filepath = string();
+	string desc = text.str();
+
+	auto found = streams.find(&table);
+	stream_data& s = (found != streams.end()) ? found->second : streams[&table];
+	if(found == streams.end())
+		s.id = next_id++;
+	socket_frame f = __frame(socket_frame::schema, s.id, desc.size());
+	s.schema.assign((const char*) &f, (const char*) (&f+1));
+	s.schema.insert(s.schema.end(), desc.begin(), desc.end());
+
+	s.stride = plan.size();
+	s.codec = block_codec(plan, table.flavor() == table_flavor::TIMESERIES);
+	s.limit = batch_rows;
+	if(udp)
+		s.limit = std::min(s.limit, (__udp_max - sizeof(socket_frame)) / std::max(s.stride, (size_t)1));
+	if(s.limit == 0 || (udp && s.schema.size() > __udp_max)) {
+		streams.erase(&table);
+		throw std::invalid_argument("The rows of table `"+table.name()+"' do not fit in a datagram");
+	}
+	s.batch.assign(sizeof(socket_frame) + s.limit*s.stride, 0);
+	s.rows = 0;
+	s.frames = 0;
+
+	// a new connection sends all the schemas
+	bool was_connected = connected();
+	if(! try_connect(1000)) {
+		if(! reconnect) {
+			streams.erase(&table);
+			throw std::runtime_error("Could not connect to "+host+":"+port);
+		}
+	} else if(was_connected)
+		send_frame(s.schema.data(), s.schema.size(), 0);
 }
 
-void output_c_file::flush()
+void output_socket::output_row(output_table& table)
 {
-	if(!stream)
-		throw std::runtime_error("I/O error flushing closed file");
-	if(fflush(stream)!=0)
-		throw std::runtime_error("I/O error flushing file");
+	stream_data& s = streams.at(&table);
+	table.plan().pack(s.batch.data() + sizeof(socket_frame) + s.rows*s.stride);
+	if(++s.rows == s.limit) send_batch(s);
 }
 
+void output_socket::output_row(const row_view& r)
+{
+	stream_data& s = streams.at(&r.table);
+	memcpy(s.batch.data() + sizeof(socket_frame) + s.rows*s.stride, r.record, s.stride);
+	if(++s.rows == s.limit) send_batch(s);
+}
 
-output_c_file::output_c_file(FILE* _stream, bool _owner, text_format f)
-: stream(_stream), owner(_owner), fmt(f) { }
-
-
-output_c_file::output_c_file(const string& _fpath, open_mode mode, text_format f)
-: output_c_file(f)
+void output_socket::output_epilog(output_table& table)
 {
-	open(_fpath, mode);
+	auto found = streams.find(&table);
+	if(found == streams.end()) return;
+	stream_data& s = found->second;
+	send_batch(s);
+	socket_frame f = __frame(socket_frame::epilog, s.id, 0);
+	if(connected() || !reconnect)
+		send_frame((const char*) &f, sizeof(f), 0);
+	streams.erase(found);
+	if(connected() && !udp)
+		drain(policy == async_policy::block);
 }
 
 
-output_c_file::~output_c_file()
+struct socket_receiver::replica : output_table
 {
-	close();
-	// remove any open formatters
-	for(auto&& f : fmtr)
-		formatter::destroy(f.second);
-}
+	std::vector<std::unique_ptr<columns>> groups;
+	std::vector<std::unique_ptr<basic_column>> cols;
+	string schema;			// the schema text, the same for all senders
+	size_t stride;
+	block_codec codec;		// the decoder of encoded frames
+	std::vector<char> records;	// the decoded records
+	std::vector<size_t> ends;	// the offsets of the last bytes of strings
+	size_t active;			// the senders between prolog and epilog
+
+	replica(const string& n, table_flavor f)
+	: output_table(n, f), stride(0), active(0) 
+	{ }
+	~replica() { }
+};
 
+struct socket_receiver::peer
+{
+	int fd;							// the connection, or -1 for UDP
+	string addr;					// the source address, for UDP
+	std::vector<char> inbuf;		// data not yet processed
+	std::map<uint16_t, replica*> tables;	// the active tables of the peer
+};
 
-void output_c_file::output_prolog(output_table& table)
+socket_receiver::socket_receiver(output_file* _sink, uint16_t port, bool _udp, const string& _prefix,
+	const string& address)
+: sink(_sink), prefix(_prefix), udp(_udp), lfd(-1), _port(0), maxframe(default_socket_max_frame)
 {
-	// Create formatter for table
-	if(fmtr.count(&table)>0) return;
-	auto form = fmtr[&table] = formatter::create(this, table, fmt);
-	form->prolog();
+	sockaddr_in addr {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(!address.empty() && inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+		throw std::invalid_argument("Bad IPv4 address `"+address+"'");
+
+	lfd = socket(AF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK, 0);
+	if(lfd < 0)
+		throw std::runtime_error(string("Could not create socket: ")+strerror(errno));
+	int one = 1;
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	socklen_t len = sizeof(addr);
+	if(::bind(lfd, (sockaddr*) &addr, sizeof(addr)) != 0 
+		|| (!udp && listen(lfd, 64) != 0)
+		|| getsockname(lfd, (sockaddr*) &addr, &len) != 0) {
+		int err = errno;
+		::close(lfd);
+		throw std::runtime_error("Could not listen on port "+std::to_string(port)+": "+strerror(err));
+	}
+	_port = ntohs(addr.sin_port);
 }
 
-void output_c_file::output_row(output_table& table)
+socket_receiver::~socket_receiver()
 {
-	fmtr.at(&table)->row();
+	for(auto& p : peers)
+		if(p->fd >= 0) ::close(p->fd);
+	peers.clear();
+	for(auto& r : replicas)
+		if(r.second->is_locked())
+			r.second->epilog();
+	replicas.clear();
+	::close(lfd);
 }
 
-void output_c_file::output_epilog(output_table& table)
-{ 
-	auto form = fmtr.at(&table);
-	form->epilog();
-
-	fmtr.erase(&table);
-	formatter::destroy(form);
+output_table* socket_receiver::table(const string& name) const
+{
+	auto found = replicas.find(name);
+	return (found == replicas.end()) ? nullptr : found->second.get();
 }
 
-
-
-
-output_c_file output_stdout(stdout, false);
-output_c_file output_stderr(stderr, false);
-
-
-//-------------------------------------
-//
-// A memory file 
-//
-//-------------------------------------
-
-
-output_mem_file::output_mem_file(text_format fmt)
-	: output_c_file(fmt), state(0)
+void socket_receiver::drop(peer& p)
 {
-	state = new memstate();
-	state->buffer = nullptr;
-	state->len = 0;
-	FILE* f = open_memstream(&state->buffer, &state->len);
-	open(f, true);
+	for(auto& t : p.tables)
+		if(--t.second->active == 0)
+			t.second->epilog();
+	p.tables.clear();
+	if(p.fd >= 0) ::close(p.fd);
+	p.fd = -1;
 }
 
-output_mem_file::~output_mem_file()
+size_t socket_receiver::frame(peer& p, const socket_frame& f, char* payload)
 {
-	if(stream != nullptr) 
-		close();
-	if(state) {
-		free(state->buffer);
-		delete state;
-	}
+	switch(f.kind) {
+	case socket_frame::schema: {
+		auto known = p.tables.find(f.table);
+		if(known != p.tables.end())
+			return 0;	// a repeated schema
+
+		string desc(payload, f.length);
+		std::istringstream in(desc);
+		string name, line;
+		int flavor = 0;
+		size_t stride = 0;
+		std::getline(in, name);
+		in >> flavor >> stride;
+		std::getline(in, line);
+
+		replica* r;
+		auto found = replicas.find(name);
+		if(found == replicas.end()) {
+			// a new table, with the columns of the schema
+			std::unique_ptr<replica> nr(new replica(prefix+name, 
+				flavor ? table_flavor::TIMESERIES : table_flavor::RESULTS));
+			nr->schema = desc;
+			nr->stride = stride;
+			std::map<string, column_group*> groups;
+			while(std::getline(in, line)) {
+				std::vector<string> fields;
+				boost::split(fields, line, boost::is_any_of("\t"));
+				const __wire_type* w = fields.size()==4 ? __find_wire_type(fields[0]) : nullptr;
+				// the format is used by text files, so it must be harmless
+				if(!w || !__safe_wire_format(fields[2], *w) 
+					|| (w->arg=='s' && std::stoul(fields[1]) < 1))
+					throw std::runtime_error("Bad schema for table `"+name+"'");
+				std::vector<string> path;
+				boost::split(path, fields[3], boost::is_any_of("/"));
+				column_group* grp = nr.get();
+				string gpath;
+				for(size_t i=0; i+1<path.size(); i++) {
+					gpath += path[i] + "/";
+					column_group*& g = groups[gpath];
+					if(! g) {
+						nr->groups.emplace_back(new columns(grp, path[i]));
+						g = nr->groups.back().get();
+					}
+					grp = g;
+				}
+				nr->cols.emplace_back(w->make(grp, path.back(), fields[2], std::stoul(fields[1])));
+			}
+			if(nr->plan().size() != stride)
+				throw std::runtime_error("Bad layout for table `"+name+"'");
+			nr->codec = block_codec(nr->plan());
+			for(auto& e : nr->plan())
+				if(e.tag == type_tag::string)
+					nr->ends.push_back(e.offset + e.size - 1);
+			nr->bind(sink);
+			r = nr.get();
+			replicas[name] = std::move(nr);
+		} else {
+			r = found->second.get();
+			if(r->schema != desc)
+				throw std::runtime_error("Different schemas for table `"+name+"'");
+		}
 
+		p.tables[f.table] = r;
+		if(r->active++ == 0)
+			r->prolog();
+		return 0;
+	}
+	case socket_frame::rows: 
+	case socket_frame::encoded: {
+		auto known = p.tables.find(f.table);
+		if(known == p.tables.end())
+			return 0;	// e.g., a UDP sender whose schema was lost
+		replica* r = known->second;
+		size_t raw = f.raw ? f.raw : f.length;
+		if(raw > maxframe || f.nrows > maxframe / std::max(r->stride, (size_t)1))
+			throw std::runtime_error("Frame too large for table `"+r->name()+"'");
+		if(f.kind == socket_frame::rows && raw != f.nrows * r->stride)
+			throw std::runtime_error("Bad row frame for table `"+r->name()+"'");
+		if(f.raw) {
+			zbuf.resize(raw);
+			uLongf zlen = raw;
+			if(uncompress((Bytef*) zbuf.data(), &zlen, (const Bytef*) payload, f.length) != Z_OK || zlen != raw)
+				throw std::runtime_error("Bad compressed frame for table `"+r->name()+"'");
+			payload = zbuf.data();
+		}
+		if(f.kind == socket_frame::encoded) {
+			r->records.resize(f.nrows * r->stride);
+			r->codec.decode(payload, raw, f.nrows, r->records.data());
+			payload = r->records.data();
+		}
+		// the strings end within their fields
+		for(size_t i=0; i<f.nrows; i++)
+			for(size_t e : r->ends)
+				payload[i*r->stride + e] = 0;
+		r->emit_rows(f.nrows, payload);
+		return f.nrows;
+	}
+	case socket_frame::epilog: {
+		auto known = p.tables.find(f.table);
+		if(known == p.tables.end())
+			return 0;
+		replica* r = known->second;
+		p.tables.erase(known);
+		if(--r->active == 0)
+			r->epilog();
+		return 0;
+	}
+	default:
+		throw std::runtime_error("Bad frame");
+	}
 }
 
-const char* output_mem_file::contents()
+size_t socket_receiver::process(peer& p, char* data, size_t bytes)
 {
-	fflush(stream);
-	return state->buffer;
+	// the complete frames, the rest is left for later
+	size_t rows = 0, pos = 0;
+	while(bytes - pos >= sizeof(socket_frame)) {
+		socket_frame f;
+		memcpy(&f, data + pos, sizeof(f));
+		// do not wait for a frame larger than the limit
+		if(f.length > maxframe)
+			throw std::runtime_error("Frame too large");
+		if(bytes - pos - sizeof(f) < f.length)
+			break;
+		rows += frame(p, f, data + pos + sizeof(f));
+		pos += sizeof(f) + f.length;
+	}
+	p.inbuf.erase(p.inbuf.begin(), p.inbuf.begin() + std::min(pos, p.inbuf.size()));
+	return rows;
 }
 
-string output_mem_file::str()
+size_t socket_receiver::poll(int timeout_ms)
 {
-	return string(contents());
-}
+	std::vector<pollfd> fds { { lfd, POLLIN, 0 } };
+	if(! udp)
+		for(auto& p : peers)
+			fds.push_back({ p->fd, POLLIN, 0 });
+	if(::poll(fds.data(), fds.size(), timeout_ms) <= 0)
+		return 0;
+
+	size_t rows = 0;
+	if(fds[0].revents & POLLIN) {
+		if(udp) {
+			dgram.resize(65536);
+			for(;;) {
+				sockaddr_storage from;
+				socklen_t len = sizeof(from);
+				ssize_t n = recvfrom(lfd, dgram.data(), dgram.size(), 0, (sockaddr*) &from, &len);
+				if(n < 0) break;
+				string addr((const char*) &from, len);
+				auto found = std::find_if(peers.begin(), peers.end(), 
+					[&](const std::unique_ptr<peer>& p) { return p->addr == addr; });
+				if(found == peers.end()) {
+					peers.emplace_back(new peer { -1, addr, {}, {} });
+					found = peers.end()-1;
+				}
+				// a bad datagram is dropped
+				try {
+					rows += process(**found, dgram.data(), n);
+				} catch(std::exception&) { }
+			}
+		} else {
+			int cfd;
+			while((cfd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0)
+				peers.emplace_back(new peer { cfd, string(), {}, {} });
+		}
+	}
 
+	// read from the connections, with the poll results
+	for(size_t i=1; i<fds.size(); i++) {
+		if(! (fds[i].revents & (POLLIN|POLLHUP|POLLERR)))
+			continue;
+		peer& p = *peers[i-1];
+		bool closed = false;
+		for(;;) {
+			size_t old = p.inbuf.size();
+			p.inbuf.resize(old + (1<<16));
+			ssize_t n = recv(p.fd, p.inbuf.data()+old, 1<<16, 0);
+			p.inbuf.resize(old + std::max(n, (ssize_t)0));
+			if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				closed = true;
+			if(n <= 0) break;
+		}
+		try {
+			rows += process(p, p.inbuf.data(), p.inbuf.size());
+		} catch(std::exception&) {
+			// a bad stream ends the connection
+			closed = true;
+		}
+		if(closed) drop(p);
+	}
+	// drop closed connections, and UDP sources with no active table
+	peers.erase(std::remove_if(peers.begin(), peers.end(), 
+		[&](const std::unique_ptr<peer>& p) { return udp ? p->tables.empty() : p->fd < 0; }), 
+		peers.end());
+	return rows;
+}
 
 
 //-------------------------------------
@@ -892,41 +5494,95 @@ string output_mem_file::str()
 
 progress_bar::progress_bar(FILE* s, size_t b, const string& msg)
 		: stream(s), message(msg), 
-		N(0), i(0), ni(0), B(b), l(0), finished(false)
+		N(0), i(0), ni(~0ull), B(b), finished(true),
+		interval(std::chrono::milliseconds(100))
 		{ }
 
+void progress_bar::set_interval(std::chrono::milliseconds ms)
+{
+	interval = ms;
+}
+
 void progress_bar::start(unsigned long long _N)
 {	
 	N = _N;
-	i=0; ni=0; l=0;
+	i.store(0, std::memory_order_relaxed);
+	finished = false;
+	t0 = clock::now();
+	redraw(true);
+}
 
-	ni = nexti();
-	size_t spc = B+1+message.size();
-	for(size_t j=0; j< spc; j++) putchar(' ');
-	fprintf(stream, "]\r%s[", message.c_str());
-	fflush(stream);
-	tick(0);
+double progress_bar::rate() const
+{
+	double secs = std::chrono::duration<double>(clock::now() - t0).count();
+	return secs > 0 ? ticks() / secs : 0.0;
+}
+
+double progress_bar::eta() const
+{
+	llint n = ticks();
+	if(n == 0) return -1.0;
+	if(n >= N) return 0.0;
+	return (N - n) / rate();
 }
 
-void progress_bar::adjustBar()
+// a duration as [h:]mm:ss
+static void __format_duration(char* buf, size_t size, double secs)
 {
-	if(i>N) i=N;
-	while(i >= ni)  {
-		++l; ni = nexti();
-		if(l<=B) { fputc('#', stream); }
+	unsigned long long s = (unsigned long long) (secs + 0.5);
+	if(s >= 3600)
+		snprintf(buf, size, "%llu:%02llu:%02llu", s/3600, (s/60)%60, s%60);
+	else
+		snprintf(buf, size, "%llu:%02llu", s/60, s%60);
+}
+
+void progress_bar::redraw(bool force)
+{
+	// one thread draws, the others go on
+	std::unique_lock<std::mutex> lock(drawing, std::try_to_lock);
+	if(! lock.owns_lock()) {
+		if(! force) return;
+		lock.lock();
 	}
-	fflush(stream);
-	if(l==B) {
-		fprintf(stream,"\n");
-		finished = true;
+	if(finished) return;
+
+	llint n = std::min(ticks(), N);
+	clock::time_point now = clock::now();
+	bool done = (n >= N);
+
+	// the next check point, after the ticks of an interval
+	double r = rate();
+	llint step = std::max((llint) (r * std::chrono::duration<double>(interval).count()), 1ull);
+	ni.store(done ? ~0ull : std::min(n + step, N), std::memory_order_relaxed);
+	if(! force && ! done && now - last < interval)
+		return;
+	last = now;
+
+	llint l = N ? (B*n)/N : B;
+	string line = "\r" + message + "[" + string(l, '#') + string(B-l, ' ') + "]";
+	char buf[64];
+	snprintf(buf, sizeof(buf), " %3llu%%", N ? (100*n)/N : 100);
+	line += buf;
+	if(n > 0) {
+		snprintf(buf, sizeof(buf), " %.3g/s", r);
+		line += buf;
+		if(! done) {
+			__format_duration(buf, sizeof(buf), eta());
+			line += " ETA ";
+			line += buf;
+		}
 	}
+	line += done ? "\n" : "   ";
+	fputs(line.c_str(), stream);
+	fflush(stream);
+	if(done) finished = true;
 }
 
 void progress_bar::finish()
 {
 	if(finished) return;
-	if(i<N)
-		tick(N-i);
+	complete(N);
+	redraw(true);
 }
 
 
@@ -946,135 +5602,218 @@ void progress_bar::finish()
 
 
 
-std::map<type_index, H5::DataType> __pred_type_map = 
+// the HDF5 type of a column, from its type tag
+H5::DataType hdf_mapped_type(const row_plan::entry& e)
 {
-	{typeid(bool), H5::PredType::NATIVE_UCHAR},
-
-	{typeid(char), H5::PredType::NATIVE_CHAR},
-	{typeid(signed char), H5::PredType::NATIVE_SCHAR},	
-	{typeid(short), H5::PredType::NATIVE_SHORT},
-	{typeid(int), H5::PredType::NATIVE_INT},
-	{typeid(long), H5::PredType::NATIVE_LONG},
-	{typeid(long long), H5::PredType::NATIVE_LLONG},
-
-	{typeid(unsigned char), H5::PredType::NATIVE_UCHAR},
-	{typeid(unsigned short), H5::PredType::NATIVE_USHORT},
-	{typeid(unsigned int), H5::PredType::NATIVE_UINT},
-	{typeid(unsigned long), H5::PredType::NATIVE_ULONG},
-	{typeid(unsigned long long), H5::PredType::NATIVE_ULLONG},
+	using namespace H5;
+	switch(e.tag) {
+	case type_tag::boolean: return PredType::NATIVE_UCHAR;
+	case type_tag::int8: return PredType::NATIVE_INT8;
+	case type_tag::uint8: return PredType::NATIVE_UINT8;
+	case type_tag::int16: return PredType::NATIVE_INT16;
+	case type_tag::uint16: return PredType::NATIVE_UINT16;
+	case type_tag::int32: return PredType::NATIVE_INT32;
+	case type_tag::uint32: return PredType::NATIVE_UINT32;
+	case type_tag::int64: return PredType::NATIVE_INT64;
+	case type_tag::uint64: return PredType::NATIVE_UINT64;
+	case type_tag::float32: return PredType::NATIVE_FLOAT;
+	case type_tag::float64: return PredType::NATIVE_DOUBLE;
+	case type_tag::ldouble: return PredType::NATIVE_LDOUBLE;
+	case type_tag::string: return StrType(0, e.size);
+	default:
+		throw std::logic_error(string("HDF5 mapping for type '")+
+			e.type.name()+"' not known");
+	}
+}
 
-	{typeid(float), H5::PredType::NATIVE_FLOAT},
-	{typeid(double), H5::PredType::NATIVE_DOUBLE},
-	{typeid(long double), H5::PredType::NATIVE_LDOUBLE}
-};
 
+void output_hdf5::table_handler::make_row(char* buffer) 
+{
+	table.plan().pack(buffer);
+}
 
-H5::DataType hdf_mapped_type(basic_column* col)
+output_hdf5::table_handler::table_handler(output_table& _table, size_t _rows, size_t _bytes) 
+: table(_table), colpos(table.size(),0), size(0), align(1), nrows(0), capacity(1),
+	counters(nullptr)
 {
-	// make it simple-minded for now
-	using namespace std::string_literals;
-	auto predit = __pred_type_map.find(col->type());
-	if(predit!=__pred_type_map.end()) 
-		return predit->second;
-	else if(col->type() == typeid(string)) {
-		return H5::StrType(0, col->size());
-	} else {
-		throw std::logic_error("HDF5 mapping for type '"s+
-			col->type().name()+"' not known"s);
+	// the layout is that of the table's row plan
+	const row_plan& plan = table.plan();
+	size = plan.size();
+	align = plan.align();
+
+	// now, compute the type
+	type = H5::CompType(size);
+	for(size_t i=0;i<plan.columns();i++) {
+		colpos[i] = plan[i].offset;
+		type.insertMember(plan.path(i), colpos[i], hdf_mapped_type(plan[i]));
 	}
-}
 
+	// size the staging buffer, either in rows or by a byte budget
+	if(_rows > 0)
+		capacity = _rows;
+	else if(size > 0)
+		capacity = std::max(_bytes/size, (size_t)1);
 
-inline static size_t __aligned(size_t pos, size_t al) {
-	assert( (al&(al-1)) == 0); // al is a power of 2
-	return al*((pos+al-1)/al);
+	// the staging buffer is zeroed once, so that padding is always clean
+	rowbuf.assign(size*capacity, 0);
 }
 
-void output_hdf5::table_handler::make_row(char* buffer) 
+// Filter ids of the third-party filters, as registered with the HDF Group
+static const H5Z_filter_t __lzf_filter = 32000;
+static const H5Z_filter_t __blosc_filter = 32001;
+
+static void __set_filter(const H5::DSetCreatPropList& props, H5Z_filter_t filter,
+	const char* name, size_t nelmts, const unsigned* values)
 {
-	size_t pos = 0;
-	for(size_t i=0; i< table.size(); i++) {
-		if(i>0) pos = __aligned(pos+table[i-1]->size(), table[i]->align());
-		assert(pos == colpos[i]);
-		table[i]->copy(buffer + pos);
-	}
+	using namespace std::string_literals;
+	if(H5_CHECK(H5Zfilter_avail(filter)) == 0)
+		throw std::runtime_error("HDF5 filter "s+name+" is not available");
+	props.setFilter(filter, H5Z_FLAG_MANDATORY, nelmts, values);
 }
 
-output_hdf5::table_handler::table_handler(output_table& _table) 
-: table(_table), colpos(table.size(),0), size(0), align(1)
+static H5::DSetAccPropList __access_props(const hdf5_dataset_options& opts)
 {
-	// first compute the size of the whole
-	// thing
-	for(size_t i=0;i<table.size();i++) {
-		align = std::max(align, table[i]->align());
-		if(i>0) size = __aligned(size, table[i]->align());
-		size += table[i]->size();
-	}
-	if(table.size()>0) size = __aligned(size, table[0]->align());
-	// now, compute the type
-	size_t pos = 0;
-	type = H5::CompType(size);
-	for(size_t i=0;i<table.size();i++) {
-		basic_column* c = table[i];
-		if(i>0) pos = __aligned(pos+table[i-1]->size(), table[i]->align());
-		colpos[i] = pos;
-		type.insertMember(c->path_name(), pos, hdf_mapped_type(c));
-	}
+	H5::DSetAccPropList props;
+	if(opts.chunk_cache > 0)
+		props.setChunkCache(H5D_CHUNK_CACHE_NSLOTS_DEFAULT, opts.chunk_cache, 
+			H5D_CHUNK_CACHE_W0_DEFAULT);
+	return props;
 }
 
-void output_hdf5::table_handler::create_dataset(const H5::Group& loc)
+void output_hdf5::table_handler::create_dataset(const H5::Group& loc,
+	const hdf5_dataset_options& opts)
 {
 	using namespace H5;
 	// it does not! create it
+	hsize_t chunk = opts.chunk_rows;
+	if(chunk == 0)
+		chunk = std::max(default_hdf5_chunk_bytes / std::max(size, (size_t)1), (size_t)16);
+
 	hsize_t zdim[] = { 0 };
-	hsize_t cdim[] = { 16 };
+	hsize_t cdim[] = { chunk };
 	hsize_t mdim[] = { H5S_UNLIMITED };
 	DataSpace dspace(1, zdim, mdim);
 	DSetCreatPropList props;
 	props.setChunk(1, cdim);
 
+	// the filter pipeline (blosc does its own shuffling)
+	if(opts.shuffle && opts.compression != hdf5_compression::blosc)
+		props.setShuffle();
+	switch(opts.compression) {
+	case hdf5_compression::none:
+		break;
+	case hdf5_compression::deflate:
+		props.setDeflate(opts.level);
+		break;
+	case hdf5_compression::lzf:
+		__set_filter(props, __lzf_filter, "lzf", 0, nullptr);
+		break;
+	case hdf5_compression::blosc: {
+		// the first 4 values are filled in by the filter itself
+		unsigned values[] = { 0, 0, 0, 0, opts.level, opts.shuffle, 0 };
+		__set_filter(props, __blosc_filter, "blosc", 7, values);
+		break;
+	}
+	}
+
 	dataset = loc.createDataSet(table.name(), 
-			type, dspace, props);		
+			type, dspace, props, __access_props(opts));		
 }
 
-void output_hdf5::table_handler::append_row()
+void output_hdf5::table_handler::open_dataset(const H5::Group& loc,
+	const hdf5_dataset_options& opts)
 {
 	using namespace H5;
-	// Make the image of an object.
+	DataSet dset = loc.openDataSet(table.name(), __access_props(opts));
+
+	// ok, the dataset exists, just check compatibility
+	hid_t dset_type = H5_CHECK(H5Dget_type(dset.getId()));
+
+	if(! (type == DataType(dset_type)))
+		throw std::runtime_error("On appending to HDF table,"\
+			" types are not compatible");
+
+	dataset = dset;
+}
+
+void output_hdf5::table_handler::append_row()
+{
+	// Make the image of an object in the staging buffer.
 	// This need not be aligned as far as I can tell!!!!!
-	char buffer[size];
-	memset(buffer,0,size); // this should silence valgrind
-	make_row(buffer);
+	make_row(rowbuf.data() + nrows*size);
+	if(++nrows == capacity)
+		flush_rows();
+}
+
+void output_hdf5::table_handler::append_record(const char* record)
+{
+	memcpy(rowbuf.data() + nrows*size, record, size);
+	if(++nrows == capacity)
+		flush_rows();
+}
+
+void output_hdf5::table_handler::append_records(const char* records, size_t n)
+{
+	if(nrows + n < capacity) {
+		memcpy(rowbuf.data() + nrows*size, records, n*size);
+		nrows += n;
+		return;
+	}
+	// keep the order of the rows, then write the records in place
+	flush_rows();
+	write_records(records, n);
+}
+
+void output_hdf5::table_handler::flush_rows()
+{
+	if(nrows==0) return;
+	write_records(rowbuf.data(), nrows);
+	nrows = 0;
+}
+
+void output_hdf5::table_handler::write_records(const char* records, size_t n)
+{
+	using namespace H5;
 
 	/*
 	Note: the following function is not yet supported in the 
 	hdf5 version of Ubuntu :-(
 
-	H5DOappend(dataset.getId(), H5P_DEFAULT, 0, 1, type, buffer);
+	H5DOappend(dataset.getId(), H5P_DEFAULT, 0, nrows, type, buffer);
 
 	So, we must do the append "manually"
 	*/
 
-	// extend the dataset by one row
+	// extend the dataset by the buffered rows
 	DataSpace tabspc = dataset.getSpace();
 	assert(tabspc.getSimpleExtentNdims()==1);
 	hsize_t ext[1];
 	tabspc.getSimpleExtentDims(ext);
-	ext[0]++;
+	hsize_t start[] = { ext[0] };
+	hsize_t count[] = { n };
+	ext[0] += n;
 	dataset.extend(ext);
 
 	// create table space
 	tabspc = dataset.getSpace();
-	hsize_t dext[] = { 1 };
-	ext[0]--;  // use the old extent
-	tabspc.selectHyperslab(H5S_SELECT_SET, dext, ext);
-	DataSpace memspc;  // scalar dataspace
-
-	dataset.write(buffer, type, memspc, tabspc);
+	tabspc.selectHyperslab(H5S_SELECT_SET, count, start);
+	DataSpace memspc(1, count);
+
+	dataset.write(records, type, memspc, tabspc);
+	if(counters && output_stats::enabled()) {
+		counters->extends.add();
+		counters->writes.add();
+		counters->bytes.add(n*size);
+	}
 }
 
 output_hdf5::table_handler::~table_handler() 
 {
+	// rows still buffered are written out; an error here cannot be
+	// reported, since we are in a destructor
+	try {
+		flush_rows();
+	} catch(...) { }
 	dataset.close();
 }
 
@@ -1087,12 +5826,16 @@ output_hdf5::table_handler::~table_handler()
 
 output_hdf5::~output_hdf5()
 {
+	// this writes out any rows left in the buffers
+	for(auto&& h : _handler)
+		delete h.second;
+	_handler.clear();
 	H5_CHECK(H5Idec_ref(locid));
 }
 
 
 output_hdf5::output_hdf5(long int _locid, open_mode _mode)
-: locid(_locid), mode(_mode)
+: locid(_locid), mode(_mode), buf_rows(1), buf_bytes(0)
 {
 	H5_CHECK(H5Iinc_ref(locid));
 }
@@ -1116,7 +5859,8 @@ output_hdf5::table_handler* output_hdf5::handler(output_table& table)
 {
 	auto it = _handler.find(&table);
 	if(it==_handler.end()) {
-		table_handler* sc = new table_handler(table);
+		table_handler* sc = new table_handler(table, buf_rows, buf_bytes);
+		sc->counters = &_counters;
 		_handler[&table] = sc;
 		return sc;
 	} else
@@ -1137,19 +5881,9 @@ void output_hdf5::output_prolog(output_table& table)
 	if(this->mode == open_mode::append) {
 		// check if an object by the given name exists in the loc
 		if(hdf5_exists(locid, table.name())) {
-			DataSet dset = loc.openDataSet(table.name());
-
-			// ok, the dataset exists, just check compatibility
-			hid_t dset_type = H5_CHECK(H5Dget_type(dset.getId()));
-
-			if(! (th->type == DataType(dset_type)))
-				throw std::runtime_error("On appending to HDF table,"\
-					" types are not compatible");
-
-			th->dataset = dset;
-
+			th->open_dataset(loc, dataset_options(table));
 		} else {
-			th->create_dataset(loc);
+			th->create_dataset(loc, dataset_options(table));
 		}
 	} else {
 		assert(mode==open_mode::truncate);
@@ -1157,7 +5891,7 @@ void output_hdf5::output_prolog(output_table& table)
 		if(hdf5_exists(locid, table.name())) {
 			loc.unlink(table.name());
 		}
-		th->create_dataset(loc);
+		th->create_dataset(loc, dataset_options(table));
 	}
 
 
@@ -1172,16 +5906,156 @@ void output_hdf5::output_row(output_table& table)
 
 }
 
+void output_hdf5::output_row(const row_view& r)
+{	
+	handler(r.table)->append_record(r.record);
+}
+
+void output_hdf5::output_rows(const row_view& first, size_t n)
+{	
+	handler(first.table)->append_records(first.record, n);
+}
+
+
+void output_hdf5::set_buffer_rows(size_t rows)
+{
+	buf_rows = std::max(rows, (size_t)1);
+	buf_bytes = 0;
+}
+
+void output_hdf5::set_buffer_bytes(size_t bytes)
+{
+	buf_rows = 0;
+	buf_bytes = bytes;
+}
+
+static void __check_dataset_options(const hdf5_dataset_options& opts)
+{
+	if(opts.level > 9)
+		throw std::invalid_argument("HDF5 compression level "+std::to_string(opts.level)+" is not in 0 to 9");
+}
+
+void output_hdf5::set_dataset_options(const hdf5_dataset_options& opts)
+{
+	__check_dataset_options(opts);
+	dset_opts = opts;
+}
+
+void output_hdf5::set_dataset_options(output_table& table, const hdf5_dataset_options& opts)
+{
+	__check_dataset_options(opts);
+	table_opts[&table] = opts;
+}
+
+const hdf5_dataset_options& output_hdf5::dataset_options(output_table& table) const
+{
+	auto it = table_opts.find(&table);
+	return (it != table_opts.end()) ? it->second : dset_opts;
+}
+
+void output_hdf5::flush()
+{
+	stat_timer timer(_counters.flushes, _counters.flush_ns);
+	for(auto&& h : _handler)
+		h.second->flush_rows();
+	H5_CHECK(H5Fflush(locid, H5F_SCOPE_LOCAL));
+}
+
 
 void output_hdf5::output_epilog(output_table& table)
 {
-	// just delete the handler
+	// write out any buffered rows and delete the handler
 	auto it = _handler.find(&table);
 	if(it != _handler.end()) {
+		it->second->flush_rows();
 		delete it->second;
 		_handler.erase(it);		
 	}
 }
 
 
-} // end namespace tables
\ No newline at end of file
+/*
+ *
+ * Virtual datasets over shards
+ *
+ */
+
+size_t hdf5_stitch_shards(const H5::Group& loc, const std::vector<string>& shards,
+	const std::vector<string>& tables, const string& group)
+{
+	using namespace H5;
+	if(shards.empty())
+		throw std::invalid_argument("No shards to stitch");
+
+	std::vector<string> names = tables;
+	if(names.empty()) {
+		H5File first(shards[0], H5F_ACC_RDONLY);
+		Group g = first.openGroup(group);
+		for(hsize_t i=0; i<g.getNumObjs(); i++)
+			if(g.getObjTypeByIdx(i) == H5G_DATASET)
+				names.push_back(g.getObjnameByIdx(i));
+	}
+
+	string prefix = group;
+	if(prefix.empty() || prefix.back() != '/')
+		prefix += '/';
+
+	size_t total = 0;
+	for(const string& name : names) {
+		// the rows and the type of the shards
+		std::vector<hsize_t> rows(shards.size(), 0);
+		DataType type;
+		bool typed = false;
+		for(size_t i=0; i<shards.size(); i++) {
+			H5File shard(shards[i], H5F_ACC_RDONLY);
+			Group g = shard.openGroup(group);
+			if(! hdf5_exists(g.getId(), name))
+				continue;
+			DataSet dset = g.openDataSet(name);
+			DataSpace space = dset.getSpace();
+			if(space.getSimpleExtentNdims() != 1)
+				throw std::runtime_error("Dataset `"+name+"' in shard `"+shards[i]+"' is not a table");
+			space.getSimpleExtentDims(&rows[i]);
+			DataType dtype = dset.getDataType();
+			if(! typed) {
+				type = dtype;
+				typed = true;
+			} else if(! (type == dtype))
+				throw std::runtime_error("The types of table `"+name+"' differ among the shards");
+		}
+		if(! typed)
+			throw std::runtime_error("Table `"+name+"' is in none of the shards");
+
+		// the mappings of the shards to consecutive rows
+		hsize_t n = 0;
+		for(hsize_t r : rows) n += r;
+		DataSpace vspace(1, &n, &n);
+		DSetCreatPropList props;
+		hsize_t start = 0;
+		for(size_t i=0; i<shards.size(); i++) {
+			if(rows[i] == 0) continue;
+			DataSpace src(1, &rows[i]);
+			vspace.selectHyperslab(H5S_SELECT_SET, &rows[i], &start);
+			H5_CHECK(H5Pset_virtual(props.getId(), vspace.getId(), shards[i].c_str(), 
+				(prefix+name).c_str(), src.getId()));
+			start += rows[i];
+		}
+		vspace.selectAll();
+
+		if(hdf5_exists(loc.getId(), name))
+			loc.unlink(name);
+		loc.createDataSet(name, type, vspace, props);
+		total += n;
+	}
+	return total;
+}
+
+size_t hdf5_stitch_shards(const string& h5file, const std::vector<string>& shards,
+	const std::vector<string>& tables, const string& group)
+{
+	H5::H5File file(h5file, H5F_ACC_TRUNC);
+	return hdf5_stitch_shards(file.openGroup("/"), shards, tables, group);
+}
+
+
+} // end namespace tables
@@ -7,9 +7,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdio>
 #include <cstring>
+#include <cstdint>
 #include <list>
 #include <map>
 #include <unordered_map>
@@ -18,6 +20,20 @@
 #include <typeinfo>
 #include <typeindex>
 #include <iostream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <type_traits>
 
 #include "hdf5_fwd.hh"
 
@@ -164,6 +180,9 @@ namespace tables
 	protected:
 		std::vector<column_item *> _children;					//< the children
 		std::unordered_map<string, column_item*> _item_names;	//< the child names (must be unique)
+		size_t _ncols;		//< the number of columns in this subtree
+
+		friend class basic_column;
 
 		/**
 			Signals that children have been deleted.
@@ -179,15 +198,33 @@ namespace tables
 		void _mark_dirty();
 
 		/**
-			Mark the owning table's column vector as bad. This is happening whenever the
-			items of the group change in any way.
+			Clean this column_group and recurse to its children.
 		  */
-		void _mark_dirty_columns();
+		virtual void _cleanup();
 
 		/**
-			Clean this column_group and recurse to its children.
+			The number of columns in the subtree of an item.
 		  */
-		virtual void _cleanup();
+		static size_t _column_count(column_item* item);
+
+		/**
+			The number of columns of the owning table that precede
+			a child of this group (in pre-order).
+		  */
+		size_t _position(column_item* child);
+
+		/**
+			Update the column counts and the owning table, if any, for
+			a child just added. With \c column_only, the child has 
+			already been added, and has just become a column.
+		  */
+		void _attach(column_item* child, bool column_only=false);
+
+		/**
+			Update the column counts and the owning table, if any, for
+			a child about to be removed.
+		  */
+		void _detach(column_item* child);
 
 		/**
 			Constructor
@@ -274,11 +311,12 @@ namespace tables
 		  	\verbatim
 		  	N1/N2/.../Nk
 		  	\endverbatim
-		  	where each Ni is a name.
+		  	where each Ni is a name. On a table, this is a single lookup
+			in an index of the path names of all its items.
 
 			@param path the path to an item, starting from this group
 			@returns an item
-			@throws std::invalid_argument if the path does not exist
+			@throws std::out_of_range if the path does not exist
 		  */
 		column_item* get_item(const string& path);
 
@@ -354,6 +392,28 @@ namespace tables
 		  */
 		virtual void copy(void*) = 0;
 
+		/**
+			@brief A function copying the binary value of a column.
+		  */
+		typedef void (*copy_function)(basic_column*, void*);
+
+		/**
+			@brief Return the address of the column's value, if it
+			can be copied from there directly.
+
+			This is used by \c row_plan to copy values with \c memcpy.
+			The default implementation returns nullptr.
+		  */
+		virtual const void* value_address() const { return nullptr; }
+
+		/**
+			@brief Return a function that copies this column's value.
+
+			This is used by \c row_plan when \c value_address() is null.
+			The default implementation returns a function calling \c copy().
+		  */
+		virtual copy_function copier() const;
+
 		/**
 			@brief Return true if the column type is arithmetic
 		  */
@@ -504,6 +564,11 @@ namespace tables
 		  */
 		void copy(void* ptr) override { memcpy(ptr, &val, _size); }
 
+		/**
+			@brief The address of the column value
+		  */
+		const void* value_address() const override { return &val; }
+
 		/**
 			@brief Set the column value to an arithmetic value.
 
@@ -563,10 +628,11 @@ namespace tables
 
 		inline const string& value() const { return this->val; }
 		inline string& value() { return val; }
-		inline void set_value(const string& v) {
-			val=v.substr(0,maxlen);
+		inline void set_value(std::string_view v) {
+			// reuses the capacity of the value
+			val.assign(v.data(), std::min(v.size(), maxlen));
 		}
-		inline string& operator=(const string& v) {
+		inline string& operator=(std::string_view v) {
 			set_value(v);
 			return val;
 		}
@@ -574,8 +640,9 @@ namespace tables
 			fprintf(s, format(), value().c_str());
 		}
 		void copy(void* ptr) override {
-			strncpy((char*)ptr,val.c_str(), maxlen+1);
-			((char*)ptr)[maxlen] = '\0';
+			size_t len = std::min(val.size(), maxlen);
+			memcpy(ptr, val.data(), len);
+			memset((char*)ptr + len, 0, maxlen+1-len);
 		}
 
 		void set(const string& val) override
@@ -585,6 +652,71 @@ namespace tables
 	};
 
 
+	/**
+		Column template specialization for fixed-capacity strings.
+
+		The value is held inline, as at most N-1 characters and a 
+		terminating zero. Setting the value truncates it without 
+		allocating, and keeps the unused bytes zero, so that rows are 
+		copied from the column with a plain \c memcpy. For output, 
+		the column type is \c string, as for \c column<string>.
+
+		@see column
+	  */
+	template <size_t N>
+	class column<char[N]> : public basic_column
+	{
+		static_assert(N > 0, "A string column needs room for the terminator");
+	protected:
+		char val[N];
+		size_t len;
+	public:
+		column(column_group* _grp, const string& _n, const string& fmt, std::string_view _v = {})
+		: basic_column(_grp, _n, fmt, typeid(string), N, 1), val(), len(0)
+		{ set_value(_v); }
+
+		column(const string& _n, const string& fmt, std::string_view _v = {})
+		: column(nullptr, _n, fmt, _v) { }
+
+		/**
+			@brief The current value
+		  */
+		inline std::string_view value() const { return std::string_view(val, len); }
+
+		/**
+			@brief The current value, zero-terminated
+		  */
+		inline const char* c_str() const { return val; }
+
+		/**
+			@brief Set the value, truncated to N-1 characters
+		  */
+		inline void set_value(std::string_view v) {
+			size_t n = std::min(v.size(), N-1);
+			if(n) memcpy(val, v.data(), n);
+			if(n < len) memset(val+n, 0, len-n);
+			len = n;
+		}
+
+		inline const char* operator=(std::string_view v) {
+			set_value(v);
+			return val;
+		}
+
+		void emit(FILE* s) override {
+			fprintf(s, format(), val);
+		}
+
+		void copy(void* ptr) override { memcpy(ptr, val, N); }
+
+		const void* value_address() const override { return val; }
+
+		void set(const string& v) override
+		{
+			set_value(v);
+		}
+	};
+
 
 	//
 	//
@@ -596,14 +728,22 @@ namespace tables
 		A column whose value is computed by a function.
 
 		This kind of column obtains its value by calling a function.
+		By default, the function is held by a \c std::function; with
+		a callable type \c F (e.g., that of a lambda), the callable is
+		stored in the column, and its calls can be inlined:
+		\code
+		auto clock = [&]() { return now; };
+		computed<double, decltype(clock)> t("t", "%g", clock);
+		\endcode
+		The callable is called on a const object.
 	  */
-	template <typename T>
+	template <typename T, typename F = std::function<T()>>
 	struct computed : basic_column
 	{
 		static_assert(std::is_arithmetic<T>::value,
 			"Computed column on non-arithmentic type is not allowed");
 	protected:
-		std::function<T()> func;
+		F func;
 
 	public:
 
@@ -614,10 +754,9 @@ namespace tables
 			@param fmt the column \c printf format
 			@param _f a function object to provide the value
 		  */
-		computed(const string& _n, const string& fmt,
-			const std::function<T()>& _f)
+		computed(const string& _n, const string& fmt, F _f)
 		: basic_column(nullptr, _n, fmt, typeid(T), sizeof(T), alignof(T)),
-			func(_f)
+			func(std::move(_f))
 		{ }
 
 		/**
@@ -638,7 +777,16 @@ namespace tables
 		  */
 		void copy(void* ptr) {
 			T val = func();
-			memcpy(ptr, &val, _size);
+			memcpy(ptr, &val, sizeof(T));
+		}
+
+		/**
+			@brief Return a function calling \c copy() non-virtually
+		  */
+		copy_function copier() const override {
+			return [](basic_column* c, void* ptr) {
+				static_cast<computed*>(c)->computed::copy(ptr);
+			};
 		}
 
 		/**
@@ -702,6 +850,11 @@ namespace tables
 			memcpy(ptr, &ref, _size);
 		}
 
+		/**
+			@brief The address of the referenced variable
+		  */
+		const void* value_address() const override { return &ref; }
+
 		/**
 			@brief Check if the column type is arithmetic
 		  */
@@ -776,8 +929,9 @@ namespace tables
 			@brief Copy the current value to a location
 		  */
 		void copy(void* ptr) override {
-			strncpy((char*)ptr, ref.c_str(), maxlen+1);
-	        ((char*)ptr)[maxlen] = '\0';
+			size_t len = std::min(ref.size(), maxlen);
+			memcpy(ptr, ref.data(), len);
+			memset((char*)ptr + len, 0, maxlen+1-len);
 		}
 
 		/**
@@ -817,685 +971,3320 @@ namespace tables
 
 
 
-
-	class output_file;
-	class output_table;
-	struct output_binding;
-
 	/**
-		An object that binds an output table to an output file.
+		@brief The running mean of a stream of samples.
 
-		These objects are created by the `bind()` methods in `output_file`
-		an `output_table`.
+		Aggregate columns summarize a stream of samples, passed by 
+		\c add(), in O(1) time and space per sample. Their value is the
+		current summary, so that they can be output in a \c result_table
+		at the end of a run. Setting the value of an aggregate column
+		(via \c set()) adds a sample.
 	  */
-	struct output_binding
+	class running_mean : public column<double>
 	{
-		typedef std::list<output_binding*> list;
-		typedef typename list::iterator iter;
+	protected:
+		size_t n;
+	public:
+		running_mean(column_group* _grp, const string& _n, const string& fmt="%.10g")
+		: column<double>(_grp, _n, fmt, 0.0), n(0) { }
+		running_mean(const string& _n, const string& fmt="%.10g")
+		: running_mean(nullptr, _n, fmt) { }
 
-		output_file* file;
-		output_table* table;
-		iter in_file_list, in_table_list;
+		double& operator=(double)=delete;
 
-		bool enabled;
-		output_binding(output_file* f, output_table* t);
-		~output_binding();
-		static void unbind_all(list&);
-		static output_binding* find(list&, output_file*);
-		static output_binding* find(list&, output_table*);
-	};
+		/**
+			@brief Add a sample
+		  */
+		inline void add(double x) { n++; val += (x-val)/n; }
 
+		/**
+			@brief The number of samples
+		  */
+		inline size_t count() const { return n; }
 
-	/**
-		Indicates the use for an output table
-	  */
-	enum class table_flavor {
-		RESULTS,    //< Indicate a normal table of results after a run
-		TIMESERIES  //< Indicate a time-series table, of data collected during a run
+		/**
+			@brief Forget all samples
+		  */
+		inline void reset() { n = 0; val = 0.0; }
+
+		void set(double x) override { add(x); }
 	};
 
+	/**
+		@brief The running (sample) variance of a stream of samples.
 
+		The variance is computed by Welford's algorithm.
+	  */
+	class running_var : public column<double>
+	{
+	protected:
+		size_t n;
+		double m, m2;
+	public:
+		running_var(column_group* _grp, const string& _n, const string& fmt="%.10g")
+		: column<double>(_grp, _n, fmt, 0.0), n(0), m(0.0), m2(0.0) { }
+		running_var(const string& _n, const string& fmt="%.10g")
+		: running_var(nullptr, _n, fmt) { }
 
-	/**
-		An output table.
+		double& operator=(double)=delete;
 
-		An output table contains a collection of columns.
-		Also, an output table can be bound to one or more output files.
-		During normal operations, when the `emit_row()` method is called,
-		each bound output file in turn processes the current values of
-		the columns to generate a row of output.
+		/**
+			@brief Add a sample
+		  */
+		inline void add(double x) {
+			n++;
+			double d = x - m;
+			m += d/n;
+			m2 += d*(x - m);
+			val = (n>1) ? m2/(n-1) : 0.0;
+		}
 
-		Columns can be added to a table at initialization time.
-		Once the columns are all added, and all output files are bound,
-		the `prolog()` method should be called.
-		After this point, it is legal to call `emit_row()`, therefore
-		columns should not be changed, nor should output files be
-		bound or unbound.
-		However, once the `epilog()` method is called,
-		columns can be added/removed again, and files can be bound or
-		unbound. This design allows columns to be stored separately (in other
-		objects) and be added to a table in a preparation phase.
+		/**
+			@brief The number of samples
+		  */
+		inline size_t count() const { return n; }
 
-		There are two distinct ways to orchestrate the output process.
+		/**
+			@brief The mean of the samples
+		  */
+		inline double mean() const { return m; }
 
-		- A unique process that calls `emit_row()` when it decides, e.g.
-		periodically during a simulation. In this model, each column is
-		kept updated independently, and is ready to be output at any time.
-		Since no 'central' location needs to know the state of all columns,
-		columns can be added by modules as they see fit.
-		This model is particularly suited to time-series output.
+		/**
+			@brief The standard deviation of the samples
+		  */
+		inline double stddev() const { return std::sqrt(val); }
 
-		- Many processes can call `emit_row()` when they have output
-		for this table. However, they should be careful to initialize
-		every column of the table.
+		/**
+			@brief Forget all samples
+		  */
+		inline void reset() { n = 0; m = m2 = val = 0.0; }
 
-		Output tables must have a non-empty name. No two tables can have the same
-		name. This is enforced by the library at construction time, the constructor
-		will throw an exception. The name should probably conform to the 'identifier'
-		convention, as it will be used in output formats.
+		void set(double x) override { add(x); }
+	};
 
+	/**
+		@brief The running minimum (or maximum) of a stream of samples.
+
+		Before any sample, the value is the largest (smallest) value
+		of the type.
+		@tparam T the sample type
+		@tparam Max if true, the maximum is computed
 	  */
-	class output_table : public column_group
+	template <typename T, bool Max=false>
+	class running_extreme : public column<T>
 	{
-	private:
-		bool _dirty_columns;		// flags that columns needs to be rebuilt
-		friend class column_group;
-		std::vector<basic_column *> _columns;		// the columns
-
+		static inline T initial() {
+			return Max ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+		}
 	protected:
-		bool en;					// enabled flag
-		output_binding::list files;	// the bindings
-		bool _locked;				// signal that the table allows updates
-		table_flavor _flavor;		// advice to files/formats
+		size_t n;
+	public:
+		running_extreme(column_group* _grp, const string& _n, const string& fmt)
+		: column<T>(_grp, _n, fmt, initial()), n(0) { }
+		running_extreme(const string& _n, const string& fmt)
+		: running_extreme(nullptr, _n, fmt) { }
 
-		virtual void _cleanup() override;
+		T& operator=(T)=delete;
 
-		friend struct output_binding;
 		/**
-		   @brief Construct an output table with given name and flavor.
-
-		   This method should probably not be used, instead construct
-		   \c result_table or \c time_series objects directly.
-		*/
-		output_table(const string& _name, table_flavor _f);
-		virtual ~output_table();
-
-	public:
-
+			@brief Add a sample
+		  */
+		inline void add(T x) {
+			n++;
+			if(Max ? (x > this->val) : (x < this->val)) this->val = x;
+		}
 
 		/**
-			@brief Returns this table as the owning table
+			@brief The number of samples
 		  */
-		virtual output_table* table() override;
+		inline size_t count() const { return n; }
 
+		/**
+			@brief Forget all samples
+		  */
+		inline void reset() { n = 0; this->val = initial(); }
 
-		virtual bool is_table() const override {
-			return true;
-		}
+		void set(double x) override { add(x); }
+	};
 
+	template <typename T> using running_min = running_extreme<T, false>;
+	template <typename T> using running_max = running_extreme<T, true>;
 
-		/**
-			Return the locking status of the table.
+	/**
+		@brief An approximate quantile of a stream of samples.
 
-			A table is locked once the prolog() method is called and it becomes
-			unlocked when the epilog() method is called. While a table is locked,
-			no column_item owned by this table can be added, modified or deleted.
-		  */
-		inline bool is_locked() const { return _locked; }
+		This uses the P-square algorithm of Jain and Chlamtac, which 
+		keeps five markers per quantile. For less than five samples, 
+		the quantile is exact.
+	  */
+	class running_quantile : public column<double>
+	{
+	protected:
+		double p;
+		size_t n;
+		double q[5];	// marker heights
+		double pos[5];	// marker positions
+		double want[5];	// desired marker positions
+	public:
+		running_quantile(column_group* _grp, const string& _n, double _p, const string& fmt="%.10g");
+		running_quantile(const string& _n, double _p, const string& fmt="%.10g")
+		: running_quantile(nullptr, _n, _p, fmt) { }
 
+		double& operator=(double)=delete;
 
 		/**
-			@brief Bind this table to an output_file
+			@brief Add a sample
 		  */
-		output_binding* bind(output_file* f) {
-			_check_unlocked();
-			auto b = output_binding::find(files, f);
-			if(b==nullptr)
-				b = new output_binding(f, this);
-			return b;
-		}
+		void add(double x);
 
 		/**
-			@brief Unind this table from an output_file.
-
-			If the table is not bound to the file, there is no
-			effect
+			@brief The quantile estimated
 		  */
-		bool unbind(output_file* f) {
-			_check_unlocked();
-			auto b = output_binding::find(files, f);
-			if(b) delete b;
-			return b;
-		}
+		inline double quantile() const { return p; }
 
 		/**
-			@brief Return all the bindings for this table.
+			@brief The number of samples
 		  */
-		inline auto bindings() const { return files; }
+		inline size_t count() const { return n; }
 
 		/**
-			@brief Unbind from all files
+			@brief Forget all samples
 		  */
-		void unbind_all() {
-			_check_unlocked();
-			output_binding::unbind_all(files);
-		}
+		inline void reset() { n = 0; val = 0.0; }
+
+		void set(double x) override { add(x); }
+	};
+
+	/**
+		@brief A histogram of a stream of samples, with fixed bins.
+
+		The histogram is a group of columns, holding the counts of
+		\c nbins bins of equal width in `[lo, hi)`, named `b0`, `b1`,
+		etc., preceded by the count of samples below `lo` (`under`)
+		and followed by the count of samples at or above `hi` (`over`).
+	  */
+	class histogram : public columns
+	{
+		double lo, hi, scale;
+		std::vector<std::unique_ptr<column<size_t>>> counts;
+	public:
+		histogram(column_group* par, const string& nam, double _lo, double _hi, size_t nbins);
+		histogram(const string& nam, double _lo, double _hi, size_t nbins)
+		: histogram(nullptr, nam, _lo, _hi, nbins) { }
+		~histogram();
 
 		/**
-			@brief Return the table flavor (results or time_series)
+			@brief Add a sample
 		  */
-		inline table_flavor flavor() const { return _flavor; }
+		inline void add(double x) {
+			size_t b;
+			if(x < lo) b = 0;
+			else if(x >= hi) b = counts.size()-1;
+			else b = std::min((size_t)((x-lo)*scale), counts.size()-3) + 1;
+			counts[b]->value()++;
+		}
 
 		/**
-			@brief Return the number of columns of this table
+			@brief The number of bins (excluding under- and overflow)
 		  */
-		inline size_t size() {
-			_cleanup();
-			return _columns.size();
-		}
+		inline size_t bins() const { return counts.size()-2; }
 
 		/**
-			@brief Return a column by index
+			@brief The count of a bin, where bin -1 is the underflow
+			and bin \c bins() is the overflow
 		  */
-		inline basic_column* operator[](size_t i) {
-			_cleanup();
-			return _columns.at(i);
-		}
+		inline size_t count(long bin) const { return counts.at(bin+1)->value(); }
 
 		/**
-			@brief Return a column item by name
+			@brief Forget all samples
 		  */
-		basic_column* operator[](const string& n);
+		void reset();
+	};
 
 
-		/**
-			@brief Set the enabled flag of the table
 
-			A disabled table does not emit any data, even if
-			\c emit_row() is called.
 
-			@param _en the value of the enabled flag
+	/**
+		@brief A snapshot of the output statistics of a table or file.
+
+		Statistics are collected only while enabled (see \c enable()).
+		Defining \c TABLES_NO_STATS at compile time removes them.
+	  */
+	struct output_stats
+	{
+		uint64_t rows = 0;			//< rows output
+		uint64_t bytes = 0;			//< bytes written
+		double row_seconds = 0;		//< time spent outputting rows
+		uint64_t flushes = 0;		//< calls to flush()
+		double flush_seconds = 0;	//< time spent in flush()
+		uint64_t extends = 0;		//< HDF5 dataset extensions
+		uint64_t writes = 0;		//< HDF5 dataset writes
+		uint64_t queued = 0;		//< bytes waiting in an async queue
+		uint64_t dropped = 0;		//< rows dropped by an async queue
+
+		/**
+			@brief Enable or disable the collection of statistics
 		  */
-		inline void set_enabled(bool _en) { en=_en; }
+		static void enable(bool on=true);
 
 		/**
-			@brief Return the enabled flag of the table
+			@brief Return true if statistics are collected
 		  */
-		inline bool enabled() const { return en; }
+		static inline bool enabled() {
+#ifdef TABLES_NO_STATS
+			return false;
+#else
+			return _enabled.load(std::memory_order_relaxed);
+#endif
+		}
+
+	private:
+		static std::atomic<bool> _enabled;
+	};
+
+	/**
+		@brief A statistics counter.
+
+		A counter is updated by a single thread (without atomic
+		read-modify-write operations), and can be read by any thread.
+	  */
+	class stat_counter
+	{
+		std::atomic<uint64_t> val;
+	public:
+		stat_counter() : val(0) { }
+		stat_counter(const stat_counter& other) : val(other.get()) { }
+		stat_counter& operator=(const stat_counter& other) { 
+			val.store(other.get(), std::memory_order_relaxed); 
+			return *this;
+		}
+
+		inline void add(uint64_t n=1) {
+			val.store(val.load(std::memory_order_relaxed)+n, std::memory_order_relaxed);
+		}
+		inline uint64_t get() const { return val.load(std::memory_order_relaxed); }
+		inline void reset() { val.store(0, std::memory_order_relaxed); }
+	};
+
+	/**
+		@brief The live statistics counters of a table or file.
+	  */
+	struct output_counters
+	{
+		stat_counter rows, bytes, row_ns, flushes, flush_ns, extends, writes;
+
+		/**
+			@brief Return a snapshot
+		  */
+		output_stats snapshot() const;
+
+		/**
+			@brief Reset all counters to zero
+		  */
+		void reset();
+	};
+
+	/**
+		@brief Counts a call and its duration, if statistics are enabled.
+	  */
+	class stat_timer
+	{
+		stat_counter* calls;
+		stat_counter* ns;
+		std::chrono::steady_clock::time_point start;
+	public:
+		inline stat_timer(stat_counter& _calls, stat_counter& _ns)
+		: calls(nullptr), ns(nullptr) {
+			if(output_stats::enabled()) {
+				calls = &_calls;
+				ns = &_ns;
+				start = std::chrono::steady_clock::now();
+			}
+		}
+		inline ~stat_timer() {
+			if(calls) {
+				calls->add();
+				ns->add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count());
+			}
+		}
+	};
+
+
+	/**
+		@brief The type of a value in a packed record.
+
+		Tags name the machine type of a value, independently of the 
+		C++ type of its column (e.g., \c long and \c long \c long 
+		are both \c int64 here).
+	  */
+	enum class type_tag : uint16_t {
+		other = 0,	//< not a value that can be described
+		boolean,
+		int8, uint8, int16, uint16, int32, uint32, int64, uint64,
+		float32, float64, 
+		ldouble,	//< \c long \c double
+		string		//< a NUL-padded string of fixed size
+	};
+
+	/**
+		@brief The tag for values of a C++ type (\c other if it has none)
+	  */
+	type_tag make_type_tag(type_index type);
+
+	/**
+		@brief The name of a type tag (e.g., "int32")
+	  */
+	const char* type_tag_name(type_tag tag);
+
+	/**
+		@brief A column in a record layout
+	  */
+	struct record_field
+	{
+		string path;		//< the path name of the column
+		type_tag tag;		//< the type of the value
+		size_t offset;		//< the offset in the record
+		size_t size;		//< the size in the record
+	};
+
+	/**
+		@brief A record layout, decoded from a binary descriptor.
+		@see row_plan::descriptor()
+	  */
+	struct record_layout
+	{
+		size_t size = 0;					//< the size of a record
+		size_t align = 1;					//< the alignment of a record
+		std::vector<record_field> fields;	//< the columns, in table order
+
+		/**
+			@brief Decode a binary descriptor
+			@throws std::runtime_error if the descriptor is not valid
+		  */
+		static record_layout decode(const void* data, size_t len);
+
+		/**
+			@brief The field for a path name, or null
+		  */
+		const record_field* find(const string& path) const;
+	};
+
+	/**
+		@brief The header of a binary layout descriptor.
+
+		The header is followed by \c columns entries, each with an
+		\c offset, a \c size (both 64 bits), a \c tag and the length
+		of the path name (both 16 bits), followed by the path name 
+		itself, padded with NULs to a multiple of 8 bytes. All numbers 
+		are in the byte order of the writer.
+	  */
+	struct layout_header
+	{
+		char magic[8];			//< "TABLELY1"
+		uint32_t columns;		//< the number of columns
+		uint32_t bytes;			//< the size of the whole descriptor
+		uint64_t record;		//< the size of a record
+		uint64_t align;			//< the alignment of a record
+	};
+
+	/**
+		@brief A precompiled plan for copying a table row.
+
+		The plan describes the binary image of a row as a packed record,
+		where each column is placed at an offset aligned to the column's
+		alignment. For each column, the plan holds either the address of
+		its value (for \c column<T> and \c column_ref<T>), or a function
+		that copies it (e.g., for \c computed<T>). Thus, copying a row
+		is a loop without virtual calls.
+
+		Output tables compile their plan when their columns change; the
+		plan of a table cannot change while the table is locked.
+		The plan is also the layout descriptor of the records, shared
+		by all output files: it holds the path names and type tags of
+		the columns, and a binary descriptor (see \c layout_header), 
+		so that neither needs to be derived again at each prolog.
+	  */
+	class row_plan
+	{
+	public:
+		/**
+			@brief The plan for a column.
+		  */
+		struct entry
+		{
+			basic_column* column;				//< the column
+			const void* src;					//< address of the value, or null
+			basic_column::copy_function copy;	//< used when src is null
+			type_index type;					//< the column type
+			size_t offset;						//< offset in the record
+			size_t size;						//< size in the record
+			type_tag tag;						//< the type of the value
+
+			/**
+				@brief Copy the column value to a location
+			  */
+			inline void copy_to(void* dst) const {
+				switch(src ? size : 0) {
+				case 0: copy(column, dst); break;
+				case 1: memcpy(dst, src, 1); break;
+				case 2: memcpy(dst, src, 2); break;
+				case 4: memcpy(dst, src, 4); break;
+				case 8: memcpy(dst, src, 8); break;
+				default: memcpy(dst, src, size);
+				}
+			}
+		};
+
+	private:
+		std::vector<entry> _entries;
+		std::vector<string> _paths;
+		string _descriptor;
+		size_t _size;
+		size_t _align;
+
+	public:
+		row_plan();
+
+		/**
+			@brief Compile a plan for a sequence of columns.
+		  */
+		void compile(const std::vector<basic_column*>& cols);
+
+		/**
+			@brief The size of the packed record
+		  */
+		inline size_t size() const { return _size; }
+
+		/**
+			@brief The alignment of the packed record
+		  */
+		inline size_t align() const { return _align; }
+
+		/**
+			@brief The number of columns
+		  */
+		inline size_t columns() const { return _entries.size(); }
+
+		/**
+			@brief The plan for a column
+		  */
+		inline const entry& operator[](size_t i) const { return _entries[i]; }
+
+		/**
+			@brief The path name of a column
+		  */
+		inline const string& path(size_t i) const { return _paths[i]; }
+
+		/**
+			@brief The binary layout descriptor of the records.
+
+			The descriptor starts with a \c layout_header, and can be 
+			decoded by \c record_layout::decode().
+		  */
+		inline const string& descriptor() const { return _descriptor; }
+
+		/**
+			@brief Write the layout as the members of a JSON object:
+			\verbatim
+			"record_size": <bytes>,
+			"align": <bytes>,
+			"layout": [ { "name": <path name>, "type": <tag name>, 
+				"offset": <bytes>, "size": <bytes> }, ... ]
+			\endverbatim
+		  */
+		void write_json(std::ostream& out) const;
+
+		inline auto begin() const { return _entries.begin(); }
+		inline auto end() const { return _entries.end(); }
+
+		/**
+			@brief Copy the current row into a buffer of \c size() bytes.
+		  */
+		inline void pack(void* buffer) const {
+			char* buf = (char*) buffer;
+			for(const entry& e : _entries)
+				e.copy_to(buf + e.offset);
+		}
+	};
+
+
+	/**
+		@brief A snapshot of a table row.
+
+		The snapshot is a packed record, laid out according to the
+		table's \c row_plan. Output files that can consume snapshots
+		implement \c output_file::output_row(const row_view&).
+	  */
+	struct row_view
+	{
+		output_table& table;	//< the table of the row
+		const row_plan& plan;	//< the layout of the record
+		const char* record;		//< the packed record
+
+		/**
+			@brief The value of an arithmetic column
+		  */
+		template <typename T>
+		inline T get(size_t col) const {
+			T val;
+			memcpy(&val, record + plan[col].offset, sizeof(T));
+			return val;
+		}
+
+		/**
+			@brief The value of a string column, zero-terminated
+		  */
+		inline const char* text(size_t col) const {
+			return record + plan[col].offset;
+		}
+	};
+
+
+	class output_file;
+	class output_table;
+	struct output_binding;
+
+	/**
+		@brief A stage that transforms the rows of a binding.
+
+		A reducer sits between a table and one of its files: it receives
+		every row emitted to the binding as a snapshot, and emits its own
+		(usually fewer) rows to the file, with the same columns. Thus, 
+		one table can feed a full-resolution file and a downsampled one,
+		evaluating its columns once per row.
+
+		The file of a reduced binding must support row snapshots
+		(see \c output_file::output_row(const row_view&)).
+	  */
+	class output_reducer
+	{
+	public:
+		virtual ~output_reducer();
+
+		/**
+			@brief Called by the table's \c prolog(), before the files.
+
+			The filter may throw to reject the table.
+		  */
+		virtual void prolog(output_binding& b) { }
+
+		/**
+			@brief Process a row emitted to the binding
+		  */
+		virtual void row(output_binding& b, const row_view& r)=0;
+
+		/**
+			@brief Called by the table's \c epilog(), before the files.
+
+			Pending rows should be emitted here.
+		  */
+		virtual void epilog(output_binding& b) { }
+
+	protected:
+		/**
+			@brief Emit a row to the file of a binding, if enabled
+		  */
+		void emit(output_binding& b, const row_view& r);
+	};
+
+
+	/**
+		An object that binds an output table to an output file.
+
+		These objects are created by the `bind()` methods in `output_file`
+		an `output_table`. The bindings of a table and of a file are 
+		kept in contiguous lists, and their storage is taken from a 
+		pool shared by all tables. A binding knows its position in 
+		both lists, and is removed in constant time, by moving the last
+		binding of each list in its place. Thus, the lists are in the 
+		order of binding until some binding is removed.
+	  */
+	struct output_binding
+	{
+		typedef std::vector<output_binding*> list;
+
+		output_file* file;
+		output_table* table;
+
+		bool enabled;
+		std::unique_ptr<output_reducer> reducer;	// the reducer stage, or null
+		bool snapshot;		// the file takes the table's row snapshot
+		size_t file_pos;	// the position in file->tables
+		size_t table_pos;	// the position in table->files
+
+		output_binding(output_file* f, output_table* t);
+		~output_binding();
+
+		// allocated from the pool
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size);
+		static void unbind_all(list&);
+		static output_binding* find(list&, output_file*);
+		static output_binding* find(list&, output_table*);
+
+		/**
+			@brief Set the reducer stage of this binding.
+
+			The binding takes ownership of the reducer. A null reducer
+			passes every row to the file (the default).
+			@throws std::logic_error if the table is locked
+		  */
+		void set_reducer(output_reducer* r);
+
+		/**
+			@brief Output a row snapshot, through the reducer if any
+		  */
+		void output(const row_view& r);
+	};
+
+
+	/**
+		Indicates the use for an output table
+	  */
+	enum class table_flavor {
+		RESULTS,    //< Indicate a normal table of results after a run
+		TIMESERIES  //< Indicate a time-series table, of data collected during a run
+	};
+
+
+	/**
+		The size of the blocks packed by \c output_table::emit_columns()
+	  */
+	const size_t default_emit_block_bytes = 1<<16;
+
+
+	/**
+		@brief A sampling policy for the rows of a table.
+
+		A filter decides which calls to \c output_table::emit_row() 
+		actually emit a row. It is consulted before any column is 
+		evaluated and before any file is called. Thus, rejected rows 
+		cost (almost) nothing.
+
+		Filters are reset by the table's \c prolog(), and can 
+		emit rows of their own at the table's \c epilog().
+	  */
+	class emit_filter
+	{
+	public:
+		virtual ~emit_filter();
+
+		/**
+			@brief Return true if the row should be emitted
+		  */
+		virtual bool accept(output_table& t)=0;
+
+		/**
+			@brief Called by the table's \c prolog(), before the files.
+
+			The filter may throw to reject the table.
+		  */
+		virtual void prolog(output_table& t) { }
+
+		/**
+			@brief Called by the table's \c epilog(), before the files
+		  */
+		virtual void epilog(output_table& t) { }
+	};
+
+
+
+	/**
+		An output table.
+
+		An output table contains a collection of columns.
+		Also, an output table can be bound to one or more output files.
+		During normal operations, when the `emit_row()` method is called,
+		each bound output file in turn processes the current values of
+		the columns to generate a row of output.
+
+		Columns can be added to a table at initialization time.
+		Once the columns are all added, and all output files are bound,
+		the `prolog()` method should be called.
+		After this point, it is legal to call `emit_row()`, therefore
+		columns should not be changed, nor should output files be
+		bound or unbound.
+		However, once the `epilog()` method is called,
+		columns can be added/removed again, and files can be bound or
+		unbound. This design allows columns to be stored separately (in other
+		objects) and be added to a table in a preparation phase.
+
+		There are two distinct ways to orchestrate the output process.
+
+		- A unique process that calls `emit_row()` when it decides, e.g.
+		periodically during a simulation. In this model, each column is
+		kept updated independently, and is ready to be output at any time.
+		Since no 'central' location needs to know the state of all columns,
+		columns can be added by modules as they see fit.
+		This model is particularly suited to time-series output.
+
+		- Many processes can call `emit_row()` when they have output
+		for this table. However, they should be careful to initialize
+		every column of the table.
+
+		Output tables must have a non-empty name. No two tables can have the same
+		name. This is enforced by the library at construction time, the constructor
+		will throw an exception. The name should probably conform to the 'identifier'
+		convention, as it will be used in output formats.
+
+	  */
+	class output_table : public column_group
+	{
+	private:
+		bool _dirty_columns;		// flags that the plan needs to be recompiled
+		friend class column_group;
+		std::vector<basic_column *> _columns;		// the columns, kept up to date
+		std::unordered_map<string, column_item*> _paths;	// the items, by path name
+		row_plan _plan;				// the plan for copying rows
+		output_counters _counters;	// the statistics
+		std::unique_ptr<emit_filter> _filter;	// the sampling policy, or null
+		std::vector<char> _record;	// the packed row, shared by the bindings
+		bool _snapshot;				// the row is packed at each emit_row()
+
+	protected:
+		bool en;					// enabled flag
+		output_binding::list files;	// the bindings
+		bool _locked;				// signal that the table allows updates
+		table_flavor _flavor;		// advice to files/formats
+
+		virtual void _cleanup() override;
+
+		/**
+			@brief Emit a packed row to every enabled binding.
+
+			This is the tail of \c emit_row(), for tables that pack
+			their rows themselves (see \c static_table).
+		  */
+		void _emit_record(const char* record);
+
+		friend struct output_binding;
+		friend class sample_reservoir;
+		friend class sample_on_change;
+		friend class concurrent_emitter;
+		/**
+		   @brief Construct an output table with given name and flavor.
+
+		   This method should probably not be used, instead construct
+		   \c result_table or \c time_series objects directly.
+		*/
+		output_table(const string& _name, table_flavor _f);
+		virtual ~output_table();
+
+	public:
+
+
+		/**
+			@brief Returns this table as the owning table
+		  */
+		virtual output_table* table() override;
+
+
+		virtual bool is_table() const override {
+			return true;
+		}
+
+
+		/**
+			Return the locking status of the table.
+
+			A table is locked once the prolog() method is called and it becomes
+			unlocked when the epilog() method is called. While a table is locked,
+			no column_item owned by this table can be added, modified or deleted.
+		  */
+		inline bool is_locked() const { return _locked; }
+
+
+		/**
+			@brief Bind this table to an output_file
+		  */
+		output_binding* bind(output_file* f) {
+			_check_unlocked();
+			auto b = output_binding::find(files, f);
+			if(b==nullptr)
+				b = new output_binding(f, this);
+			return b;
+		}
+
+		/**
+			@brief Unind this table from an output_file.
+
+			If the table is not bound to the file, there is no
+			effect
+		  */
+		bool unbind(output_file* f) {
+			_check_unlocked();
+			auto b = output_binding::find(files, f);
+			if(b) delete b;
+			return b;
+		}
+
+		/**
+			@brief Return all the bindings for this table.
+		  */
+		inline const output_binding::list& bindings() const { return files; }
+
+		/**
+			@brief Unbind from all files
+		  */
+		void unbind_all() {
+			_check_unlocked();
+			output_binding::unbind_all(files);
+		}
+
+		/**
+			@brief Return the table flavor (results or time_series)
+		  */
+		inline table_flavor flavor() const { return _flavor; }
+
+		/**
+			@brief Return the number of columns of this table
+		  */
+		inline size_t size() {
+			if(!_locked) _cleanup();
+			return _columns.size();
+		}
+
+		/**
+			@brief Return a column by index
+		  */
+		inline basic_column* operator[](size_t i) {
+			if(!_locked) _cleanup();
+			return _columns.at(i);
+		}
+
+		/**
+			@brief Return the plan for copying rows of this table.
+
+			The plan is compiled whenever the columns of the table change,
+			and it does not change while the table is locked.
+		  */
+		inline const row_plan& plan() {
+			if(!_locked) _cleanup();
+			return _plan;
+		}
+
+		/**
+			@brief Return a column item by name
+		  */
+		basic_column* operator[](const string& n);
+
+
+		/**
+			@brief Set the enabled flag of the table
+
+			A disabled table does not emit any data, even if
+			\c emit_row() is called.
+
+			@param _en the value of the enabled flag
+		  */
+		inline void set_enabled(bool _en) { en=_en; }
+
+		/**
+			@brief Return the enabled flag of the table
+		  */
+		inline bool enabled() const { return en; }
+
+		// data api
+
+		/**
+			@brief Put a table to output mode.
+
+			A call to this method must be made before any data is output,
+			but only after all columns have been added.
+		  */
+		void prolog();    // calls files to e.g. print a header
+
+		/**
+			@brief Emit a table row
+
+			Data for the table row is collected from the column objects.
+			When more than one bound file takes row snapshots (see 
+			\c output_file::takes_snapshots()), or a binding has a 
+			reducer, the columns are evaluated once into a snapshot, 
+			and the same snapshot is passed to all of them.
+		  */
+		void emit_row();  // a new table row is ready
+
+		/**
+			@brief Emit rows from an array of packed records.
+
+			The records must have the layout of the table's plan
+			(see \c plan()). Files receive all the rows in one call 
+			(see \c output_file::output_rows()). The rows are not 
+			sampled: the filter is not consulted.
+
+			Note that the plan pads a record to the alignment of its 
+			first column only, so a C struct whose members are the 
+			column types may be larger (e.g., \c {int,double,int} is 
+			24 bytes, but its record is 20). Pass arrays of structs 
+			through the typed overload, which checks the size.
+
+			@param n the number of records
+			@param records the records, \c n * \c plan().size() bytes
+		  */
+		void emit_rows(size_t n, const void* records);
+
+		/**
+			@brief Emit rows from an array of structs.
+
+			The struct must have the layout of the table's plan.
+			@throws std::invalid_argument if the size of \c R is not
+				the record size of the plan
+		  */
+		template <typename R, typename = std::enable_if_t<std::is_class_v<R>>>
+		inline void emit_rows(size_t n, const R* records) {
+			static_assert(std::is_trivially_copyable_v<R>, "records must be trivially copyable");
+			if(sizeof(R) != _plan.size())
+				throw std::invalid_argument("the record type does not match the layout of table "+name());
+			emit_rows(n, (const void*) records);
+		}
+
+		/**
+			@brief Emit rows from arrays of column values.
+
+			There is one array per column, in order, holding \c n 
+			values of the column's size (\c n * \c size() bytes 
+			for string columns). The rows are packed in blocks 
+			and emitted by \c emit_rows().
+
+			@throws std::invalid_argument if there is not one array per column
+		  */
+		void emit_columns(size_t n, const std::vector<const void*>& spans);
+
+		/**
+			@brief A snapshot of the statistics of this table.
+
+			The rows count the calls to \c emit_row() and the time is 
+			spent in all the bound files.
+		  */
+		inline output_stats stats() const { return _counters.snapshot(); }
+
+		/**
+			@brief Reset the statistics of this table
+		  */
+		inline void reset_stats() { _counters.reset(); }
+
+		/**
+			@brief Set the sampling policy of this table.
+
+			The table takes ownership of the filter (which is deleted
+			if the table is locked). A null filter emits every row
+			(the default).
+			@throws std::logic_error if the table is locked
+		  */
+		void set_filter(std::unique_ptr<emit_filter> f);
+
+		/**
+			@brief The sampling policy of this table, or null
+		  */
+		inline emit_filter* filter() const { return _filter.get(); }
+
+		/**
+			@brief Terminate output mode, make table editable again
+
+			A call to this method must follow all output operations
+		  */
+		void epilog();    // calls files to e.g. print a footer
+
+
+		/**
+			@brief Generate a JSON description of the columns of this table.
+
+			The description format is a JSON object of the form
+			\verbatim
+			{
+				"name": <table name>,
+				"columns": [
+					{
+						"name": "somecol",
+						"type": "double",
+						"arithmetic": true
+					},
+					...
+				]
+			}
+
+			@param out the output stream to receive the JSON
+		 */
+		virtual void generate_schema(std::ostream& out);
+
+
+		// static members
+
+		typedef std::unordered_set<output_table*> registry;
+
+		/**
+			@brief Get a table object by name
+		  */
+		static output_table* get(const string&);
+
+		/**
+			@brief A container for all table objects
+		  */
+		static const registry& all();
+	};
+
+
+	/**
+		@brief Table for data reported after the end of a run
+
+		A result table is a flavor of \c output_table which specializes
+		in reporting data after the end of a run.
+	  */
+	class result_table : public output_table
+	{
+	public:
+		/**
+			@brief Construct a table
+			@param _name the table name
+		  */
+		result_table(const string& _name);
+
+		/**
+			@brief Construct a table and add columns
+			@param _name the table name
+			@param col a list of column objects to add
+		  */
+		result_table(const string& _name,
+			column_item_list col);
+
+
+		/**
+			@brief Destroy the result table
+		  */
+		virtual ~result_table();
+	};
+
+
+	/**
+		@brief Emit every n-th row (the first, the n+1-th, etc.)
+	  */
+	class sample_every : public emit_filter
+	{
+		size_t n;
+		size_t count;
+	public:
+		sample_every(size_t _n) : n(std::max(_n, (size_t)1)), count(0) { }
+		inline bool accept(output_table&) override { return count++ % n == 0; }
+		void prolog(output_table&) override { count = 0; }
+	};
+
+	/**
+		@brief Emit each row independently, with a given probability
+	  */
+	class sample_random : public emit_filter
+	{
+		std::mt19937_64 gen;
+		uint64_t threshold;		// of the random numbers accepted
+		bool all;
+		unsigned seed;
+	public:
+		sample_random(double p, unsigned _seed=0);
+		inline bool accept(output_table&) override { return all || gen() < threshold; }
+		void prolog(output_table&) override { gen.seed(seed); }
+	};
+
+	/**
+		@brief Emit a uniform random sample of k rows, at the epilog.
+
+		This is reservoir sampling: the table's rows are snapshot
+		(evaluating all columns) only when they enter the reservoir.
+		The sample is emitted in the order of the rows, as row snapshots
+		(see \c output_file::output_row(const row_view&)), and is counted
+		in the statistics of the table and the files.
+
+		Since the rows are emitted from their snapshots, every column
+		must have a type tag; \c prolog() throws \c std::logic_error
+		otherwise.
+	  */
+	class sample_reservoir : public emit_filter
+	{
+		size_t k;
+		unsigned seed;
+		std::mt19937_64 gen;
+		size_t seen;					// the rows seen so far
+		std::vector<char> records;		// k records
+		std::vector<size_t> order;		// the row number of each record
+	public:
+		sample_reservoir(size_t _k, unsigned _seed=0);
+		bool accept(output_table& t) override;
+		void prolog(output_table& t) override;
+		void epilog(output_table& t) override;
+	};
+
+	/**
+		@brief Emit a row only if some column changed since the last
+		emitted row.
+
+		For time series, the time column is not compared. Note that
+		all columns are evaluated to detect the change; the emitted
+		row is the snapshot taken for the comparison, so each column is
+		evaluated once per row.
+
+		As with \c sample_reservoir, every column must have a type tag;
+		\c prolog() throws \c std::logic_error otherwise.
+	  */
+	class sample_on_change : public emit_filter
+	{
+		std::vector<char> last, current;
+		size_t from;		// the offset where comparison starts
+		bool first;
+	public:
+		sample_on_change();
+		bool accept(output_table& t) override;
+		void prolog(output_table& t) override;
+	};
+
+
+	/**
+		@brief The aggregate of a window, for \c window_reducer
+	  */
+	enum class window_op {
+		first,	//< the first row of the window
+		last,	//< the last row of the window
+		min,	//< the minimum of every arithmetic column
+		max,	//< the maximum of every arithmetic column
+		mean	//< the mean of every arithmetic column
+	};
+
+	/**
+		@brief Reduce a time series to one row per tumbling window.
+
+		The windows are the intervals [k*width, (k+1)*width) of the time
+		column, and the time of a reduced row is the start of its window.
+		Every other arithmetic column is aggregated by the window's 
+		operation; other columns (e.g., strings) take their last value 
+		in the window. Integer and \c bool means are rounded.
+	  */
+	class window_reducer : public output_reducer
+	{
+	public:
+		typedef double (*load_function)(const char*);
+		typedef void (*store_function)(char*, double);
+	private:
+		struct slot {
+			size_t offset, size;
+			load_function load;		// null for non-arithmetic columns
+			store_function store;
+		};
+		double width;
+		window_op op;
+		std::vector<slot> slots;
+		std::vector<double> acc;
+		std::vector<char> out;
+		const row_plan* plan;
+		double window;		// the index of the open window
+		size_t n;			// rows in the open window
+		void flush(output_binding& b);
+	public:
+		window_reducer(double _width, window_op _op = window_op::mean);
+		void prolog(output_binding& b) override;
+		void row(output_binding& b, const row_view& r) override;
+		void epilog(output_binding& b) override;
+	};
+
+	/**
+		@brief Downsample a time series for plotting.
+
+		This is the Largest-Triangle-Three-Buckets algorithm, in its
+		streaming form: the rows are split into buckets of a fixed 
+		number of rows, and from each bucket the row is emitted that 
+		forms the largest triangle with the previously emitted row and 
+		the average of the next bucket. The first and last rows are 
+		always emitted. The areas are computed over the time column
+		and one arithmetic column, given by name.
+	  */
+	class lttb_reducer : public output_reducer
+	{
+		size_t bucket_rows;
+		string ycol;
+		size_t rsize;
+		window_reducer::load_function xload, yload;
+		size_t xoff, yoff;
+		std::vector<char> a, cur, next;		// selected row, current and next buckets
+		size_t ncur, nnext;
+		bool first;
+		void select(output_binding& b, size_t rows, double cx, double cy);
+		void average(const std::vector<char>& rows, size_t nrows, double& cx, double& cy) const;
+	public:
+		lttb_reducer(size_t _bucket_rows, const string& _ycol);
+		void prolog(output_binding& b) override;
+		void row(output_binding& b, const row_view& r) override;
+		void epilog(output_binding& b) override;
+	};
+
+
+	/**
+		@brief Table for data collected during a run
+
+		A time series table collects a number of column values during a run.
+
+		The clock of the time column is a \c std::function by default.
+		A clock of type \c Clock (e.g., a lambda) is stored inline, and 
+		the type can be deduced from the constructor:
+		\code
+		time_series ts("ts", "%g", [&]() { return now; });
+		\endcode
+	  */
+	template <typename TimeType, typename Clock = std::function<TimeType()>>
+	class time_series : public output_table
+	{
+	public:
+		/**
+			@brief Construct a time series table
+			@param _name the table name
+			@param _nowfmt the format of the time column
+			@param _nowfunc the clock
+		  */
+		time_series(const string& _name, const string& _nowfmt, Clock _nowfunc)
+		: output_table(_name, table_flavor::TIMESERIES),
+			now("time", _nowfmt, std::move(_nowfunc))
+		{ add(now); }
+
+		/**
+			@brief The type of the time column.
+			*/
+		typedef TimeType time_type;
+
+		/**
+			@brief A column for this table containing the current stream time
+
+			This column is the first column of the time series table
+		  */
+		computed<TimeType, Clock> now;
+
+		/**
+			@brief Emit a row when the time has advanced by at least
+			\c dt since the last emitted row.
+
+			Only the time column is evaluated for rejected rows.
+		  */
+		class sample_interval : public emit_filter
+		{
+			time_series& series;
+			TimeType dt;
+			TimeType last;
+			bool first;
+		public:
+			sample_interval(time_series& ts, TimeType _dt)
+			: series(ts), dt(_dt), last(), first(true) { }
+			bool accept(output_table&) override {
+				TimeType t = series.now.value();
+				if(!first && t < last + dt) return false;
+				first = false;
+				last = t;
+				return true;
+			}
+			void prolog(output_table&) override { first = true; }
+		};
+
+		/**
+			@brief Emit all rows (the default)
+		  */
+		inline void emit_all() { set_filter(nullptr); }
+
+		/**
+			@brief Emit every n-th row
+		  */
+		inline void emit_every(size_t n) { set_filter(std::make_unique<sample_every>(n)); }
+
+		/**
+			@brief Emit a row whenever time has advanced by at least dt
+		  */
+		inline void emit_interval(TimeType dt) { set_filter(std::make_unique<sample_interval>(*this, dt)); }
+
+		/**
+			@brief Emit each row with probability p
+		  */
+		inline void emit_random(double p, unsigned seed=0) { set_filter(std::make_unique<sample_random>(p, seed)); }
+
+		/**
+			@brief Emit a random sample of k rows, at the epilog
+		  */
+		inline void emit_reservoir(size_t k, unsigned seed=0) { set_filter(std::make_unique<sample_reservoir>(k, seed)); }
+
+		/**
+			@brief Emit a row only if some column (other than time) changed
+		  */
+		inline void emit_on_change() { set_filter(std::make_unique<sample_on_change>()); }
+	};
+
+	/**
+		@brief Deduce the time type and the clock of a time series
+		from its clock
+	  */
+	template <typename Clock>
+	time_series(const string&, const string&, Clock) 
+		-> time_series<std::decay_t<std::invoke_result_t<const Clock&>>, Clock>;
+
+
+	/**
+		@brief The static layout of a column type in a row record.
+
+		This is specialized for the columns of fixed size: 
+		\c column<T>, \c column<char[N]>, \c column_ref<T> and 
+		\c computed<T>, for arithmetic T.
+	  */
+	template <typename Col>
+	struct static_column;
+
+	template <typename T>
+	struct static_column<column<T>>
+	{
+		static_assert(std::is_arithmetic_v<T>, "static tables take arithmetic columns, or column<char[N]>");
+		static constexpr size_t size = sizeof(T), align = alignof(T);
+		static inline void copy(column<T>& c, char* dst) { memcpy(dst, &c.value(), sizeof(T)); }
+	};
+
+	template <size_t N>
+	struct static_column<column<char[N]>>
+	{
+		static constexpr size_t size = N, align = 1;
+		static inline void copy(column<char[N]>& c, char* dst) { memcpy(dst, c.c_str(), N); }
+	};
+
+	template <typename T>
+	struct static_column<column_ref<T>>
+	{
+		static_assert(std::is_arithmetic_v<T>, "static tables take arithmetic columns, or column<char[N]>");
+		static constexpr size_t size = sizeof(T), align = alignof(T);
+		static inline void copy(column_ref<T>& c, char* dst) { T v = c.value(); memcpy(dst, &v, sizeof(T)); }
+	};
+
+	template <typename T, typename F>
+	struct static_column<computed<T, F>>
+	{
+		static_assert(std::is_arithmetic_v<T>, "static tables take arithmetic columns, or column<char[N]>");
+		static constexpr size_t size = sizeof(T), align = alignof(T);
+		static inline void copy(computed<T, F>& c, char* dst) { T v = c.value(); memcpy(dst, &v, sizeof(T)); }
+	};
+
+	/**
+		@brief A row layout computed at compile time.
+
+		The layout is that of \c row_plan::compile().
+	  */
+	template <size_t N>
+	struct static_layout
+	{
+		size_t offset[N];
+		size_t size;
+		size_t align;
+	};
+
+	template <typename... Cols>
+	constexpr static_layout<sizeof...(Cols)> make_static_layout()
+	{
+		constexpr size_t n = sizeof...(Cols);
+		constexpr size_t sizes[] = { static_column<Cols>::size... };
+		constexpr size_t aligns[] = { static_column<Cols>::align... };
+		auto aligned = [](size_t pos, size_t a) { return (pos + a-1) / a * a; };
+
+		static_layout<n> l {};
+		size_t pos = 0;
+		l.align = 1;
+		for(size_t i=0; i<n; i++) {
+			l.align = std::max(l.align, aligns[i]);
+			if(i>0) pos = aligned(pos + sizes[i-1], aligns[i]);
+			l.offset[i] = pos;
+		}
+		l.size = aligned(pos + sizes[n-1], aligns[0]);
+		return l;
+	}
+
+
+	/**
+		@brief A table with a schema fixed at compile time.
+
+		The columns are given to the constructor, and the table keeps
+		typed references to them, in order. The record layout is 
+		computed at compile time, and \c emit_row() packs the row with 
+		an inlined copy of every column, without virtual calls. The 
+		row is then passed to every bound file as a row snapshot 
+		(see \c output_file::output_row(const row_view&)).
+
+		The table is otherwise an ordinary output table, and works 
+		with every output file, filter and reducer. Its columns should
+		not change: \c emit_row() throws \c std::logic_error if they do.
+
+		Example:
+		@code
+		column<double> x("x", "%g");
+		column<int> n("n", "%d");
+		static_table tab("hot", x, n);
+		@endcode
+	  */
+	template <typename... Cols>
+	class static_table : public output_table
+	{
+		static_assert(sizeof...(Cols) > 0, "A static table needs columns");
+	public:
+		static constexpr static_layout<sizeof...(Cols)> layout = make_static_layout<Cols...>();
+
+	private:
+		std::tuple<Cols&...> cols;
+
+		template <size_t... I>
+		inline void pack(char* record, std::index_sequence<I...>) {
+			(static_column<Cols>::copy(std::get<I>(cols), record + layout.offset[I]), ...);
+		}
+
+	public:
+		/**
+			@brief Construct a table of the given columns
+		  */
+		static_table(const string& _name, Cols&... _cols)
+		: static_table(_name, table_flavor::RESULTS, _cols...) { }
+
+		/**
+			@brief Construct a table of the given flavor and columns.
+
+			The first column of a time series should be the time.
+		  */
+		static_table(const string& _name, table_flavor _f, Cols&... _cols)
+		: output_table(_name, _f), cols(_cols...)
+		{
+			(add(_cols), ...);
+			constexpr size_t sizes[] = { static_column<Cols>::size... };
+			const row_plan& p = plan();
+			for(size_t i=0; i<p.columns(); i++)
+				if(p[i].offset != layout.offset[i] || p[i].size != sizes[i])
+					throw std::logic_error("the static layout of table "+name()+" is wrong");
+		}
+
+		virtual ~static_table() { }
+
+		/**
+			@brief Emit a table row
+		  */
+		inline void emit_row() {
+			if(files.empty())
+				return;
+			if(!_locked)
+				throw std::logic_error("prolog() has not been called before emit_row()");
+			if(!en) return;
+			if(filter() && !filter()->accept(*this)) return;
+			if(plan().columns() != sizeof...(Cols) || plan().size() != layout.size)
+				throw std::logic_error("the columns of static table "+name()+" have changed");
+
+			alignas(layout.align) char record[layout.size];
+			pack(record, std::index_sequence_for<Cols...>());
+			_emit_record(record);
+		}
+
+		/**
+			@brief Return the typed reference to the I-th column
+		  */
+		template <size_t I>
+		inline auto& get() { return std::get<I>(cols); }
+	};
+
+
+	/**
+		@brief A time series of output statistics.
+
+		The series publishes the statistics of a set of watched tables 
+		and files, so that they can be written by any output file. 
+		Each call to \c publish() emits a row for every watched object,
+		with the object's kind (`table` or `file`), its name and a 
+		snapshot of its statistics (see \c output_stats). The time
+		is the number of seconds since the series was created.
+
+		Watched objects must outlive the series, or be removed by
+		\c unwatch().
+	  */
+	class stats_series : public time_series<double>
+	{
+		struct source {
+			string name;
+			output_table* table;
+			output_file* file;
+		};
+		std::vector<source> sources;
+		std::chrono::steady_clock::time_point start;
+
+	public:
+		column<string> kind { this, "kind", 5, "%s" };
+		column<string> source_name { this, "source", 31, "%s" };
+		column<size_t> rows { this, "rows", "%zu" };
+		column<size_t> bytes { this, "bytes", "%zu" };
+		column<double> row_seconds { this, "row_seconds", "%.6f" };
+		column<size_t> flushes { this, "flushes", "%zu" };
+		column<double> flush_seconds { this, "flush_seconds", "%.6f" };
+		column<size_t> extends { this, "extends", "%zu" };
+		column<size_t> writes { this, "writes", "%zu" };
+		column<size_t> queued { this, "queued", "%zu" };
+		column<size_t> dropped { this, "dropped", "%zu" };
+
+		/**
+			@brief Construct a statistics series with the given name
+		  */
+		stats_series(const string& name = "tables_stats");
+
+		/**
+			@brief Watch a table, under the table's name
+		  */
+		void watch(output_table& t);
+
+		/**
+			@brief Watch a file, under the given name
+		  */
+		void watch(output_file& f, const string& name);
+
+		/**
+			@brief Stop watching a table
+		  */
+		void unwatch(output_table& t);
+
+		/**
+			@brief Stop watching a file
+		  */
+		void unwatch(output_file& f);
+
+		/**
+			@brief Emit a row for every watched object
+		  */
+		void publish();
+	};
+
+
+	/**
+		@brief Concurrent emission of rows of a table, from many threads.
+
+		Output tables are not thread-safe: their column objects hold a
+		single set of values. A concurrent emitter allows many threads to
+		emit rows for a locked table. Each thread fills in its own row
+		(see \c local()), so the threads share no column values. 
+		
+		Each thread collects its rows in a batch of packed records. When
+		the batch is full, it is handed to a single writer thread, which
+		emits the rows through the table, as row snapshots: they go to
+		all enabled bound output files (and their reducers), and are 
+		counted in the table's statistics. Thus, synchronization happens 
+		once per batch, not once per row. If ordering is requested for a 
+		time series, the rows of each batch handed to the writer are 
+		sorted by the time column.
+
+		Rows emitted while the table is disabled are dropped by 
+		\c row::emit(). The table's sampling policy (see 
+		\c output_table::set_filter()) is \e not applied to the rows 
+		of an emitter, since it examines the table's own columns.
+
+		The values of a thread's row are initialized from the table's
+		columns when the row is created, and are kept between emissions.
+		Computed columns (e.g., the time column of a time series) are
+		evaluated by \c row::emit(), in the emitting thread.
+
+		The table must be locked (by \c prolog()) during the lifetime of
+		the emitter, and its rows should be emitted only via the emitter.
+	  */
+	class concurrent_emitter
+	{
+	public:
+		/**
+			@brief The row of a thread
+		  */
+		class row
+		{
+			concurrent_emitter& owner;
+			std::vector<char> batch;	// the records of the batch
+			size_t n;					// the number of emitted records in batch
+			friend class concurrent_emitter;
+
+			inline char* current() { return batch.data() + n*owner.plan.size(); }
+			void submit();
+		public:
+			row(concurrent_emitter& e);
+
+			/**
+				@brief Set the value of an arithmetic column.
+
+				@throws std::invalid_argument if the column is not of type T
+			  */
+			template <typename T>
+			void set(size_t col, const T& val) {
+				static_assert(std::is_arithmetic<T>::value, "use set(col, string) for text");
+				const row_plan::entry& e = owner.plan[col];
+				if(e.type != typeid(T))
+					throw std::invalid_argument("wrong column type for column "+e.column->name());
+				memcpy(current()+e.offset, &val, sizeof(T));
+			}
+
+			/**
+				@brief Set the value of a string column, truncating it if needed.
+			  */
+			void set(size_t col, const string& val);
+
+			/**
+				@brief Set the value of a column by path name.
+			  */
+			template <typename T>
+			void set(const string& path, const T& val) { set(owner.index(path), val); }
+			inline void set(const string& path, const char* val) { set(owner.index(path), string(val)); }
+
+			/**
+				@brief Emit the row.
+			  */
+			void emit();
+
+			/**
+				@brief Hand the current batch to the writer, even if not full.
+			  */
+			void flush();
+		};
+
+	private:
+		output_table& table;
+		const row_plan& plan;
+		size_t batch_rows;
+		bool ordered;
+		std::unordered_map<string, size_t> names;
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<std::shared_ptr<row>> rows;				// all thread rows
+		std::vector<std::pair<std::vector<char>, size_t>> ready;	// batches to write
+		std::vector<std::vector<char>> spare;				// empty batches
+		size_t pending;				// batches taken by the writer, not yet written
+		bool stop;
+		std::exception_ptr error;
+		std::thread writer;
+		const size_t id;
+
+		size_t index(const string& path) const;
+		void submit(row& r);
+		void write_batch(std::vector<std::pair<std::vector<char>, size_t>>& batches);
+		void run();
+
+	public:
+		/**
+			@brief Create an emitter for a locked table.
+
+			@param t the table
+			@param _batch_rows the number of rows in a thread's batch
+			@param _ordered if true, order rows by the time column 
+				(this needs a time series table)
+		  */
+		concurrent_emitter(output_table& t, size_t _batch_rows=256, bool _ordered=false);
+
+		/**
+			@brief Flush all rows and stop the writer thread.
+		  */
+		~concurrent_emitter();
+
+		/**
+			@brief Return the row of the calling thread.
+		  */
+		row& local();
+
+		/**
+			@brief Write all rows emitted so far.
+
+			This hands the batches of all threads to the writer and waits
+			until they are written. It must be called while no thread is
+			emitting rows.
+			@throws any error raised by the output files in the writer
+		  */
+		void flush();
+	};
+
+
+	/**
+		@brief Open mode fore new output files
+
+		When creating a new file object, the values of this \c enum are
+		used to indicate whether to open the file in _truncate_ or _append_ mode.
+	  */
+	enum class open_mode { truncate, append };
+
+	/**
+		@brief Default open mode
+	  */
+	const open_mode default_open_mode = open_mode::truncate;
+
+	/**
+		@brief  Abstract base class for an output file
+
+		Output files are used to write \c output_table data to the
+		filesystem
+	  */
+	class output_file
+	{
+	protected:
+		output_binding::list tables;
+		output_counters _counters;
+		friend struct output_binding;
+	public:
+
+		/**
+			@brief Constructor
+		  */
+		output_file();
+
+		output_file(const output_file&)=delete;
+		output_file& operator=(const output_file&)=delete;
+		output_file(output_file&&) = default;
+		output_file& operator=(output_file&&) = default;
+
+		/**
+			@brief Destructor
+		  */
+		virtual ~output_file();
+
+
+		/**
+			@brief Bind this file to a table
+			@param t the table to bind with
+			@return the binding object
+		  */
+		output_binding* bind(output_table& t) {
+			auto b = output_binding::find(tables, &t);
+			if(b==nullptr)
+				b = new output_binding(this, &t);
+			return b;
+		}
+
+		/**
+			@brief Unbind this file from a table
+		  */
+		bool unbind(result_table& t) {
+			auto b = output_binding::find(tables, &t);
+			if(b) delete b;
+			return b;
+		}
+
+		/**
+			@brief All bindings
+		  */
+		inline const output_binding::list& bindings() const { return tables; }
+
+		/**
+			@brief Unbind this file from all tables
+		  */
+		void unbind_all() {
+			output_binding::unbind_all(tables);
+		}
+
+		/**
+			@brief The live statistics counters of this file.
+
+			The rows and their time are counted by the tables; the
+			other counters are updated by the file itself.
+		  */
+		inline output_counters& counters() { return _counters; }
+
+		/**
+			@brief A snapshot of the statistics of this file
+		  */
+		virtual output_stats stats() const { return _counters.snapshot(); }
+
+		/**
+			@brief Reset the statistics of this file
+		  */
+		inline void reset_stats() { _counters.reset(); }
+
+		/**
+			@brief Flush this file
+		  */
+		virtual void flush() { }
+
+		/**
+			@brief Close this file
+		  */
+		virtual void close() { }
+
+		/**
+			@brief Called by a table to prepare for output mode
+
+		  */
+		virtual void output_prolog(output_table&)=0;
+
+		/**
+			@brief Output a table row
+		  */
+		virtual void output_row(output_table&)=0;
+
+		/**
+			@brief Output a row snapshot of a table.
+
+			The row is taken from the record of the snapshot, instead of
+			the current values of the table's columns.
+			The default implementation throws \c std::logic_error.
+		  */
+		virtual void output_row(const row_view&);
+
+		/**
+			@brief True if this file implements \c output_row(const row_view&).
+
+			When a table is bound to several such files (or to reducers),
+			\c output_table::emit_row() evaluates the columns once, into
+			a snapshot, and passes the same snapshot to all of them.
+			This needs a type tag for every column of the table (see
+			\c make_type_tag()); otherwise, every file evaluates the 
+			columns itself. Files which do not take snapshots always
+			evaluate the columns themselves.
+		  */
+		virtual bool takes_snapshots() const { return false; }
+
+		/**
+			@brief Output consecutive row snapshots of a table.
+
+			The \c n records start at \c first.record, one every
+			\c first.plan.size() bytes. The default implementation
+			calls \c output_row(const row_view&) for each.
+		  */
+		virtual void output_rows(const row_view& first, size_t n);
+
+		/**
+			@brief Conclude the output session
+		  */
+		virtual void output_epilog(output_table&)=0;
+
+		/**
+			@brief Called when a table is unbound from this file.
+
+			This is called when the binding is removed, including when
+			the table is destroyed; files keeping state for the table
+			should drop it here. It must not throw. When the file
+			itself is destroyed, its bindings are removed by the
+			destructor of this class, and overrides are not called.
+		  */
+		virtual void output_unbind(output_table&) { }
+	};
+
+
+	typedef std::map<string, string> varmap;
+
+	/**
+		@brief Split a url of the form `type:path?var=value,...`.
+
+		The type is an identifier, the path is a sequence of names
+		separated by `/` (with an optional `/` in front) and the values
+		are paths. The variables are added to \c vmap. Returns false 
+		if the url is malformed, leaving the arguments unchanged.
+	  */
+	bool parse_url(const string& url, string& type, string& path, varmap& vmap);
+
+	/**
+		@brief The normal form of a url, with its variables sorted by 
+		name (and only the last value of a repeated variable).
+
+		Throws \c std::runtime_error if the url is malformed.
+	  */
+	string normalize_url(const string& url);
+
+
+	/**
+		@brief Factory for output_file objects.
+
+		The url has the form `type:path?var=value,...`. The variables
+		recognized by each type are the following (boolean values are
+		`true` or `false`):
+
+		| type               | variable       | value                                         |
+		| ------------------ | -------------- | --------------------------------------------- |
+		| `file`             | `open_mode`    | `truncate` or `append`                        |
+		|                    | `format`       | the text format (see \c text_format)          |
+		|                    | `compress`     | `none`, `gzip` or `zstd`                      |
+		|                    | `level`        | the compression level                         |
+		|                    | `thread`       | compress on a worker thread (boolean)         |
+		| `hdf5`             | `open_mode`    | `truncate` or `append`                        |
+		|                    | `chunk`        | the chunk size in rows                        |
+		|                    | `compress`     | `none`, `deflate`, `lzf` or `blosc`           |
+		|                    | `level`        | the compression level, 0 to 9                 |
+		|                    | `shuffle`      | the shuffle filter (boolean)                  |
+		|                    | `cache`        | the chunk cache size in bytes                 |
+		|                    | `buffer`       | the number of rows buffered per table         |
+		| `arrow`, `feather` | `batch`        | the rows per record batch                     |
+		|                    | `dict`         | dictionary-encode strings (boolean)           |
+		| `mmap`             | `open_mode`    | `truncate` or `append`                        |
+		|                    | `grow`         | the growth increment of the file, in bytes    |
+		| `shm`              | `rows`         | the rows in each ring                         |
+		| `tcp`, `udp`       | `batch`        | the rows per frame                            |
+		|                    | `sendbuf`      | the size of the send buffer, in bytes         |
+		|                    | `backpressure` | `block` or `drop`, when the buffer is full    |
+		|                    | `zlib`         | compress the frames (boolean)                 |
+		|                    | `encode`       | encode the columns (boolean)                  |
+		|                    | `reconnect`    | reconnect broken connections (boolean)        |
+		| all                | `async`        | wrap the file in an \c output_async (boolean) |
+		|                    | `queue`        | the queue size of the wrapper, in bytes       |
+		|                    | `policy`       | `block` or `drop`, when the queue is full     |
+
+		See \c text_compression_options, \c hdf5_dataset_options,
+		\c output_arrow, \c output_mmap, \c output_shm and 
+		\c output_socket for details. The path of `shm` urls is the 
+		prefix of the shared-memory segments, and the path of `tcp` and
+		`udp` urls is `host:port`. Socket urls reject `compress` and 
+		`buffer`, which mean something else for files. The `async` 
+		wrapper is refused for `hdf5` files, unless the HDF5 library is 
+		thread-safe.
+
+		Other types can be added by \c register_output_type(). Every
+		call returns a new file (except for `stdout` and `stderr`), 
+		owned by the caller; see \c open_shared_file() for sharing.
+	  */
+	output_file* open_file(const string& url);
+
+	/**
+		@brief A factory of output files for the urls of a type.
+
+		The factory is called with the path and the variables of a url
+		(see \c parse_url()), and returns a new output file. The 
+		variables `async`, `queue` and `policy` are also handled by
+		\c open_file().
+	  */
+	typedef std::function<output_file*(const string& path, const varmap& vars)> output_factory;
+
+	/**
+		@brief Register the factory of a url type for \c open_file(),
+		replacing any previous one, or remove it if \c factory is empty.
+
+		The built-in types can be replaced as well. Throws 
+		\c std::invalid_argument if the type is not an identifier.
+	  */
+	void register_output_type(const string& type, const output_factory& factory);
+
+	/**
+		@brief Open a file shared by all the callers with the same url.
+
+		The first call for a url (see \c normalize_url()) opens the 
+		file with \c open_file(); later calls return the same file, 
+		until it is closed by as many calls to \c close_shared_file().
+		This is thread-safe.
+	  */
+	output_file* open_shared_file(const string& url);
+
+	/**
+		@brief Release a file returned by \c open_shared_file(), and 
+		delete it when it is released by all its users.
+
+		Returns true if the file was deleted. The standard streams are
+		never deleted. Throws \c std::invalid_argument if the file 
+		was not opened by \c open_shared_file().
+	  */
+	bool close_shared_file(output_file* f);
+
+
+	/**
+		@brief Specify the format of text files
+
+		\c csvtab Formats rows without a header, which is
+		a problem for multi-table output. Columns are separated
+		by comma. There is a header at the top row
+
+		\c csvrel Each row is prefixed by the table name. All
+		row values are separated by ,
+	  */
+	enum class text_format {
+		csvtab,
+		csvrel
+	};
+	const text_format default_text_format = text_format::csvrel;
+
+	/**
+		@brief The compression of text files
+	  */
+	enum class text_compression {
+		none,	//< plain text
+		gzip,	//< gzip (zlib)
+		zstd	//< zstandard, if the library was built with it
+	};
+
+	/**
+		@brief Options for the compression of text files.
+	  */
+	struct text_compression_options
+	{
+		text_compression method = text_compression::none;
+		int level = -1;			//< the compression level, or -1 for the default
+		bool threaded = true;	//< compress on a worker thread
+	};
+
+	// forward
+	struct text_compressor;
+
+	// forward
+	class output_c_file;
+
+	/**
+		@brief Base class for text file formatters
+	  */
+	struct formatter {
+	protected:
+		output_c_file* ofile;
+		output_table& table;
+
+		// count bytes written to the file
+		void count(size_t bytes);
+
+	public:
+		formatter(output_c_file* of, output_table& tab);
+		virtual ~formatter();
+		virtual void prolog()=0;
+		virtual void row()=0;
+		virtual void row(const row_view&)=0;
+		virtual void rows(const row_view& first, size_t n);
+		virtual void epilog()=0;
+
+		// static factory
+		static formatter* create(output_c_file*,output_table& t, text_format fmt);
+		static void destroy(formatter*);
+
+		// allocated from the pool
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size);
+	};
+
+
+	/**
+		@brief An output file for text files via the
+		C standard library.
+	  */
+	class output_c_file : public output_file
+	{
+	protected:
+
+		FILE* stream;
+		string filepath;
+		bool owner;
+		text_format fmt;
+		std::unordered_map<output_table*,formatter*> fmtr;
+		text_compressor* zsink;		// the compressor of the stream, or null
+
+		/**
+			@brief Use a compressed stream writing to a target stream
+			@param target the stream of compressed data
+			@param z the compression
+		  */
+		void open_compressed(FILE* target, const text_compression_options& z);
+
+	public:
+
+		/**
+			@brief Construct without a stream
+			@param _fmt the format
+		  */
+		output_c_file(text_format _fmt=default_text_format)
+			: stream(0), filepath(), owner(false), fmt(_fmt), zsink(nullptr) {}
+
+		/**
+			@brief Create an \c output_c_file on an existing stream
+			@param _stream the stream to use
+			@param _owner whether to call \c fclose at the end or not
+			@param _fmt the format
+		  */
+		output_c_file(FILE* _stream, bool _owner, text_format _fmt=default_text_format);
+
+		/**
+			@brief Create an \c output_c_file for a given filename
+			@param _fpath the file name to open
+			@param mode the open mode
+			@param _fmt the format
+		  */
+		output_c_file(const string& _fpath,
+			open_mode mode = default_open_mode, text_format _fmt=default_text_format);
+
+		/**
+			@brief Create a compressed \c output_c_file for a given filename
+			@param _fpath the file name to open
+			@param mode the open mode
+			@param _fmt the format
+			@param z the compression
+		  */
+		output_c_file(const string& _fpath, open_mode mode, text_format _fmt,
+			const text_compression_options& z);
+
+		/**
+			@brief Move constructor
+		  */
+		inline output_c_file(output_c_file&& other)
+		: stream(other.stream), filepath(other.filepath), owner(other.owner), fmt(other.fmt),
+			zsink(other.zsink)
+		{ other.stream = nullptr; other.zsink = nullptr; }
+
+		/**
+			@brief Move assignment
+		  */
+		inline output_c_file& operator=(output_c_file&& other)
+		{
+			stream = other.stream;
+			filepath = other.filepath;
+			owner = other.owner;
+			zsink = other.zsink;
+			other.stream = nullptr;
+			other.zsink = nullptr;
+			return *this;
+		}
+
+		/**
+			@brief Destructor
+			This will call \c close() before destroying the object
+		  */
+		virtual ~output_c_file();
+
+		/**
+			@brief Open a new C stream for this object
+			@param _fpath the file path to use
+			@param mode the open mode
+		  */
+		virtual void open(const string& _fpath,
+				open_mode mode = default_open_mode);
+
+		/**
+			@brief Open a new compressed stream for this object.
+
+			The text is compressed as it is written, in blocks (on a 
+			worker thread, if \c z.threaded). In append mode, a new 
+			compressed stream is appended, which gzip and zstd tools 
+			read as one.
+			@param _fpath the file path to use
+			@param mode the open mode
+			@param z the compression
+			@throws std::invalid_argument if the compression is not available
+		  */
+		void open(const string& _fpath, open_mode mode, const text_compression_options& z);
+
+		/**
+			@brief Use an existing stream for this object
+			@param _stream the stream to use
+			@param _owner whether the stream is owned or not
+		  */
+		virtual void open(FILE* _stream, bool _owner);
+
+		/**
+			@brief Close a steam and reset the \c output_c_file object
+
+			This method behaves differently based on whether the stream is
+			owned or not. On an owned stream, \c fclose is called. On a
+			non-owned stream, \c fflush is called. An owned stream is
+			released even when \c fclose fails and this throws.
+		  */
+		virtual void close();
+
+		/**
+			@brief Flush the underlying stream.
+
+			A compressed stream is flushed, so that the data written 
+			so far can be decompressed.
+		  */
+		virtual void flush();
+
+		/**
+			@brief True if the stream is compressed
+		  */
+		inline bool compressed() const { return zsink != nullptr; }
+
+		/**
+			@brief The current stream object (which may be null)
+		  */
+		inline FILE* file() const { return stream; }
+
+		/**
+			@brief Set the owner flag for the current stream
+		  */
+		void set_owner(bool b) { owner = b; }
+
+		/**
+			@brief Get the owner flag for the current stream
+		  */
+		bool is_owner() const { return owner; }
+
+		/**
+			@brief Return the path to the current stream
+		  */
+		const string& path() const { return filepath; }
+
+		/**
+			@brief Prepare for output.
+			@param t the \c output_table to prepare for
+		  */
+		virtual void output_prolog(output_table& t);
+
+		/**
+			@brief Output a row
+			@param t the \c output_table to output from
+		  */
+		virtual void output_row(output_table&);
+
+		/**
+			@brief Output a row snapshot
+			@param r the row
+		  */
+		virtual void output_row(const row_view& r) override;
+		virtual bool takes_snapshots() const override { return true; }
+
+		/**
+			@brief Output consecutive row snapshots, formatted in one pass
+		  */
+		virtual void output_rows(const row_view& first, size_t n) override;
+
+		/**
+			@brief Finish the output session for this table
+			@param t the \c output_table to finish for.
+		  */
+		virtual void output_epilog(output_table&);
+	};
+
+	/**
+		@brief An \c output_c_file for the standard output.
+	  */
+	extern output_c_file output_stdout;
+
+	/**
+		@brief An \c output_c_file for the standard error.
+	  */
+	extern output_c_file output_stderr;
+
+	/**
+		@brief A text output stream writing to a memory region.
+
+		This is mostly useful for internal purposes, such as
+		debugging.
+	 */
+	class output_mem_file : public output_c_file
+	{
+		struct memstate {
+			char* buffer;
+			size_t len;
+		};
+		memstate* state;
+	public:
+
+		/**
+			@brief Constructor
+		  */
+		output_mem_file(text_format fmt = text_format::csvtab);
+
+		/**
+			@brief Construct a compressed memory file.
+
+			The contents are the compressed data, flushed at every
+			call to \c contents() or \c str().
+		  */
+		output_mem_file(text_format fmt, const text_compression_options& z);
+
+		/**
+			@brief Destructor
+		  */
+		~output_mem_file();
+
+		/**
+			@brief Move assignment
+		  */
+		inline output_mem_file& operator=(output_mem_file&& other)
+		{
+			output_c_file::operator=((output_c_file&&)other);
+			state = other.state;
+			other.state = nullptr;
+			return *this;
+		}
+
+		/**
+			@brief Get a pointer to the current contents of the
+			stream.
+
+			Note that this pointer should not be used after more data
+			is added to the stream.
+		*/
+		const char* contents();
+
+		/**
+			Get a copy of the data in the stream.
+			@return a string with the current contents
+		  */
+		string str();
+
+		/**
+			@brief The size of the current contents
+		  */
+		size_t size();
+	};
+
 
-		// data api
+	/**
+		@brief What an \c output_async does with a row when its queue is full
+	  */
+	enum class async_policy {
+		block,	//< wait until there is space in the queue
+		drop	//< drop the row
+	};
+
+	/**
+		@brief Default queue size of an \c output_async, in bytes
+	  */
+	const size_t default_async_queue = 1<<20;
+
+	/**
+		@brief An output file that writes to another file from a background thread.
+
+		Each row emitted to an \c output_async is taken as a snapshot
+		(see \c row_view) and placed in a queue. A background thread takes
+		the snapshots from the queue and passes them to the wrapped file,
+		which must support row snapshots.
+
+		The queue is a lock-free ring buffer with a single producer and a
+		single consumer, therefore all tables bound to an \c output_async
+		must emit their rows from the same thread. When the queue is full,
+		rows are either dropped or the producer waits, according to the
+		\c async_policy.
+
+		The \c output_prolog(), \c output_epilog(), \c flush() and \c close()
+		methods wait until the queue is drained, and then call the wrapped
+		file from the calling thread. Errors raised by the wrapped file in
+		the background are rethrown from the next call on the calling thread. 
+
+		Since the wrapped file runs alongside the calling thread, it must
+		not share unsynchronized global state with it. In particular, an
+		\c output_hdf5 can be wrapped only if the HDF5 library is built
+		thread-safe (see \c H5is_library_threadsafe()); otherwise, the 
+		constructor throws \c std::invalid_argument, and the file is not 
+		taken.
+	  */
+	class output_async : public output_file
+	{
+		// the header of a queue slot, the packed record follows
+		struct slot {
+			output_table* table;	// the table, or null to skip to the start
+			const row_plan* plan;	// the record layout
+			size_t size;			// the size of the slot in bytes
+		};
+		static constexpr size_t slot_align = 32;
+
+		output_file* target;
+		bool owner;
+		async_policy policy;
+
+		std::vector<char> ring;			// the queue
+		std::atomic<size_t> head;		// the write position of the producer
+		std::atomic<size_t> tail;		// the read position of the consumer
+		std::atomic<bool> waiting;		// the consumer is blocked on cv
+		std::atomic<size_t> blocked;	// the tail awaited by the producer, or 0
+		std::atomic<bool> stop;			// the consumer should exit
+		std::atomic<bool> failed;		// an error was raised in the background
+		std::atomic<size_t> ndropped;	// number of dropped rows
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::condition_variable room;	// signals the consumer's progress
+		std::exception_ptr error;
+		std::thread worker;
+
+		size_t slot_size(const row_plan& plan) const;
+		void wait_for_tail(size_t t);
+		void enqueue(output_table& table, const char* record);
+		void run();
+		void drain();
+		void check_error();
+
+	public:
 
 		/**
-			@brief Put a table to output mode.
+			@brief Wrap an output file.
 
-			A call to this method must be made before any data is output,
-			but only after all columns have been added.
+			@param f the file to write to
+			@param _owner if true, \c f will be deleted with this object
+			@param queue the size of the queue in bytes
+			@param p the policy for a full queue
 		  */
-		void prolog();    // calls files to e.g. print a header
+		output_async(output_file* f, bool _owner=false,
+			size_t queue=default_async_queue, async_policy p=async_policy::block);
 
 		/**
-			@brief Emit a table row
+			@brief Drain the queue and stop the background thread
+		  */
+		~output_async();
 
-			Data for the table row is collected from the column objects
+		/**
+			@brief The wrapped file
 		  */
-		void emit_row();  // a new table row is ready
+		inline output_file* file() const { return target; }
 
 		/**
-			@brief Terminate output mode, make table editable again
+			@brief The number of bytes currently in the queue
+		  */
+		inline size_t queued() const { return head.load() - tail.load(); }
 
-			A call to this method must follow all output operations
+		/**
+			@brief The number of rows dropped because the queue was full
 		  */
-		void epilog();    // calls files to e.g. print a footer
+		inline size_t dropped() const { return ndropped.load(); }
 
+		/**
+			@brief The statistics of this file, with the queue state
+		  */
+		virtual output_stats stats() const override;
 
 		/**
-			@brief Generate a JSON description of the columns of this table.
+			@brief Drain the queue and flush the wrapped file
+		  */
+		virtual void flush() override;
 
-			The description format is a JSON object of the form
-			\verbatim
-			{
-				"name": <table name>,
-				"columns": [
-					{
-						"name": "somecol",
-						"type": "double",
-						"arithmetic": true
-					},
-					...
-				]
-			}
+		/**
+			@brief Drain the queue and close the wrapped file
+		  */
+		virtual void close() override;
 
-			@param out the output stream to receive the JSON
-		 */
-		virtual void generate_schema(std::ostream& out);
+		virtual void output_prolog(output_table&) override;
+		virtual void output_row(output_table&) override;
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+		virtual void output_epilog(output_table&) override;
+	};
 
 
-		// static members
+	/**
+		@brief A read-only view of a contiguous array of values.
 
-		typedef std::unordered_set<output_table*> registry;
+		This is a minimal version of C++20 \c std::span, used to
+		access column data without copying.
+	  */
+	template <typename T>
+	class column_span
+	{
+		const T* _data;
+		size_t _size;
+	public:
+		column_span(const T* d, size_t n) : _data(d), _size(n) { }
+
+		inline const T* data() const { return _data; }
+		inline size_t size() const { return _size; }
+		inline bool empty() const { return _size==0; }
+		inline const T& operator[](size_t i) const { return _data[i]; }
+		inline const T* begin() const { return _data; }
+		inline const T* end() const { return _data+_size; }
+	};
+
+
+	/**
+		@brief An output file storing tables in memory, column by column.
+
+		For each bound table, the values of each column are appended to
+		a contiguous array (a struct-of-arrays layout). Each element of the
+		array holds the binary image of the column, as returned by
+		\c basic_column::copy(), and is \c basic_column::size() bytes long.
+		Thus, arithmetic columns are stored as arrays of their type, and
+		string columns as arrays of fixed-width, zero-terminated strings.
+
+		The data of a table is kept after its \c epilog(), until
+		\c clear() is called or the table is unbound (which includes its
+		destruction). A new \c prolog() for the same table appends
+		to the existing data.
+	  */
+	class output_columnar : public output_file
+	{
+	public:
+		/**
+			@brief The data of a column
+		  */
+		struct column_data
+		{
+			string name;				//< the column's path name
+			type_index type;			//< the column's type
+			size_t width;				//< bytes per element
+			std::vector<char> data;		//< the column values
+			basic_column* source;		//< the column, during output
+		};
+
+	protected:
+		struct table_data
+		{
+			std::vector<column_data> columns;
+			size_t rows;
+			bool active;		// between prolog and epilog
+		};
+		std::unordered_map<output_table*, table_data> _data;
+
+		const table_data& tdata(output_table&) const;
+
+	public:
 
 		/**
-			@brief Get a table object by name
+			@brief Constructor
 		  */
-		static output_table* get(const string&);
+		output_columnar();
 
 		/**
-			@brief A container for all table objects
+			@brief Destructor
 		  */
-		static const registry& all();
-	};
+		~output_columnar();
 
+		/**
+			@brief The number of rows stored for a table
+		  */
+		size_t rows(output_table& t) const;
 
-	/**
-		@brief Table for data reported after the end of a run
+		/**
+			@brief The stored data of a column, by index
+		  */
+		const column_data& column(output_table& t, size_t col) const;
 
-		A result table is a flavor of \c output_table which specializes
-		in reporting data after the end of a run.
-	  */
-	class result_table : public output_table
-	{
-	public:
 		/**
-			@brief Construct a table
-			@param _name the table name
+			@brief The stored data of a column, by path name
 		  */
-		result_table(const string& _name);
+		const column_data& column(output_table& t, const string& path) const;
 
 		/**
-			@brief Construct a table and add columns
-			@param _name the table name
-			@param col a list of column objects to add
+			@brief Typed access to the stored values of a column.
+
+			@tparam T the column type, which must be arithmetic
+			@throws std::invalid_argument if the column is not of type T
 		  */
-		result_table(const string& _name,
-			column_item_list col);
+		template <typename T, typename Col>
+		column_span<T> get(output_table& t, const Col& col) const
+		{
+			static_assert(std::is_arithmetic<T>::value,
+				"get<T> is only supported for arithmetic columns");
+			const column_data& cd = column(t, col);
+			if(cd.type != typeid(T))
+				throw std::invalid_argument("wrong column type for column "+cd.name);
+			return column_span<T>((const T*) cd.data.data(), cd.data.size()/cd.width);
+		}
+
+		/**
+			@brief Access the stored value of a string column
+		  */
+		template <typename Col>
+		const char* text(output_table& t, const Col& col, size_t row) const
+		{
+			const column_data& cd = column(t, col);
+			if(cd.type != typeid(string))
+				throw std::invalid_argument("wrong column type for column "+cd.name);
+			return cd.data.data() + row*cd.width;
+		}
+
+		/**
+			@brief Copy stored rows into a buffer of packed records.
 
+			Copies rows `[from, from+n)` into consecutive records of
+			`stride` bytes, placing column `i` at `offset[i]` in each record.
+			This can be used to export the data to binary formats.
+		  */
+		void pack_rows(output_table& t, size_t from, size_t n, 
+			char* buffer, const std::vector<size_t>& offset, size_t stride) const;
 
 		/**
-			@brief Destroy the result table
+			@brief Drop the stored data of a table
 		  */
-		virtual ~result_table();
+		void clear(output_table& t);
+
+		/**
+			@brief Drop all stored data
+		  */
+		void clear();
+
+		virtual void output_prolog(output_table&) override;
+		virtual void output_row(output_table&) override;
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+		virtual void output_epilog(output_table&) override;
+		virtual void output_unbind(output_table&) override;
 	};
 
 
 	/**
-		@brief Table for data collected during a run
+		@brief Default number of rows in a record batch of an Arrow file
+	  */
+	const size_t default_arrow_batch_rows = 1<<16;
 
-		A time series table collects a number of column values during a run
+	/**
+		@brief An output file in the Arrow IPC file format (a.k.a. Feather V2).
+
+		The rows of a table are collected column by column, and written 
+		as Arrow record batches of \c batch_rows() rows. Arithmetic 
+		columns map to the Arrow integer, floating point and boolean 
+		types, and string columns to UTF-8 strings. By default, string
+		columns are dictionary-encoded: new dictionary entries are written
+		as (delta) dictionary batches, before the record batch using them.
+		Column groups map to struct fields, with nested children.
+
+		An Arrow file holds a single table. The file is (re)created by 
+		the table's \c prolog(), and completed by its \c epilog().
+		The files can be read by Arrow libraries, e.g., by
+		\c pyarrow.feather.read_table() in Python.
 	  */
-	template <typename TimeType>
-	class time_series : public output_table
+	class output_arrow : public output_file
 	{
+		string filepath;
+		size_t nbatch;			// rows per record batch
+		bool dict;				// dictionary-encode strings
+		struct table_writer;
+		table_writer* writer;	// the writer of the active table, or null
 	public:
+
 		/**
-			@brief Construct a time series table
-			@param _name the table name
+			@brief Create an Arrow file for the given path.
+
+			The file is created at the table's \c prolog().
+			@param path the file path
+			@param batch_rows the number of rows per record batch
+			@param dictionary if true, string columns are dictionary-encoded
 		  */
-		time_series(const string& _name, const string& _nowfmt, const std::function<TimeType()>& _nowfunc)
-		: output_table(_name, table_flavor::TIMESERIES),
-			now("time", _nowfmt, _nowfunc)
-		{ add(now); }
+		output_arrow(const string& path, size_t batch_rows=default_arrow_batch_rows,
+			bool dictionary=true);
 
 		/**
-			@brief The type of the time column.
-			*/
-		typedef TimeType time_type;
+			@brief Destructor
+		  */
+		~output_arrow();
 
 		/**
-			@brief A column for this table containing the current stream time
+			@brief The file path
+		  */
+		inline const string& path() const { return filepath; }
 
-			This column is the first column of the time series table
+		/**
+			@brief The number of rows per record batch
+		  */
+		inline size_t batch_rows() const { return nbatch; }
+
+		/**
+			@brief Set the number of rows per record batch.
+
+			This only affects tables whose \c prolog() is called later.
+		  */
+		void set_batch_rows(size_t rows);
+
+		/**
+			@brief Select the dictionary encoding of string columns.
+
+			This only affects tables whose \c prolog() is called later.
+		  */
+		inline void set_dictionary(bool d) { dict = d; }
+
+		/**
+			@brief Write the collected rows as a (short) record batch
 		  */
-		computed<TimeType> now;
+		virtual void flush() override;
+
+		virtual void output_prolog(output_table&) override;
+		virtual void output_row(output_table&) override;
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+		virtual void output_epilog(output_table&) override;
 	};
 
 
 	/**
-		@brief Open mode fore new output files
+		@brief The header of a memory-mapped table file.
 
-		When creating a new file object, the values of this \c enum are
-		used to indicate whether to open the file in _truncate_ or _append_ mode.
+		The header is followed by the JSON description of the records,
+		of \c layout bytes, and by their binary descriptor (see 
+		\c row_plan::descriptor()). The records start at offset \c data.
 	  */
-	enum class open_mode { truncate, append };
+	struct mmap_header
+	{
+		char magic[8];			//< "TABLEMM1"
+		uint64_t data;			//< the file offset of the first record
+		uint64_t record;		//< the size of a record
+		uint64_t rows;			//< the number of records
+		uint64_t layout;		//< the size of the JSON layout
+		uint64_t descriptor;	//< the offset of the binary descriptor, or 0
+		uint64_t descriptor_size;	//< the size of the binary descriptor
+		uint64_t reserved[1];
+	};
 
 	/**
-		@brief Default open mode
+		@brief Default growth increment of memory-mapped files, in bytes
 	  */
-	const open_mode default_open_mode = open_mode::truncate;
+	const size_t default_mmap_grow = 1<<24;
 
 	/**
-		@brief  Abstract base class for an output file
-
-		Output files are used to write \c output_table data to the
-		filesystem
+		@brief An output file of fixed-size binary records, written via
+		a memory mapping.
+
+		The rows of a table are stored as packed records with the layout
+		of the table's \c row_plan (the layout of the HDF5 datasets).
+		Rows are copied directly into the mapping, and the row count in
+		the header is updated with each row, so that readers can follow
+		the file as it grows. The file is extended with \c ftruncate(),
+		by at least \c grow bytes at a time, and remapped. At \c epilog(),
+		the file is truncated to the size of its rows.
+
+		The file starts with an \c mmap_header, followed by a JSON 
+		description of the records:
+		\verbatim
+		{
+			"schema": <the table's schema, see output_table::generate_schema()>,
+			"record_size": <bytes>,
+			"align": <bytes>,
+			"layout": [ { "name": <path name>, "type": <tag name>, 
+				"offset": <bytes>, "size": <bytes> }, ... ]
+		}
+		\endverbatim
+		and by the same layout as a binary descriptor. Thus, the records
+		can be read with no parsing, e.g., by \c numpy.memmap.
+
+		A file holds a single table. In append mode, the rows are 
+		appended to an existing file of the same layout. In truncate
+		mode, the file is truncated by the first \c prolog() only, and
+		later prolog/epilog cycles append to it.
 	  */
-	class output_file
+	class output_mmap : public output_file
 	{
-	protected:
-		output_binding::list tables;
-		friend struct output_binding;
+		string filepath;
+		open_mode mode;
+		bool created;			// the file was opened (and truncated) before
+		size_t grow;
+		output_table* active;	// the table between prolog and epilog
+		int fd;
+		char* base;				// the mapping
+		size_t mapped;			// the size of the mapping (and the file)
+		size_t stride;
+
+		inline mmap_header* header() { return (mmap_header*) base; }
+		void close_file();
+		void reserve(size_t bytes);
+		char* next_record();
 	public:
 
 		/**
-			@brief Constructor
-		  */
-		output_file();
+			@brief Create an output for the given file path.
 
-		output_file(const output_file&)=delete;
-		output_file& operator=(const output_file&)=delete;
-		output_file(output_file&&) = default;
-		output_file& operator=(output_file&&) = default;
+			The file is opened at the table's \c prolog().
+			@param path the file path
+			@param mode the open mode
+			@param _grow the minimum growth of the file, in bytes
+		  */
+		output_mmap(const string& path, open_mode mode=default_open_mode,
+			size_t _grow=default_mmap_grow);
 
 		/**
 			@brief Destructor
 		  */
-		virtual ~output_file();
-
+		~output_mmap();
 
 		/**
-			@brief Bind this file to a table
-			@param t the table to bind with
-			@return the binding object
+			@brief The file path
 		  */
-		output_binding* bind(output_table& t) {
-			auto b = output_binding::find(tables, &t);
-			if(b==nullptr)
-				b = new output_binding(this, &t);
-			return b;
-		}
+		inline const string& path() const { return filepath; }
 
 		/**
-			@brief Unbind this file from a table
+			@brief The number of rows in the file, or 0 if the file is not open
 		  */
-		bool unbind(result_table& t) {
-			auto b = output_binding::find(tables, &t);
-			if(b) delete b;
-			return b;
-		}
+		size_t rows() const;
 
 		/**
-			@brief All bindings
+			@brief Return the JSON layout for a table
 		  */
-		inline auto bindings() const { return tables; }
+		static string layout(output_table& table);
 
 		/**
-			@brief Unbind this file from all tables
+			@brief Schedule the mapped rows for writing to disk
 		  */
-		void unbind_all() {
-			output_binding::unbind_all(tables);
-		}
+		virtual void flush() override;
+
+		virtual void output_prolog(output_table&) override;
+		virtual void output_row(output_table&) override;
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+		virtual void output_epilog(output_table&) override;
+	};
+
 
+	/**
+		@brief The header of a shared-memory table segment.
+
+		The header is followed by the JSON layout of the records (as 
+		for \c output_mmap), of \c layout bytes, by their binary 
+		descriptor, and by a ring of
+		\c capacity records, starting at offset \c data. Row \c r is
+		held by slot <tt>r % capacity</tt>.
+
+		The header's \c seq is a sequence lock over the ring: it is
+		twice the number of rows written, plus one while a row is 
+		being written. Readers copy rows, and then check \c seq 
+		again to find the ones that were not overwritten meanwhile 
+		(see \c shm_reader).
+	  */
+	struct shm_header
+	{
+		char magic[8];					//< "TABLESH1"
+		std::atomic<uint64_t> seq;		//< the sequence lock
+		uint64_t data;					//< the offset of the ring
+		uint64_t record;				//< the size of a record
+		uint64_t capacity;				//< the number of records in the ring
+		uint64_t layout;				//< the size of the JSON layout
+		std::atomic<uint64_t> active;	//< 1 between prolog and epilog
+		uint64_t descriptor;			//< the offset of the binary descriptor
+		uint64_t descriptor_size;		//< the size of the binary descriptor
+	};
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, 
+		"shared-memory segments need lock-free atomics");
+
+	/**
+		@brief Default number of rows in a shared-memory ring
+	  */
+	const size_t default_shm_rows = 1<<12;
+
+	/**
+		@brief A sink publishing the latest rows of tables in shared memory.
+
+		Every bound table gets a POSIX shared-memory segment, named
+		<tt>name.table</tt> (see \c segment()), holding a \c shm_header,
+		the JSON layout of \c output_mmap::layout() and a ring of the 
+		latest rows, as packed records of the table's \c row_plan.
+
+		Writing a row is a copy into the mapping and two atomic stores:
+		there are no system calls, and no waiting on readers, which may
+		come and go at any time. The segments are created at the 
+		table's \c prolog(), and removed when the sink is destroyed.
+	  */
+	class output_shm : public output_file
+	{
+		struct segment_data {
+			string name;
+			int fd;
+			char* base;
+			size_t mapped;
+			size_t stride;
+			uint64_t capacity;
+			inline shm_header* header() { return (shm_header*) base; }
+			void write(const char* record);
+			template <typename F> inline void publish(F fill);
+		};
+		string prefix;
+		size_t capacity;
+		std::unordered_map<output_table*, segment_data> segments;
+		void close_segment(segment_data& s, bool unlink);
+	public:
 		/**
-			@brief Flush this file
+			@brief Create a sink.
+			@param name the prefix of the segment names
+			@param rows the number of rows in each ring
 		  */
-		virtual void flush() { }
+		output_shm(const string& name, size_t rows=default_shm_rows);
 
 		/**
-			@brief Close this file
+			@brief Destroy the sink, removing the segments
 		  */
-		virtual void close() { }
+		~output_shm();
 
 		/**
-			@brief Called by a table to prepare for output mode
-
+			@brief The segment name for a table
 		  */
-		virtual void output_prolog(output_table&)=0;
+		string segment(output_table& table) const;
+
+		virtual void output_prolog(output_table&) override;
+		virtual void output_row(output_table&) override;
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+		virtual void output_epilog(output_table&) override;
+	};
 
+	/**
+		@brief A reader tailing a shared-memory table segment.
+
+		The reader never blocks the writer: rows overwritten before
+		they are read are skipped, and counted by \c lost().
+	  */
+	class shm_reader
+	{
+		int fd;
+		const char* base;
+		size_t mapped;
+		uint64_t next, _lost;
+		inline const shm_header* header() const { return (const shm_header*) base; }
+	public:
 		/**
-			@brief Output a table row
+			@brief Open a segment by name, e.g. \c output_shm::segment()
+			@throws std::runtime_error if there is no such segment
 		  */
-		virtual void output_row(output_table&)=0;
+		shm_reader(const string& name);
+		~shm_reader();
 
 		/**
-			@brief Conclude the output session
+			@brief The JSON layout of the records
 		  */
-		virtual void output_epilog(output_table&)=0;
-	};
-
-
-	typedef std::map<string, string> varmap;
+		string layout() const;
 
-	bool parse_url(const string& url, string& type, string& path, varmap& vmap);
+		/**
+			@brief The layout of the records, from their binary descriptor
+		  */
+		record_layout descriptor() const;
 
+		/**
+			@brief The size of a record
+		  */
+		inline size_t record_size() const { return header()->record; }
 
-	/**
-		@brief Factory for output_file objects.
-	  */
-	output_file* open_file(const string& url);
+		/**
+			@brief The number of rows written to the segment
+		  */
+		inline uint64_t rows() const { return header()->seq.load(std::memory_order_acquire)/2; }
 
+		/**
+			@brief True while the table is between prolog and epilog
+		  */
+		inline bool active() const { return header()->active.load(std::memory_order_acquire); }
 
-	/**
-		@brief Specify the format of text files
+		/**
+			@brief The number of rows skipped, because they were overwritten
+		  */
+		inline uint64_t lost() const { return _lost; }
 
-		\c csvtab Formats rows without a header, which is
-		a problem for multi-table output. Columns are separated
-		by comma. There is a header at the top row
+		/**
+			@brief Copy the next rows, and return their number.
 
-		\c csvrel Each row is prefixed by the table name. All
-		row values are separated by ,
-	  */
-	enum class text_format {
-		csvtab,
-		csvrel
+			At most \c max rows are copied to \c buffer, which must
+			hold \c max records. Returns 0 if there are no new rows.
+		  */
+		size_t read(void* buffer, size_t max);
 	};
-	const text_format default_text_format = text_format::csvrel;
 
-	// forward
-	class output_c_file;
 
 	/**
-		@brief Base class for text file formatters
+		@brief The encoding of a column in a block of records
+		(see \c block_codec).
 	  */
-	struct formatter {
-	protected:
-		output_c_file* ofile;
-		output_table& table;
-
-	public:
-		formatter(output_c_file* of, output_table& tab);
-		virtual ~formatter();
-		virtual void prolog()=0;
-		virtual void row()=0;
-		virtual void epilog()=0;
-
-		// static factory
-		static formatter* create(output_c_file*,output_table& t, text_format fmt);
-		static void destroy(formatter*);
+	enum class column_encoding : uint8_t {
+		raw = 0,		//< the values as they are
+		delta = 1,		//< delta-of-delta of the values, as integers
+		xor_float = 2,	//< the XOR of consecutive floats (Gorilla-style)
+		rle = 3			//< runs of equal values
 	};
 
-
 	/**
-		@brief An output file for text files via the
-		C standard library.
+		@brief An encoder of blocks of packed records, column by column.
+
+		Every block is encoded on its own. The encoding of a column is
+		chosen by its type:
+		- the time column of a time series (the first column) is
+		  encoded as the delta-of-delta of its values (of the bits of
+		  floats), as zigzag varints, with runs of zeros collapsed;
+		- \c float and \c double columns are encoded as the XOR of
+		  consecutive values, as a bit stream of the meaningful bits;
+		- integer, \c bool and string columns are run-length encoded;
+		- other columns are copied.
+		All encodings are lossless. The encoded block starts with the
+		number of columns; every column is stored as its encoding
+		(one byte), the size of its data (a varint) and the data, so
+		that blocks can be decoded with the layout alone.
 	  */
-	class output_c_file : public output_file
+	class block_codec
 	{
-	protected:
-
-		FILE* stream;
-		string filepath;
-		bool owner;
-		text_format fmt;
-		std::unordered_map<output_table*,formatter*> fmtr;
-
+		struct column_info {
+			size_t offset;
+			size_t size;
+			bool is_signed;
+			column_encoding encoding;
+		};
+		std::vector<column_info> _columns;
+		size_t _record;
 	public:
+		block_codec() : _record(0) { }
 
 		/**
-			@brief Construct without a stream
-			@param _fmt the format
+			@brief The codec for the records of a row plan.
+			@param plan the layout of the records
+			@param series true to encode the first column as time
 		  */
-		output_c_file(text_format _fmt=default_text_format)
-			: stream(0), filepath(), owner(false), fmt(_fmt) {}
+		explicit block_codec(const row_plan& plan, bool series=false);
 
 		/**
-			@brief Create an \c output_c_file on an existing stream
-			@param _stream the stream to use
-			@param _owner whether to call \c fclose at the end or not
-			@param _fmt the format
+			@brief The size of a record
 		  */
-		output_c_file(FILE* _stream, bool _owner, text_format _fmt=default_text_format);
+		inline size_t record_size() const { return _record; }
 
 		/**
-			@brief Create an \c output_c_file for a given filename
-			@param _fpath the file name to open
-			@param mode the open mode
-			@param _fmt the format
+			@brief The number of columns
 		  */
-		output_c_file(const string& _fpath,
-			open_mode mode = default_open_mode, text_format _fmt=default_text_format);
+		inline size_t columns() const { return _columns.size(); }
 
 		/**
-			@brief Move constructor
+			@brief The encoding of a column
 		  */
-		inline output_c_file(output_c_file&& other)
-		: stream(other.stream), filepath(other.filepath), owner(other.owner), fmt(other.fmt)
-		{ other.stream = nullptr; }
+		inline column_encoding encoding(size_t i) const { return _columns.at(i).encoding; }
 
 		/**
-			@brief Move assignment
+			@brief Change the encoding of a column.
+
+			Throws \c std::invalid_argument if the encoding does not
+			apply to the column (\c xor_float needs 4 or 8 byte values,
+			\c delta needs at most 8 bytes).
 		  */
-		inline output_c_file& operator=(output_c_file&& other)
-		{
-			stream = other.stream;
-			filepath = other.filepath;
-			owner = other.owner;
-			other.stream = nullptr;
-			return *this;
-		}
+		void set_encoding(size_t i, column_encoding e);
 
 		/**
-			@brief Destructor
-			This will call \c close() before destroying the object
+			@brief Encode a block of \c rows records, appending it to \c out
 		  */
-		virtual ~output_c_file();
+		void encode(const char* records, size_t rows, std::vector<char>& out) const;
 
 		/**
-			@brief Open a new C stream for this object
-			@param _fpath the file path to use
-			@param mode the open mode
+			@brief Decode a block of \c rows records of \c bytes into
+			\c records.
+
+			Throws \c std::runtime_error if the block does not hold
+			\c rows records of this layout.
 		  */
-		virtual void open(const string& _fpath,
-				open_mode mode = default_open_mode);
+		void decode(const char* data, size_t bytes, size_t rows, char* records) const;
+	};
+
+
+	/**
+		@brief The header of a frame sent by \c output_socket.
+
+		All values are in the byte order of the sender. A frame is 
+		followed by \c length bytes of payload:
+		- a \c schema frame carries the description of a table, as
+		  text lines: the table name, the flavor (0 for results, 1 for 
+		  time series), the record size, and then one line per column,
+		  `type size format path`, separated by tabs;
+		- a \c rows frame carries \c rows packed records, compressed
+		  with zlib if \c raw (the uncompressed size) is not 0;
+		- an \c encoded frame carries \c rows records encoded by a
+		  \c block_codec, compressed with zlib if \c raw is not 0;
+		- an \c epilog frame ends the run of a table.
+		The \c table is an id chosen by the sender.
+	  */
+	struct socket_frame
+	{
+		enum kind_type : uint16_t { schema=1, rows=2, epilog=3, encoded=4 };
+		uint32_t length;		//< the payload size
+		uint16_t kind;			//< the frame kind
+		uint16_t table;			//< the table id
+		uint32_t nrows;			//< the number of records, in row frames
+		uint32_t raw;			//< the uncompressed size, or 0
+	};
+
+	/**
+		@brief Default number of rows per frame of an \c output_socket
+	  */
+	const size_t default_socket_batch_rows = 1024;
+
+	/**
+		@brief Default size of the send buffer of an \c output_socket
+	  */
+	const size_t default_socket_buffer = 1<<22;
+
+	/**
+		@brief Default maximum frame size accepted by a \c socket_receiver
+	  */
+	const size_t default_socket_max_frame = 1<<26;
 
+	/**
+		@brief An output file streaming rows over TCP or UDP.
+
+		The schema of a table is sent at its \c prolog(), and its rows
+		follow in batched frames of packed records (see 
+		\c socket_frame), received by a \c socket_receiver.
+
+		The socket is non-blocking. Frames are queued in a send buffer,
+		drained whenever the socket can take data. When the buffer is 
+		full, the policy either waits for the socket (\c block) or drops
+		the frame (\c drop), counting the rows in \c stats().dropped.
+
+		Over TCP, if the connection breaks and reconnection is enabled, 
+		the buffered data are discarded, and the connection is retried
+		at most once per second as rows arrive; the schemas of the 
+		active tables are sent again on reconnection. Otherwise, a 
+		broken connection throws \c std::runtime_error.
+
+		The row frames can be encoded column by column by a 
+		\c block_codec, and compressed with zlib. A frame is sent as 
+		packed records when neither makes it smaller.
+
+		Over UDP, every frame is a datagram, the batches are limited
+		to fit in one, frames are dropped when the socket is busy, and 
+		the schemas are repeated every 64 frames.
+	  */
+	class output_socket : public output_file
+	{
+		struct stream_data {
+			uint16_t id;
+			std::vector<char> schema;	// the schema frame
+			std::vector<char> batch;	// the records of the pending frame
+			size_t stride;
+			size_t rows;				// rows in the batch
+			size_t limit;				// rows per frame
+			size_t frames;				// frames sent
+			block_codec codec;			// the encoding of the batches
+			std::vector<char> encoded;	// the encoded frame
+		};
+		string host;
+		string port;
+		bool udp;
+		size_t batch_rows;
+		size_t max_buffer;
+		async_policy policy;
+		bool compress;
+		bool encode;
+		bool reconnect;
+		int fd;
+		bool connecting;				// a connection is in progress
+		std::vector<char> outbuf;		// the send buffer
+		size_t outpos;					// the first unsent byte
+		std::chrono::steady_clock::time_point last_attempt;
+		std::unordered_map<output_table*, stream_data> streams;
+		uint16_t next_id;
+		uint64_t _dropped;
+		std::vector<char> zbuf;
+
+		bool try_connect(int wait_ms);
+		void connected_now();
+		void disconnect();
+		bool drain(bool wait);
+		void send_frame(const char* frame, size_t bytes, size_t rows);
+		void send_batch(stream_data& s);
+	public:
 		/**
-			@brief Use an existing stream for this object
-			@param _stream the stream to use
-			@param _owner whether the stream is owned or not
+			@brief Create a socket output to a host.
+
+			The connection is made at the first \c prolog().
+			@param host the host name or address
+			@param port the port number or service name
+			@param udp true for UDP, false for TCP
+			@param batch the number of rows per frame
 		  */
-		virtual void open(FILE* _stream, bool _owner);
+		output_socket(const string& host, const string& port, bool udp=false, 
+			size_t batch=default_socket_batch_rows);
 
 		/**
-			@brief Close a steam and reset the \c output_c_file object
-
-			This method behaves differently based on whether the stream is
-			owned or not. On an owned stream, \c fclose is called. On a
-			non-owned stream, \c fflush is called.
+			@brief Destructor, sending the buffered frames
 		  */
-		virtual void close();
+		~output_socket();
 
 		/**
-			@brief Flush the underlying stream
+			@brief Set the size of the send buffer, in bytes
 		  */
-		virtual void flush();
+		void set_buffer_bytes(size_t bytes);
 
 		/**
-			@brief The current stream object (which may be null)
+			@brief Set the policy when the send buffer is full
 		  */
-		inline FILE* file() const { return stream; }
+		void set_policy(async_policy p);
 
 		/**
-			@brief Set the owner flag for the current stream
+			@brief Enable compression of the row frames (with zlib)
 		  */
-		void set_owner(bool b) { owner = b; }
+		void set_compression(bool on);
 
 		/**
-			@brief Get the owner flag for the current stream
+			@brief Enable the column encoding of the row frames (see 
+			\c block_codec), before compression
 		  */
-		bool is_owner() const { return owner; }
+		void set_encoding(bool on);
 
 		/**
-			@brief Return the path to the current stream
+			@brief Enable reconnection of broken TCP connections
 		  */
-		const string& path() const { return filepath; }
+		void set_reconnect(bool on);
 
 		/**
-			@brief Prepare for output.
-			@param t the \c output_table to prepare for
+			@brief True if the socket is connected
 		  */
-		virtual void output_prolog(output_table& t);
+		inline bool connected() const { return fd >= 0 && !connecting; }
 
 		/**
-			@brief Output a row
-			@param t the \c output_table to output from
+			@brief The number of bytes waiting in the send buffer
 		  */
-		virtual void output_row(output_table&);
+		inline size_t buffered() const { return outbuf.size() - outpos; }
 
 		/**
-			@brief Finish the output session for this table
-			@param t the \c output_table to finish for.
+			@brief Send the pending batches, and wait for the send
+			buffer to drain (only with the \c block policy)
 		  */
-		virtual void output_epilog(output_table&);
-	};
+		virtual void flush() override;
 
-	/**
-		@brief An \c output_c_file for the standard output.
-	  */
-	extern output_c_file output_stdout;
+		virtual output_stats stats() const override;
 
-	/**
-		@brief An \c output_c_file for the standard error.
-	  */
-	extern output_c_file output_stderr;
+		virtual void output_prolog(output_table&) override;
+		virtual void output_row(output_table&) override;
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+		virtual void output_epilog(output_table&) override;
+	};
 
 	/**
-		@brief A text output stream writing to a memory region.
-
-		This is mostly useful for internal purposes, such as
-		debugging.
-	 */
-	class output_mem_file : public output_c_file
+		@brief A receiver of the tables sent by \c output_socket.
+
+		The receiver listens on a port, and writes the received tables
+		into an output file. For every table name, the receiver makes a
+		table with the columns of the schema (and a name prefix), bound
+		to the file. The rows of all the senders of a table go to the 
+		same table, which stays in output mode while some sender is 
+		active; the schemas of a table must be the same for all senders.
+
+		The receiver is driven by calls to \c poll(), e.g., in a loop.
+
+		A frame whose payload, uncompressed size or records exceed
+		\c max_frame() bytes is rejected, ending the connection of its
+		sender (for UDP, the datagram is dropped). Thus, the memory of
+		the receiver is bounded, whatever a sender claims.
+
+		Since the column formats of a schema are used by text files,
+		a schema is rejected unless every format has a single printf
+		conversion matching its column type (and no \c %n or \c *).
+		The received strings are cut at the end of their fields.
+		The same check applies to the formats sent by \c output_socket.
+	  */
+	class socket_receiver
 	{
-		struct memstate {
-			char* buffer;
-			size_t len;
-		};
-		memstate* state;
 	public:
+		struct replica;
+	private:
+		struct peer;
+		output_file* sink;
+		string prefix;
+		bool udp;
+		int lfd;
+		uint16_t _port;
+		size_t maxframe;
+		std::map<string, std::unique_ptr<replica>> replicas;
+		std::vector<std::unique_ptr<peer>> peers;
+		std::vector<char> dgram, zbuf;
+
+		size_t process(peer& p, char* data, size_t bytes);
+		size_t frame(peer& p, const socket_frame& f, char* payload);
+		void drop(peer& p);
+	public:
+		/**
+			@brief Listen on a port.
+			@param sink the output file for the received tables
+			@param port the port, or 0 for any free port (see \c port())
+			@param udp true for UDP, false for TCP
+			@param prefix the prefix of the received table names
+			@param address the IPv4 address to listen on, or empty for
+				all the interfaces
+		  */
+		socket_receiver(output_file* sink, uint16_t port=0, bool udp=false, 
+			const string& prefix=string(), const string& address=string());
 
 		/**
-			@brief Constructor
+			@brief Destructor, ending the output of all tables
 		  */
-		output_mem_file(text_format fmt = text_format::csvtab);
+		~socket_receiver();
 
 		/**
-			@brief Destructor
+			@brief The port the receiver listens on
 		  */
-		~output_mem_file();
+		inline uint16_t port() const { return _port; }
 
 		/**
-			@brief Move assignment
+			@brief Wait for data, at most \c timeout_ms milliseconds, and
+			process it. Returns the number of rows received.
 		  */
-		inline output_mem_file& operator=(output_mem_file&& other)
-		{
-			output_c_file::operator=((output_c_file&&)other);
-			state = other.state;
-			other.state = nullptr;
-			return *this;
-		}
+		size_t poll(int timeout_ms);
 
 		/**
-			@brief Get a pointer to the current contents of the
-			stream.
+			@brief The received table of a given name (without prefix), or null
+		  */
+		output_table* table(const string& name) const;
 
-			Note that this pointer should not be used after more data
-			is added to the stream.
-		*/
-		const char* contents();
+		/**
+			@brief The maximum frame size, in bytes
+		  */
+		inline size_t max_frame() const { return maxframe; }
 
 		/**
-			Get a copy of the data in the stream.
-			@return a string with the current contents
+			@brief Set the maximum frame size, in bytes
 		  */
-		string str();
+		inline void set_max_frame(size_t bytes) { maxframe = bytes; }
+
+		/**
+			@brief The number of senders: the connections for TCP, 
+			the sources with active tables for UDP
+		  */
+		inline size_t senders() const { return peers.size(); }
 	};
 
 
@@ -1508,9 +4297,11 @@ namespace tables
 
 		The progress bar is displayed as
 		\code
-		My progress message: [#####                  ]
+		My progress message: [#####                  ]  22% 1.5e+04/s ETA 0:07
 		\endcode
-		determined by parameters passed at the constructor.
+		determined by parameters passed at the constructor. The rate
+		and the remaining time are computed from the ticks since 
+		\c start().
 
 		A typical session looks (in time) something like the following
 		\code
@@ -1524,20 +4315,31 @@ namespace tables
 		\endcode
 
 		That is, tick() advances incrementally, and complete() is "abosolutely".
+
+		Methods \c tick() and \c complete() can be called from many 
+		threads at once; \c start() and \c finish() must not run
+		concurrently with them. A tick is a relaxed atomic add and a
+		comparison. The bar is redrawn by the thread whose tick reaches
+		the next check point, at most once per redraw interval (but 
+		always when the bar is complete); the check points are spaced
+		by the ticks expected in an interval, at the current rate.
 	*/
 	class progress_bar
 	{
 		typedef unsigned long long llint;
+		typedef std::chrono::steady_clock clock;
 		FILE* stream;
 		string message;
-		size_t N,i,ni;
-		llint B,l;
-		bool finished;
-
+		llint N;
+		std::atomic<llint> i;		// the ticks
+		std::atomic<llint> ni;		// the ticks of the next redraw
+		llint B;
+		std::atomic<bool> finished;
+		std::mutex drawing;			// held by the redrawing thread
+		clock::time_point t0, last;	// the start and the last redraw
+		clock::duration interval;
 
-		inline llint nexti() const { return (N*(l+1)+B-1)/B; }
-
-		void adjustBar();
+		void redraw(bool force);
 
 	public:
 		/**
@@ -1548,6 +4350,11 @@ namespace tables
 		 */
 		progress_bar(FILE* , size_t b=40, const string& msg="");
 
+		/**
+		  Set the minimum time between redraws (100 msec by default).
+		 */
+		void set_interval(std::chrono::milliseconds ms);
+
 		/**
 		  Start printing the bar and expect the given number of ticks.
 		  @param n total number of ticks expected
@@ -1558,9 +4365,9 @@ namespace tables
 		  This method signals ticks to the progress bar.
 		 */
 		inline void tick(size_t ticks = 1) {
-			if(finished) return;
-			if( (i += ticks)>=ni )
-	        	adjustBar();
+			llint now = i.fetch_add(ticks, std::memory_order_relaxed) + ticks;
+			if(now >= ni.load(std::memory_order_relaxed))
+				redraw(false);
 		}
 
 	    /**
@@ -1568,18 +4375,77 @@ namespace tables
 	      set the ticks to the given value.
 	     */
 	    inline void complete(size_t ticks) {
-	            if(finished) return;
-	            if((ticks > ni) && (ticks>i)) tick(ticks-i);
+			llint cur = i.load(std::memory_order_relaxed);
+			while(ticks > cur && !i.compare_exchange_weak(cur, ticks, std::memory_order_relaxed))
+				;
+			if(ticks > cur && ticks >= ni.load(std::memory_order_relaxed))
+				redraw(false);
 	    }
 
 	    /**
 	      Finish the bar now, possibly early.
 	     */
 	    void finish();
+
+		/**
+		  The number of ticks so far
+		 */
+		inline unsigned long long ticks() const { return i.load(std::memory_order_relaxed); }
+
+		/**
+		  The ticks per second since \c start()
+		 */
+		double rate() const;
+
+		/**
+		  The estimated seconds to completion, at the current rate,
+		  or a negative value if it is not known yet
+		 */
+		double eta() const;
 	};
 
 
 
+	/**
+		@brief Compression filters for HDF5 datasets.
+
+		The \c deflate filter is always part of HDF5. The \c lzf and
+		\c blosc filters are third-party filters, which must be available
+		to the HDF5 library (e.g., as plugins) when a dataset is created.
+	  */
+	enum class hdf5_compression { none, deflate, lzf, blosc };
+
+	/**
+		@brief Creation options for the datasets of an \c output_hdf5.
+	  */
+	struct hdf5_dataset_options
+	{
+		/**
+			@brief Chunk size of a dataset, in rows.
+
+			If 0, the chunk size is computed from the record size of the
+			table, so that a chunk holds about \c default_hdf5_chunk_bytes.
+		  */
+		size_t chunk_rows = 0;
+
+		/** @brief The compression filter */
+		hdf5_compression compression = hdf5_compression::none;
+
+		/** @brief The compression level (0 to 9), for filters that take one */
+		unsigned level = 4;
+
+		/** @brief Apply the shuffle filter before compressing */
+		bool shuffle = false;
+
+		/** @brief The size of the chunk cache in bytes, or 0 for the HDF5 default */
+		size_t chunk_cache = 0;
+	};
+
+	/**
+		@brief Target chunk size (in bytes) for automatically sized chunks
+	  */
+	const size_t default_hdf5_chunk_bytes = 1<<16;
+
 	/**
 		@brief Output to an HDF5 file.
 
@@ -1587,11 +4453,26 @@ namespace tables
 		one HDF5 group. The dataset name will be the table name.
 		HDF5 datasets will be created as arrays of structs ('compound types'
 		in HDF5 parlance).
+
+		By default, every row is written to its dataset as soon as it is
+		emitted. To reduce the HDF5 overhead, rows can be buffered per table
+		and written in batches, by calling \c set_buffer_rows() or
+		\c set_buffer_bytes() before the tables' \c prolog(). Buffered rows
+		are written out when the buffer fills, and also on \c flush(),
+		on \c output_epilog() and on destruction.
+
+		Dataset creation options (chunk size, compression and the chunk
+		cache) can be set for all tables of the file, or for individual
+		tables, via \c set_dataset_options().
 	  */
 	class output_hdf5 : public output_file
 	{
 		long int locid;
 		open_mode mode;
+		size_t buf_rows;		// buffer size in rows, or 0
+		size_t buf_bytes;		// buffer size in bytes, if buf_rows==0
+		hdf5_dataset_options dset_opts;		// options for all tables
+		std::map<output_table*, hdf5_dataset_options> table_opts;	// per-table options
 
 		struct table_handler;
 		std::map<output_table*, table_handler*> _handler;
@@ -1620,6 +4501,47 @@ namespace tables
 		  */
 		output_hdf5(const string& h5file, open_mode mode=default_open_mode);
 
+		/**
+			@brief Buffer up to the given number of rows per table.
+
+			A value of 1 (the default) means that no buffering is done.
+			This only affects tables whose \c prolog() is called later.
+		  */
+		void set_buffer_rows(size_t rows);
+
+		/**
+			@brief Buffer rows per table, up to the given number of bytes.
+
+			The buffer of each table holds as many rows as fit in
+			\c bytes, but at least one row.
+			This only affects tables whose \c prolog() is called later.
+		  */
+		void set_buffer_bytes(size_t bytes);
+
+		/**
+			@brief Set the dataset creation options for all tables.
+
+			Tables with options of their own are not affected.
+			@throws std::invalid_argument if the level is not in 0 to 9
+		  */
+		void set_dataset_options(const hdf5_dataset_options& opts);
+
+		/**
+			@brief Set the dataset creation options for a particular table.
+			@throws std::invalid_argument if the level is not in 0 to 9
+		  */
+		void set_dataset_options(output_table& table, const hdf5_dataset_options& opts);
+
+		/**
+			@brief Return the dataset creation options used for a table.
+		  */
+		const hdf5_dataset_options& dataset_options(output_table& table) const;
+
+		/**
+			@brief Write out all buffered rows and flush the HDF5 file
+		  */
+		virtual void flush() override;
+
 		/**
 			@brief Prepare for output from this table
 		  */
@@ -1630,6 +4552,18 @@ namespace tables
 		  */
 		virtual void output_row(output_table&);
 
+		/**
+			@brief Output a row snapshot
+		  */
+		virtual void output_row(const row_view&) override;
+		virtual bool takes_snapshots() const override { return true; }
+
+		/**
+			@brief Output consecutive row snapshots, in one write
+			when they exceed the buffer
+		  */
+		virtual void output_rows(const row_view& first, size_t n) override;
+
 		/**
 			@brief Conclude the output session
 		  */
@@ -1642,5 +4576,41 @@ namespace tables
 	};
 
 
+	/**
+		@brief Stitch the datasets of sharded HDF5 outputs into virtual
+		datasets.
+
+		In a parallel run, every rank writes its rows of the tables into
+		a shard of its own, by an \c output_hdf5 on the file. When all the
+		shards are closed (e.g., after a barrier), one rank calls this to
+		create, in \c loc, a virtual dataset for every table, which maps
+		the rows of the shards one after the other, in the order of 
+		\c shards. Readers then see one dataset per table, and no rows 
+		are copied.
+
+		The datasets of a table must have the same compound type (that 
+		of the table's \c row_plan) in all the shards. A shard without 
+		the dataset of a table contributes no rows. Existing datasets of
+		the same names in \c loc are replaced. The shard paths are stored
+		as given; relative paths are resolved by HDF5 from the directory 
+		of the file of \c loc.
+		@param loc the group of the virtual datasets
+		@param shards the paths of the shard files
+		@param tables the names of the tables, or empty for all the 
+			datasets in \c group of the first shard
+		@param group the group of the datasets in the shards
+		@return the total number of rows of the virtual datasets
+	  */
+	size_t hdf5_stitch_shards(const H5::Group& loc, const std::vector<string>& shards,
+		const std::vector<string>& tables = {}, const string& group = "/");
+
+	/**
+		@brief Stitch sharded HDF5 outputs into virtual datasets in the 
+		root group of a new file (truncating it if needed)
+	  */
+	size_t hdf5_stitch_shards(const string& h5file, const std::vector<string>& shards,
+		const std::vector<string>& tables = {}, const string& group = "/");
+
+
 }  // end namespace tables
 
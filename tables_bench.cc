@@ -0,0 +1,238 @@
+/**
+	@file tables_bench.cc Micro-benchmarks for row emission
+
+	Usage: tables_bench [-n rows] [-d dir] [filter]
+
+	Every benchmark emits rows of a table into one backend, and reports
+	rows per second, output bytes per second and heap allocations per
+	emitted row. Only the benchmarks whose name contains `filter`
+	are run. Output files are created (and removed) in `dir`.
+  */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <functional>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tables.hh"
+
+using namespace tables;
+
+//
+// Counting heap allocations
+//
+
+static std::atomic<size_t> __allocations(0);
+
+void* operator new(size_t n)
+{
+	__allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(n ? n : 1);
+	if(p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+
+//
+// Benchmark tables
+//
+
+/*
+	A table of generated columns. The column mix is given by a string,
+	whose letters select the column kinds, cyclically:
+	d: column<double>, i: column<int>, s: column<string>,
+	t: column<char[17]>, r: column_ref<long>, c: computed<double>
+ */
+struct bench_table
+{
+	std::unique_ptr<result_table> results;
+	std::unique_ptr<time_series<double>> series;
+	output_table* table;
+	std::vector<std::unique_ptr<basic_column>> cols;
+	std::vector<column<double>*> dcols;
+	std::vector<column<int>*> icols;
+	std::vector<column<string>*> scols;
+	std::vector<column<char[17]>*> tcols;
+	long ref_value = 0;
+	double clock = 0.0;
+
+	bench_table(const string& name, const string& mix, size_t ncols, bool is_series)
+	{
+		if(is_series) {
+			series.reset(new time_series<double>(name, "%.10g", [this]() { return clock; }));
+			table = series.get();
+		} else {
+			results.reset(new result_table(name));
+			table = results.get();
+		}
+
+		for(size_t i=0; i<ncols; i++) {
+			string cname = "c" + std::to_string(i);
+			basic_column* col = nullptr;
+			switch(mix[i % mix.size()]) {
+			case 'd': col = new column<double>(cname, "%.10g");
+				dcols.push_back((column<double>*) col); break;
+			case 'i': col = new column<int>(cname, "%d");
+				icols.push_back((column<int>*) col); break;
+			case 's': col = new column<string>(cname, 16, "%s");
+				scols.push_back((column<string>*) col); break;
+			case 't': col = new column<char[17]>(cname, "%s");
+				tcols.push_back((column<char[17]>*) col); break;
+			case 'r': col = new column_ref<long>(cname, "%ld", ref_value); break;
+			case 'c': col = new computed<double>(cname, "%g", [this]() { return 2*clock; }); break;
+			default: throw std::invalid_argument("bad column mix");
+			}
+			cols.emplace_back(col);
+			table->add(*col);
+		}
+	}
+
+	inline void update(size_t row)
+	{
+		clock = row;
+		ref_value = row;
+		for(auto c : dcols) *c = row*0.5;
+		for(auto c : icols) *c = row;
+		for(auto c : scols) *c = (row & 1) ? "odd row" : "even row";
+		for(auto c : tcols) *c = (row & 1) ? "odd row" : "even row";
+	}
+};
+
+
+//
+// Backends
+//
+
+struct backend
+{
+	const char* name;
+	// create the output file for a path
+	std::function<output_file*(const string& path)> create;
+	// the output size in bytes of in-memory files, or null for files on disk
+	std::function<size_t(output_file*, output_table&)> bytes;
+};
+
+static size_t __file_size(const string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st)==0 ? st.st_size : 0;
+}
+
+static std::vector<backend> __backends()
+{
+	return {
+		{ "csvtab", [](const string& p) { return new output_c_file(p, open_mode::truncate, text_format::csvtab); }, nullptr },
+		{ "csvrel", [](const string& p) { return new output_c_file(p, open_mode::truncate, text_format::csvrel); }, nullptr },
+		{ "memfile", [](const string&) { return new output_mem_file(text_format::csvtab); },
+			[](output_file* f, output_table&) { return ((output_mem_file*)f)->str().size(); } },
+		{ "hdf5", [](const string& p) { return new output_hdf5(p, open_mode::truncate); }, nullptr },
+		{ "hdf5.buf", [](const string& p) {
+				output_hdf5* f = new output_hdf5(p, open_mode::truncate);
+				f->set_buffer_bytes(1<<16);
+				return f;
+			}, nullptr },
+		{ "columnar", [](const string&) { return new output_columnar(); },
+			[](output_file* f, output_table& t) {
+				return ((output_columnar*)f)->rows(t) * t.plan().size(); } },
+		{ "arrow", [](const string& p) { return new output_arrow(p); }, nullptr },
+		{ "mmap", [](const string& p) { return new output_mmap(p); }, nullptr },
+		{ "async.csvtab", [](const string& p) {
+				return new output_async(new output_c_file(p, open_mode::truncate, text_format::csvtab), true); }, nullptr }
+	};
+}
+
+
+//
+// Running
+//
+
+struct workload
+{
+	const char* name;
+	const char* mix;
+	size_t ncols;
+	bool series;
+};
+
+static const workload __workloads[] = {
+	{ "result.d4", "d", 4, false },
+	{ "result.d16", "d", 16, false },
+	{ "result.d64", "d", 64, false },
+	{ "result.mixed8", "disrc", 8, false },
+	{ "result.mixed32", "disrc", 32, false },
+	{ "result.tags8", "dt", 8, false },
+	{ "series.d8", "d", 8, true },
+	{ "series.mixed16", "disrc", 16, true }
+};
+
+static void run(const workload& w, const backend& b, size_t nrows, const string& dir)
+{
+	string name = string(w.name) + "/" + b.name;
+	string path = dir + "/tables_bench." + b.name;
+
+	bench_table bt("bench", w.mix, w.ncols, w.series);
+	std::unique_ptr<output_file> f(b.create(path));
+	bt.table->bind(f.get());
+
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	bt.table->prolog();
+	size_t allocs = __allocations.load();
+	for(size_t i=0; i<nrows; i++) {
+		bt.update(i);
+		bt.table->emit_row();
+	}
+	allocs = __allocations.load() - allocs;
+	bt.table->epilog();
+	f->flush();
+	double secs = std::chrono::duration<double>(clock::now() - start).count();
+
+	size_t bytes = b.bytes ? b.bytes(f.get(), *bt.table) : 0;
+	bt.table->unbind(f.get());
+	f.reset();
+	if(! b.bytes) {
+		bytes = __file_size(path);
+		unlink(path.c_str());
+	}
+
+	printf("%-30s %12.0f %12.2f %10.3f\n", name.c_str(),
+		nrows/secs, bytes/secs/1e6, (double)allocs/nrows);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	size_t nrows = 200000;
+	string dir = ".";
+	string filter;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:d:")) != -1) {
+		switch(opt) {
+		case 'n': nrows = std::max(atol(optarg), 1L); break;
+		case 'd': dir = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-n rows] [-d dir] [filter]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(optind < argc) filter = argv[optind];
+
+	printf("%-30s %12s %12s %10s\n", "benchmark", "rows/s", "MB/s", "allocs/row");
+	for(const workload& w : __workloads)
+		for(const backend& b : __backends()) {
+			string name = string(w.name) + "/" + b.name;
+			if(name.find(filter) == string::npos) continue;
+			run(w, b, nrows, dir);
+		}
+	return 0;
+}
@@ -2,8 +2,15 @@
 #define __OUTPUT_TESTS_HH__
 
 #include <sstream>
+#include <fstream>
+#include <complex>
+#include <optional>
 #include <cxxtest/TestSuite.h>
 #include <jsoncpp/json/json.h>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
 
 #include "tables.hh"
 #include "hdf5_util.hh"
@@ -42,6 +49,20 @@ struct myresults  : result_table, table_mixin1, table_mixin2
 	}
 };
 
+// a column of a type the library knows nothing about
+struct complex_column : basic_column
+{
+	std::complex<double> val;
+
+	complex_column(column_group* g, const string& n)
+	: basic_column(g, n, "%g%+gi", typeid(std::complex<double>), 
+		sizeof(val), alignof(std::complex<double>)) { }
+
+	void emit(FILE* s) override { fprintf(s, format(), val.real(), val.imag()); }
+	void copy(void* p) override { memcpy(p, &val, sizeof(val)); }
+	const void* value_address() const override { return &val; }
+};
+
 namespace tables { class OutputTestSuite; }
 
 class tables::OutputTestSuite : public CxxTest::TestSuite
@@ -139,6 +160,87 @@ public:
 		delete fset[1];
 	}
 
+	template <typename T>
+	static string printf_value(const char* fmt, T val)
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), fmt, val);
+		return buf;
+	}
+
+	void test_text_encoding()
+	{
+		int cnt = -42;
+		result_table tab("formats");
+		column<int> i1 { &tab, "i1", "%d", -17 };
+		column<long> i2 { &tab, "i2", "%ld", 1234567890123L };
+		column<int> i3 { &tab, "i3", "%u", -1 };
+		column<size_t> i4 { &tab, "i4", "%zu", 77 };
+		column<short> i5 { &tab, "i5", "%hd", -3 };
+		column<bool> i6 { &tab, "i6", "%d", true };
+		column<double> d1 { &tab, "d1", "%g", 1.0/3 };
+		column<double> d2 { &tab, "d2", "%.3f", -2.71828 };
+		column<double> d3 { &tab, "d3", "%e", 6.02e23 };
+		column<float> d4 { &tab, "d4", "%f", 0.1f };
+		column<double> d5 { &tab, "d5", "%.10g", 1e-300 };
+		column<double> d6 { &tab, "d6", "%f", 1e300 };
+		column<string> s1 { &tab, "s1", 10, "%s", "hello" };
+		column<int> f1 { &tab, "f1", "%5d", 12 };
+		column<char> f2 { &tab, "f2", "%c", 'A' };
+		column<int> f3 { &tab, "f3", "x=%d", 5 };
+		column_ref<int> r1 { "r1", "%d", cnt };
+		computed<double> c1 { "c1", "%.2f", []() { return 0.125; } };
+		tab.add({&r1, &c1});
+
+		output_mem_file f(text_format::csvrel);
+		tab.bind(&f);
+		tab.prolog();
+		tab.emit_row();
+		cnt = 42;
+		tab.emit_row();
+		tab.epilog();
+
+		string expected;
+		for(int i : {-42, 42}) {
+			expected += "formats,";
+			expected += printf_value("%d", -17) + ",";
+			expected += printf_value("%ld", 1234567890123L) + ",";
+			expected += printf_value("%u", -1) + ",";
+			expected += printf_value("%zu", (size_t)77) + ",";
+			expected += printf_value("%hd", -3) + ",";
+			expected += printf_value("%d", 1) + ",";
+			expected += printf_value("%g", 1.0/3) + ",";
+			expected += printf_value("%.3f", -2.71828) + ",";
+			expected += printf_value("%e", 6.02e23) + ",";
+			expected += printf_value("%f", (double)0.1f) + ",";
+			expected += printf_value("%.10g", 1e-300) + ",";
+			expected += printf_value("%f", 1e300) + ",";
+			expected += "hello,";
+			expected += printf_value("%5d", 12) + ",";
+			expected += "A,";
+			expected += printf_value("x=%d", 5) + ",";
+			expected += printf_value("%d", i) + ",";
+			expected += printf_value("%.2f", 0.125) + "\n";
+		}
+		TS_ASSERT_EQUALS(f.str(), expected);
+	}
+
+	void test_custom_column()
+	{
+		result_table tab("t006");
+		column<int> id(&tab, "id", "%d");
+		complex_column z(&tab, "z");
+
+		output_mem_file f(text_format::csvrel);
+		tab.bind(&f);
+		tab.prolog();
+		id = 1;
+		z.val = { 1, 2 };
+		tab.emit_row();
+		tab.epilog();
+		TS_ASSERT_EQUALS(f.str(), "t006,1,1+2i\n");
+	}
+
 	void test_bind() 
 	{
 		silly_table T1("table1"), T2("table2");
@@ -182,12 +284,62 @@ public:
 		TS_ASSERT_EQUALS(f1->bindings().size(), 2);
 		TS_ASSERT_EQUALS(f2->bindings().size(), 1);
 
+		// the bindings are kept in the order of binding
+		TS_ASSERT_EQUALS(T1.bindings()[0]->file, f1);
+		TS_ASSERT_EQUALS(T1.bindings()[1]->file, f2);
+
 		delete f1;
 		delete f2;
 		TS_ASSERT_EQUALS(T1.bindings().size(), 0);
 		TS_ASSERT_EQUALS(T2.bindings().size(), 0);
 	}
 
+	void test_bind_many()
+	{
+		// bind and unbind many tables, so that the pooled storage of 
+		// bindings and formatters is recycled, in no particular order
+		output_mem_file mf(text_format::csvrel);
+		output_columnar cf;
+		size_t rows = 0;
+		for(int round=0; round<4; round++) {
+			std::vector<std::unique_ptr<silly_table>> tabs;
+			for(int i=0; i<200; i++) {
+				tabs.emplace_back(new silly_table(("t"+std::to_string(i)).c_str()));
+				tabs.back()->bind(&mf);
+				tabs.back()->bind(&cf);
+			}
+			// unbind every third table from the text file, from both
+			// files every fifth
+			for(int i=0; i<200; i++) {
+				if(i%3==0) tabs[i]->unbind(&mf);
+				if(i%5==0) tabs[i].reset();
+			}
+			size_t bound = 0;
+			for(int i=0; i<200; i++)
+				if(tabs[i]) bound += (i%3 != 0);
+			TS_ASSERT_EQUALS(mf.bindings().size(), bound);
+			for(size_t i=0; i<mf.bindings().size(); i++) {
+				output_binding* b = mf.bindings()[i];
+				TS_ASSERT_EQUALS(b->file, &mf);
+				TS_ASSERT_EQUALS(b->file_pos, i);
+				TS_ASSERT_EQUALS(b->table->bindings()[b->table_pos], b);
+			}
+
+			for(auto& t : tabs) {
+				if(! t) continue;
+				t->count = round;
+				t->prolog();
+				t->emit_row();
+				t->epilog();
+			}
+			rows += bound;
+			string out = mf.str();
+			TS_ASSERT_EQUALS((size_t) std::count(out.begin(), out.end(), '\n'), rows);
+		}
+		TS_ASSERT_EQUALS(mf.bindings().size(), 0);
+		TS_ASSERT_EQUALS(cf.bindings().size(), 0);
+	}
+
 
 	struct dummy_table : result_table
 	{
@@ -259,6 +411,124 @@ public:
 	}
 
 
+	void test_row_plan()
+	{
+		dummy_table dummy("dummy");
+		const row_plan& plan = dummy.plan();
+
+		TS_ASSERT_EQUALS(plan.columns(), 6);
+		TS_ASSERT_EQUALS(plan.size(), sizeof(__dummy_rec));
+		TS_ASSERT_EQUALS(plan.align(), alignof(__dummy_rec));
+		TS_ASSERT_EQUALS(plan[3].offset, offsetof(__dummy_rec,zeta));
+		TS_ASSERT_EQUALS(plan[5].offset, offsetof(__dummy_rec,mname));
+		TS_ASSERT_EQUALS(plan[3].src, &dummy.zeta.value());
+		TS_ASSERT_EQUALS(plan[5].src, nullptr);
+
+		__dummy_rec rec;
+		dummy.fill_columns(7);
+		plan.pack(&rec);
+		TS_ASSERT_EQUALS(rec.sid, 7);
+		TS_ASSERT_EQUALS(rec.zeta, 3.5);
+		TS_ASSERT_EQUALS(rec.nsize, 14);
+		TS_ASSERT_EQUALS(string(rec.mname), "this is record 7");
+
+		// computed and referenced columns
+		double clock = 1.5;
+		int counter = 3;
+		time_series<double> ts("ts", "%g", [&]() { return clock; });
+		column_ref<int> cref("counter", "%d", counter);
+		ts.add(cref);
+
+		struct { double now; int counter; } tsrec;
+		TS_ASSERT_EQUALS(ts.plan().size(), sizeof(tsrec));
+		TS_ASSERT_EQUALS(ts.plan()[1].src, &counter);
+		clock = 2.5; 
+		counter = 4;
+		ts.plan().pack(&tsrec);
+		TS_ASSERT_EQUALS(tsrec.now, 2.5);
+		TS_ASSERT_EQUALS(tsrec.counter, 4);
+
+		// the plan follows changes to the columns
+		ts.remove(cref);
+		TS_ASSERT_EQUALS(ts.plan().columns(), 1);
+	}
+
+	void test_inline_clock()
+	{
+		long ticks = 0;
+		auto clock = [&]() { return ticks; };
+		time_series ts("ts", "%ld", clock);
+		static_assert(std::is_same<decltype(ts)::time_type, long>::value, "deduced time type");
+		static_assert(std::is_same<decltype(ts.now), computed<long, decltype(clock)>>::value, "inline clock");
+
+		auto twice = [&]() { return 2*ticks; };
+		computed<long, decltype(twice)> tw("twice", "%ld", twice);
+		ts.add(tw);
+
+		output_mem_file f(text_format::csvrel);
+		ts.bind(&f);
+		ts.prolog();
+		for(ticks=1; ticks<=3; ticks++)
+			ts.emit_row();
+		ts.epilog();
+		TS_ASSERT_EQUALS(f.str(), "ts,1,2\nts,2,4\nts,3,6\n");
+
+		struct { long now; long twice; } rec;
+		ticks = 7;
+		ts.plan().pack(&rec);
+		TS_ASSERT_EQUALS(rec.now, 7);
+		TS_ASSERT_EQUALS(rec.twice, 14);
+		TS_ASSERT_EQUALS(ts.plan()[0].tag, type_tag::int64);
+	}
+
+	void test_layout_descriptor()
+	{
+		dummy_table dummy("dummy");
+		columns grp(&dummy, "grp");
+		column<float> ratio(&grp, "ratio", "%g");
+		const row_plan& plan = dummy.plan();
+
+		TS_ASSERT_EQUALS(plan[0].tag, type_tag::boolean);
+		TS_ASSERT_EQUALS(plan[1].tag, type_tag::int16);
+		TS_ASSERT_EQUALS(plan[3].tag, type_tag::float64);
+		TS_ASSERT_EQUALS(plan[4].tag, type_tag::uint64);
+		TS_ASSERT_EQUALS(plan[5].tag, type_tag::string);
+		TS_ASSERT_EQUALS(plan[6].tag, type_tag::float32);
+		TS_ASSERT_EQUALS(plan.path(6), "grp/ratio");
+		TS_ASSERT_EQUALS(make_type_tag(typeid(long long)), type_tag::int64);
+		TS_ASSERT_EQUALS(make_type_tag(typeid(std::vector<int>)), type_tag::other);
+		TS_ASSERT_EQUALS(string(type_tag_name(type_tag::uint32)), "uint32");
+
+		const string& bin = plan.descriptor();
+		TS_ASSERT_EQUALS(bin.size() % 8, 0);
+		record_layout rl = record_layout::decode(bin.data(), bin.size());
+		TS_ASSERT_EQUALS(rl.size, plan.size());
+		TS_ASSERT_EQUALS(rl.align, plan.align());
+		TS_ASSERT_EQUALS(rl.fields.size(), plan.columns());
+		for(size_t i=0; i<plan.columns(); i++) {
+			TS_ASSERT_EQUALS(rl.fields[i].path, plan.path(i));
+			TS_ASSERT_EQUALS(rl.fields[i].tag, plan[i].tag);
+			TS_ASSERT_EQUALS(rl.fields[i].offset, plan[i].offset);
+			TS_ASSERT_EQUALS(rl.fields[i].size, plan[i].size);
+		}
+		TS_ASSERT(rl.find("grp/ratio") == &rl.fields[6]);
+		TS_ASSERT(rl.find("ratio") == nullptr);
+		TS_ASSERT_THROWS(record_layout::decode(bin.data(), bin.size()-1), std::runtime_error);
+		TS_ASSERT_THROWS(record_layout::decode("TABLELY0", 8), std::runtime_error);
+
+		// the JSON layout
+		std::ostringstream out;
+		out << "{";
+		plan.write_json(out);
+		out << "}";
+		Json::Value js;
+		std::istringstream(out.str()) >> js;
+		TS_ASSERT_EQUALS(js["record_size"].asUInt64(), plan.size());
+		TS_ASSERT_EQUALS(js["layout"][6]["name"].asString(), "grp/ratio");
+		TS_ASSERT_EQUALS(js["layout"][6]["type"].asString(), "float32");
+		TS_ASSERT_EQUALS(js["layout"][6]["offset"].asUInt64(), plan[6].offset);
+	}
+
 	void check_dummy_dataset(H5::DataSet dataset, size_t Nrec)
 	{
 		using namespace H5;
@@ -438,6 +708,1677 @@ public:
 		check_dummy_dataset(file.openDataSet("dummy"), 25);
 	}
 
+	void test_output_hdf5_buffered()
+	{
+		using namespace H5;
+
+		dummy_table dummy("dummy");
+		auto file = H5File("dummy_file5.h5", H5F_ACC_TRUNC);
+
+		auto dset= new output_hdf5(file, open_mode::append);
+		dset->set_buffer_rows(8);
+		dset->bind(dummy);
+		dummy.prolog();
+		for(size_t i=0; i<20; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+
+		// only full batches have been written
+		check_dummy_dataset(file.openDataSet("dummy"), 16);
+		dset->flush();
+		check_dummy_dataset(file.openDataSet("dummy"), 20);
+
+		for(size_t i=20; i<25; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		dummy.epilog();
+		check_dummy_dataset(file.openDataSet("dummy"), 25);
+
+		// rows pending at destruction are also written
+		dset->set_buffer_bytes(1024);
+		dummy.prolog();
+		for(size_t i=25; i<30; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		delete dset;
+		dummy.epilog();
+		check_dummy_dataset(file.openDataSet("dummy"), 30);
+	}
+
+	void test_hdf5_stitch_shards()
+	{
+		using namespace H5;
+
+		// three ranks, the last one without rows of dummy
+		dummy_table dummy("dummy");
+		result_table other("other");
+		column<int> rank(&other, "rank", "%d");
+		const std::vector<string> shards { "dummy_shard0.h5", "dummy_shard1.h5", "dummy_shard2.h5" };
+		size_t begin[] = { 0, 10, 25 };
+		for(size_t r=0; r<shards.size(); r++) {
+			output_hdf5 shard(shards[r], open_mode::truncate);
+			if(r < 2) {
+				dummy.bind(&shard);
+				dummy.prolog();
+				for(size_t i=begin[r]; i<begin[r+1]; i++) {
+					dummy.fill_columns(i);
+					dummy.emit_row();
+				}
+				dummy.epilog();
+				dummy.unbind(&shard);
+			}
+			other.bind(&shard);
+			other.prolog();
+			rank = r;
+			other.emit_row();
+			other.epilog();
+			other.unbind(&shard);
+		}
+
+		TS_ASSERT_EQUALS(hdf5_stitch_shards("dummy_vds.h5", shards), 28);
+		H5File file("dummy_vds.h5", H5F_ACC_RDONLY);
+		check_dummy_dataset(file.openDataSet("dummy"), 25);
+
+		DataSet ranks = file.openDataSet("other");
+		hsize_t n;
+		ranks.getSpace().getSimpleExtentDims(&n);
+		TS_ASSERT_EQUALS(n, 3);
+		int data[3];
+		CompType type(sizeof(int));
+		type.insertMember("rank", 0, PredType::NATIVE_INT);
+		ranks.read(data, type);
+		TS_ASSERT_EQUALS(data[2], 2);
+
+		TS_ASSERT_THROWS(hdf5_stitch_shards(file.openGroup("/"), shards, {"missing"}), std::runtime_error);
+		TS_ASSERT_THROWS(hdf5_stitch_shards("dummy_vds2.h5", {}), std::invalid_argument);
+	}
+
+	void test_emit_rows()
+	{
+		using namespace H5;
+
+		dummy_table dummy("dummy");
+		const size_t N = 30;
+		std::vector<__dummy_rec> recs(N);
+		for(size_t i=0; i<N; i++) {
+			dummy.fill_columns(i);
+			dummy.plan().pack(&recs[i]);
+		}
+
+		// the same output as row by row
+		output_mem_file rowwise(text_format::csvtab), bulk(text_format::csvtab);
+		dummy.bind(&rowwise);
+		dummy.prolog();
+		for(size_t i=0; i<N; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		dummy.epilog();
+		dummy.unbind_all();
+
+		auto file = H5File("dummy_file_bulk.h5", H5F_ACC_TRUNC);
+		auto dset = new output_hdf5(file, open_mode::append);
+		dset->set_buffer_rows(8);
+		dset->bind(dummy);
+		dummy.bind(&bulk);
+		TS_ASSERT_THROWS(dummy.emit_rows(1, recs.data()), std::logic_error);
+		output_stats::enable();
+		dummy.prolog();
+		dummy.emit_rows(3, recs.data());
+		// buffered, nothing written yet
+		hsize_t dims[1];
+		file.openDataSet("dummy").getSpace().getSimpleExtentDims(dims);
+		TS_ASSERT_EQUALS(dims[0], 0);
+		// larger than the buffer, written at once
+		dummy.emit_rows(N-3, recs.data()+3);
+		check_dummy_dataset(file.openDataSet("dummy"), N);
+		dummy.epilog();
+		TS_ASSERT_EQUALS(bulk.str(), rowwise.str());
+		TS_ASSERT_EQUALS(dummy.stats().rows, N);
+		output_stats::enable(false);
+		delete dset;
+
+		// from column arrays
+		result_table tab("spans");
+		column<int> id(&tab, "id", "%d");
+		column<double> x(&tab, "x", "%g");
+		column<string> name(&tab, "name", 3, "%s");
+		output_columnar cf;
+		tab.bind(&cf);
+		int ids[] = { 1, 2, 3 };
+		double xs[] = { 0.5, 1.5, 2.5 };
+		const char names[] = "aaa\0bbb\0ccc";
+		tab.prolog();
+		tab.emit_columns(3, { ids, xs, names });
+		TS_ASSERT_THROWS(tab.emit_columns(3, { ids, xs }), std::invalid_argument);
+		tab.epilog();
+		TS_ASSERT_EQUALS(cf.rows(tab), 3);
+		TS_ASSERT_EQUALS(cf.get<int>(tab, "id")[2], 3);
+		TS_ASSERT_EQUALS(cf.get<double>(tab, "x")[1], 1.5);
+
+		// a struct padded beyond the record is rejected
+		result_table padded("padded");
+		column<int> a(&padded, "a", "%d");
+		column<double> b(&padded, "b", "%g");
+		column<int> c(&padded, "c", "%d");
+		struct abc { int a; double b; int c; } abcs[2] = { {1, 0.5, 2}, {3, 1.5, 4} };
+		output_columnar pf;
+		padded.bind(&pf);
+		padded.prolog();
+		TS_ASSERT_EQUALS(padded.plan().size(), 20);
+		TS_ASSERT_THROWS(padded.emit_rows(2, abcs), std::invalid_argument);
+		padded.epilog();
+		TS_ASSERT_EQUALS(pf.rows(padded), 0);
+	}
+
+	void test_output_hdf5_dataset_options()
+	{
+		using namespace H5;
+
+		dummy_table dummy1("dummy1");
+		dummy_table dummy2("dummy2");
+		auto file = H5File("dummy_file6.h5", H5F_ACC_TRUNC);
+
+		hdf5_dataset_options opts;
+		opts.chunk_rows = 100;
+		opts.compression = hdf5_compression::deflate;
+		opts.shuffle = true;
+		opts.chunk_cache = 1<<20;
+
+		output_hdf5* dset = new output_hdf5(file, open_mode::truncate);
+		dset->set_dataset_options(opts);
+		dset->set_dataset_options(dummy2, hdf5_dataset_options());
+		TS_ASSERT_EQUALS(dset->dataset_options(dummy1).chunk_rows, 100);
+		TS_ASSERT_EQUALS(dset->dataset_options(dummy2).chunk_rows, 0);
+
+		for(dummy_table* t : {&dummy1, &dummy2}) {
+			dset->bind(*t);
+			t->prolog();
+			for(size_t i=0; i<10; i++) {
+				t->fill_columns(i);
+				t->emit_row();
+			}
+			t->epilog();
+		}
+		delete dset;
+
+		hsize_t cdim[1];
+		DSetCreatPropList props1 = file.openDataSet("dummy1").getCreatePlist();
+		props1.getChunk(1, cdim);
+		TS_ASSERT_EQUALS(cdim[0], 100);
+		TS_ASSERT_EQUALS(props1.getNfilters(), 2);
+
+		DSetCreatPropList props2 = file.openDataSet("dummy2").getCreatePlist();
+		props2.getChunk(1, cdim);
+		TS_ASSERT_EQUALS(cdim[0], default_hdf5_chunk_bytes/sizeof(__dummy_rec));
+		TS_ASSERT_EQUALS(props2.getNfilters(), 0);
+
+		check_dummy_dataset(file.openDataSet("dummy1"), 10);
+		check_dummy_dataset(file.openDataSet("dummy2"), 10);
+	}
+
+	void test_open_file_hdf5()
+	{
+		output_file* f = open_file("hdf5:dummy_file7.h5?chunk=64,compress=deflate,level=6,shuffle=true,buffer=10");
+		output_hdf5* h5f = dynamic_cast<output_hdf5*>(f);
+		TS_ASSERT(h5f != nullptr);
+
+		dummy_table dummy("dummy");
+		const hdf5_dataset_options& opts = h5f->dataset_options(dummy);
+		TS_ASSERT_EQUALS(opts.chunk_rows, 64);
+		TS_ASSERT_EQUALS(opts.compression, hdf5_compression::deflate);
+		TS_ASSERT_EQUALS(opts.level, 6);
+		TS_ASSERT_EQUALS(opts.shuffle, true);
+		TS_ASSERT_EQUALS(opts.chunk_cache, 0);
+		delete f;
+
+		TS_ASSERT_THROWS(open_file("hdf5:dummy_file7.h5?chunk=lots"), std::runtime_error);
+		TS_ASSERT_THROWS(open_file("hdf5:dummy_file7.h5?compress=zip"), std::runtime_error);
+		TS_ASSERT_THROWS(open_file("hdf5:dummy_file7.h5?compress=deflate,level=10"), std::invalid_argument);
+		// not narrowed to a valid level
+		TS_ASSERT_THROWS(open_file("hdf5:dummy_file7.h5?level=4294967300"), std::invalid_argument);
+
+		output_hdf5 h("dummy_file7.h5", open_mode::truncate);
+		hdf5_dataset_options bad;
+		bad.level = 10;
+		TS_ASSERT_THROWS(h.set_dataset_options(bad), std::invalid_argument);
+		TS_ASSERT_THROWS(h.set_dataset_options(dummy, bad), std::invalid_argument);
+		TS_ASSERT_EQUALS(h.dataset_options(dummy).level, 4);
+	}
+
+	void test_output_columnar()
+	{
+		dummy_table dummy("dummy");
+		output_columnar f;
+		f.bind(dummy);
+
+		dummy.prolog();
+		for(size_t i=0; i<10; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		dummy.epilog();
+
+		TS_ASSERT_EQUALS(f.rows(dummy), 10);
+		TS_ASSERT_EQUALS(f.column(dummy, 3).name, "zeta");
+		TS_ASSERT_EQUALS(f.column(dummy, "mname").width, 32);
+
+		auto sid = f.get<int16_t>(dummy, "sid");
+		auto zeta = f.get<double>(dummy, 3);
+		TS_ASSERT_EQUALS(sid.size(), 10);
+		TS_ASSERT_EQUALS(zeta.size(), 10);
+		double sum = 0.0;
+		for(double z : zeta) sum += z;
+		TS_ASSERT_EQUALS(sum, 22.5);
+
+		TS_ASSERT_THROWS(f.get<int>(dummy, "sid"), std::invalid_argument);
+		TS_ASSERT_THROWS(f.get<double>(dummy, "none"), std::out_of_range);
+
+		// pack into records and compare
+		__dummy_rec data[10];
+		std::vector<size_t> offsets {
+			offsetof(__dummy_rec,bool_attr), offsetof(__dummy_rec,sid),
+			offsetof(__dummy_rec,hid), offsetof(__dummy_rec,zeta),
+			offsetof(__dummy_rec,nsize), offsetof(__dummy_rec,mname)
+		};
+		f.pack_rows(dummy, 0, 10, (char*)data, offsets, sizeof(__dummy_rec));
+
+		dummy_table dummy2("dummy2");
+		for(size_t i=0; i<10; i++) {
+			dummy2.fill_columns(i);
+			TS_ASSERT_EQUALS(sid[i], dummy2.sid.value());
+			TS_ASSERT_EQUALS(string(f.text(dummy, "mname", i)), dummy2.mname.value());
+			TS_ASSERT_EQUALS(data[i].bool_attr, dummy2.bool_attr.value());
+			TS_ASSERT_EQUALS(data[i].zeta, dummy2.zeta.value());
+			TS_ASSERT_EQUALS(data[i].nsize, dummy2.nsize.value());
+			TS_ASSERT_EQUALS(string(data[i].mname), dummy2.mname.value());
+		}
+
+		// a new session appends
+		dummy.prolog();
+		dummy.emit_row();
+		dummy.epilog();
+		TS_ASSERT_EQUALS(f.rows(dummy), 11);
+
+		f.clear();
+		TS_ASSERT_EQUALS(f.rows(dummy), 0);
+
+		// the data is dropped when the table is unbound, so a table
+		// constructed at the same address starts afresh
+		dummy.prolog();
+		dummy.emit_row();
+		dummy.epilog();
+		dummy.unbind(&f);
+		TS_ASSERT_EQUALS(f.rows(dummy), 0);
+
+		std::optional<dummy_table> tab;
+		tab.emplace("reused");
+		const output_table* addr = &*tab;
+		f.bind(*tab);
+		tab->prolog();
+		tab->emit_row();
+		tab->epilog();
+		TS_ASSERT_EQUALS(f.rows(*tab), 1);
+		tab.reset();
+		tab.emplace("reused");
+		TS_ASSERT_EQUALS(&*tab, addr);
+		TS_ASSERT_EQUALS(f.rows(*tab), 0);
+		TS_ASSERT_THROWS(f.column(*tab, 0), std::out_of_range);
+		f.bind(*tab);
+		tab->prolog();
+		tab->emit_row();
+		tab->epilog();
+		TS_ASSERT_EQUALS(f.rows(*tab), 1);
+	}
+
+	void test_output_async()
+	{
+		silly_table tab("SILLY");
+		output_mem_file sync_file(text_format::csvrel);
+		output_mem_file file(text_format::csvrel);
+		output_async async_file(&file, false, 1024);
+
+		tab.bind(&sync_file);
+		tab.bind(&async_file);
+		tab.prolog();
+		for(int i=0; i<1000; i++) {
+			tab.count = i;
+			tab.mean_x = i/3.0;
+			tab.label = (i%2) ? "odd" : "even";
+			tab.emit_row();
+		}
+		async_file.flush();
+		TS_ASSERT_EQUALS(async_file.queued(), 0);
+		TS_ASSERT_EQUALS(async_file.dropped(), 0);
+		TS_ASSERT_EQUALS(file.str(), sync_file.str());
+		tab.epilog();
+	}
+
+	// A file that blocks in output_row until released
+	struct gated_file : output_file
+	{
+		std::mutex gate;
+		size_t rows = 0;
+		void output_prolog(output_table&) override { }
+		void output_row(output_table&) override { }
+		void output_row(const row_view&) override { 
+			std::lock_guard<std::mutex> lock(gate);
+			rows++; 
+		}
+		void output_epilog(output_table&) override { }
+	};
+
+	void test_output_async_hdf5()
+	{
+		hbool_t safe = false;
+		H5is_library_threadsafe(&safe);
+		output_hdf5 hf("dummy_file_async.h5", open_mode::truncate);
+		if(safe)
+			TS_ASSERT_THROWS_NOTHING(output_async{&hf});
+		else {
+			TS_ASSERT_THROWS(output_async{&hf}, std::invalid_argument);
+			TS_ASSERT_THROWS(open_file("hdf5:dummy_file_async.h5?async=true"), std::invalid_argument);
+		}
+	}
+
+	void test_output_async_drop()
+	{
+		silly_table tab("SILLY");
+		gated_file file;
+		output_async async_file(&file, false, 256, async_policy::drop);
+		tab.bind(&async_file);
+		tab.prolog();
+
+		file.gate.lock();
+		for(int i=0; i<100; i++)
+			tab.emit_row();
+		TS_ASSERT(async_file.dropped() > 0);
+		TS_ASSERT(async_file.queued() > 0);
+		file.gate.unlock();
+
+		tab.epilog();
+		TS_ASSERT_EQUALS(async_file.queued(), 0);
+		TS_ASSERT_EQUALS(file.rows + async_file.dropped(), 100);
+	}
+
+	// A file that does not support row snapshots
+	struct plain_file : output_file
+	{
+		void output_prolog(output_table&) override { }
+		void output_row(output_table&) override { }
+		void output_epilog(output_table&) override { }
+	};
+
+	void test_row_snapshot()
+	{
+		result_table t("t");
+		int calls = 0;
+		computed<int> counted("counted", "%d", [&]() { return ++calls; });
+		column<double> x("x", "%g");
+		t.add(counted);
+		t.add(x);
+
+		output_mem_file mf(text_format::csvrel);
+		output_columnar cf;
+		plain_file pf;
+		TS_ASSERT(mf.takes_snapshots());
+		TS_ASSERT(! pf.takes_snapshots());
+
+		// a single file evaluates the columns itself
+		t.bind(&mf);
+		t.prolog();
+		x = 1.0;
+		t.emit_row();
+		TS_ASSERT_EQUALS(calls, 1);
+		t.epilog();
+
+		// several files share one evaluation per row
+		t.bind(&cf);
+		t.bind(&pf);
+		t.prolog();
+		calls = 0;
+		for(int i=0; i<10; i++) {
+			x = i;
+			t.emit_row();
+		}
+		t.epilog();
+		// (the plain file reads no column)
+		TS_ASSERT_EQUALS(calls, 10);
+		TS_ASSERT_EQUALS(cf.rows(t), 10);
+		TS_ASSERT_EQUALS(cf.get<int>(t, "counted")[9], 10);
+		TS_ASSERT(mf.str().find("t,10,9\n") != string::npos);
+
+		t.unbind(&pf);
+		t.prolog();
+		calls = 0;
+		t.emit_row();
+		t.epilog();
+		TS_ASSERT_EQUALS(calls, 1);
+		TS_ASSERT_EQUALS(cf.get<int>(t, "counted")[10], 1);
+
+		// values without a type tag cannot be formatted from a
+		// snapshot, so each file evaluates the columns
+		result_table tz("t023");
+		column<int> id(&tz, "id", "%d");
+		complex_column z(&tz, "z");
+		output_mem_file f1(text_format::csvrel), f2(text_format::csvrel);
+		tz.bind(&f1);
+		tz.bind(&f2);
+		tz.prolog();
+		id = 1;
+		z.val = { 1, 2 };
+		TS_ASSERT_THROWS_NOTHING(tz.emit_row());
+		tz.epilog();
+		TS_ASSERT_EQUALS(f1.str(), "t023,1,1+2i\n");
+		TS_ASSERT_EQUALS(f2.str(), "t023,1,1+2i\n");
+	}
+
+	void test_output_async_error()
+	{
+		silly_table tab("SILLY");
+		output_async async_file(new plain_file(), true);
+		tab.bind(&async_file);
+		tab.prolog();
+		tab.emit_row();
+		TS_ASSERT_THROWS(async_file.flush(), std::logic_error);
+		TS_ASSERT_THROWS_NOTHING(async_file.flush());
+		tab.epilog();
+
+		TS_ASSERT_THROWS(output_async(new plain_file(), true, 16).output_prolog(tab), 
+			std::length_error);
+	}
+
+	void test_open_file_async()
+	{
+		using namespace H5;
+
+		output_file* f = open_file("hdf5:dummy_file8.h5?async=true,queue=4096,buffer=4");
+		output_async* af = dynamic_cast<output_async*>(f);
+		TS_ASSERT(af != nullptr);
+		TS_ASSERT(dynamic_cast<output_hdf5*>(af->file()) != nullptr);
+
+		dummy_table dummy("dummy");
+		dummy.bind(f);
+		dummy.prolog();
+		for(size_t i=0; i<50; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		dummy.epilog();
+		delete f;
+
+		H5File file("dummy_file8.h5", H5F_ACC_RDONLY);
+		check_dummy_dataset(file.openDataSet("dummy"), 50);
+
+		f = open_file("stdout:?async=true");
+		TS_ASSERT_EQUALS(dynamic_cast<output_async*>(f)->file(), &output_stdout);
+		delete f;
+	}
+
+	// Read a file into a string
+	static string slurp(const string& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::ostringstream ss;
+		ss << in.rdbuf();
+		return ss.str();
+	}
+
+	// The length of a vector field of the root table of a flatbuffer
+	static uint32_t fb_vector_length(const char* fb, size_t field)
+	{
+		auto u32 = [](const char* p) { uint32_t v; memcpy(&v, p, 4); return v; };
+		const char* tab = fb + u32(fb);
+		int32_t soff;
+		memcpy(&soff, tab, 4);
+		uint16_t voff;
+		memcpy(&voff, tab - soff + 4 + 2*field, 2);
+		const char* vec = tab + voff + u32(tab + voff);
+		return u32(vec);
+	}
+
+	// A table of a flatbuffer, read per the flatbuffers binary format
+	struct fb_ref
+	{
+		const char* tab;
+
+		template <typename T>
+		static T get(const char* p) { T v; memcpy(&v, p, sizeof(T)); return v; }
+
+		// the root table of a flatbuffer
+		static fb_ref root(const char* fb) { return fb_ref { fb + get<uint32_t>(fb) }; }
+
+		// the address of a field, or null if absent
+		const char* field(size_t id) const {
+			const char* vt = tab - get<int32_t>(tab);
+			if(4+2*id >= get<uint16_t>(vt)) return nullptr;
+			uint16_t off = get<uint16_t>(vt + 4 + 2*id);
+			return off ? tab + off : nullptr;
+		}
+		template <typename T>
+		T scalar(size_t id, T dflt=0) const {
+			const char* p = field(id);
+			return p ? get<T>(p) : dflt;
+		}
+		// referenced objects: tables, vectors and strings
+		const char* ref(size_t id) const {
+			const char* p = field(id);
+			return p + get<uint32_t>(p);
+		}
+		fb_ref table(size_t id) const { return fb_ref { ref(id) }; }
+		uint32_t length(size_t id) const { return field(id) ? get<uint32_t>(ref(id)) : 0; }
+		fb_ref table(size_t id, size_t i) const {
+			const char* slot = ref(id) + 4 + 4*i;
+			return fb_ref { slot + get<uint32_t>(slot) };
+		}
+		template <typename S>
+		S element(size_t id, size_t i) const { return get<S>(ref(id) + 4 + i*sizeof(S)); }
+		string text(size_t id) const { return string(ref(id)+4, length(id)); }
+	};
+
+	// The Arrow message of a file block: the flatbuffer and the body
+	struct arrow_msg
+	{
+		fb_ref meta;
+		const char* body;
+
+		arrow_msg(const string& data, int64_t offset, int32_t metalen=-1) {
+			const char* p = data.data() + offset;
+			TS_ASSERT_EQUALS(fb_ref::get<uint32_t>(p), 0xFFFFFFFFu);
+			meta = fb_ref::root(p + 8);
+			TS_ASSERT_EQUALS(meta.scalar<int16_t>(0), 4);	// V5
+			if(metalen<0) metalen = 8 + fb_ref::get<int32_t>(p+4);
+			body = p + metalen;
+		}
+		uint8_t type() const { return meta.scalar<uint8_t>(1); }
+		fb_ref header() const { return meta.table(2); }
+
+		// buffer i of a record batch
+		template <typename T>
+		const T* buffer(fb_ref batch, size_t i, size_t& len) const {
+			int64_t b[2];
+			memcpy(b, batch.ref(2) + 4 + 16*i, 16);
+			len = b[1] / sizeof(T);
+			return (const T*)(body + b[0]);
+		}
+		template <typename T>
+		T value(fb_ref batch, size_t buf, size_t row) const {
+			size_t len;
+			const T* v = buffer<T>(batch, buf, len);
+			TS_ASSERT(row < len);
+			return v[row];
+		}
+	};
+
+	void test_output_arrow_layout()
+	{
+		dummy_table dummy("dummy");
+		output_arrow f("dummy_file9b.arrow", 4);
+		dummy.bind(&f);
+		dummy.prolog();
+		for(size_t i=0; i<10; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		dummy.epilog();
+
+		string data = slurp("dummy_file9b.arrow");
+
+		// the schema message follows the magic
+		arrow_msg sm(data, 8);
+		TS_ASSERT_EQUALS(sm.type(), 1);
+		fb_ref schema = sm.header();
+		TS_ASSERT_EQUALS(schema.scalar<int16_t>(0), 0);	// little endian
+		TS_ASSERT_EQUALS(schema.length(1), 6);
+		const char* names[] = { "bool_attr", "sid", "hid", "zeta", "nsize", "mname" };
+		for(size_t i=0; i<6; i++)
+			TS_ASSERT_EQUALS(schema.table(1, i).text(0), names[i]);
+		fb_ref sid = schema.table(1, 1);
+		TS_ASSERT_EQUALS(sid.scalar<uint8_t>(2), 2);			// Int
+		TS_ASSERT_EQUALS(sid.table(3).scalar<int32_t>(0), 16);
+		TS_ASSERT_EQUALS(sid.table(3).scalar<uint8_t>(1), 1);	// signed
+		fb_ref zeta = schema.table(1, 3);
+		TS_ASSERT_EQUALS(zeta.scalar<uint8_t>(2), 3);			// FloatingPoint
+		TS_ASSERT_EQUALS(zeta.table(3).scalar<int16_t>(0), 2);	// DOUBLE
+		fb_ref mname = schema.table(1, 5);
+		TS_ASSERT_EQUALS(mname.scalar<uint8_t>(2), 5);			// Utf8
+		fb_ref denc = mname.table(4);
+		int64_t dict_id = denc.scalar<int64_t>(0);
+		TS_ASSERT_EQUALS(denc.table(1).scalar<int32_t>(0), 32);
+
+		// the footer
+		int32_t len = fb_ref::get<int32_t>(data.data()+data.size()-10);
+		TS_ASSERT_EQUALS((data.size()-10-len) % 8, 0);
+		fb_ref footer = fb_ref::root(data.data()+data.size()-10-len);
+		TS_ASSERT_EQUALS(footer.table(1).length(1), 6);
+		TS_ASSERT_EQUALS(footer.length(2), 3);
+		TS_ASSERT_EQUALS(footer.length(3), 3);
+		struct block { int64_t offset; int32_t meta; int32_t pad; int64_t body; };
+
+		// the dictionary batches, the first is not a delta
+		std::vector<string> dict;
+		for(size_t d=0; d<3; d++) {
+			block b = footer.element<block>(2, d);
+			arrow_msg dm(data, b.offset, b.meta);
+			TS_ASSERT_EQUALS(dm.type(), 2);
+			TS_ASSERT_EQUALS(dm.meta.scalar<int64_t>(3), b.body);
+			fb_ref db = dm.header();
+			TS_ASSERT_EQUALS(db.scalar<int64_t>(0), dict_id);
+			TS_ASSERT_EQUALS(db.scalar<uint8_t>(2), d>0);
+			fb_ref rb = db.table(1);
+			size_t n = rb.scalar<int64_t>(0), noff, nchars;
+			TS_ASSERT_EQUALS(n, d<2 ? 4 : 2);
+			const int32_t* off = dm.buffer<int32_t>(rb, 1, noff);
+			const char* chars = dm.buffer<char>(rb, 2, nchars);
+			TS_ASSERT_EQUALS(noff, n+1);
+			TS_ASSERT_EQUALS(off[n], nchars);
+			for(size_t i=0; i<n; i++)
+				dict.emplace_back(chars+off[i], off[i+1]-off[i]);
+		}
+		TS_ASSERT_EQUALS(dict.size(), 10);
+
+		// the record batches
+		size_t row = 0;
+		for(size_t r=0; r<3; r++) {
+			block b = footer.element<block>(3, r);
+			arrow_msg rm(data, b.offset, b.meta);
+			TS_ASSERT_EQUALS(rm.type(), 3);
+			fb_ref rb = rm.header();
+			size_t n = rb.scalar<int64_t>(0);
+			TS_ASSERT_EQUALS(rb.length(1), 6);
+			TS_ASSERT_EQUALS(rb.length(2), 12);
+			// validity and values buffers, for each column
+			for(size_t i=0; i<n; i++, row++) {
+				dummy.fill_columns(row);
+				TS_ASSERT_EQUALS(rm.value<int16_t>(rb, 3, i), (int16_t)row);
+				TS_ASSERT_EQUALS(rm.value<double>(rb, 7, i), row/2.);
+				TS_ASSERT_EQUALS(rm.value<size_t>(rb, 9, i), 2*row);
+				int32_t idx = rm.value<int32_t>(rb, 11, i);
+				TS_ASSERT(idx>=0 && idx<(int32_t)dict.size());
+				TS_ASSERT_EQUALS(dict[idx], dummy.mname.value());
+				uint8_t bits = rm.value<uint8_t>(rb, 1, i/8);
+				TS_ASSERT_EQUALS((bool)((bits >> (i%8)) & 1), dummy.bool_attr.value());
+			}
+		}
+		TS_ASSERT_EQUALS(row, 10);
+	}
+
+	void test_output_arrow()
+	{
+		dummy_table dummy("dummy");
+		output_file* f = open_file("arrow:dummy_file9.arrow?batch=4");
+		output_arrow* af = dynamic_cast<output_arrow*>(f);
+		TS_ASSERT(af != nullptr);
+		TS_ASSERT_EQUALS(af->batch_rows(), 4);
+
+		dummy_table other("other");
+		dummy.bind(f);
+		other.bind(f);
+		dummy.prolog();
+		for(size_t i=0; i<10; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		// a file holds a single table
+		TS_ASSERT_THROWS(other.prolog(), std::logic_error);
+		dummy.epilog();
+		delete f;
+
+		string data = slurp("dummy_file9.arrow");
+		TS_ASSERT_EQUALS(data.substr(0, 8), string("ARROW1\0\0", 8));
+		TS_ASSERT_EQUALS(data.substr(data.size()-6), "ARROW1");
+		int32_t len;
+		memcpy(&len, data.data()+data.size()-10, 4);
+		const char* footer = data.data() + data.size()-10-len;
+		// the dictionary of mname grows with each of the three record batches
+		TS_ASSERT_EQUALS(fb_vector_length(footer, 2), 3);
+		TS_ASSERT_EQUALS(fb_vector_length(footer, 3), 3);
+
+		// unsupported types
+		column<long double> ld("ld", "%Lg");
+		result_table tab("tab", {&ld});
+		output_arrow lf("dummy_file10.arrow");
+		tab.bind(&lf);
+		TS_ASSERT_THROWS(tab.prolog(), std::invalid_argument);
+		TS_ASSERT_THROWS(open_file("arrow:foo.arrow?open_mode=append"), std::invalid_argument);
+	}
+
+	void test_output_mmap()
+	{
+		dummy_table dummy("dummy");
+		output_file* f = open_file("mmap:dummy_file11.bin?grow=4096");
+		output_mmap* mf = dynamic_cast<output_mmap*>(f);
+		TS_ASSERT(mf != nullptr);
+
+		dummy.bind(f);
+		dummy.prolog();
+		for(size_t i=0; i<300; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		TS_ASSERT_EQUALS(mf->rows(), 300);
+		dummy.epilog();
+		// the file is truncated once, later cycles append
+		dummy.prolog();
+		for(size_t i=300; i<500; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		TS_ASSERT_EQUALS(mf->rows(), 500);
+		dummy.epilog();
+		delete f;
+
+		// append more rows
+		output_mmap af("dummy_file11.bin", open_mode::append);
+		dummy.bind(&af);
+		dummy.prolog();
+		for(size_t i=500; i<600; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		dummy.epilog();
+
+		string data = slurp("dummy_file11.bin");
+		mmap_header h;
+		memcpy(&h, data.data(), sizeof(h));
+		TS_ASSERT_EQUALS(string(h.magic, 8), "TABLEMM1");
+		TS_ASSERT_EQUALS(h.record, sizeof(__dummy_rec));
+		TS_ASSERT_EQUALS(h.rows, 600);
+		TS_ASSERT_EQUALS(data.size(), h.data + h.rows*h.record);
+
+		Json::Value desc;
+		std::istringstream(data.substr(sizeof(h), h.layout)) >> desc;
+		TS_ASSERT_EQUALS(desc["record_size"].asUInt64(), sizeof(__dummy_rec));
+		TS_ASSERT_EQUALS(desc["schema"]["name"].asString(), "dummy");
+		TS_ASSERT_EQUALS(desc["layout"][3]["name"].asString(), "zeta");
+		TS_ASSERT_EQUALS(desc["layout"][3]["offset"].asUInt64(), offsetof(__dummy_rec, zeta));
+		TS_ASSERT_EQUALS(desc["layout"][3]["type"].asString(), "float64");
+		TS_ASSERT(h.descriptor >= sizeof(h) + h.layout && h.descriptor + h.descriptor_size <= h.data);
+		record_layout rl = record_layout::decode(data.data() + h.descriptor, h.descriptor_size);
+		TS_ASSERT_EQUALS(rl.fields.size(), 6);
+		TS_ASSERT_EQUALS(rl.fields[5].offset, offsetof(__dummy_rec, mname));
+
+		dummy_table dummy2("dummy2");
+		for(size_t i=0; i<600; i++) {
+			__dummy_rec rec;
+			memcpy(&rec, data.data() + h.data + i*h.record, sizeof(rec));
+			dummy2.fill_columns(i);
+			TS_ASSERT_EQUALS(rec.sid, dummy2.sid.value());
+			TS_ASSERT_EQUALS(rec.zeta, dummy2.zeta.value());
+			TS_ASSERT_EQUALS(string(rec.mname), dummy2.mname.value());
+		}
+
+		// appending a different layout fails
+		silly_table silly("SILLY");
+		output_mmap sf("dummy_file11.bin", open_mode::append);
+		silly.bind(&sf);
+		TS_ASSERT_THROWS(silly.prolog(), std::runtime_error);
+	}
+
+	void test_output_shm()
+	{
+		double clock = 0.0;
+		time_series<double> ts("ts", "%g", [&]() { return clock; });
+		column<int> level("level", "%d");
+		ts.add(level);
+
+		std::unique_ptr<output_file> f(open_file("shm:tables_test?rows=8"));
+		output_shm* shm = dynamic_cast<output_shm*>(f.get());
+		TS_ASSERT(shm != nullptr);
+		TS_ASSERT_EQUALS(shm->segment(ts), "/tables_test.ts");
+		TS_ASSERT_THROWS(shm_reader("/tables_test.none"), std::runtime_error);
+
+		struct { double time; int level; } rec[8];
+		ts.bind(f.get());
+		ts.prolog();
+		shm_reader reader(shm->segment(ts));
+		TS_ASSERT(reader.active());
+		TS_ASSERT_EQUALS(reader.record_size(), sizeof(rec[0]));
+		TS_ASSERT(reader.layout().find("\"level\"") != string::npos);
+		TS_ASSERT_EQUALS(reader.descriptor().fields.at(1).tag, type_tag::int32);
+		TS_ASSERT_EQUALS(reader.read(rec, 8), 0);
+
+		auto emit = [&](int n) {
+			for(int i=0; i<n; i++) {
+				level = reader.rows();
+				clock = 0.5*level.value();
+				ts.emit_row();
+			}
+		};
+		emit(3);
+		TS_ASSERT_EQUALS(reader.read(rec, 2), 2);
+		TS_ASSERT_EQUALS(rec[1].level, 1);
+		TS_ASSERT_EQUALS(reader.read(rec, 8), 1);
+		TS_ASSERT_EQUALS(rec[0].level, 2);
+		TS_ASSERT_EQUALS(rec[0].time, 1.0);
+
+		// a slow reader loses the overwritten rows
+		emit(20);
+		TS_ASSERT_EQUALS(reader.read(rec, 8), 8);
+		TS_ASSERT_EQUALS(rec[0].level, 15);
+		TS_ASSERT_EQUALS(rec[7].level, 22);
+		TS_ASSERT_EQUALS(reader.lost(), 12);
+		ts.epilog();
+		TS_ASSERT(! reader.active());
+		TS_ASSERT_EQUALS(reader.rows(), 23);
+		ts.unbind(f.get());
+
+		// the segments are removed with the sink
+		f.reset();
+		TS_ASSERT_THROWS(shm_reader("/tables_test.ts"), std::runtime_error);
+	}
+
+	void test_block_codec()
+	{
+		double clock = 0.0;
+		time_series<double> ts("ts", "%g", [&]() { return clock; });
+		column<double> temp(&ts, "temp", "%g");
+		column<int> level(&ts, "level", "%d");
+		column<bool> on(&ts, "on", "%d");
+		column<char[8]> tag(&ts, "tag", "%s");
+		column<long double> big(&ts, "big", "%Lg");
+		output_columnar cf;
+		ts.bind(&cf);
+		ts.prolog();
+
+		const row_plan& plan = ts.plan();
+		block_codec codec(plan, true);
+		TS_ASSERT_EQUALS(codec.columns(), 6);
+		TS_ASSERT_EQUALS(codec.record_size(), plan.size());
+		TS_ASSERT_EQUALS(codec.encoding(0), column_encoding::delta);
+		TS_ASSERT_EQUALS(codec.encoding(1), column_encoding::xor_float);
+		TS_ASSERT_EQUALS(codec.encoding(2), column_encoding::rle);
+		TS_ASSERT_EQUALS(codec.encoding(3), column_encoding::rle);
+		TS_ASSERT_EQUALS(codec.encoding(4), column_encoding::rle);
+		TS_ASSERT_EQUALS(codec.encoding(5), column_encoding::raw);
+		TS_ASSERT_THROWS(codec.set_encoding(5, column_encoding::xor_float), std::invalid_argument);
+		TS_ASSERT_THROWS(codec.set_encoding(5, column_encoding::delta), std::invalid_argument);
+
+		const size_t N = 1000;
+		std::vector<char> records(N*plan.size(), 0);
+		for(size_t i=0; i<N; i++) {
+			clock = 0.5*i;
+			temp = 20.0 + (i/100)*0.25;
+			level = -(int)(i/50);
+			on = (i/300) & 1;
+			tag = (i < 700) ? "idle" : "busy";
+			big = i;
+			plan.pack(records.data() + i*plan.size());
+		}
+
+		std::vector<char> enc;
+		codec.encode(records.data(), N, enc);
+		size_t raw_columns = N*(plan.size() - plan[5].size);
+		TS_ASSERT_LESS_THAN(enc.size() - N*plan[5].size, raw_columns/10);
+
+		std::vector<char> dec(records.size(), 1);
+		codec.decode(enc.data(), enc.size(), N, dec.data());
+		TS_ASSERT(dec == records);
+
+		// all encodings are lossless, and decoding does not depend on
+		// the encodings of the codec
+		block_codec other(plan);
+		other.set_encoding(0, column_encoding::rle);
+		other.set_encoding(1, column_encoding::delta);
+		other.set_encoding(2, column_encoding::xor_float);
+		other.set_encoding(3, column_encoding::raw);
+		enc.clear();
+		other.encode(records.data(), N, enc);
+		std::fill(dec.begin(), dec.end(), 1);
+		codec.decode(enc.data(), enc.size(), N, dec.data());
+		TS_ASSERT(dec == records);
+
+		TS_ASSERT_THROWS(codec.decode(enc.data(), enc.size()/2, N, dec.data()), std::runtime_error);
+		dec.resize(records.size() + plan.size());
+		TS_ASSERT_THROWS(codec.decode(enc.data(), enc.size(), N+1, dec.data()), std::runtime_error);
+		ts.epilog();
+	}
+
+	void test_output_socket()
+	{
+		output_columnar cf;
+		socket_receiver rx(&cf, 0, false, "rx_");
+		TS_ASSERT(rx.port() != 0);
+
+		double clock = 0.0;
+		time_series<double> ts("ts", "%g", [&]() { return clock; });
+		columns grp(&ts, "g");
+		column<int> level(&grp, "level", "%d");
+		column<char[8]> tag("tag", "%s");
+		ts.add(tag);
+
+		string url = "tcp:127.0.0.1:"+std::to_string(rx.port())+"?batch=4,zlib=true,sendbuf=65536,backpressure=block";
+		std::unique_ptr<output_file> f(open_file(url));
+		// the file options of the same names are not taken
+		TS_ASSERT_THROWS(open_file("tcp:127.0.0.1:1?compress=true"), std::invalid_argument);
+		TS_ASSERT_THROWS(open_file("udp:127.0.0.1:1?buffer=4096"), std::invalid_argument);
+		TS_ASSERT_THROWS(open_file("tcp:127.0.0.1:1?backpressure=wait"), std::runtime_error);
+		output_socket* sock = dynamic_cast<output_socket*>(f.get());
+		TS_ASSERT(sock != nullptr);
+		ts.bind(f.get());
+		ts.prolog();
+		TS_ASSERT(sock->connected());
+		for(int i=0; i<10; i++) {
+			clock = i;
+			level = i;
+			tag = (i & 1) ? "odd" : "even";
+			ts.emit_row();
+		}
+		ts.epilog();
+
+		size_t rows = 0;
+		for(int i=0; i<100 && (rows < 10 || rx.table("ts")->is_locked()); i++)
+			rows += rx.poll(10);
+		TS_ASSERT_EQUALS(rows, 10);
+		output_table* t = rx.table("ts");
+		TS_ASSERT(t != nullptr);
+		TS_ASSERT_EQUALS(t->name(), "rx_ts");
+		TS_ASSERT_EQUALS(t->flavor(), table_flavor::TIMESERIES);
+		TS_ASSERT(! t->is_locked());
+		TS_ASSERT_EQUALS(cf.rows(*t), 10);
+		TS_ASSERT_EQUALS(cf.get<int>(*t, "g/level")[7], 7);
+		TS_ASSERT_EQUALS(cf.get<double>(*t, "time")[9], 9.0);
+		TS_ASSERT_EQUALS(sock->stats().dropped, 0);
+		ts.unbind(f.get());
+		f.reset();
+
+		// a frame larger than the limit ends the connection
+		for(int i=0; i<100 && rx.senders()>0; i++)
+			rx.poll(10);
+		rx.set_max_frame(1<<20);
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(rx.port());
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		TS_ASSERT_EQUALS(connect(fd, (sockaddr*) &addr, sizeof(addr)), 0);
+		for(int i=0; i<100 && rx.senders()==0; i++)
+			rx.poll(10);
+		TS_ASSERT_EQUALS(rx.senders(), 1);
+		socket_frame huge { 1u<<30, socket_frame::schema, 0, 0, 0 };
+		TS_ASSERT_EQUALS(send(fd, &huge, sizeof(huge), 0), (ssize_t) sizeof(huge));
+		for(int i=0; i<100 && rx.senders()>0; i++)
+			rx.poll(10);
+		TS_ASSERT_EQUALS(rx.senders(), 0);
+		::close(fd);
+
+
+		// datagrams
+		output_columnar uf;
+		socket_receiver urx(&uf, 0, true, "urx_");
+		output_socket us("127.0.0.1", std::to_string(urx.port()), true, 3);
+		us.set_encoding(true);
+		ts.bind(&us);
+		ts.prolog();
+		for(int i=0; i<5; i++) {
+			level = i;
+			ts.emit_row();
+		}
+		ts.epilog();
+		ts.unbind(&us);
+		rows = 0;
+		for(int i=0; i<100 && rows < 5; i++)
+			rows += urx.poll(10);
+		TS_ASSERT_EQUALS(rows, 5);
+		TS_ASSERT_EQUALS(uf.get<int>(*urx.table("ts"), "g/level")[4], 4);
+		// the source is forgotten after its epilog
+		for(int i=0; i<100 && urx.table("ts")->is_locked(); i++)
+			urx.poll(10);
+		TS_ASSERT_EQUALS(urx.senders(), 0);
+
+		// no receiver
+		uint16_t port;
+		{
+			socket_receiver gone(&uf);
+			port = gone.port();
+		}
+		output_socket nobody("127.0.0.1", std::to_string(port));
+		ts.bind(&nobody);
+		TS_ASSERT_THROWS(ts.prolog(), std::runtime_error);
+		ts.epilog();
+		ts.unbind(&nobody);
+
+		// formats that printf cannot take safely are not sent
+		column<int> bad("bad", "%s");
+		ts.add(bad);
+		output_socket evil("127.0.0.1", std::to_string(rx.port()));
+		ts.bind(&evil);
+		TS_ASSERT_THROWS(ts.prolog(), std::invalid_argument);
+		ts.epilog();
+		ts.unbind(&evil);
+		ts.remove(bad);
+	}
+
+	// Send frames to a receiver over a raw connection, and return 
+	// true if the receiver kept the connection
+	static bool send_frames(socket_receiver& rx, const std::vector<std::pair<socket_frame, string>>& frames)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(rx.port());
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		TS_ASSERT_EQUALS(connect(fd, (sockaddr*) &addr, sizeof(addr)), 0);
+		for(int i=0; i<100 && rx.senders()==0; i++)
+			rx.poll(10);
+		for(auto& f : frames) {
+			string data((const char*) &f.first, sizeof(socket_frame));
+			data += f.second;
+			TS_ASSERT_EQUALS(send(fd, data.data(), data.size(), 0), (ssize_t) data.size());
+		}
+		for(int i=0; i<10; i++)
+			rx.poll(10);
+		bool kept = rx.senders() > 0;
+		::close(fd);
+		for(int i=0; i<100 && rx.senders()>0; i++)
+			rx.poll(10);
+		return kept;
+	}
+
+	void test_socket_receiver_hostile()
+	{
+		TS_ASSERT_THROWS(socket_receiver(nullptr, 0, false, "", "localhost:80"), std::invalid_argument);
+
+		output_mem_file mf(text_format::csvrel);
+		socket_receiver rx(&mf, 0, false, "", "127.0.0.1");
+		auto schema = [](const string& text) {
+			socket_frame f { (uint32_t) text.size(), socket_frame::schema, 1, 0, 0 };
+			return std::make_pair(f, text);
+		};
+
+		// a format that writes to memory
+		TS_ASSERT(! send_frames(rx, { schema("evil\n0\n4\nint\t4\t%s%n\tx\n") }));
+		TS_ASSERT(rx.table("evil") == nullptr);
+		// a format with two conversions, or of the wrong type
+		TS_ASSERT(! send_frames(rx, { schema("evil\n0\n4\nint\t4\t%d%d\tx\n") }));
+		TS_ASSERT(! send_frames(rx, { schema("evil\n0\n8\ndouble\t8\t%s\tx\n") }));
+		TS_ASSERT(! send_frames(rx, { schema("evil\n0\n8\nlong\t8\t%*d\tx\n") }));
+		// a string of no size
+		TS_ASSERT(! send_frames(rx, { schema("evil\n0\n0\nstring\t0\t%s\tx\n") }));
+		TS_ASSERT(rx.table("evil") == nullptr);
+
+		// a string with no terminating zero is cut
+		socket_frame rows { 16, socket_frame::rows, 1, 1, 0 };
+		socket_frame end { 0, socket_frame::epilog, 1, 0, 0 };
+		TS_ASSERT(send_frames(rx, { 
+			schema("good\n0\n16\nstring\t8\t%s\tname\nlong\t8\t%ld\tn\n"),
+			{ rows, string("ABCDEFGH") + string("\x05\0\0\0\0\0\0\0", 8) }, 
+			{ end, string() } }));
+		TS_ASSERT(rx.table("good") != nullptr);
+		TS_ASSERT_EQUALS(mf.str(), "good,ABCDEFG,5\n");
+	}
+
+	static string gunzip(const char* data, size_t n)
+	{
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		inflateInit2(&z, 15+32);
+		z.next_in = (Bytef*) data;
+		z.avail_in = n;
+		string ret;
+		char buf[4096];
+		int err;
+		do {
+			z.next_out = (Bytef*) buf;
+			z.avail_out = sizeof(buf);
+			err = inflate(&z, Z_NO_FLUSH);
+			ret.append(buf, sizeof(buf) - z.avail_out);
+		} while(err == Z_OK && (z.avail_in > 0 || z.avail_out == 0));
+		inflateEnd(&z);
+		return ret;
+	}
+
+	void test_compressed_text()
+	{
+		result_table t("t");
+		column<int> x("x", "%d");
+		column<double> y("y", "%.3f");
+		t.add(x);
+		t.add(y);
+
+		output_mem_file mf(text_format::csvtab);
+		text_compression_options zo;
+		zo.method = text_compression::gzip;
+		output_mem_file zf(text_format::csvtab, zo);
+		TS_ASSERT(zf.compressed());
+		TS_ASSERT(! mf.compressed());
+		zo.threaded = false;
+		zo.level = 9;
+		std::unique_ptr<output_c_file> ff(new output_c_file("tables_test_z.txt.gz", 
+			open_mode::truncate, text_format::csvtab, zo));
+
+		t.bind(&mf);
+		t.bind(&zf);
+		t.bind(ff.get());
+		t.prolog();
+		for(int i=0; i<20000; i++) {
+			x = i;
+			y = i*0.25;
+			t.emit_row();
+		}
+		// a flush makes everything written so far readable
+		zf.flush();
+		string part = gunzip(zf.contents(), zf.size());
+		t.epilog();
+		t.unbind(&mf);
+		t.unbind(&zf);
+		t.unbind(ff.get());
+
+		const string plain = mf.str();
+		TS_ASSERT(plain.size() > 200000);
+		TS_ASSERT(zf.size() < plain.size()/3);
+		TS_ASSERT_EQUALS(part, plain);
+		TS_ASSERT_EQUALS(gunzip(zf.contents(), zf.size()), plain);
+
+		ff.reset();
+		std::ifstream in("tables_test_z.txt.gz", std::ios::binary);
+		string gz((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		TS_ASSERT_EQUALS(gunzip(gz.data(), gz.size()), plain);
+
+		// zstd is present only when the library was found
+		zo.method = text_compression::zstd;
+		try {
+			output_mem_file zs(text_format::csvtab, zo);
+			fputs("hello", zs.file());
+			zs.close();
+			TS_ASSERT_EQUALS(string(zs.contents(), 4), string("\x28\xb5\x2f\xfd"));
+		} catch(std::invalid_argument&) {
+			TS_ASSERT_THROWS(open_file("file:tables_test_z.txt.zst?compress=zstd"), std::invalid_argument);
+		}
+		TS_ASSERT_THROWS(open_file("file:tables_test_z.txt.gz?compress=lz4"), std::runtime_error);
+		std::unique_ptr<output_file> uf(open_file("file:tables_test_z.txt.gz?compress=gzip,level=1,thread=false"));
+		TS_ASSERT(dynamic_cast<output_c_file&>(*uf).compressed());
+
+		// a failed close releases the stream
+		zo.method = text_compression::gzip;
+		output_c_file full("/dev/full", open_mode::truncate, text_format::csvtab, zo);
+		fputs("lost", full.file());
+		TS_ASSERT_THROWS(full.close(), std::runtime_error);
+		TS_ASSERT(full.file() == nullptr);
+		TS_ASSERT(! full.compressed());
+		TS_ASSERT_THROWS_NOTHING(full.close());
+	}
+
+	void test_output_stats()
+	{
+		dummy_table dummy("dummy");
+		output_mem_file mf(text_format::csvrel);
+		output_hdf5 hf("dummy_file12.h5");
+		hf.set_buffer_rows(8);
+		dummy.bind(&mf);
+		dummy.bind(&hf);
+
+		// nothing is counted while disabled
+		dummy.prolog();
+		dummy.emit_row();
+		TS_ASSERT_EQUALS(dummy.stats().rows, 0);
+		TS_ASSERT_EQUALS(mf.stats().bytes, 0);
+
+		output_stats::enable();
+		size_t len = mf.str().size();
+		for(size_t i=0; i<20; i++) {
+			dummy.fill_columns(i);
+			dummy.emit_row();
+		}
+		mf.flush();
+		dummy.epilog();
+
+		output_stats ts = dummy.stats();
+		TS_ASSERT_EQUALS(ts.rows, 20);
+		TS_ASSERT(ts.row_seconds > 0.0);
+		output_stats ms = mf.stats();
+		TS_ASSERT_EQUALS(ms.rows, 20);
+		TS_ASSERT_EQUALS(ms.bytes, mf.str().size() - len);
+		TS_ASSERT_EQUALS(ms.flushes, 1);
+		output_stats hs = hf.stats();
+		TS_ASSERT_EQUALS(hs.rows, 20);
+		// 8+8 rows from the buffer, 5 at the epilog
+		TS_ASSERT_EQUALS(hs.writes, 3);
+		TS_ASSERT_EQUALS(hs.extends, 3);
+		TS_ASSERT_EQUALS(hs.bytes, 21*sizeof(__dummy_rec));
+		// (up to the rounding of nanoseconds to seconds)
+		TS_ASSERT(ts.row_seconds >= (ms.row_seconds + hs.row_seconds)*(1-1e-12));
+
+		// publish as a time series
+		stats_series st;
+		st.watch(dummy);
+		st.watch(mf, "memfile");
+		output_columnar cf;
+		st.bind(&cf);
+		st.prolog();
+		st.publish();
+		st.epilog();
+		TS_ASSERT_EQUALS(cf.rows(st), 2);
+		TS_ASSERT_EQUALS(string(cf.text(st, "kind", 0)), "table");
+		TS_ASSERT_EQUALS(string(cf.text(st, "source", 1)), "memfile");
+		TS_ASSERT_EQUALS(cf.get<size_t>(st, "rows")[0], 20);
+		TS_ASSERT_EQUALS(cf.get<size_t>(st, "bytes")[1], ms.bytes);
+
+		dummy.reset_stats();
+		TS_ASSERT_EQUALS(dummy.stats().rows, 0);
+		output_stats::enable(false);
+	}
+
+	void test_static_table()
+	{
+		long counter = 0;
+		column<int> id("id", "%d");
+		column<double> x("x", "%g");
+		column<char[8]> tag("tag", "%s");
+		column_ref<long> cref("counter", "%ld", counter);
+		computed<double> twice("twice", "%g", [&]() { return 2*x.value(); });
+		static_table tab("static", id, x, tag, cref, twice);
+
+		struct { int id; double x; char tag[8]; long counter; double twice; } rec;
+		TS_ASSERT_EQUALS(tab.layout.size, sizeof(rec));
+		TS_ASSERT_EQUALS(tab.layout.offset[3], offsetof(decltype(rec), counter));
+		TS_ASSERT_EQUALS(tab.plan().size(), sizeof(rec));
+		TS_ASSERT_EQUALS(&tab.get<1>(), &x);
+
+		output_mem_file f(text_format::csvrel);
+		output_columnar cf;
+		tab.bind(&f);
+		tab.bind(&cf);
+		tab.prolog();
+		for(int i=0; i<3; i++) {
+			id = i;
+			x = i*0.5;
+			tag = (i & 1) ? "odd" : "even";
+			counter = 10*i;
+			tab.emit_row();
+		}
+		// the dynamic path is still available
+		output_table& dyn = tab;
+		dyn.emit_row();
+		tab.epilog();
+
+		TS_ASSERT_EQUALS(f.str(),
+			"static,0,0,even,0,0\n"
+			"static,1,0.5,odd,10,1\n"
+			"static,2,1,even,20,2\n"
+			"static,2,1,even,20,2\n");
+		TS_ASSERT_EQUALS(cf.rows(tab), 4);
+		TS_ASSERT_EQUALS(cf.get<double>(tab, "twice")[1], 1.0);
+
+		// the schema is fixed
+		tab.unbind(&cf);
+		column<int> extra("extra", "%d");
+		tab.add(extra);
+		tab.prolog();
+		TS_ASSERT_THROWS(tab.emit_row(), std::logic_error);
+		tab.epilog();
+		tab.unbind_all();
+	}
+
+	void test_inline_string()
+	{
+		result_table tab("strings");
+		column<char[8]> tag(&tab, "tag", "%s", "start");
+		column<string> name(&tab, "name", 7, "%s");
+		TS_ASSERT_EQUALS(tag.value(), "start");
+		TS_ASSERT_EQUALS(tag.size(), 8);
+
+		// truncated, and zero-padded
+		tag = "a long tag";
+		TS_ASSERT_EQUALS(tag.value(), "a long ");
+		tag = string("ab");
+		TS_ASSERT_EQUALS(tag.value(), "ab");
+		const char* raw = tag.c_str();
+		for(size_t i=2; i<8; i++)
+			TS_ASSERT_EQUALS(raw[i], 0);
+
+		const row_plan& plan = tab.plan();
+		TS_ASSERT_EQUALS(plan[0].src, tag.c_str());
+		TS_ASSERT_EQUALS(plan[0].type, typeid(string));
+
+		name = "a long name";
+		TS_ASSERT_EQUALS(name.value(), "a long ");
+		name = "x";
+		std::vector<char> rec(plan.size(), 'z');
+		plan.pack(rec.data());
+		TS_ASSERT_EQUALS(string(rec.data() + plan[0].offset), "ab");
+		TS_ASSERT_EQUALS(string(rec.data() + plan[1].offset), "x");
+		for(size_t i=1; i<8; i++)
+			TS_ASSERT_EQUALS(rec[plan[1].offset + i], 0);
+
+		output_mem_file f(text_format::csvrel);
+		tab.bind(&f);
+		tab.prolog();
+		tab.emit_row();
+		tag.set("cd");
+		tab.emit_row();
+		tab.epilog();
+		TS_ASSERT_EQUALS(f.str(), "strings,ab,x\nstrings,cd,x\n");
+	}
+
+	void test_reducers()
+	{
+		double clock = 0.0;
+		time_series<double> ts("ts", "%g", [&]() { return clock; });
+		column<double> y("y", "%g");
+		column<int> level("level", "%d");
+		ts.add({&y, &level});
+		output_columnar full, windows, lttb;
+		ts.bind(&full);
+		ts.bind(&windows)->set_reducer(new window_reducer(10.0));
+		ts.bind(&lttb)->set_reducer(new lttb_reducer(10, "y"));
+
+		ts.prolog();
+		TS_ASSERT_THROWS(ts.bind(&full)->set_reducer(nullptr), std::logic_error);
+		for(int i=0; i<1000; i++) {
+			clock = i*0.1;
+			y = (i==555) ? 100.0 : i % 2;
+			level = i;
+			ts.emit_row();
+		}
+		ts.epilog();
+
+		TS_ASSERT_EQUALS(full.rows(ts), 1000);
+
+		// one row per 100 rows, at the start of the window
+		TS_ASSERT_EQUALS(windows.rows(ts), 10);
+		auto wtime = windows.get<double>(ts, "time");
+		auto wlevel = windows.get<int>(ts, "level");
+		TS_ASSERT_EQUALS(wtime[3], 30.0);
+		TS_ASSERT_EQUALS(wlevel[3], 350);	// 349.5 rounded
+		TS_ASSERT_DELTA(windows.get<double>(ts, "y")[0], 0.5, 1e-12);
+
+		// the first, last and the spike are kept
+		size_t n = lttb.rows(ts);
+		TS_ASSERT(n >= 90 && n <= 110);
+		auto ltime = lttb.get<double>(ts, "time");
+		auto ly = lttb.get<double>(ts, "y");
+		TS_ASSERT_EQUALS(ltime[0], 0.0);
+		TS_ASSERT_DELTA(ltime[n-1], 99.9, 1e-9);
+		TS_ASSERT(std::find(ly.begin(), ly.end(), 100.0) != ly.end());
+		for(size_t i=1; i<n; i++)
+			TS_ASSERT(ltime[i-1] < ltime[i]);
+
+		// other aggregates, of all arithmetic types
+		ts.unbind(&full);
+		ts.unbind(&lttb);
+		column<bool> flag("flag", "%d");
+		column<unsigned char> small("small", "%hhu");
+		column<long double> big("big", "%Lg");
+		ts.add({&flag, &small, &big});
+		ts.bind(&windows)->set_reducer(new window_reducer(50.0, window_op::max));
+		windows.clear();
+		ts.prolog();
+		for(int i=0; i<1000; i++) {
+			clock = i*0.1;
+			level = i;
+			flag = (i==100);
+			small = i % 200;
+			big = (i % 500) * 0.5L;
+			ts.emit_row();
+		}
+		ts.epilog();
+		TS_ASSERT_EQUALS(windows.rows(ts), 2);
+		TS_ASSERT_EQUALS(windows.get<int>(ts, "level")[0], 499);
+		TS_ASSERT_EQUALS(windows.get<bool>(ts, "flag")[0], true);
+		TS_ASSERT_EQUALS(windows.get<bool>(ts, "flag")[1], false);
+		TS_ASSERT_EQUALS(windows.get<unsigned char>(ts, "small")[1], 199);
+		TS_ASSERT_EQUALS(windows.get<long double>(ts, "big")[0], 249.5L);
+
+		result_table rt("rt");
+		rt.bind(&lttb)->set_reducer(new window_reducer(1.0));
+		TS_ASSERT_THROWS(rt.prolog(), std::logic_error);
+		rt.unbind(&lttb);
+	}
+
+	void test_aggregates()
+	{
+		result_table tab("agg");
+		running_mean mean(&tab, "mean");
+		running_var var(&tab, "var");
+		running_min<int> lo(&tab, "min", "%d");
+		running_max<int> hi(&tab, "max", "%d");
+		running_quantile median(&tab, "median", 0.5);
+		histogram h(&tab, "h", 0.0, 100.0, 10);
+
+		mean.set(3.0);
+		median.set(3.0);
+		TS_ASSERT_EQUALS(mean.value(), 3.0);
+		TS_ASSERT_EQUALS(median.value(), 3.0);
+		mean.reset();
+		median.reset();
+		TS_ASSERT_EQUALS(mean.count(), 0);
+
+		// a permutation of 1..10000
+		for(size_t i=0; i<10000; i++) {
+			double x = (i*7919) % 10000 + 1;
+			mean.set(x);
+			var.set(x);
+			lo.set(x);
+			hi.set(x);
+			median.set(x);
+			h.add(x/100 - 1);
+		}
+		TS_ASSERT_DELTA(mean.value(), 5000.5, 1e-9);
+		TS_ASSERT_DELTA(var.mean(), 5000.5, 1e-9);
+		TS_ASSERT_DELTA(var.value(), 10000.0*10001/12, 1e-3);
+		TS_ASSERT_EQUALS(lo.value(), 1);
+		TS_ASSERT_EQUALS(hi.value(), 10000);
+		TS_ASSERT_DELTA(median.value(), 5000.5, 50.0);
+		TS_ASSERT_EQUALS(h.bins(), 10);
+		TS_ASSERT_EQUALS(h.count(-1), 99);
+		TS_ASSERT_EQUALS(h.count(0), 1000);
+		TS_ASSERT_EQUALS(h.count(9), 901);
+		TS_ASSERT_EQUALS(h.count(10), 0);
+		h.add(100.0);
+		TS_ASSERT_EQUALS(h.count(10), 1);
+
+		output_columnar f;
+		tab.bind(&f);
+		tab.prolog();
+		tab.emit_row();
+		tab.epilog();
+		TS_ASSERT_EQUALS(f.rows(tab), 1);
+		TS_ASSERT_EQUALS(f.get<int>(tab, "max")[0], 10000);
+		TS_ASSERT_EQUALS(f.get<size_t>(tab, "h/b0")[0], 1000);
+		tab.unbind(&f);
+
+		h.reset();
+		TS_ASSERT_EQUALS(h.count(0), 0);
+		TS_ASSERT_THROWS(running_quantile("q", 1.5), std::invalid_argument);
+		TS_ASSERT_THROWS(histogram("h2", 1.0, 1.0, 4), std::invalid_argument);
+	}
+
+	void test_sampling()
+	{
+		double clock = 0.0;
+		int calls = 0;
+		time_series<double> ts("ts", "%g", [&]() { return clock; });
+		computed<int> counted("counted", "%d", [&]() { return ++calls; });
+		column<int> level("level", "%d");
+		ts.add({&counted, &level});
+		output_columnar f;
+		ts.bind(&f);
+
+		auto run = [&]() {
+			f.clear();
+			calls = 0;
+			ts.prolog();
+			for(int i=0; i<100; i++) {
+				clock = i*0.5;
+				level = i/10;
+				ts.emit_row();
+			}
+			ts.epilog();
+			return f.rows(ts);
+		};
+
+		ts.emit_every(10);
+		TS_ASSERT_EQUALS(run(), 10);
+		TS_ASSERT_EQUALS(f.get<double>(ts, "time")[1], 5.0);
+		// rejected rows are not evaluated
+		TS_ASSERT_EQUALS(calls, 10);
+
+		ts.emit_interval(4.9);
+		TS_ASSERT_EQUALS(run(), 10);
+		TS_ASSERT_EQUALS(f.get<double>(ts, "time")[9], 45.0);
+
+		ts.emit_random(0.25, 7);
+		size_t n = run();
+		TS_ASSERT(n > 5 && n < 50);
+		TS_ASSERT_EQUALS(calls, n);
+		TS_ASSERT_EQUALS(run(), n);	// same seed, same sample
+		ts.emit_random(1.0);
+		TS_ASSERT_EQUALS(run(), 100);
+
+		ts.emit_reservoir(7, 3);
+		output_stats::enable();
+		TS_ASSERT_EQUALS(run(), 7);
+		output_stats::enable(false);
+		auto times = f.get<double>(ts, "time");
+		for(size_t i=1; i<7; i++)
+			TS_ASSERT(times[i-1] < times[i]);
+		// the sample is counted
+		TS_ASSERT_EQUALS(ts.stats().rows, 7);
+		TS_ASSERT_EQUALS(f.stats().rows, 7);
+		ts.reset_stats();
+
+		// the sample cannot hold untagged columns
+		{
+			complex_column z(&ts, "z");
+			TS_ASSERT_THROWS(ts.prolog(), std::logic_error);
+		}
+
+		// counted changes each time, so compare on level only
+		ts.remove(counted);
+		computed<int> doubled("doubled", "%d", [&]() { calls++; return 2*level.value(); });
+		ts.add(doubled);
+		ts.emit_on_change();
+		TS_ASSERT_EQUALS(run(), 10);
+		TS_ASSERT_EQUALS(f.get<int>(ts, "level")[3], 3);
+		TS_ASSERT_EQUALS(f.get<int>(ts, "doubled")[3], 6);
+		// the emitted rows are not evaluated again
+		TS_ASSERT_EQUALS(calls, 100);
+		{
+			complex_column z(&ts, "z");
+			TS_ASSERT_THROWS(ts.prolog(), std::logic_error);
+		}
+		ts.remove(doubled);
+
+		ts.emit_all();
+		TS_ASSERT_EQUALS(run(), 100);
+
+		ts.prolog();
+		TS_ASSERT_THROWS(ts.emit_every(2), std::logic_error);
+		ts.epilog();
+	}
+
+	void test_concurrent_emitter()
+	{
+		silly_table tab("SILLY");
+		output_columnar f;
+		f.bind(tab);
+		TS_ASSERT_THROWS(concurrent_emitter{tab}, std::logic_error);
+
+		tab.label = "init";
+		tab.prolog();
+		output_stats::enable();
+		{
+			const int T = 4, N = 1000;
+			concurrent_emitter em(tab, 64);
+			std::vector<std::thread> threads;
+			for(int t=0; t<T; t++)
+				threads.emplace_back([&em, t]() {
+					concurrent_emitter::row& r = em.local();
+					r.set("label", string("thread ")+std::to_string(t));
+					for(int i=0; i<N; i++) {
+						r.set(0, t);
+						r.set("mean_x", (double)i);
+						r.emit();
+					}
+				});
+			for(auto& th : threads) th.join();
+			TS_ASSERT_THROWS(em.local().set(0, 1.0), std::invalid_argument);
+			em.flush();
+
+			TS_ASSERT_EQUALS(f.rows(tab), T*N);
+			TS_ASSERT_EQUALS(tab.stats().rows, T*N);
+			TS_ASSERT_EQUALS(f.stats().rows, T*N);
+			auto count = f.get<int>(tab, "count");
+			auto mean_x = f.get<double>(tab, "mean_x");
+			std::vector<double> sums(T, 0.0);
+			for(size_t i=0; i<count.size(); i++) {
+				sums[count[i]] += mean_x[i];
+				TS_ASSERT_EQUALS(string(f.text(tab, "label", i)), 
+					"thread "+std::to_string(count[i]));
+			}
+			for(int t=0; t<T; t++)
+				TS_ASSERT_EQUALS(sums[t], N*(N-1)/2.0);
+
+			// values persist between emissions, and start from the table
+			em.local().emit();
+			em.flush();
+			TS_ASSERT_EQUALS(string(f.text(tab, "label", T*N)), "init");
+		}
+		output_stats::enable(false);
+		tab.reset_stats();
+		f.reset_stats();
+		{
+			// a new emitter gets a new row in the same thread,
+			// and a disabled table drops the rows
+			concurrent_emitter em(tab);
+			em.local().set("mean_x", 2.5);
+			em.local().emit();
+			tab.set_enabled(false);
+			em.local().emit();
+			em.flush();
+			tab.set_enabled(true);
+			TS_ASSERT_EQUALS(f.rows(tab), 4002);
+			TS_ASSERT_EQUALS(f.get<double>(tab, "mean_x")[4001], 2.5);
+		}
+		tab.epilog();
+	}
+
+	void test_concurrent_emitter_ordered()
+	{
+		static thread_local double clock = 0.0;
+		time_series<double> ts("ts", "%g", []() { return clock; });
+		column<int> who("who", "%d");
+		ts.add(who);
+		output_columnar f;
+		f.bind(ts);
+
+		silly_table tab("SILLY");
+		tab.prolog();
+		TS_ASSERT_THROWS((concurrent_emitter{tab, 16, true}), std::invalid_argument);
+		tab.epilog();
+
+		ts.prolog();
+		{
+			const int T = 4, N = 250;
+			concurrent_emitter em(ts, N+1, true);
+			std::vector<std::thread> threads;
+			for(int t=0; t<T; t++)
+				threads.emplace_back([&em, t]() {
+					concurrent_emitter::row& r = em.local();
+					r.set("who", t);
+					for(int i=0; i<N; i++) {
+						clock = i*T + t;
+						r.emit();
+					}
+				});
+			for(auto& th : threads) th.join();
+			em.flush();
+
+			auto now = f.get<double>(ts, 0);
+			auto from = f.get<int>(ts, "who");
+			TS_ASSERT_EQUALS(now.size(), T*N);
+			for(size_t i=0; i<now.size(); i++) {
+				TS_ASSERT_EQUALS(now[i], (double)i);
+				TS_ASSERT_EQUALS(from[i], (int)i % T);
+			}
+		}
+		ts.epilog();
+	}
+
 	void test_settable()
 	{
 		column<double> double_foo("double", "%.10g", 0.0);
@@ -634,6 +2575,58 @@ public:
 			"hdf5", "hello", varmap { {"format","csvtab"} } );
 		check_purl("stdout:", "stdout", "", varmap { } );
 		check_purl("foo:", "foo", "", varmap { } );
+		check_purl("tcp:Yard.example.org:9000?batch=8", 
+			"tcp", "Yard.example.org:9000", varmap { {"batch","8"} } );
+		check_purl("file:a?x=1,x=2", "file", "a", varmap { {"x","2"} } );
+
+		TS_ASSERT_EQUALS(normalize_url("file:a/b?z=1,y=2,z=3"), "file:a/b?y=2,z=3");
+		TS_ASSERT_EQUALS(normalize_url("stdout:"), "stdout:");
+		TS_ASSERT_THROWS(normalize_url("a:/a/"), std::runtime_error);
+	}
+
+	void test_shared_files()
+	{
+		size_t opened = 0;
+		register_output_type("memory", [&](const string&, const varmap& vars) {
+			opened++;
+			text_format fmt = vars.count("format") ? text_format::csvrel : text_format::csvtab;
+			return new output_mem_file(fmt);
+		});
+
+		std::unique_ptr<output_file> own(open_file("memory:x"));
+		TS_ASSERT(dynamic_cast<output_mem_file*>(own.get()) != nullptr);
+		TS_ASSERT_EQUALS(opened, 1);
+
+		output_file* f1 = open_shared_file("memory:results?format=csvrel,queue=64");
+		output_file* f2 = open_shared_file("memory:results?queue=64,format=csvrel");
+		output_file* f3 = open_shared_file("memory:results");
+		TS_ASSERT_EQUALS(f1, f2);
+		TS_ASSERT_DIFFERS(f1, f3);
+		TS_ASSERT_EQUALS(opened, 3);
+
+		result_table tab("tab");
+		column<int> x(&tab, "x", "%d");
+		tab.bind(f1);
+		tab.prolog();
+		x = 3;
+		tab.emit_row();
+		tab.epilog();
+		tab.unbind(f1);
+		TS_ASSERT_EQUALS(((output_mem_file*) f2)->str(), "tab,3\n");
+
+		TS_ASSERT(! close_shared_file(f1));
+		TS_ASSERT(close_shared_file(f2));
+		TS_ASSERT(close_shared_file(f3));
+		TS_ASSERT_THROWS(close_shared_file(f3), std::invalid_argument);
+		TS_ASSERT_THROWS(close_shared_file(own.get()), std::invalid_argument);
+
+		// the standard streams are shared, and never deleted
+		TS_ASSERT_EQUALS(open_shared_file("stdout:"), &output_stdout);
+		TS_ASSERT(! close_shared_file(&output_stdout));
+
+		register_output_type("memory", nullptr);
+		TS_ASSERT_THROWS(open_file("memory:x"), std::runtime_error);
+		TS_ASSERT_THROWS(register_output_type("bad type", nullptr), std::invalid_argument);
 	}
 
     void check_bad_url(const string& url)
@@ -676,6 +2669,53 @@ public:
     	check_bad_url("a:?a=1 for me,one for you");
     }
 
+	void test_progress_bar()
+	{
+		char* text = nullptr;
+		size_t len = 0;
+		FILE* f = open_memstream(&text, &len);
+		progress_bar bar(f, 10, "work: ");
+		bar.set_interval(std::chrono::hours(1));
+
+		const size_t N = 100000;
+		bar.start(N);
+		std::vector<std::thread> workers;
+		for(int t=0; t<4; t++)
+			workers.emplace_back([&]() {
+				for(size_t k=0; k<N/4; k++) bar.tick();
+			});
+		for(auto& w : workers) w.join();
+		TS_ASSERT_EQUALS(bar.ticks(), N);
+		TS_ASSERT_EQUALS(bar.eta(), 0.0);
+		TS_ASSERT(bar.rate() > 0);
+		bar.finish();
+		fclose(f);
+
+		// drawn at the start and when complete only
+		string out(text, len);
+		free(text);
+		TS_ASSERT_EQUALS(std::count(out.begin(), out.end(), '\r'), 2);
+		TS_ASSERT_EQUALS(out.substr(0, 27), "\rwork: [          ]   0%   ");
+		TS_ASSERT(out.find("\rwork: [##########] 100% ") != string::npos);
+		TS_ASSERT_EQUALS(out.back(), '\n');
+
+		// finishing early completes the bar
+		f = open_memstream(&text, &len);
+		progress_bar early(f, 4);
+		early.set_interval(std::chrono::milliseconds(0));
+		early.start(8);
+		early.complete(4);
+		early.tick();
+		early.finish();
+		early.tick();
+		fclose(f);
+		out.assign(text, len);
+		free(text);
+		TS_ASSERT_EQUALS(std::count(out.begin(), out.end(), '\n'), 1);
+		TS_ASSERT(out.find("[##  ]  50%") != string::npos);
+		TS_ASSERT(out.find("[####] 100%") != string::npos);
+	}
+
 };
 
 